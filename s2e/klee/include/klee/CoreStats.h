@@ -30,6 +30,10 @@ namespace stats {
   /// The number of process forks.
   extern Statistic forks;
 
+  /// Number of instructions whose operands were all constant and
+  /// that were evaluated natively by the interpreter fast path.
+  extern Statistic fastPathInstructions;
+
   /// Number of states, this is a "fake" statistic used by istats, it
   /// isn't normally up-to-date.
   extern Statistic states;
@@ -187,6 +187,7 @@ protected:
   llvm::Function* getCalledFunction(llvm::CallSite &cs, ExecutionState &state);
 
   void executeInstruction(ExecutionState &state, KInstruction *ki);
+  bool executeConcreteInstruction(ExecutionState &state, KInstruction *ki);
 
   void printFileLine(ExecutionState &state, KInstruction *ki);
 
@@ -216,6 +217,13 @@ protected:
                             llvm::Function *function,
                             std::vector< ref<Expr> > &arguments);
 
+  /// Calls the native code of \a function through the external dispatcher,
+  /// bypassing special function handlers.
+  void executeExternalCall(ExecutionState &state,
+                           KInstruction *target,
+                           llvm::Function *function,
+                           std::vector< ref<Expr> > &arguments);
+
   ObjectState *bindObjectInState(ExecutionState &state, const MemoryObject *mo,
                                  bool isLocal, const Array *array = 0);
 
@@ -270,6 +278,13 @@ protected:
                    llvm::Function *f,
                    std::vector< ref<Expr> > &arguments);
 
+  /// Pushes a frame for the LLVM body of \a f, even if \a f is overridden
+  /// by a special function handler.
+  void executeInternalCall(ExecutionState &state,
+                           KInstruction *ki,
+                           llvm::Function *f,
+                           std::vector< ref<Expr> > &arguments);
+
   // do address resolution / object binding / out of bounds checking
   // and perform the operation
   void executeMemoryOperation(ExecutionState &state,
@@ -396,6 +411,13 @@ public:
   virtual StatePair concolicFork(ExecutionState &current,
                          ref<Expr> condition, bool isInternal);
 
+  // Called before forking on a symbolic condition, once the solver showed
+  // that both sides are feasible (speculative forking does not check).
+  // Returning false makes the state follow only one side.
+  virtual bool isForkAllowed(ExecutionState &current, ref<Expr> condition) {
+    return true;
+  }
+
   bool resolveSpeculativeState(ExecutionState &state);
   bool checkSpeculativeState(ExecutionState &state);
 
@@ -395,6 +395,17 @@ public:
     return alloc(v, w);
   }
 
+  /// rebind - Overwrite the value of an unshared constant in place. Used by
+  /// the interpreter fast path to recycle the destination register's
+  /// constant instead of allocating a new one.
+  void rebind(uint64_t v) {
+    assert(refCount == 1 && "rebinding a shared constant");
+    assert(v == bits64::truncateToNBits(v, getWidth()) &&
+           "invalid constant");
+    value = llvm::APInt(getWidth(), v);
+    computeHash();
+  }
+
   static bool classof(const Expr *E) {
     return E->getKind() == Expr::Constant;
   }
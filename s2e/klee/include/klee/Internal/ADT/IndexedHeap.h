@@ -0,0 +1,174 @@
+//===-- IndexedHeap.h -------------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_INDEXEDHEAP_H
+#define KLEE_INDEXEDHEAP_H
+
+#include <cassert>
+#include <functional>
+#include <tr1/unordered_map>
+#include <utility>
+#include <vector>
+
+namespace klee {
+  /// A d-ary heap of distinct items that keeps the position of every item,
+  /// so that the priority of any item can be changed or the item removed
+  /// in O(log n) without searching for it.
+  ///
+  /// The top of the heap is the item whose priority is first according to
+  /// Compare, i.e., the smallest one with std::less. Ties are broken
+  /// arbitrarily.
+  template <class T, class Priority,
+            class Compare = std::less<Priority>,
+            unsigned Arity = 4>
+  class IndexedHeap {
+    typedef std::pair<T, Priority> Entry;
+    typedef std::tr1::unordered_map<T, unsigned> Positions;
+
+    std::vector<Entry> heap;
+    Positions positions;
+    Compare compare;
+
+  public:
+    IndexedHeap(const Compare &_compare = Compare()) : compare(_compare) {}
+
+    bool empty() const { return heap.empty(); }
+    unsigned size() const { return heap.size(); }
+
+    bool contains(T item) const { return positions.count(item); }
+
+    const T &top() const {
+      assert(!heap.empty());
+      return heap[0].first;
+    }
+
+    const Priority &topPriority() const {
+      assert(!heap.empty());
+      return heap[0].second;
+    }
+
+    const Priority &getPriority(T item) const {
+      typename Positions::const_iterator it = positions.find(item);
+      assert(it != positions.end());
+      return heap[it->second].second;
+    }
+
+    /// Inserts the item, or changes its priority if it is already present.
+    void push(T item, const Priority &priority) {
+      typename Positions::iterator it = positions.find(item);
+      if (it != positions.end()) {
+        updateAt(it->second, priority);
+        return;
+      }
+
+      unsigned pos = heap.size();
+      heap.push_back(Entry(item, priority));
+      positions[item] = pos;
+      siftUp(pos);
+    }
+
+    void update(T item, const Priority &priority) {
+      typename Positions::iterator it = positions.find(item);
+      assert(it != positions.end());
+      updateAt(it->second, priority);
+    }
+
+    /// Removes the item and returns false if it was not in the heap.
+    bool erase(T item) {
+      typename Positions::iterator it = positions.find(item);
+      if (it == positions.end())
+        return false;
+
+      unsigned pos = it->second;
+      positions.erase(it);
+
+      unsigned last = heap.size() - 1;
+      if (pos != last) {
+        move(last, pos);
+        heap.pop_back();
+        if (!siftUp(pos))
+          siftDown(pos);
+      } else {
+        heap.pop_back();
+      }
+      return true;
+    }
+
+    void pop() {
+      assert(!heap.empty());
+      erase(heap[0].first);
+    }
+
+    void clear() {
+      heap.clear();
+      positions.clear();
+    }
+
+  private:
+    void updateAt(unsigned pos, const Priority &priority) {
+      heap[pos].second = priority;
+      if (!siftUp(pos))
+        siftDown(pos);
+    }
+
+    void move(unsigned from, unsigned to) {
+      heap[to] = heap[from];
+      positions[heap[to].first] = to;
+    }
+
+    /// Returns true if the entry moved.
+    bool siftUp(unsigned pos) {
+      Entry entry = heap[pos];
+      unsigned start = pos;
+
+      while (pos > 0) {
+        unsigned parent = (pos - 1) / Arity;
+        if (!compare(entry.second, heap[parent].second))
+          break;
+        move(parent, pos);
+        pos = parent;
+      }
+
+      if (pos == start)
+        return false;
+
+      heap[pos] = entry;
+      positions[entry.first] = pos;
+      return true;
+    }
+
+    void siftDown(unsigned pos) {
+      Entry entry = heap[pos];
+      unsigned size = heap.size();
+
+      while (true) {
+        unsigned first = pos * Arity + 1;
+        if (first >= size)
+          break;
+
+        unsigned best = first;
+        unsigned end = first + Arity < size ? first + Arity : size;
+        for (unsigned child = first + 1; child < end; ++child) {
+          if (compare(heap[child].second, heap[best].second))
+            best = child;
+        }
+
+        if (!compare(heap[best].second, entry.second))
+          break;
+        move(best, pos);
+        pos = best;
+      }
+
+      heap[pos] = entry;
+      positions[entry.first] = pos;
+    }
+  };
+}
+
+#endif
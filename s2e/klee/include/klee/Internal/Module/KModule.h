@@ -120,7 +120,9 @@ namespace klee {
     unsigned getConstantID(llvm::Constant *c, KInstruction* ki);
 
     /// Update shadow structures for newly added function
-    KFunction* updateModuleWithFunction(llvm::Function *f);
+    /// Set optimize to false for functions that already went through the
+    /// optimization passes (e.g., loaded from a code cache).
+    KFunction* updateModuleWithFunction(llvm::Function *f, bool optimize = true);
 
     /// Remove function from KModule and call removeFromParend on it
     void removeFunction(llvm::Function *f, bool keepDeclaration = false);
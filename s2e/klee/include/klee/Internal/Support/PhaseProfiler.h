@@ -0,0 +1,104 @@
+//===-- PhaseProfiler.h -----------------------------------------*- C++ -*-===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef KLEE_PHASEPROFILER_H
+#define KLEE_PHASEPROFILER_H
+
+#include <stdint.h>
+#include <string>
+
+namespace klee {
+  /// PhaseProfiler - Cheap accounting of where host time goes.
+  ///
+  /// Time is read from the time stamp counter and charged to the current
+  /// phase whenever the phase changes, so nested phases are accounted
+  /// exclusively (e.g., solver time is not counted in the interpreter).
+  /// Clients register their own phases on top of the builtin ones.
+  class PhaseProfiler {
+  public:
+    enum { Other = 0, Solver = 1, MaxPhases = 256 };
+
+  private:
+    static bool enabled;
+    static unsigned current;
+    static uint64_t lastTimestamp;
+    static uint64_t cycles[MaxPhases];
+    static uint64_t entries[MaxPhases];
+
+    static inline void charge(uint64_t now) {
+      cycles[current] += now - lastTimestamp;
+      lastTimestamp = now;
+    }
+
+  public:
+    static inline uint64_t readTimestamp() {
+#if defined(__i386__) || defined(__x86_64__)
+      uint32_t lo, hi;
+      __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+      return ((uint64_t) hi << 32) | lo;
+#else
+      return readTimestampSlow();
+#endif
+    }
+
+    /// enter - Make \a phase current and return the previous phase,
+    /// which must be passed back to leave().
+    static inline unsigned enter(unsigned phase) {
+      unsigned previous = current;
+      if (enabled) {
+        charge(readTimestamp());
+        ++entries[phase];
+        current = phase;
+      }
+      return previous;
+    }
+
+    static inline void leave(unsigned previous) {
+      if (enabled) {
+        charge(readTimestamp());
+        current = previous;
+      }
+    }
+
+    static unsigned getCurrent() { return current; }
+
+    static void setEnabled(bool enable);
+    static bool isEnabled() { return enabled; }
+
+    /// registerPhase - Return the identifier of the phase called \a name,
+    /// creating it if needed.
+    static unsigned registerPhase(const std::string &name);
+
+    static unsigned getPhaseCount();
+    static const std::string &getPhaseName(unsigned phase);
+
+    /// getCycles - Return the time stamp counter ticks spent in \a phase,
+    /// including the time elapsed since the current phase was entered.
+    static uint64_t getCycles(unsigned phase);
+    static uint64_t getEntries(unsigned phase) { return entries[phase]; }
+
+    /// getCyclesPerSecond - Estimate the counter frequency from the wall
+    /// clock time elapsed since the profiler was started.
+    static double getCyclesPerSecond();
+
+    static uint64_t readTimestampSlow();
+  };
+
+  /// PhaseTimer - Charge the lifetime of this object to a phase.
+  class PhaseTimer {
+    unsigned previous;
+
+  public:
+    PhaseTimer(unsigned phase) : previous(PhaseProfiler::enter(phase)) {}
+    ~PhaseTimer() { PhaseProfiler::leave(previous); }
+  };
+}
+
+#endif
+
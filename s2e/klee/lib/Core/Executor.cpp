@@ -269,6 +269,11 @@ namespace {
   EnableSpeculativeForking("enable-speculative-forking",
             cl::desc("Enable speculative forking for concolic execution"),
             cl::init(true));
+
+  cl::opt<bool>
+  ConcreteFastPath("concrete-fast-path",
+            cl::desc("Evaluate integer instructions with constant operands natively"),
+            cl::init(true));
 }
 
 //S2E: we want these to be accessible in S2E executor
@@ -807,19 +812,7 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
         assert(ce && "Expression must be constant here!");
     }
 
-    if (current.forkDisabled) {
-       if (ce->isTrue()) {
-           //Condition is true in the current state
-           addConstraint(current, condition);
-           return StatePair(&current, 0);
-       } else {
-           //Condition is false in the current state
-           addConstraint(current, Expr::createIsZero(condition));
-           return StatePair(0, &current);
-       }
-    }
-
-    if (!EnableSpeculativeForking) {
+    if (!current.forkDisabled && !EnableSpeculativeForking) {
         if (ce->isTrue()) {
             //Condition is true in the current state
             current.speculativeCondition = Expr::createIsZero(condition);
@@ -843,6 +836,18 @@ Executor::concolicFork(ExecutionState &current, ref<Expr> condition, bool isInte
         }
     }
 
+    if (current.forkDisabled || !isForkAllowed(current, condition)) {
+       if (ce->isTrue()) {
+           //Condition is true in the current state
+           addConstraint(current, condition);
+           return StatePair(&current, 0);
+       } else {
+           //Condition is false in the current state
+           addConstraint(current, Expr::createIsZero(condition));
+           return StatePair(0, &current);
+       }
+    }
+
     ExecutionState *trueState, *falseState, *branchedState;
     branchedState = current.branch();
     addedStates.insert(branchedState);
@@ -999,7 +1004,8 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
       if ((MaxMemoryInhibit && atMemoryLimit) || 
           current.forkDisabled ||
           inhibitForking || 
-          (MaxForks!=~0u && stats::forks >= MaxForks)) {
+          (MaxForks!=~0u && stats::forks >= MaxForks) ||
+          !isForkAllowed(current, condition)) {
 
 	if (MaxMemoryInhibit && atMemoryLimit)
 	  klee_warning_once(0, "skipping fork (memory cap exceeded)");
@@ -1007,8 +1013,10 @@ Executor::fork(ExecutionState &current, ref<Expr> condition, bool isInternal) {
 	  klee_warning_once(0, "skipping fork (fork disabled on current path)");
 	else if (inhibitForking)
 	  klee_warning_once(0, "skipping fork (fork disabled globally)");
-	else 
+	else if (MaxForks!=~0u && stats::forks >= MaxForks)
 	  klee_warning_once(0, "skipping fork (max-forks reached)");
+	else
+	  klee_warning_once(0, "skipping fork (not allowed on current path)");
 
         TimerStatIncrementer timer(stats::forkTime);
         if (theRNG.getBool()) {
@@ -1448,80 +1456,87 @@ void Executor::executeCall(ExecutionState &state,
     if (InvokeInst *ii = dyn_cast<InvokeInst>(i))
       transferToBasicBlock(ii->getNormalDest(), i->getParent(), state);
   } else {
-    // FIXME: I'm not really happy about this reliance on prevPC but it is ok, I
-    // guess. This just done to avoid having to pass KInstIterator everywhere
-    // instead of the actual instruction, since we can't make a KInstIterator
-    // from just an instruction (unlike LLVM).
-    KFunction *kf = kmodule->functionMap[f];
-    state.pushFrame(state.prevPC, kf);
-    state.pc = kf->instructions;
-        
-    if (statsTracker)
-      statsTracker->framePushed(state, &state.stack[state.stack.size()-2]);
+    executeInternalCall(state, ki, f, arguments);
+  }
+}
+
+void Executor::executeInternalCall(ExecutionState &state,
+                                   KInstruction *ki,
+                                   Function *f,
+                                   std::vector< ref<Expr> > &arguments) {
+  // FIXME: I'm not really happy about this reliance on prevPC but it is ok, I
+  // guess. This just done to avoid having to pass KInstIterator everywhere
+  // instead of the actual instruction, since we can't make a KInstIterator
+  // from just an instruction (unlike LLVM).
+  KFunction *kf = kmodule->functionMap[f];
+  state.pushFrame(state.prevPC, kf);
+  state.pc = kf->instructions;
+      
+  if (statsTracker)
+    statsTracker->framePushed(state, &state.stack[state.stack.size()-2]);
  
-     // TODO: support "byval" parameter attribute
-     // TODO: support zeroext, signext, sret attributes
-        
-    unsigned callingArgs = arguments.size();
-    unsigned funcArgs = f->arg_size();
-    if (!f->isVarArg()) {
-      if (callingArgs > funcArgs) {
-        klee_warning_once(f, "calling %s with extra arguments.", 
-                          f->getName().data());
-      } else if (callingArgs < funcArgs) {
-        terminateStateOnError(state, "calling function with too few arguments", 
-                              "user.err");
-        return;
-      }
-    } else {
-      if (callingArgs < funcArgs) {
-        terminateStateOnError(state, "calling function with too few arguments", 
-                              "user.err");
-        return;
-      }
-            
-      StackFrame &sf = state.stack.back();
-      unsigned size = 0;
-      for (unsigned i = funcArgs; i < callingArgs; i++) {
-        // FIXME: This is really specific to the architecture, not the pointer
-        // size. This happens to work fir x86-32 and x86-64, however.
-        Expr::Width WordSize = Context::get().getPointerWidth();
-        if (WordSize == Expr::Int32) {
-          size += Expr::getMinBytesForWidth(arguments[i]->getWidth());
-        } else {
-          size += llvm::RoundUpToAlignment(arguments[i]->getWidth(), 
-                                           WordSize) / 8;
-        }
+   // TODO: support "byval" parameter attribute
+   // TODO: support zeroext, signext, sret attributes
+      
+  unsigned callingArgs = arguments.size();
+  unsigned funcArgs = f->arg_size();
+  if (!f->isVarArg()) {
+    if (callingArgs > funcArgs) {
+      klee_warning_once(f, "calling %s with extra arguments.", 
+                        f->getName().data());
+    } else if (callingArgs < funcArgs) {
+      terminateStateOnError(state, "calling function with too few arguments", 
+                            "user.err");
+      return;
+    }
+  } else {
+    if (callingArgs < funcArgs) {
+      terminateStateOnError(state, "calling function with too few arguments", 
+                            "user.err");
+      return;
+    }
+          
+    StackFrame &sf = state.stack.back();
+    unsigned size = 0;
+    for (unsigned i = funcArgs; i < callingArgs; i++) {
+      // FIXME: This is really specific to the architecture, not the pointer
+      // size. This happens to work fir x86-32 and x86-64, however.
+      Expr::Width WordSize = Context::get().getPointerWidth();
+      if (WordSize == Expr::Int32) {
+        size += Expr::getMinBytesForWidth(arguments[i]->getWidth());
+      } else {
+        size += llvm::RoundUpToAlignment(arguments[i]->getWidth(), 
+                                         WordSize) / 8;
       }
+    }
 
-      MemoryObject *mo = sf.varargs = memory->allocate(size, true, false, 
-                                                       state.prevPC->inst);
-      if (!mo) {
-        terminateStateOnExecError(state, "out of memory (varargs)");
-        return;
-      }
-      ObjectState *os = bindObjectInState(state, mo, true);
-      unsigned offset = 0;
-      for (unsigned i = funcArgs; i < callingArgs; i++) {
-        // FIXME: This is really specific to the architecture, not the pointer
-        // size. This happens to work fir x86-32 and x86-64, however.
-        Expr::Width WordSize = Context::get().getPointerWidth();
-        if (WordSize == Expr::Int32) {
-          os->write(offset, arguments[i]);
-          offset += Expr::getMinBytesForWidth(arguments[i]->getWidth());
-        } else {
-          assert(WordSize == Expr::Int64 && "Unknown word size!");
-          os->write(offset, arguments[i]);
-          offset += llvm::RoundUpToAlignment(arguments[i]->getWidth(), 
-                                             WordSize) / 8;
-        }
+    MemoryObject *mo = sf.varargs = memory->allocate(size, true, false, 
+                                                     state.prevPC->inst);
+    if (!mo) {
+      terminateStateOnExecError(state, "out of memory (varargs)");
+      return;
+    }
+    ObjectState *os = bindObjectInState(state, mo, true);
+    unsigned offset = 0;
+    for (unsigned i = funcArgs; i < callingArgs; i++) {
+      // FIXME: This is really specific to the architecture, not the pointer
+      // size. This happens to work fir x86-32 and x86-64, however.
+      Expr::Width WordSize = Context::get().getPointerWidth();
+      if (WordSize == Expr::Int32) {
+        os->write(offset, arguments[i]);
+        offset += Expr::getMinBytesForWidth(arguments[i]->getWidth());
+      } else {
+        assert(WordSize == Expr::Int64 && "Unknown word size!");
+        os->write(offset, arguments[i]);
+        offset += llvm::RoundUpToAlignment(arguments[i]->getWidth(), 
+                                           WordSize) / 8;
       }
     }
-
-    unsigned numFormals = f->arg_size();
-    for (unsigned i=0; i<numFormals; ++i) 
-      bindArgument(kf, i, state, arguments[i]);
   }
+
+  unsigned numFormals = f->arg_size();
+  for (unsigned i=0; i<numFormals; ++i) 
+    bindArgument(kf, i, state, arguments[i]);
 }
 
 void Executor::transferToBasicBlock(BasicBlock *dst, BasicBlock *src, 
@@ -1599,8 +1614,148 @@ static bool isDebugIntrinsic(const Function *f, KModule *KM) {
 #endif
 }
 
+static inline int64_t sextToInt64(uint64_t v, unsigned width) {
+  unsigned shift = 64 - width;
+  return ((int64_t) (v << shift)) >> shift;
+}
+
+/* Evaluates integer instructions whose operands are all constants using
+   native arithmetic. The result is written straight into the destination
+   register; when that register holds an unshared constant of the right
+   width, the constant is recycled instead of allocating a new one.
+   Returns false when the instruction must go through the generic path. */
+bool Executor::executeConcreteInstruction(ExecutionState &state,
+                                          KInstruction *ki) {
+  Instruction *i = ki->inst;
+  unsigned opcode = i->getOpcode();
+  uint64_t result;
+  unsigned width;
+
+  if (opcode == Instruction::Select) {
+    ConstantExpr *cond = dyn_cast<ConstantExpr>(eval(ki, 0, state).value);
+    if (!cond)
+      return false;
+    const Cell &chosen = eval(ki, cond->isTrue() ? 1 : 2, state);
+    getDestCell(state, ki).value = chosen.value;
+    ++stats::fastPathInstructions;
+    return true;
+  }
+
+  if (!i->getType()->isIntegerTy())
+    return false;
+
+  width = cast<IntegerType>(i->getType())->getBitWidth();
+  if (width > 64)
+    return false;
+
+  if (isa<BinaryOperator>(i) || isa<ICmpInst>(i)) {
+    ConstantExpr *left = dyn_cast<ConstantExpr>(eval(ki, 0, state).value);
+    if (!left)
+      return false;
+    ConstantExpr *right = dyn_cast<ConstantExpr>(eval(ki, 1, state).value);
+    if (!right)
+      return false;
+
+    unsigned opWidth = left->getWidth();
+    if (opWidth > 64)
+      return false;
+
+    uint64_t l = left->getZExtValue();
+    uint64_t r = right->getZExtValue();
+
+    switch (opcode) {
+    case Instruction::Add: result = l + r; break;
+    case Instruction::Sub: result = l - r; break;
+    case Instruction::Mul: result = l * r; break;
+    case Instruction::And: result = l & r; break;
+    case Instruction::Or:  result = l | r; break;
+    case Instruction::Xor: result = l ^ r; break;
+
+    case Instruction::UDiv:
+    case Instruction::URem:
+      if (r == 0)
+        return false;
+      result = opcode == Instruction::UDiv ? l / r : l % r;
+      break;
+
+    case Instruction::SDiv:
+    case Instruction::SRem: {
+      int64_t sl = sextToInt64(l, opWidth);
+      int64_t sr = sextToInt64(r, opWidth);
+      /* INT64_MIN / -1 traps on the host */
+      if (sr == 0 || (sr == -1 && (uint64_t) sl == 1ULL << 63))
+        return false;
+      result = opcode == Instruction::SDiv ? sl / sr : sl % sr;
+      break;
+    }
+
+    case Instruction::Shl:
+    case Instruction::LShr:
+    case Instruction::AShr:
+      if (r >= opWidth)
+        return false;
+      if (opcode == Instruction::Shl)
+        result = l << r;
+      else if (opcode == Instruction::LShr)
+        result = l >> r;
+      else
+        result = sextToInt64(l, opWidth) >> r;
+      break;
+
+    case Instruction::ICmp: {
+      int64_t sl = sextToInt64(l, opWidth);
+      int64_t sr = sextToInt64(r, opWidth);
+      switch (cast<ICmpInst>(i)->getPredicate()) {
+      case ICmpInst::ICMP_EQ:  result = l == r; break;
+      case ICmpInst::ICMP_NE:  result = l != r; break;
+      case ICmpInst::ICMP_UGT: result = l > r; break;
+      case ICmpInst::ICMP_UGE: result = l >= r; break;
+      case ICmpInst::ICMP_ULT: result = l < r; break;
+      case ICmpInst::ICMP_ULE: result = l <= r; break;
+      case ICmpInst::ICMP_SGT: result = sl > sr; break;
+      case ICmpInst::ICMP_SGE: result = sl >= sr; break;
+      case ICmpInst::ICMP_SLT: result = sl < sr; break;
+      case ICmpInst::ICMP_SLE: result = sl <= sr; break;
+      default: return false;
+      }
+      break;
+    }
+
+    default:
+      return false;
+    }
+  } else if (opcode == Instruction::Trunc || opcode == Instruction::ZExt ||
+             opcode == Instruction::SExt) {
+    ConstantExpr *arg = dyn_cast<ConstantExpr>(eval(ki, 0, state).value);
+    if (!arg || arg->getWidth() > 64)
+      return false;
+    result = arg->getZExtValue();
+    if (opcode == Instruction::SExt)
+      result = sextToInt64(result, arg->getWidth());
+  } else {
+    return false;
+  }
+
+  result = bits64::truncateToNBits(result, width);
+
+  ref<Expr> &dest = getDestCell(state, ki).value;
+  ConstantExpr *old = dyn_cast_or_null<ConstantExpr>(dest.get());
+  if (old && old->refCount == 1 && old->getWidth() == width) {
+    old->rebind(result);
+  } else {
+    dest = ConstantExpr::create(result, width);
+  }
+
+  ++stats::fastPathInstructions;
+  return true;
+}
+
 void Executor::executeInstruction(ExecutionState &state, KInstruction *ki) {
   Instruction *i = ki->inst;
+
+  if (ConcreteFastPath && executeConcreteInstruction(state, ki))
+    return;
+
   switch (i->getOpcode()) {
     // Control flow
   case Instruction::Ret: {
@@ -2950,6 +3105,13 @@ void Executor::callExternalFunction(ExecutionState &state,
     return;
   }
 
+  executeExternalCall(state, target, function, arguments);
+}
+
+void Executor::executeExternalCall(ExecutionState &state,
+                                   KInstruction *target,
+                                   Function *function,
+                                   std::vector< ref<Expr> > &arguments) {
   // normal external function handling path
   uint64_t *args = (uint64_t*) alloca(sizeof(*args) * (arguments.size() + 1));
   memset(args, 0, sizeof(*args) * (arguments.size() + 1));
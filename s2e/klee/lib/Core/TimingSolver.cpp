@@ -15,6 +15,7 @@
 #include "klee/Statistics.h"
 
 #include "klee/CoreStats.h"
+#include "klee/Internal/Support/PhaseProfiler.h"
 
 #include "llvm/Support/Process.h"
 
@@ -34,6 +35,7 @@ bool TimingSolver::evaluate(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  PhaseTimer phaseTimer(PhaseProfiler::Solver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -60,6 +62,7 @@ bool TimingSolver::mustBeTrue(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
 
+  PhaseTimer phaseTimer(PhaseProfiler::Solver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -110,6 +113,7 @@ bool TimingSolver::getValue(const ExecutionState& state, ref<Expr> expr,
     return true;
   }
   
+  PhaseTimer phaseTimer(PhaseProfiler::Solver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -135,6 +139,7 @@ TimingSolver::getInitialValues(const ExecutionState& state,
   if (objects.empty())
     return true;
 
+  PhaseTimer phaseTimer(PhaseProfiler::Solver);
   sys::TimeValue now(0,0),user(0,0),delta(0,0),sys(0,0);
   sys::Process::GetTimeUsage(now,user,sys);
 
@@ -152,5 +157,6 @@ TimingSolver::getInitialValues(const ExecutionState& state,
 
 std::pair< ref<Expr>, ref<Expr> >
 TimingSolver::getRange(const ExecutionState& state, ref<Expr> expr) {
+  PhaseTimer phaseTimer(PhaseProfiler::Solver);
   return solver->getRange(Query(state.constraints, expr));
 }
@@ -0,0 +1,85 @@
+//===-- PhaseProfiler.cpp -------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/Support/PhaseProfiler.h"
+#include "klee/Internal/System/Time.h"
+
+#include <cassert>
+#include <vector>
+
+using namespace klee;
+
+bool PhaseProfiler::enabled = true;
+unsigned PhaseProfiler::current = PhaseProfiler::Other;
+uint64_t PhaseProfiler::lastTimestamp = PhaseProfiler::readTimestamp();
+uint64_t PhaseProfiler::cycles[PhaseProfiler::MaxPhases];
+uint64_t PhaseProfiler::entries[PhaseProfiler::MaxPhases];
+
+namespace {
+  struct Calibration {
+    uint64_t startTimestamp;
+    double startTime;
+
+    Calibration() : startTimestamp(PhaseProfiler::readTimestamp()),
+                    startTime(util::getWallTime()) {}
+  };
+
+  Calibration calibration;
+
+  std::vector<std::string> &getNames() {
+    static std::vector<std::string> names;
+    if (names.empty()) {
+      names.push_back("Other");
+      names.push_back("Solver");
+    }
+    return names;
+  }
+}
+
+uint64_t PhaseProfiler::readTimestampSlow() {
+  return (uint64_t) (util::getWallTime() * 1000000000.0);
+}
+
+void PhaseProfiler::setEnabled(bool enable) {
+  if (enable && !enabled)
+    lastTimestamp = readTimestamp();
+  enabled = enable;
+}
+
+unsigned PhaseProfiler::registerPhase(const std::string &name) {
+  std::vector<std::string> &names = getNames();
+  for (unsigned i = 0; i < names.size(); ++i)
+    if (names[i] == name)
+      return i;
+
+  assert(names.size() < MaxPhases && "too many phases");
+  names.push_back(name);
+  return names.size() - 1;
+}
+
+unsigned PhaseProfiler::getPhaseCount() {
+  return getNames().size();
+}
+
+const std::string &PhaseProfiler::getPhaseName(unsigned phase) {
+  return getNames()[phase];
+}
+
+uint64_t PhaseProfiler::getCycles(unsigned phase) {
+  if (enabled && phase == current)
+    charge(readTimestamp());
+  return cycles[phase];
+}
+
+double PhaseProfiler::getCyclesPerSecond() {
+  double elapsed = util::getWallTime() - calibration.startTime;
+  if (elapsed <= 0)
+    return 0;
+  return (readTimestamp() - calibration.startTimestamp) / elapsed;
+}
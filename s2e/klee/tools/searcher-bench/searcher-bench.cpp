@@ -0,0 +1,199 @@
+//===-- searcher-bench.cpp ------------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Drives the state priority queues used by the searchers with a synthetic
+// stream of forks, kills and priority updates, and reports the time spent
+// in each of them.
+//
+//===----------------------------------------------------------------------===//
+
+#include "klee/Internal/ADT/IndexedHeap.h"
+#include "klee/Internal/ADT/RNG.h"
+#include "klee/Internal/System/Time.h"
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <set>
+#include <vector>
+
+using namespace llvm;
+using namespace klee;
+
+namespace {
+  cl::opt<unsigned>
+  States("states", cl::desc("Number of live states to reach (default=100000)"),
+         cl::init(100000));
+
+  cl::opt<unsigned>
+  Steps("steps", cl::desc("Number of operations after the initial forks "
+                          "(default=1000000)"),
+        cl::init(1000000));
+
+  cl::opt<unsigned>
+  ForkRate("fork-rate", cl::desc("Percentage of operations that fork "
+                                 "(default=5)"),
+           cl::init(5));
+
+  cl::opt<unsigned>
+  KillRate("kill-rate", cl::desc("Percentage of operations that kill a state "
+                                 "(default=5)"),
+           cl::init(5));
+
+  cl::opt<unsigned>
+  Seed("seed", cl::desc("Seed of the operation stream (default=1)"),
+       cl::init(1));
+}
+
+/// Stands for an execution state. The priority lives outside of the queue,
+/// like the per-state metric of a searcher plugin.
+struct BenchState {
+  unsigned id;
+  unsigned priority;
+};
+
+enum OpKind { Fork, Kill, Update };
+
+struct Op {
+  OpKind kind;
+  unsigned index;
+  unsigned priority;
+};
+
+/// The searchers used to keep states in a std::set whose comparator reads
+/// the priority from the state, so that changing it requires an erase and
+/// a reinsertion.
+struct BenchStateOrder {
+  bool operator()(const BenchState *s1, const BenchState *s2) const {
+    if (s1->priority == s2->priority)
+      return s1->id < s2->id;
+    return s1->priority < s2->priority;
+  }
+};
+
+class SetQueue {
+  std::set<BenchState*, BenchStateOrder> states;
+
+public:
+  void add(BenchState *s) { states.insert(s); }
+  void remove(BenchState *s) { states.erase(s); }
+  void update(BenchState *s, unsigned priority) {
+    states.erase(s);
+    s->priority = priority;
+    states.insert(s);
+  }
+  BenchState *select() { return *states.begin(); }
+};
+
+class HeapQueue {
+  IndexedHeap<BenchState*, unsigned> states;
+
+public:
+  void add(BenchState *s) { states.push(s, s->priority); }
+  void remove(BenchState *s) { states.erase(s); }
+  void update(BenchState *s, unsigned priority) {
+    s->priority = priority;
+    states.update(s, priority);
+  }
+  BenchState *select() { return states.top(); }
+};
+
+/// Generates the operations up front, so that both queues see the same
+/// stream and the generation cost is not measured. Operations refer to
+/// states by their index in the live state vector at the time they run.
+static void generateOps(std::vector<Op> &ops) {
+  RNG rng(Seed);
+  unsigned live = 1;
+
+  for (unsigned i = 1; i < States; ++i) {
+    Op op = { Fork, rng.getInt32() % live, rng.getInt32() % 1024 };
+    ops.push_back(op);
+    ++live;
+  }
+
+  for (unsigned i = 0; i < Steps; ++i) {
+    unsigned r = rng.getInt32() % 100;
+    Op op = { Update, rng.getInt32() % live, rng.getInt32() % 1024 };
+    if (r < ForkRate) {
+      op.kind = Fork;
+      ++live;
+    } else if (r < ForkRate + KillRate && live > 1) {
+      op.kind = Kill;
+      --live;
+    }
+    ops.push_back(op);
+  }
+}
+
+template <class Queue>
+static double run(const std::vector<Op> &ops, unsigned &checksum) {
+  std::vector<BenchState*> live;
+  std::vector<BenchState> storage(ops.size() + 1);
+  unsigned next = 0;
+  Queue queue;
+
+  BenchState *initial = &storage[next];
+  initial->id = next++;
+  initial->priority = 0;
+  live.push_back(initial);
+  queue.add(initial);
+
+  checksum = 0;
+  double start = util::getWallTime();
+
+  for (std::vector<Op>::const_iterator it = ops.begin(), ie = ops.end();
+       it != ie; ++it) {
+    BenchState *s = live[it->index];
+    switch (it->kind) {
+    case Fork: {
+      BenchState *forked = &storage[next];
+      forked->id = next++;
+      forked->priority = it->priority;
+      live.push_back(forked);
+      queue.add(forked);
+      break;
+    }
+    case Kill:
+      queue.remove(s);
+      live[it->index] = live.back();
+      live.pop_back();
+      break;
+    case Update:
+      queue.update(s, it->priority);
+      break;
+    }
+
+    checksum += queue.select()->priority;
+  }
+
+  return util::getWallTime() - start;
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, " state queue benchmark\n");
+
+  std::vector<Op> ops;
+  generateOps(ops);
+
+  unsigned setChecksum, heapChecksum;
+  double setTime = run<SetQueue>(ops, setChecksum);
+  double heapTime = run<HeapQueue>(ops, heapChecksum);
+
+  outs() << "Operations: " << ops.size() << "\n";
+  outs() << "std::set:    " << setTime << "s\n";
+  outs() << "IndexedHeap: " << heapTime << "s\n";
+
+  // Ties may be broken differently, but the selected priorities must match.
+  if (setChecksum != heapChecksum) {
+    errs() << "searcher-bench: queues selected different priorities\n";
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,125 @@
+//===-- IndexedHeapTest.cpp -----------------------------------------------===//
+//
+//                     The KLEE Symbolic Virtual Machine
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "gtest/gtest.h"
+
+#include "klee/Internal/ADT/IndexedHeap.h"
+#include "klee/Internal/ADT/RNG.h"
+
+#include <functional>
+#include <map>
+#include <set>
+
+using namespace klee;
+
+namespace {
+
+TEST(IndexedHeapTest, PushPop) {
+  IndexedHeap<int, unsigned> heap;
+  EXPECT_TRUE(heap.empty());
+
+  heap.push(1, 30);
+  heap.push(2, 10);
+  heap.push(3, 20);
+  EXPECT_EQ(3U, heap.size());
+  EXPECT_TRUE(heap.contains(2));
+  EXPECT_FALSE(heap.contains(4));
+
+  EXPECT_EQ(2, heap.top());
+  EXPECT_EQ(10U, heap.topPriority());
+  heap.pop();
+  EXPECT_EQ(3, heap.top());
+  heap.pop();
+  EXPECT_EQ(1, heap.top());
+  heap.pop();
+  EXPECT_TRUE(heap.empty());
+}
+
+TEST(IndexedHeapTest, Update) {
+  IndexedHeap<int, unsigned> heap;
+  for (int i = 0; i < 10; ++i)
+    heap.push(i, 100 + i);
+
+  heap.update(9, 1);
+  EXPECT_EQ(9, heap.top());
+  EXPECT_EQ(1U, heap.getPriority(9));
+
+  heap.update(9, 200);
+  EXPECT_EQ(0, heap.top());
+
+  // Pushing an existing item changes its priority.
+  heap.push(5, 0);
+  EXPECT_EQ(5, heap.top());
+  EXPECT_EQ(10U, heap.size());
+}
+
+TEST(IndexedHeapTest, Erase) {
+  IndexedHeap<int, unsigned, std::greater<unsigned> > heap;
+  for (int i = 0; i < 10; ++i)
+    heap.push(i, i);
+
+  EXPECT_EQ(9, heap.top());
+  EXPECT_TRUE(heap.erase(9));
+  EXPECT_FALSE(heap.erase(9));
+  EXPECT_TRUE(heap.erase(3));
+  EXPECT_EQ(8U, heap.size());
+
+  unsigned expected[] = { 8, 7, 6, 5, 4, 2, 1, 0 };
+  for (unsigned i = 0; i < 8; ++i) {
+    EXPECT_EQ(expected[i], heap.topPriority());
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+// Compare against a std::set ordered by (priority, item) on a random
+// stream of insertions, removals and priority changes.
+TEST(IndexedHeapTest, Random) {
+  IndexedHeap<unsigned, unsigned> heap;
+  std::map<unsigned, unsigned> priorities;
+  std::set<std::pair<unsigned, unsigned> > reference;
+  RNG rng(1);
+
+  for (unsigned i = 0; i < 20000; ++i) {
+    unsigned item = rng.getInt32() % 512;
+    unsigned priority = rng.getInt32() % 64;
+    std::map<unsigned, unsigned>::iterator it = priorities.find(item);
+
+    if (it != priorities.end()) {
+      reference.erase(std::make_pair(it->second, item));
+      if (rng.getBool()) {
+        EXPECT_TRUE(heap.erase(item));
+        priorities.erase(it);
+      } else {
+        heap.update(item, priority);
+        it->second = priority;
+        reference.insert(std::make_pair(priority, item));
+      }
+    } else {
+      heap.push(item, priority);
+      priorities[item] = priority;
+      reference.insert(std::make_pair(priority, item));
+    }
+
+    ASSERT_EQ(reference.size(), heap.size());
+    if (!reference.empty()) {
+      ASSERT_EQ(reference.begin()->first, heap.topPriority());
+      ASSERT_EQ(heap.topPriority(), priorities[heap.top()]);
+    }
+  }
+
+  while (!reference.empty()) {
+    ASSERT_EQ(reference.begin()->first, heap.topPriority());
+    reference.erase(std::make_pair(heap.topPriority(), heap.top()));
+    heap.pop();
+  }
+  EXPECT_TRUE(heap.empty());
+}
+
+}
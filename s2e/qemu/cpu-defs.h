@@ -218,6 +218,7 @@ typedef struct CPUWatchpoint {
     struct TranslationBlock *current_tb; /* currently executing TB  */  \
 	/*[fwl]增加s2e_current_tb指针 */									\
     struct TranslationBlock *s2e_current_tb; /* currently executing TB  */  \
+    int s2e_split_insn; /* if non-zero, native code exits before this insn */ \
     /* soft mmu support */                                              \
     /* in order to avoid passing too many arguments to the MMIO         \
        helpers, we store some rarely used information in the CPU        \
@@ -237,6 +237,9 @@ int cpu_exec(CPUArchState *env)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     uintptr_t next_tb;
+#ifdef CONFIG_S2E
+    volatile unsigned cpu_exec_phase;
+#endif
 
     if (env->halted) {
         if (!cpu_has_work(env)) {
@@ -289,6 +292,9 @@ int cpu_exec(CPUArchState *env)
     if (!s2e_is_runnable(g_s2e_state)) {
         return EXCP_S2E;
     }
+
+    /* s2e_longjmp skips the phase leave calls of translation and plugins */
+    cpu_exec_phase = s2e_phase_current();
 #endif
 
     env->exception_index = -1;
@@ -694,6 +700,7 @@ int cpu_exec(CPUArchState *env)
 			 */
             #ifdef CONFIG_S2E
             assert(g_s2e_state);
+            s2e_phase_leave(cpu_exec_phase);
             if (!s2e_is_runnable(g_s2e_state)) {
                 cpu_single_env = NULL;
                 return EXCP_S2E;
@@ -175,6 +175,11 @@ enum JumpType
 {
     JT_RET, JT_LRET
 };
+
+/* Register accesses are tracked for the first 32 TCG globals,
+   the last slot is for helpers that may touch symbolic memory */
+#define S2E_TB_ACCESS_SLOTS 33
+#define S2E_TB_ACCESS_SYMBOLIC_MEM 32
 #endif
 
 
@@ -232,10 +237,41 @@ struct TranslationBlock {
     struct S2ETranslationBlock* s2e_tb;
     struct TranslationBlock* s2e_tb_next[2];
     uint64_t pcOfLastInstr; /* XXX: hack for call instructions */
+
+    /* Index of the first instruction that touches each register,
+       0xff if none of the first 255 instructions does */
+    uint8_t s2e_first_access[S2E_TB_ACCESS_SLOTS];
 #endif
 
 };
 
+#ifdef CONFIG_S2E
+static inline void s2e_tb_reset_accesses(TranslationBlock *tb)
+{
+    memset(tb->s2e_first_access, 0xff, sizeof(tb->s2e_first_access));
+}
+
+static inline void s2e_tb_record_accesses(TranslationBlock *tb, int insn,
+                                          uint64_t mask, uint64_t accesses_mem)
+{
+    int i;
+    if (insn >= 0xff) {
+        return;
+    }
+
+    for (i = 0; i < S2E_TB_ACCESS_SYMBOLIC_MEM; ++i) {
+        if ((mask & (1ULL << i)) && tb->s2e_first_access[i] == 0xff) {
+            tb->s2e_first_access[i] = insn;
+        }
+    }
+
+    if ((accesses_mem & 4) &&
+        tb->s2e_first_access[S2E_TB_ACCESS_SYMBOLIC_MEM] == 0xff) {
+        tb->s2e_first_access[S2E_TB_ACCESS_SYMBOLIC_MEM] = insn;
+    }
+}
+#endif
+
 static inline unsigned int tb_jmp_cache_hash_page(target_ulong pc)
 {
     target_ulong tmp;
@@ -0,0 +1,332 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#include "BackgroundTranslator.h"
+#include "BitcodeCache.h"
+#include "Utils.h"
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/PassManager.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
+
+namespace llvm {
+    //Defined in KLEE, these are the passes of KModule::updateModuleWithFunction
+    extern void CreateOptimizePasses(PassManagerBase &, Module *);
+}
+
+using namespace llvm;
+
+namespace s2e {
+
+//Name of the function inside of the modules exchanged with the worker
+static const char *JOB_FUNCTION_NAME = "tb";
+
+static Module *parseBitcode(const std::string &bitcode, LLVMContext &context)
+{
+    OwningPtr<MemoryBuffer> buffer(
+            MemoryBuffer::getMemBuffer(StringRef(bitcode), "", false));
+    std::string error;
+    return ParseBitcodeFile(buffer.get(), context, &error);
+}
+
+/** Copies function into a standalone module and returns its bitcode */
+static bool writeFunction(Function *function, const Module *layout, std::string &bitcode)
+{
+    Module module("tcg-llvm-job", function->getContext());
+    module.setDataLayout(layout->getDataLayout());
+    module.setTargetTriple(layout->getTargetTriple());
+
+    if (!BitcodeCache::cloneFunction(function, &module, JOB_FUNCTION_NAME, true)) {
+        return false;
+    }
+
+    raw_string_ostream os(bitcode);
+    WriteBitcodeToFile(&module, os);
+    os.flush();
+    return true;
+}
+
+BackgroundTranslator::BackgroundTranslator(Module *module,
+                                           const std::string &helpersPath,
+                                           unsigned maxPending)
+    : m_module(module), m_helpersPath(helpersPath), m_maxPending(maxPending),
+      m_stop(false), m_submitted(0), m_installed(0), m_wasted(0), m_failed(0)
+{
+    qemu_mutex_init(&m_lock);
+    qemu_cond_init(&m_cond);
+    qemu_thread_create(&m_thread, threadEntry, this, QEMU_THREAD_JOINABLE);
+}
+
+BackgroundTranslator::~BackgroundTranslator()
+{
+    qemu_mutex_lock(&m_lock);
+    m_stop = true;
+    qemu_cond_signal(&m_cond);
+    qemu_mutex_unlock(&m_lock);
+
+    qemu_thread_join(&m_thread);
+
+    foreach2(it, m_queue.begin(), m_queue.end()) {
+        delete *it;
+    }
+
+    foreach2(it, m_completed.begin(), m_completed.end()) {
+        delete *it;
+    }
+
+    qemu_cond_destroy(&m_cond);
+    qemu_mutex_destroy(&m_lock);
+}
+
+bool BackgroundTranslator::submit(Function *function)
+{
+    if (!canSubmit() || m_jobs.count(function)) {
+        return false;
+    }
+
+    Job *job = new Job();
+    job->function = function;
+
+    if (!writeFunction(function, m_module, job->input)) {
+        ++m_failed;
+        delete job;
+        return false;
+    }
+
+    m_jobs[function] = job;
+    ++m_submitted;
+
+    qemu_mutex_lock(&m_lock);
+    m_queue.push_back(job);
+    qemu_cond_signal(&m_cond);
+    qemu_mutex_unlock(&m_lock);
+
+    return true;
+}
+
+void BackgroundTranslator::forget(Function *function)
+{
+    m_optimized.erase(function);
+
+    Jobs::iterator it = m_jobs.find(function);
+    if (it == m_jobs.end()) {
+        return;
+    }
+
+    Job *job = (*it).second;
+    m_jobs.erase(it);
+    ++m_wasted;
+
+    //Jobs that the worker did not pick yet can be dropped right away,
+    //the others will be deleted when they complete.
+    qemu_mutex_lock(&m_lock);
+    foreach2(qit, m_queue.begin(), m_queue.end()) {
+        if (*qit == job) {
+            m_queue.erase(qit);
+            qemu_mutex_unlock(&m_lock);
+            delete job;
+            return;
+        }
+    }
+    job->function = NULL;
+    qemu_mutex_unlock(&m_lock);
+}
+
+/**
+ *  Replaces the body of function with the one stored in bitcode.
+ *  The function object itself stays the same, because the translation
+ *  block and the JIT still refer to it.
+ */
+bool BackgroundTranslator::install(Function *function, const std::string &bitcode)
+{
+    Module *optimized = parseBitcode(bitcode, m_module->getContext());
+    if (!optimized) {
+        return false;
+    }
+
+    Function *clone = NULL;
+    Function *optimizedFunction = optimized->getFunction(JOB_FUNCTION_NAME);
+    if (optimizedFunction && !optimizedFunction->isDeclaration()) {
+        clone = BitcodeCache::cloneFunction(optimizedFunction, m_module, "", false);
+    }
+    delete optimized;
+
+    if (!clone) {
+        return false;
+    }
+
+    GlobalValue::LinkageTypes linkage = function->getLinkage();
+    function->deleteBody();
+    function->setLinkage(linkage);
+
+    function->getBasicBlockList().splice(function->end(), clone->getBasicBlockList());
+
+    Function::arg_iterator arg = function->arg_begin();
+    for (Function::arg_iterator cloneArg = clone->arg_begin();
+         cloneArg != clone->arg_end(); ++cloneArg, ++arg) {
+        cloneArg->replaceAllUsesWith(arg);
+    }
+
+    clone->eraseFromParent();
+    return true;
+}
+
+void BackgroundTranslator::poll()
+{
+    if (m_jobs.empty()) {
+        return;
+    }
+
+    std::vector<Job*> completed;
+    qemu_mutex_lock(&m_lock);
+    completed.swap(m_completed);
+    qemu_mutex_unlock(&m_lock);
+
+    foreach2(it, completed.begin(), completed.end()) {
+        Job *job = *it;
+        if (job->function) {
+            m_jobs.erase(job->function);
+
+            if (!job->output.empty() && install(job->function, job->output)) {
+                m_optimized.insert(job->function);
+                ++m_installed;
+            } else {
+                ++m_failed;
+            }
+        }
+        delete job;
+    }
+}
+
+void *BackgroundTranslator::threadEntry(void *opaque)
+{
+    static_cast<BackgroundTranslator*>(opaque)->run();
+    return NULL;
+}
+
+void BackgroundTranslator::run()
+{
+    LLVMContext context;
+    Module *helpers = NULL;
+    FunctionPassManager *fpm = NULL;
+
+    //The helpers must be available for inlining, as they are in KLEE's module
+    OwningPtr<MemoryBuffer> buffer;
+    if (!MemoryBuffer::getFile(m_helpersPath.c_str(), buffer)) {
+        std::string error;
+        helpers = ParseBitcodeFile(buffer.get(), context, &error);
+    }
+
+    if (helpers) {
+        helpers->setDataLayout(m_module->getDataLayout());
+        helpers->setTargetTriple(m_module->getTargetTriple());
+
+        fpm = new FunctionPassManager(helpers);
+        CreateOptimizePasses(*fpm, helpers);
+        fpm->doInitialization();
+    }
+
+    qemu_mutex_lock(&m_lock);
+    while (true) {
+        while (m_queue.empty() && !m_stop) {
+            qemu_cond_wait(&m_cond, &m_lock);
+        }
+
+        if (m_stop) {
+            break;
+        }
+
+        Job *job = m_queue.front();
+        m_queue.pop_front();
+        qemu_mutex_unlock(&m_lock);
+
+        //Failed jobs have an empty output and fall back to KLEE's passes
+        if (helpers) {
+            job->output = optimize(helpers, *fpm, job->input);
+        }
+
+        qemu_mutex_lock(&m_lock);
+        m_completed.push_back(job);
+    }
+    qemu_mutex_unlock(&m_lock);
+
+    delete fpm;
+    delete helpers;
+}
+
+std::string BackgroundTranslator::optimize(Module *helpers, FunctionPassManager &fpm,
+                                           const std::string &bitcode)
+{
+    std::string result;
+
+    OwningPtr<Module> input(parseBitcode(bitcode, helpers->getContext()));
+    if (!input) {
+        return result;
+    }
+
+    Function *inputFunction = input->getFunction(JOB_FUNCTION_NAME);
+    if (!inputFunction || inputFunction->isDeclaration()) {
+        return result;
+    }
+
+    Function *function = BitcodeCache::cloneFunction(inputFunction, helpers, "", true);
+    if (!function) {
+        return result;
+    }
+
+    fpm.run(*function);
+
+    if (!writeFunction(function, helpers, result)) {
+        result.clear();
+    }
+
+    function->eraseFromParent();
+    return result;
+}
+
+void BackgroundTranslator::printStats(raw_ostream &os) const
+{
+    os << "Background translation: " << m_submitted << " submitted, "
+       << m_installed << " installed, " << m_wasted << " wasted, "
+       << m_failed << " failed" << '\n';
+}
+
+} // namespace s2e
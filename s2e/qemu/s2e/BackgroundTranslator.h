@@ -0,0 +1,139 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_BACKGROUNDTRANSLATOR_H
+#define S2E_BACKGROUNDTRANSLATOR_H
+
+extern "C" {
+#include <qemu-thread.h>
+}
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#include <deque>
+#include <vector>
+#include <string>
+
+namespace llvm {
+    class Module;
+    class Function;
+    class FunctionPassManager;
+}
+
+namespace s2e {
+
+/**
+ *  Optimizes the LLVM code of translation blocks on a separate thread.
+ *
+ *  The executor submits the functions of the translation blocks that will
+ *  likely run in KLEE soon. Generating the LLVM code needs the TCG and CPU
+ *  state and stays on the main thread, but the optimization passes that
+ *  KLEE would otherwise run right before the first execution are applied
+ *  by the worker in its own LLVM context. Functions travel between the
+ *  two contexts as bitcode.
+ */
+class BackgroundTranslator
+{
+public:
+    BackgroundTranslator(llvm::Module *module, const std::string &helpersPath,
+                         unsigned maxPending);
+    ~BackgroundTranslator();
+
+    bool canSubmit() const {
+        return m_jobs.size() < m_maxPending;
+    }
+
+    /** Queues the function for optimization */
+    bool submit(llvm::Function *function);
+
+    /** Installs the optimized code of the completed jobs */
+    void poll();
+
+    /** Whether poll() replaced the body of the function with optimized code */
+    bool isOptimized(llvm::Function *function) const {
+        return m_optimized.count(function);
+    }
+
+    /** Must be called when KLEE takes over the function or before it is deleted */
+    void forget(llvm::Function *function);
+
+    void printStats(llvm::raw_ostream &os) const;
+
+private:
+    struct Job {
+        /* Accessed by the main thread only, NULL once forgotten */
+        llvm::Function *function;
+
+        std::string input;
+        std::string output;
+    };
+
+    typedef std::tr1::unordered_map<llvm::Function*, Job*> Jobs;
+    typedef std::tr1::unordered_set<llvm::Function*> OptimizedFunctions;
+
+    llvm::Module *m_module;
+    std::string m_helpersPath;
+    unsigned m_maxPending;
+
+    Jobs m_jobs;
+    OptimizedFunctions m_optimized;
+
+    /* Shared with the worker, protected by m_lock */
+    QemuThread m_thread;
+    QemuMutex m_lock;
+    QemuCond m_cond;
+    std::deque<Job*> m_queue;
+    std::vector<Job*> m_completed;
+    bool m_stop;
+
+    uint64_t m_submitted;
+    uint64_t m_installed;
+    uint64_t m_wasted;
+    uint64_t m_failed;
+
+    bool install(llvm::Function *function, const std::string &bitcode);
+
+    static void *threadEntry(void *opaque);
+    void run();
+    std::string optimize(llvm::Module *helpers, llvm::FunctionPassManager &fpm,
+                         const std::string &bitcode);
+};
+
+} // namespace s2e
+
+#endif // S2E_BACKGROUNDTRANSLATOR_H
@@ -0,0 +1,337 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include <qemu-common.h>
+#include <cpu-all.h>
+#include <exec-all.h>
+}
+
+#include "BitcodeCache.h"
+#include "S2EExecutor.h"
+
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/s2e_qemu.h>
+
+#include <llvm/Module.h>
+#include <llvm/Constants.h>
+#include <llvm/DerivedTypes.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/ADT/OwningPtr.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Bitcode/ReaderWriter.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/system_error.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include <sstream>
+#include <iomanip>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+using namespace llvm;
+
+namespace s2e {
+
+//Name of the function inside of the cached modules
+static const char *CACHED_FUNCTION_NAME = "tb";
+
+BitcodeCache::BitcodeCache(Module *module, const std::string &directory,
+                           uint64_t maxSize, const std::string &pipeline)
+    : m_module(module), m_directory(directory), m_maxSize(maxSize),
+      m_pipeline(2166136261U), m_currentSize(0), m_hits(0), m_misses(0),
+      m_stores(0), m_rejected(0), m_errors(0)
+{
+    foreach2(it, pipeline.begin(), pipeline.end()) {
+        m_pipeline = (m_pipeline ^ (uint8_t) *it) * 16777619U;
+    }
+
+    if (mkdir(m_directory.c_str(), 0775) < 0 && errno != EEXIST) {
+        ++m_errors;
+    }
+
+    computeCurrentSize();
+}
+
+BitcodeCache::~BitcodeCache()
+{
+
+}
+
+std::string BitcodeCache::getPath(uint64_t key) const
+{
+    std::stringstream ss;
+    ss << m_directory << "/" << std::hex << std::setw(16) << std::setfill('0')
+       << key << "-" << std::setw(8) << m_pipeline << ".bc";
+    return ss.str();
+}
+
+void BitcodeCache::computeCurrentSize()
+{
+    DIR *dir = opendir(m_directory.c_str());
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        std::string name = entry->d_name;
+        if (name.size() < 3 || name.compare(name.size() - 3, 3, ".bc")) {
+            continue;
+        }
+
+        struct stat st;
+        std::string path = m_directory + "/" + name;
+        if (stat(path.c_str(), &st) == 0) {
+            m_currentSize += st.st_size;
+        }
+    }
+
+    closedir(dir);
+}
+
+/**
+ *  Copies function into dest, mapping all the global values it references
+ *  to the globals of dest that have the same name and type. If some global
+ *  does not exist, it is declared when declareMissing is true, otherwise
+ *  the copy fails.
+ */
+Function* BitcodeCache::cloneFunction(Function *function, Module *dest,
+                                      const std::string &name, bool declareMissing)
+{
+    SmallPtrSet<Constant*, 32> visited;
+    SmallVector<Constant*, 32> worklist;
+    SmallPtrSet<GlobalValue*, 16> globals;
+
+    for (Function::iterator bb = function->begin(); bb != function->end(); ++bb) {
+        for (BasicBlock::iterator it = bb->begin(); it != bb->end(); ++it) {
+            for (User::op_iterator op = it->op_begin(); op != it->op_end(); ++op) {
+                if (Constant *c = dyn_cast<Constant>(*op)) {
+                    if (visited.insert(c)) {
+                        worklist.push_back(c);
+                    }
+                }
+            }
+        }
+    }
+
+    while (!worklist.empty()) {
+        Constant *c = worklist.pop_back_val();
+        if (GlobalValue *gv = dyn_cast<GlobalValue>(c)) {
+            globals.insert(gv);
+            continue;
+        }
+
+        for (User::op_iterator op = c->op_begin(); op != c->op_end(); ++op) {
+            Constant *oc = cast<Constant>(*op);
+            if (visited.insert(oc)) {
+                worklist.push_back(oc);
+            }
+        }
+    }
+
+    ValueToValueMapTy vmap;
+    for (SmallPtrSet<GlobalValue*, 16>::iterator it = globals.begin();
+         it != globals.end(); ++it) {
+        GlobalValue *gv = *it;
+        GlobalValue *destGv = dest->getNamedValue(gv->getName());
+
+        if (!destGv && declareMissing) {
+            if (Function *f = dyn_cast<Function>(gv)) {
+                destGv = Function::Create(f->getFunctionType(),
+                                          GlobalValue::ExternalLinkage,
+                                          f->getName(), dest);
+            } else if (GlobalVariable *var = dyn_cast<GlobalVariable>(gv)) {
+                destGv = new GlobalVariable(*dest, var->getType()->getElementType(),
+                                            var->isConstant(),
+                                            GlobalValue::ExternalLinkage,
+                                            NULL, var->getName());
+            }
+        }
+
+        if (!destGv || destGv->getType() != gv->getType()) {
+            return NULL;
+        }
+
+        vmap[gv] = destGv;
+    }
+
+    Function *clone = Function::Create(function->getFunctionType(),
+                                       function->getLinkage(), name, dest);
+    clone->copyAttributesFrom(function);
+
+    Function::arg_iterator destArg = clone->arg_begin();
+    for (Function::const_arg_iterator arg = function->arg_begin();
+         arg != function->arg_end(); ++arg, ++destArg) {
+        destArg->setName(arg->getName());
+        vmap[arg] = destArg;
+    }
+
+    SmallVector<ReturnInst*, 8> returns;
+    CloneFunctionInto(clone, function, vmap, true, returns);
+
+    return clone;
+}
+
+bool BitcodeCache::readCode(TranslationBlock *tb, std::vector<uint8_t> &code)
+{
+    code.resize(tb->size);
+    return tb->size == 0 ||
+           g_s2e_state->readMemoryConcrete(tb->pc, &code[0], tb->size);
+}
+
+Function* BitcodeCache::load(uint64_t key, const char *fcnName)
+{
+    std::string path = getPath(key);
+
+    OwningPtr<MemoryBuffer> buffer;
+    if (MemoryBuffer::getFile(path.c_str(), buffer)) {
+        ++m_misses;
+        return NULL;
+    }
+
+    std::string error;
+    Module *cached = ParseBitcodeFile(buffer.get(), m_module->getContext(), &error);
+    Function *function = NULL;
+
+    if (cached) {
+        Function *cachedFunction = cached->getFunction(CACHED_FUNCTION_NAME);
+        if (cachedFunction && !cachedFunction->isDeclaration()) {
+            function = cloneFunction(cachedFunction, m_module, fcnName, false);
+        }
+        delete cached;
+    }
+
+    if (!function) {
+        //Stale or corrupted entry, it will be overwritten
+        ++m_errors;
+        ++m_misses;
+        return NULL;
+    }
+
+    ++m_hits;
+    m_loaded.insert(function);
+    return function;
+}
+
+void BitcodeCache::generated(uint64_t key, Function *function)
+{
+    m_pending[function] = key;
+}
+
+void BitcodeCache::store(Function *function)
+{
+    PendingFunctions::iterator it = m_pending.find(function);
+    if (it == m_pending.end()) {
+        return;
+    }
+
+    uint64_t key = (*it).second;
+    m_pending.erase(it);
+
+    if (m_currentSize >= m_maxSize) {
+        ++m_rejected;
+        return;
+    }
+
+    Module module("tcg-llvm-cache", m_module->getContext());
+    module.setDataLayout(m_module->getDataLayout());
+    module.setTargetTriple(m_module->getTargetTriple());
+
+    if (!cloneFunction(function, &module, CACHED_FUNCTION_NAME, true)) {
+        ++m_errors;
+        return;
+    }
+
+    std::string path = getPath(key);
+    std::stringstream tmpPath;
+    tmpPath << path << ".tmp." << getpid();
+
+    std::string error;
+    {
+        raw_fd_ostream os(tmpPath.str().c_str(), error, raw_fd_ostream::F_Binary);
+        if (!error.empty()) {
+            ++m_errors;
+            return;
+        }
+
+        WriteBitcodeToFile(&module, os);
+        m_currentSize += os.tell();
+        os.close();
+
+        if (os.has_error()) {
+            os.clear_error();
+            unlink(tmpPath.str().c_str());
+            ++m_errors;
+            return;
+        }
+    }
+
+    //Other S2E processes may be reading the same entry
+    if (rename(tmpPath.str().c_str(), path.c_str()) < 0) {
+        unlink(tmpPath.str().c_str());
+        ++m_errors;
+        return;
+    }
+
+    ++m_stores;
+}
+
+void BitcodeCache::forget(Function *function)
+{
+    m_pending.erase(function);
+    m_loaded.erase(function);
+}
+
+void BitcodeCache::printStats(raw_ostream &os) const
+{
+    os << "Bitcode cache: " << m_hits << " hits, " << m_misses << " misses, "
+       << m_stores << " stores, " << m_rejected << " rejected (cache full), "
+       << m_errors << " errors, " << (m_currentSize >> 10) << " KB in "
+       << m_directory << '\n';
+}
+
+} // namespace s2e
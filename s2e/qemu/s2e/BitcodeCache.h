@@ -0,0 +1,123 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_BITCODECACHE_H
+#define S2E_BITCODECACHE_H
+
+#include <tcg-llvm.h>
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#include <string>
+#include <vector>
+
+namespace llvm {
+    class Module;
+    class GlobalValue;
+}
+
+namespace s2e {
+
+/**
+ *  On-disk cache of the LLVM code of translation blocks.
+ *
+ *  Each function is stored in its own bitcode file once KLEE optimized it,
+ *  so that subsequent runs of the same guest can skip both the TCG to LLVM
+ *  translation and the optimization passes. Entries are keyed on the guest
+ *  code of the blocks. The cached code refers to the helpers and to the
+ *  runtime structures by name only, so that it does not depend on where
+ *  QEMU was loaded. The directory can be shared between S2E processes:
+ *  files are written under a temporary name and atomically renamed. File
+ *  names include the optimization pipeline, so that runs with different
+ *  passes do not share entries.
+ */
+class BitcodeCache : public TCGLLVMFunctionCache
+{
+public:
+    BitcodeCache(llvm::Module *module, const std::string &directory,
+                 uint64_t maxSize, const std::string &pipeline);
+    virtual ~BitcodeCache();
+
+    virtual bool readCode(TranslationBlock *tb, std::vector<uint8_t> &code);
+    virtual llvm::Function* load(uint64_t key, const char *fcnName);
+    virtual void generated(uint64_t key, llvm::Function *function);
+
+    /** Whether the function came from the cache and is already optimized */
+    bool isCached(llvm::Function *function) const {
+        return m_loaded.count(function);
+    }
+
+    /** Writes a generated function after it has been optimized */
+    void store(llvm::Function *function);
+
+    /** Must be called before the function is deleted */
+    void forget(llvm::Function *function);
+
+    void printStats(llvm::raw_ostream &os) const;
+
+    static llvm::Function* cloneFunction(llvm::Function *function, llvm::Module *dest,
+                                         const std::string &name, bool declareMissing);
+
+private:
+    typedef std::tr1::unordered_map<llvm::Function*, uint64_t> PendingFunctions;
+    typedef std::tr1::unordered_set<llvm::Function*> LoadedFunctions;
+
+    llvm::Module *m_module;
+    std::string m_directory;
+    uint64_t m_maxSize;
+
+    /* Hash of the optimization passes applied to stored functions */
+    uint32_t m_pipeline;
+    uint64_t m_currentSize;
+
+    PendingFunctions m_pending;
+    LoadedFunctions m_loaded;
+
+    uint64_t m_hits;
+    uint64_t m_misses;
+    uint64_t m_stores;
+    uint64_t m_rejected;
+    uint64_t m_errors;
+
+    std::string getPath(uint64_t key) const;
+    void computeCurrentSize();
+};
+
+} // namespace s2e
+
+#endif // S2E_BITCODECACHE_H
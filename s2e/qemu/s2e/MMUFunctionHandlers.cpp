@@ -49,6 +49,7 @@ extern struct CPUX86State *env;
 #include <s2e/s2e_qemu.h>
 
 #include <llvm/Module.h>
+#include <llvm/Instructions.h>
 
 using namespace klee;
 
@@ -511,6 +512,65 @@ void S2EExecutor::handle_ldst_kernel(Executor* executor,
 }
 
 
+/* Stands in for __ld*_mmu / __st*_mmu in the code of translation blocks.
+   Concrete addresses of RAM pages present in both the QEMU and the S2E TLB
+   are served straight from the ObjectState cached in the S2E TLB, which
+   skips the interpretation of the helper and its tracing calls. Everything
+   else (symbolic addresses, IO, accesses straddling RAM objects, TLB misses,
+   writes to pages not owned by the state, plugins listening to memory
+   accesses) continues into the original helper. */
+void S2EExecutor::handle_s2e_tlb_probe(Executor* executor,
+                                     ExecutionState* state,
+                                     klee::KInstruction* target,
+                                     std::vector< ref<Expr> > &args)
+{
+    S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
+    llvm::Function *probe = cast<llvm::CallInst>(target->inst)->getCalledFunction();
+    bool isWrite = probe->getReturnType()->isVoidTy();
+
+    Expr::Width width = isWrite ? args[1]->getWidth() :
+                        s2eExecutor->getWidthForLLVMType(probe->getReturnType());
+    unsigned data_size = width / 8;
+    unsigned sizeIndex = data_size == 8 ? 3 : data_size >> 1;
+
+#ifdef S2E_ENABLE_S2E_TLB
+    ConstantExpr *constantAddress = dyn_cast<ConstantExpr>(args[0]);
+    if (constantAddress &&
+            s2eExecutor->m_s2e->getCorePlugin()->onDataMemoryAccess.empty()) {
+        target_ulong addr = constantAddress->getZExtValue();
+        unsigned mmu_idx = cast<ConstantExpr>(args[isWrite ? 2 : 1])->getZExtValue();
+
+        int object_index = addr >> S2E_RAM_OBJECT_BITS;
+        int index = (object_index >> S2E_RAM_OBJECT_DIFF) & (CPU_TLB_SIZE - 1);
+        target_ulong tlb_addr = isWrite ? env->tlb_table[mmu_idx][index].addr_write :
+                                          env->tlb_table[mmu_idx][index].ADDR_READ;
+
+        /* Valid RAM mapping without IO/notdirty flags, inside one object */
+        if (likely((addr & TARGET_PAGE_MASK) == tlb_addr &&
+                   ((addr & ~S2E_RAM_OBJECT_MASK) + data_size - 1) < S2E_RAM_OBJECT_SIZE)) {
+            S2ETLBEntry *e = &env->s2e_tlb_table[mmu_idx][object_index & (CPU_S2E_TLB_SIZE-1)];
+            ObjectState *os = static_cast<ObjectState*>(e->objectState);
+            unsigned offset = addr & ~S2E_RAM_OBJECT_MASK;
+
+            if (os && !isWrite) {
+                s2eExecutor->bindLocal(target, *state, os->read(offset, width));
+                return;
+            }
+
+            /* The low bit of the addend tells that the state owns the page */
+            if (os && (e->addend & 1) && !os->readOnly &&
+                    (!os->getObject()->isSharedConcrete || isa<ConstantExpr>(args[1]))) {
+                os->write(offset, args[1]);
+                return;
+            }
+        }
+    }
+#endif
+
+    s2eExecutor->executeCall(*state, target,
+                             s2eExecutor->m_s2eTlbProbeHelpers[isWrite][sizeIndex], args);
+}
+
 S2EExecutor::HandlerInfo S2EExecutor::s_handlerInfo[] = {
 #define add(name, handler) { name, \
                                   &S2EExecutor::handler }
@@ -542,6 +602,32 @@ void S2EExecutor::replaceExternalFunctionsWithSpecialHandlers()
     }
 }
 
+static const char *s_s2eTlbProbes[2][4][2] = {
+    { {"tcg_llvm_s2e_tlb_ldb", "__ldb_mmu"}, {"tcg_llvm_s2e_tlb_ldw", "__ldw_mmu"},
+      {"tcg_llvm_s2e_tlb_ldl", "__ldl_mmu"}, {"tcg_llvm_s2e_tlb_ldq", "__ldq_mmu"} },
+    { {"tcg_llvm_s2e_tlb_stb", "__stb_mmu"}, {"tcg_llvm_s2e_tlb_stw", "__stw_mmu"},
+      {"tcg_llvm_s2e_tlb_stl", "__stl_mmu"}, {"tcg_llvm_s2e_tlb_stq", "__stq_mmu"} }
+};
+
+/* Declares the probes with the signature of the helper they replace.
+   Must run before the TCG LLVM context looks up its helpers. */
+void S2EExecutor::installS2ETlbProbes()
+{
+    for (unsigned isWrite = 0; isWrite < 2; ++isWrite) {
+        for (unsigned i = 0; i < 4; ++i) {
+            Function *helper = kmodule->module->getFunction(s_s2eTlbProbes[isWrite][i][1]);
+            assert(helper && "Could not find softmmu helper");
+
+            Function *probe = dyn_cast<Function>(kmodule->module->getOrInsertFunction(
+                    s_s2eTlbProbes[isWrite][i][0], helper->getFunctionType()));
+            assert(probe);
+
+            m_s2eTlbProbeHelpers[isWrite][i] = helper;
+            addSpecialFunctionHandler(probe, handle_s2e_tlb_probe);
+        }
+    }
+}
+
 static const char *s_disabledHelpers[] = {
     "helper_load_seg" //, "helper_iret_protected"
 };
@@ -0,0 +1,241 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov (vitaly.chipounov@epfl.ch)
+ *    Volodymyr Kuznetsov (vova.kuznetsov@epfl.ch)
+ *
+ * All contributors listed in S2E-AUTHORS.
+ *
+ */
+
+extern "C" {
+#include <qemu-common.h>
+#include <cpu-all.h>
+#include <tcg.h>
+}
+
+#include "S2EExecutor.h"
+#include "S2EExecutionState.h"
+#include "S2E.h"
+#include "Utils.h"
+
+#include <klee/Interpreter.h>
+#include <klee/Internal/Module/KInstruction.h>
+#include <klee/Internal/Module/KModule.h>
+
+#include <llvm/Module.h>
+#include <llvm/Instructions.h>
+#include <llvm/Support/CallSite.h>
+#include <llvm/Support/InstIterator.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+
+using namespace klee;
+using namespace llvm;
+
+namespace s2e {
+
+/**
+ *  Native helper library.
+ *
+ *  QEMU helpers are compiled twice: natively into the emulator and to LLVM
+ *  bitcode for KLEE. The native versions access guest registers through
+ *  RR_cpu/WR_cpu, which read the symbolic register file and concretize
+ *  whatever they touch. Calling them is therefore correct whenever their
+ *  operands and the registers they read are concrete, and much cheaper than
+ *  interpreting the bitcode.
+ *
+ *  Every registered helper that has a bitcode body is intercepted. Helpers
+ *  whose declared register footprint is known and that do not access guest
+ *  memory run natively when their inputs are concrete; all others are
+ *  interpreted. The number of calls taking each path is recorded so that
+ *  the helpers most worth a native implementation show up in helpers.csv.
+ */
+
+/* Returns true if the bitcode of f may reach code that must run inside
+   KLEE, i.e., special function handlers and the TCG/LLVM runtime. */
+bool S2EExecutor::helperNeedsInterpreter(Function *f)
+{
+    std::set<Function*> visited;
+    std::vector<Function*> worklist;
+    worklist.push_back(f);
+
+    while (!worklist.empty()) {
+        Function *cur = worklist.back();
+        worklist.pop_back();
+
+        if (!visited.insert(cur).second) {
+            continue;
+        }
+
+        if (cur != f && overridenInternalFunctions.count(cur)) {
+            return true;
+        }
+
+        if (cur->isDeclaration()) {
+            if (cur->getName().startswith("tcg_llvm_")) {
+                return true;
+            }
+            continue;
+        }
+
+        for (inst_iterator it = inst_begin(cur), ie = inst_end(cur); it != ie; ++it) {
+            CallSite cs(&*it);
+            if (!cs) {
+                continue;
+            }
+
+            Function *callee = dyn_cast<Function>(cs.getCalledValue()->stripPointerCasts());
+            if (!callee) {
+                /* Indirect calls may go anywhere */
+                return true;
+            }
+
+            if (!callee->isIntrinsic()) {
+                worklist.push_back(callee);
+            }
+        }
+    }
+
+    return false;
+}
+
+void S2EExecutor::installNativeHelpers()
+{
+    Module *module = kmodule->module;
+    unsigned nativeCount = 0;
+
+    for (int i = 0; i < tcg_ctx.nb_helpers; ++i) {
+        const TCGHelperInfo &info = tcg_ctx.helpers[i];
+
+        Function *f = module->getFunction(std::string("helper_") + info.name);
+        if (!f || f->isDeclaration() || overridenInternalFunctions.count(f)) {
+            continue;
+        }
+
+        /* Handlers are looked up by the called function, make sure
+           there are no calls through pointers or casts */
+        if (f->hasAddressTaken()) {
+            continue;
+        }
+
+        NativeHelper helper;
+        helper.rmask = info.reg_rmask;
+        helper.nativeCalls = 0;
+        helper.interpretedCalls = 0;
+        helper.native = !info.accesses_mem &&
+                info.reg_rmask != (uint64_t) -1 &&
+                info.reg_wmask != (uint64_t) -1 &&
+                sys::DynamicLibrary::SearchForAddressOfSymbol(f->getName().str()) &&
+                !helperNeedsInterpreter(f);
+
+        m_nativeHelpers[f] = helper;
+        nativeCount += helper.native;
+    }
+
+    foreach2(it, m_nativeHelpers.begin(), m_nativeHelpers.end()) {
+        addSpecialFunctionHandler((*it).first, handleNativeHelper);
+        overridenInternalFunctions.insert((*it).first);
+    }
+
+    m_s2e->getDebugStream() << "Native helpers: " << nativeCount
+            << " of " << m_nativeHelpers.size() << " intercepted helpers\n";
+}
+
+void S2EExecutor::handleNativeHelper(Executor* executor,
+                                     ExecutionState* state,
+                                     KInstruction* target,
+                                     std::vector<ref<Expr> > &args)
+{
+    S2EExecutor* s2eExecutor = static_cast<S2EExecutor*>(executor);
+    S2EExecutionState* s2eState = static_cast<S2EExecutionState*>(state);
+
+    CallSite cs(target->inst);
+    Function *f = cast<Function>(cs.getCalledValue()->stripPointerCasts());
+
+    NativeHelpers::iterator it = s2eExecutor->m_nativeHelpers.find(f);
+    assert(it != s2eExecutor->m_nativeHelpers.end());
+    NativeHelper &helper = (*it).second;
+
+    bool concrete = helper.native &&
+            !(helper.rmask & s2eState->getSymbolicRegistersMask());
+
+    for (unsigned i = 0; concrete && i < args.size(); ++i) {
+        concrete = isa<ConstantExpr>(args[i]);
+    }
+
+    if (concrete) {
+        ++helper.nativeCalls;
+        s2eExecutor->executeExternalCall(*state, target, f, args);
+    } else {
+        ++helper.interpretedCalls;
+        s2eExecutor->executeInternalCall(*state, target, f, args);
+    }
+}
+
+namespace {
+typedef std::pair<Function*, S2EExecutor::NativeHelper> NativeHelperProfile;
+
+bool compareInterpretedCalls(const NativeHelperProfile &a, const NativeHelperProfile &b)
+{
+    return a.second.interpretedCalls > b.second.interpretedCalls;
+}
+}
+
+/* Dumps the per-helper invocation profile, the helpers that are most often
+   interpreted come first. */
+void S2EExecutor::writeNativeHelperProfile()
+{
+    if (m_nativeHelpers.empty()) {
+        return;
+    }
+
+    std::vector<NativeHelperProfile> profile(m_nativeHelpers.begin(), m_nativeHelpers.end());
+    std::sort(profile.begin(), profile.end(), compareInterpretedCalls);
+
+    raw_ostream *os = interpreterHandler->openOutputFile("helpers.csv");
+    if (!os) {
+        return;
+    }
+
+    *os << "Helper,Native,NativeCalls,InterpretedCalls\n";
+    foreach2(it, profile.begin(), profile.end()) {
+        const S2EExecutor::NativeHelper &helper = (*it).second;
+        *os << (*it).first->getName() << ','
+            << (helper.native ? 1 : 0) << ','
+            << helper.nativeCalls << ','
+            << helper.interpretedCalls << '\n';
+    }
+
+    delete os;
+}
+
+} // namespace s2e
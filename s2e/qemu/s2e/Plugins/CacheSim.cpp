@@ -288,8 +288,7 @@ CacheSimState::CacheSimState(S2EExecutionState *s, Plugin *p)
 
         if(m_i1) {
             s2e->getDebugStream()  << "CacheSim: connecting to onTranslateBlockStart" << '\n';
-            s2e->getCorePlugin()->onTranslateBlockStart.connect(
-             sigc::mem_fun(*csp, &CacheSim::onTranslateBlockStart));
+            csp->connectInstructionCache();
         }
     }
 
@@ -394,6 +393,14 @@ void CacheSim::initialize()
 
     m_cacheStructureWrittenToLog = false;
 
+    //Blocks outside of the modules would be dropped by profileAccess,
+    //do not instrument them in the first place.
+    m_moduleFilter = NULL;
+    if (m_execDetector && m_profileModulesOnly && !m_reportWholeSystem) {
+        m_moduleFilter = new ModuleTranslationFilter(this, m_execDetector);
+        s2e()->getCorePlugin()->registerTranslationFilter(m_moduleFilter);
+    }
+
     ////////////////////
     //XXX: trick to force the initialization of the cache upon first memory access.
     m_d1_connection = s2e()->getCorePlugin()->onDataMemoryAccess.connect(
@@ -452,6 +459,17 @@ void CacheSim::writeCacheDescriptionToLog(S2EExecutionState *state)
     m_cacheStructureWrittenToLog = true;
 }
 
+void CacheSim::connectInstructionCache()
+{
+    if (m_moduleFilter) {
+        m_moduleFilter->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &CacheSim::onTranslateBlockStart));
+    } else {
+        s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &CacheSim::onTranslateBlockStart));
+    }
+}
+
 //Connect the tracing when the first module is loaded
 void CacheSim::onModuleTranslateBlockStart(
     ExecutionSignal* signal,
@@ -470,8 +488,7 @@ void CacheSim::onModuleTranslateBlockStart(
             sigc::mem_fun(*this, &CacheSim::onDataMemoryAccess));
 
     if(plgState->m_i1)
-        s2e()->getCorePlugin()->onTranslateBlockStart.connect(
-            sigc::mem_fun(*this, &CacheSim::onTranslateBlockStart));
+        connectInstructionCache();
 
     //We connected ourselves, do not need to monitor modules anymore.
     s2e()->getDebugStream()  << "Disconnecting module translation cache sim" << '\n';
@@ -94,6 +94,12 @@ protected:
     sigc::connection m_d1_connection;
     sigc::connection m_i1_connection;
 
+    //Restricts the instruction cache instrumentation to the
+    //tracked modules when only those are profiled
+    ModuleTranslationFilter *m_moduleFilter;
+
+    void connectInstructionCache();
+
     void onModuleTranslateBlockStart(
         ExecutionSignal* signal,
         S2EExecutionState *state,
@@ -0,0 +1,356 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "ConcolicFuzzer.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+
+#include <llvm/Support/CommandLine.h>
+
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+
+extern llvm::cl::opt<bool> ConcolicMode;
+
+namespace s2e {
+namespace plugins {
+
+//Levels of the condition that identify a branch
+static const unsigned CONDITION_HASH_DEPTH = 6;
+
+S2E_DEFINE_PLUGIN(ConcolicFuzzer, "Concolic testing campaign driven by a corpus of inputs and block coverage",
+                  "ConcolicFuzzer", "CoverageBitmap", "ModuleExecutionDetector", "BaseInstructions");
+
+void ConcolicFuzzer::initialize()
+{
+    if (!ConcolicMode) {
+        s2e()->getWarningsStream() << "ConcolicFuzzer requires --use-concolic-execution\n";
+        exit(-1);
+    }
+
+    m_executor = s2e()->getExecutor();
+    m_coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    m_concolicInputs = s2e()->getConfig()->getInt(getConfigKey() + ".concolicInputs", 1);
+    m_maxRunningStates = s2e()->getConfig()->getInt(getConfigKey() + ".maxRunningStates", 4);
+
+    m_createdInputs = 0;
+    m_snapshotPending = NULL;
+    m_snapshot = NULL;
+    m_runningStates = 1;
+
+    m_runs = 0;
+    m_negations = 0;
+    m_skippedNegations = 0;
+    m_corpusSize = 0;
+
+    loadSeeds();
+
+    //BaseInstructions is connected first and creates the buffers
+    s2e()->getCorePlugin()->onCustomInstruction.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onCustomInstruction));
+
+    s2e()->getCorePlugin()->onStateSelect.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onStateSelect));
+
+    s2e()->getCorePlugin()->onStateForkDecide.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onStateForkDecide));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onStateFork));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onStateKill));
+
+    m_coverage->onNewBlock.connect(
+            sigc::mem_fun(*this, &ConcolicFuzzer::onNewBlock));
+}
+
+ConcolicFuzzer::~ConcolicFuzzer()
+{
+    s2e()->getMessagesStream() << "ConcolicFuzzer: " << m_runs << " seeds run, "
+            << m_seeds.size() << " left, " << m_negations << " branches negated, "
+            << m_skippedNegations << " skipped, " << m_corpusSize << " inputs saved\n";
+}
+
+void ConcolicFuzzer::loadSeeds()
+{
+    ConfigFile::string_list files = s2e()->getConfig()->getStringList(getConfigKey() + ".seeds");
+
+    foreach2(it, files.begin(), files.end()) {
+        std::ifstream file((*it).c_str(), std::ios::binary);
+        if (!file) {
+            s2e()->getWarningsStream() << "ConcolicFuzzer: could not read seed " << *it << '\n';
+            continue;
+        }
+
+        Input input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        m_seeds.push_back(input);
+    }
+}
+
+/** Copies the state at the instruction that follows the custom instruction */
+void ConcolicFuzzer::takeSnapshot(S2EExecutionState *state)
+{
+    m_snapshot = m_executor->copyState(state);
+    m_snapshotPending = NULL;
+
+    foreach2(it, state->symbolics.begin(), state->symbolics.end()) {
+        const klee::Array *array = (*it).second;
+        if (state->concolics.bindings.count(array)) {
+            m_inputArrays.push_back(array);
+        }
+    }
+
+    s2e()->getMessagesStream(state) << "ConcolicFuzzer: took a snapshot with "
+            << m_inputArrays.size() << " concolic buffers\n";
+}
+
+void ConcolicFuzzer::runSeed(const Input &input)
+{
+    S2EExecutionState *state = m_executor->copyState(m_snapshot);
+
+    unsigned offset = 0;
+    foreach2(it, m_inputArrays.begin(), m_inputArrays.end()) {
+        std::vector<unsigned char> &values = state->concolics.bindings[*it];
+        for (unsigned i = 0; i < values.size() && offset < input.size(); ++i) {
+            values[i] = input[offset++];
+        }
+    }
+
+    if (offset < input.size()) {
+        s2e()->getWarningsStream() << "ConcolicFuzzer: seed has " << input.size() - offset
+                << " bytes more than the concolic buffers\n";
+    }
+
+    DECLARE_PLUGINSTATE(ConcolicFuzzerState, state);
+    plgState->m_saved = false;
+
+    ++m_runs;
+    ++m_runningStates;
+    m_executor->addState(state);
+}
+
+/** Writes the concrete values of the snapshot buffers, in order */
+void ConcolicFuzzer::saveInput(S2EExecutionState *state)
+{
+    std::stringstream name;
+    name << "corpus-" << std::setw(6) << std::setfill('0') << m_corpusSize++ << ".bin";
+
+    llvm::raw_ostream *os = s2e()->openOutputFile(name.str());
+    foreach2(it, m_inputArrays.begin(), m_inputArrays.end()) {
+        klee::Assignment::bindings_ty::const_iterator bit = state->concolics.bindings.find(*it);
+        for (unsigned i = 0; i < (*it)->size; ++i) {
+            *os << (char) (bit != state->concolics.bindings.end() ? (*bit).second[i] : 0);
+        }
+    }
+    delete os;
+}
+
+void ConcolicFuzzer::onCustomInstruction(S2EExecutionState *state, uint64_t opcode)
+{
+    //s2e_make_concolic
+    if (((opcode >> 8) & 0xFF) != 0x11 || m_snapshot || m_snapshotPending) {
+        return;
+    }
+
+    if (++m_createdInputs < m_concolicInputs) {
+        return;
+    }
+
+    //States can only be copied outside of the cpu loop
+    m_snapshotPending = state;
+    state->writeCpuState(CPU_OFFSET(eip), state->getPc() + 10, 32);
+    m_executor->scheduleStateSwitch();
+
+    state->writeCpuState(CPU_OFFSET(exception_index), EXCP_S2E, 8*sizeof(int));
+    throw CpuExitException();
+}
+
+void ConcolicFuzzer::onStateSelect(S2EExecutionState *state)
+{
+    if (state == m_snapshotPending && !state->isZombie()) {
+        takeSnapshot(state);
+    }
+
+    if (!m_snapshot) {
+        return;
+    }
+
+    while (!m_seeds.empty() && m_runningStates < m_maxRunningStates) {
+        runSeed(m_seeds.front());
+        m_seeds.pop_front();
+    }
+}
+
+/**
+ *  Hashes the operators and constants of the top of the condition, but not
+ *  the arrays it reads. This tells apart the conditions that one guest
+ *  instruction branches on, e.g., the flags of a comparison, and stays the
+ *  same across states, processes and runs.
+ */
+static uint64_t hashCondition(const klee::ref<klee::Expr> &e, unsigned depth)
+{
+    uint64_t h = (e->getKind() * 1099511628211ULL) ^ e->getWidth();
+
+    if (klee::ConstantExpr *ce = llvm::dyn_cast<klee::ConstantExpr>(e)) {
+        if (ce->getWidth() <= 64) {
+            h = (h * 1099511628211ULL) ^ ce->getZExtValue();
+        }
+        return h;
+    }
+
+    if (depth) {
+        for (unsigned i = 0; i < e->getNumKids(); ++i) {
+            h = (h * 1099511628211ULL) ^ hashCondition(e->getKid(i), depth - 1);
+        }
+    }
+    return h;
+}
+
+/**
+ *  Lets the state fork, i.e., negate the branch, only if no state took
+ *  or negated the other direction before. Negated directions count as
+ *  covered right away, so that other states do not negate them again.
+ */
+void ConcolicFuzzer::onStateForkDecide(S2EExecutionState *state,
+                                       const klee::ref<klee::Expr> &condition, bool *allow)
+{
+    if (!*allow || llvm::isa<klee::ConstantExpr>(condition) ||
+        condition->getWidth() != klee::Expr::Bool) {
+        return;
+    }
+
+    klee::ref<klee::Expr> value = state->concolics.evaluate(condition);
+    klee::ConstantExpr *ce = llvm::dyn_cast<klee::ConstantExpr>(value);
+    if (!ce) {
+        //Some values are missing, the executor solves for them
+        return;
+    }
+
+    std::string module;
+    uint64_t pc = state->getPc();
+    const ModuleDescriptor *md = m_detector->getModule(state, pc, false);
+    if (md) {
+        module = md->Name;
+        pc = md->ToRelative(pc);
+    }
+
+    bool taken = ce->isTrue();
+    uint64_t discriminator = hashCondition(condition, CONDITION_HASH_DEPTH);
+    m_coverage->testAndSetBranch(module, pc, discriminator, taken);
+
+    if (m_coverage->testAndSetBranch(module, pc, discriminator, !taken)) {
+        ++m_skippedNegations;
+        *allow = false;
+        return;
+    }
+
+    ++m_negations;
+}
+
+void ConcolicFuzzer::onStateFork(S2EExecutionState *state,
+                                 const std::vector<S2EExecutionState*> &newStates,
+                                 const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    m_runningStates += newStates.size() - 1;
+
+    //The other states get new inputs when the executor resolves them
+    foreach2(it, newStates.begin(), newStates.end()) {
+        if (*it != state) {
+            DECLARE_PLUGINSTATE(ConcolicFuzzerState, *it);
+            plgState->m_saved = false;
+        }
+    }
+}
+
+void ConcolicFuzzer::onStateKill(S2EExecutionState *state)
+{
+    if (m_runningStates) {
+        --m_runningStates;
+    }
+
+    if (state == m_snapshotPending) {
+        m_snapshotPending = NULL;
+    }
+}
+
+void ConcolicFuzzer::onNewBlock(S2EExecutionState *state,
+                                const std::string &module, uint64_t relativePc)
+{
+    if (!m_snapshot || state->isSpeculative()) {
+        return;
+    }
+
+    DECLARE_PLUGINSTATE(ConcolicFuzzerState, state);
+    if (!plgState->m_saved) {
+        saveInput(state);
+        plgState->m_saved = true;
+    }
+}
+
+ConcolicFuzzerState::ConcolicFuzzerState()
+{
+    m_saved = false;
+}
+
+ConcolicFuzzerState::~ConcolicFuzzerState()
+{
+
+}
+
+ConcolicFuzzerState* ConcolicFuzzerState::clone() const
+{
+    return new ConcolicFuzzerState(*this);
+}
+
+PluginState *ConcolicFuzzerState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new ConcolicFuzzerState();
+}
+
+} // namespace plugins
+} // namespace s2e
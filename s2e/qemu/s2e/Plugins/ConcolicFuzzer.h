@@ -0,0 +1,142 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_CONCOLICFUZZER_H
+#define S2E_PLUGINS_CONCOLICFUZZER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/CoverageBitmap.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/S2EExecutor.h>
+
+#include <klee/util/Assignment.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Drives a concolic testing campaign from a corpus of concrete inputs.
+ *
+ *  States follow the branch directions chosen by their concrete inputs.
+ *  A state forks, which makes the executor solve for an input taking the
+ *  other direction, only if no state of any process took or negated that
+ *  direction before, according to CoverageBitmap. Each input that covers
+ *  a new block is written to the output directory.
+ *
+ *  After the guest created concolicInputs concolic buffers, the state is
+ *  copied. The seed files are run from that copy, with their bytes
+ *  replacing the concrete values of these buffers, in order.
+ */
+class ConcolicFuzzer : public Plugin
+{
+    S2E_PLUGIN
+public:
+    ConcolicFuzzer(S2E* s2e): Plugin(s2e) {}
+    virtual ~ConcolicFuzzer();
+
+    void initialize();
+
+private:
+    typedef std::vector<unsigned char> Input;
+
+    S2EExecutor *m_executor;
+    CoverageBitmap *m_coverage;
+    ModuleExecutionDetector *m_detector;
+
+    unsigned m_concolicInputs;
+    unsigned m_maxRunningStates;
+
+    unsigned m_createdInputs;
+    S2EExecutionState *m_snapshotPending;
+    S2EExecutionState *m_snapshot;
+
+    /* Concolic buffers that exist in the snapshot, in creation order */
+    std::vector<const klee::Array*> m_inputArrays;
+
+    std::deque<Input> m_seeds;
+    unsigned m_runningStates;
+
+    uint64_t m_runs;
+    uint64_t m_negations;
+    uint64_t m_skippedNegations;
+    unsigned m_corpusSize;
+
+    void loadSeeds();
+    void takeSnapshot(S2EExecutionState *state);
+    void runSeed(const Input &input);
+    void saveInput(S2EExecutionState *state);
+
+    void onCustomInstruction(S2EExecutionState *state, uint64_t opcode);
+    void onStateSelect(S2EExecutionState *state);
+
+    void onStateForkDecide(S2EExecutionState *state,
+                           const klee::ref<klee::Expr> &condition, bool *allow);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onStateKill(S2EExecutionState *state);
+
+    void onNewBlock(S2EExecutionState *state,
+                    const std::string &module, uint64_t relativePc);
+};
+
+class ConcolicFuzzerState : public PluginState
+{
+private:
+    /* Whether the current input of the state was written to the corpus */
+    bool m_saved;
+
+public:
+    ConcolicFuzzerState();
+    virtual ~ConcolicFuzzerState();
+    virtual ConcolicFuzzerState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class ConcolicFuzzer;
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
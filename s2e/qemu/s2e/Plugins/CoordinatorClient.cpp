@@ -0,0 +1,466 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "CoordinatorClient.h"
+#include <s2e/Plugins/CoverageBitmap.h>
+#include <s2e/Plugins/PathReplay.h>
+#include <s2e/Plugins/StateManager.h>
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/TimeValue.h>
+
+#include <sstream>
+
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(CoordinatorClient, "Shares paths, coverage and state ids with S2E processes on other hosts",
+                  "CoordinatorClient", "PathReplay");
+
+void CoordinatorClient::initialize()
+{
+    m_executor = s2e()->getExecutor();
+    m_pathReplay = static_cast<PathReplay*>(s2e()->getPlugin("PathReplay"));
+    m_coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
+    m_stateManager = static_cast<StateManager*>(s2e()->getPlugin("StateManager"));
+
+    ConfigFile *cfg = s2e()->getConfig();
+    m_host = cfg->getString(getConfigKey() + ".host", "127.0.0.1");
+    m_port = cfg->getInt(getConfigKey() + ".port", 7557);
+    m_syncInterval = cfg->getInt(getConfigKey() + ".syncInterval", 5);
+    m_exportThreshold = cfg->getInt(getConfigKey() + ".exportThreshold", 100);
+    m_importThreshold = cfg->getInt(getConfigKey() + ".importThreshold", 10);
+    m_batchSize = cfg->getInt(getConfigKey() + ".batchSize", 10);
+
+    m_socket = -1;
+    m_nodeId = -1;
+    m_lastSyncTime = 0;
+    m_bitmapVersion = 0;
+    m_killEpoch = 0;
+    m_exportedPaths = 0;
+    m_importedPaths = 0;
+
+    if (m_coverage) {
+        m_syncedBitmap.resize(m_coverage->getBitmap()->wordCount(), 0);
+    }
+
+    if (!connect() || !join()) {
+        exit(-1);
+    }
+
+    //Paths from other hosts replay from the initial state
+    m_pathReplay->scheduleRootCheckpoint();
+
+    //Only the first host explores from the initial state,
+    //the others wait until there are paths to replay
+    while (m_nodeId > 0 && !importPaths()) {
+        s2e()->getMessagesStream() << "CoordinatorClient: waiting for paths to replay\n";
+        if (m_socket < 0) {
+            exit(-1);
+        }
+        sleep(m_syncInterval);
+    }
+
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &CoordinatorClient::onTimer));
+
+    s2e()->getCorePlugin()->onProcessForkComplete.connect(
+            sigc::mem_fun(*this, &CoordinatorClient::onProcessForkComplete));
+
+    if (m_stateManager) {
+        m_stateManager->onKillAll.connect(
+                sigc::mem_fun(*this, &CoordinatorClient::onKillAll));
+    }
+}
+
+CoordinatorClient::~CoordinatorClient()
+{
+    disconnect();
+
+    s2e()->getMessagesStream() << "CoordinatorClient: " << m_exportedPaths << " paths exported, "
+            << m_importedPaths << " imported\n";
+}
+
+bool CoordinatorClient::connect()
+{
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::stringstream port;
+    port << m_port;
+
+    int error = getaddrinfo(m_host.c_str(), port.str().c_str(), &hints, &addresses);
+    if (error) {
+        s2e()->getWarningsStream() << "CoordinatorClient: could not resolve " << m_host
+                << ": " << gai_strerror(error) << "\n";
+        return false;
+    }
+
+    for (struct addrinfo *it = addresses; it; it = it->ai_next) {
+        int fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+
+        if (::connect(fd, it->ai_addr, it->ai_addrlen) == 0) {
+            m_socket = fd;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(addresses);
+
+    if (m_socket < 0) {
+        s2e()->getWarningsStream() << "CoordinatorClient: could not connect to "
+                << m_host << ":" << m_port << "\n";
+        return false;
+    }
+
+    //Do not hang the guest if the coordinator stops answering
+    struct timeval timeout = {30, 0};
+    setsockopt(m_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    m_buffer.clear();
+    return true;
+}
+
+void CoordinatorClient::disconnect()
+{
+    if (m_socket >= 0) {
+        close(m_socket);
+        m_socket = -1;
+    }
+}
+
+/** Sends one line and waits for the one line reply */
+bool CoordinatorClient::request(const std::string &message, std::string &reply)
+{
+    if (m_socket < 0) {
+        return false;
+    }
+
+    std::string line = message + "\n";
+    const char *data = line.data();
+    size_t left = line.size();
+    bool ok = true;
+
+    while (ok && left) {
+        ssize_t sent = send(m_socket, data, left, 0);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = sent > 0;
+        if (ok) {
+            data += sent;
+            left -= sent;
+        }
+    }
+
+    size_t end;
+    while (ok && (end = m_buffer.find('\n')) == std::string::npos) {
+        char buffer[4096];
+        ssize_t received = recv(m_socket, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        ok = received > 0;
+        if (ok) {
+            m_buffer.append(buffer, received);
+        }
+    }
+
+    if (!ok) {
+        s2e()->getWarningsStream() << "CoordinatorClient: lost the connection to the coordinator\n";
+        disconnect();
+        return false;
+    }
+
+    reply = m_buffer.substr(0, end);
+    m_buffer.erase(0, end + 1);
+
+    if (reply.compare(0, 5, "ERROR") == 0) {
+        s2e()->getWarningsStream() << "CoordinatorClient: " << reply << "\n";
+        return false;
+    }
+    return true;
+}
+
+/** HELLO <node id or -> <bitmap words>
+    WELCOME <node id> <first state id> <kill epoch> */
+bool CoordinatorClient::join()
+{
+    std::stringstream message;
+    message << "HELLO ";
+    if (m_nodeId < 0) {
+        message << "-";
+    } else {
+        message << m_nodeId;
+    }
+    message << " " << m_syncedBitmap.size();
+
+    std::string reply;
+    if (!request(message.str(), reply)) {
+        disconnect();
+        return false;
+    }
+
+    std::istringstream is(reply);
+    std::string op;
+    int nodeId;
+    unsigned firstStateId;
+    uint64_t killEpoch;
+
+    if (!(is >> op >> nodeId >> firstStateId >> killEpoch) || op != "WELCOME") {
+        s2e()->getWarningsStream() << "CoordinatorClient: unexpected reply " << reply << "\n";
+        disconnect();
+        return false;
+    }
+
+    //Processes forked on this host share the range of the first one
+    if (m_nodeId < 0) {
+        m_nodeId = nodeId;
+        m_killEpoch = killEpoch;
+        s2e()->setNextStateId(firstStateId);
+
+        s2e()->getMessagesStream() << "CoordinatorClient: joined as node " << m_nodeId
+                << ", state ids start at " << firstStateId << "\n";
+    }
+
+    return true;
+}
+
+/**
+ *  SYNC <bitmap version> <successful states> <index>:<word>...
+ *  SYNC <bitmap version> <remote successful states> <kill epoch> <index>:<word>...
+ *
+ *  Sends the words of the coverage bitmap that changed since the last
+ *  synchronization and merges the words other hosts changed since then.
+ */
+void CoordinatorClient::synchronize()
+{
+    std::vector<std::pair<uint64_t, uint64_t> > changes;
+    std::string message;
+    llvm::raw_string_ostream os(message);
+
+    uint64_t successCount = m_stateManager ? m_stateManager->getSuccessfulStateCount() : 0;
+    os << "SYNC " << m_bitmapVersion << " " << successCount;
+
+    if (m_coverage) {
+        const uint64_t *words = m_coverage->getBitmap()->data();
+        for (uint64_t i = 0; i < m_syncedBitmap.size(); ++i) {
+            uint64_t word = words[i];
+            if (word != m_syncedBitmap[i]) {
+                changes.push_back(std::make_pair(i, word));
+                os << " " << i << ":";
+                os.write_hex(word);
+            }
+        }
+    }
+    os.flush();
+
+    std::string reply;
+    if (!request(message, reply)) {
+        return;
+    }
+
+    foreach2(it, changes.begin(), changes.end()) {
+        m_syncedBitmap[(*it).first] = (*it).second;
+    }
+
+    std::istringstream is(reply);
+    std::string op, token;
+    uint64_t version, remoteSuccessCount, killEpoch;
+
+    if (!(is >> op >> version >> remoteSuccessCount >> killEpoch) || op != "SYNC") {
+        s2e()->getWarningsStream() << "CoordinatorClient: unexpected reply " << reply << "\n";
+        return;
+    }
+
+    while (is >> token) {
+        char *end;
+        uint64_t index = strtoull(token.c_str(), &end, 10);
+        if (*end != ':' || index >= m_syncedBitmap.size()) {
+            continue;
+        }
+
+        uint64_t word = strtoull(end + 1, &end, 16);
+        m_coverage->getBitmap()->mergeWord(index, word);
+        m_syncedBitmap[index] |= word;
+    }
+    m_bitmapVersion = version;
+
+    if (m_stateManager) {
+        m_stateManager->setRemoteSuccessfulStateCount(remoteSuccessCount);
+    }
+
+    if (killEpoch > m_killEpoch) {
+        m_killEpoch = killEpoch;
+        s2e()->getMessagesStream() << "CoordinatorClient: another host kept a successful state, "
+                << "killing all states\n";
+        if (m_stateManager) {
+            m_stateManager->queueKillAll();
+        }
+    }
+}
+
+/** PUSH <path> */
+void CoordinatorClient::exportPaths()
+{
+    PathReplay::ForkDecisions path;
+    PathReplay::Inputs inputs;
+
+    for (unsigned i = 0; i < m_batchSize; ++i) {
+        if (m_pathReplay->getFrontierSize() <= m_exportThreshold ||
+            !m_pathReplay->exportPath(path, inputs)) {
+            break;
+        }
+
+        std::string message, reply;
+        llvm::raw_string_ostream os(message);
+        os << "PUSH ";
+        PathReplay::writePath(os, m_exportedPaths, path, inputs);
+        os.flush();
+
+        if (!request(message, reply)) {
+            //Keep exploring the path locally
+            m_pathReplay->importPath(path, inputs);
+            break;
+        }
+        ++m_exportedPaths;
+    }
+}
+
+/** PULL
+    PATH <path> or NONE */
+unsigned CoordinatorClient::importPaths()
+{
+    if (m_pathReplay->getFrontierSize() || m_executor->getStatesCount() >= m_importThreshold) {
+        return 0;
+    }
+
+    unsigned count = 0;
+    while (count < m_batchSize) {
+        std::string reply;
+        if (!request("PULL", reply) || reply == "NONE") {
+            break;
+        }
+
+        std::istringstream is(reply);
+        std::string op;
+        uint64_t pathId;
+        PathReplay::ForkDecisions path;
+        PathReplay::Inputs inputs;
+
+        if (!(is >> op) || op != "PATH" || !PathReplay::parsePath(is, pathId, path, inputs)) {
+            s2e()->getWarningsStream() << "CoordinatorClient: malformed path " << reply << "\n";
+            continue;
+        }
+
+        m_pathReplay->importPath(path, inputs);
+        ++m_importedPaths;
+        ++count;
+    }
+
+    return count;
+}
+
+void CoordinatorClient::onTimer()
+{
+    uint64_t now = llvm::sys::TimeValue::now().toEpochTime();
+    if (now - m_lastSyncTime < m_syncInterval) {
+        return;
+    }
+    m_lastSyncTime = now;
+
+    //Try again later if the coordinator went away
+    if (m_socket < 0 && (!connect() || !join())) {
+        return;
+    }
+
+    synchronize();
+    exportPaths();
+    importPaths();
+}
+
+/** KILL
+    OK <kill epoch> */
+void CoordinatorClient::onKillAll()
+{
+    std::string reply;
+    if (!request("KILL", reply)) {
+        return;
+    }
+
+    std::istringstream is(reply);
+    std::string op;
+    uint64_t killEpoch;
+    if (is >> op >> killEpoch && op == "OK") {
+        //Our own request must not kill our successful state
+        m_killEpoch = killEpoch;
+    }
+}
+
+/** The child must not share the connection of its parent */
+void CoordinatorClient::onProcessForkComplete(bool isChild)
+{
+    if (!isChild) {
+        return;
+    }
+
+    disconnect();
+    if (connect()) {
+        join();
+    }
+}
+
+} // namespace plugins
+} // namespace s2e
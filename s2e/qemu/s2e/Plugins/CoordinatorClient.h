@@ -0,0 +1,125 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_COORDINATORCLIENT_H
+#define S2E_PLUGINS_COORDINATORCLIENT_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/S2EExecutor.h>
+
+#include <string>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+class PathReplay;
+class CoverageBitmap;
+class StateManager;
+
+/**
+ *  Connects the S2E processes of this host to a coordinator, so that one
+ *  campaign can span several hosts started from the same snapshot.
+ *
+ *  The coordinator hands out a range of state ids to each host. Every
+ *  syncInterval seconds, each process exchanges the words of the coverage
+ *  bitmap that changed with the coordinator, pushes evicted paths when it
+ *  has too many of them and pulls paths when it runs out of states.
+ *  Paths are the fork decisions and concolic values recorded by
+ *  PathReplay, which recreates them from the initial state. Successful
+ *  state counts and StateManager kill decisions are forwarded to the
+ *  other hosts.
+ */
+class CoordinatorClient : public Plugin
+{
+    S2E_PLUGIN
+public:
+    CoordinatorClient(S2E* s2e): Plugin(s2e) {}
+    virtual ~CoordinatorClient();
+
+    void initialize();
+
+private:
+    S2EExecutor *m_executor;
+    PathReplay *m_pathReplay;
+    CoverageBitmap *m_coverage;
+    StateManager *m_stateManager;
+
+    std::string m_host;
+    unsigned m_port;
+    int m_socket;
+    /* Received bytes that follow the last reply */
+    std::string m_buffer;
+
+    /* Hosts that join later only replay paths of others */
+    int m_nodeId;
+
+    unsigned m_syncInterval;
+    uint64_t m_lastSyncTime;
+    unsigned m_exportThreshold;
+    unsigned m_importThreshold;
+    unsigned m_batchSize;
+
+    /* Coverage bitmap as of the last synchronization */
+    std::vector<uint64_t> m_syncedBitmap;
+    uint64_t m_bitmapVersion;
+
+    /* Last kill request known to this process */
+    uint64_t m_killEpoch;
+
+    uint64_t m_exportedPaths;
+    uint64_t m_importedPaths;
+
+    bool connect();
+    void disconnect();
+    bool request(const std::string &message, std::string &reply);
+
+    bool join();
+    void synchronize();
+    void exportPaths();
+    unsigned importPaths();
+
+    void onTimer();
+    void onKillAll();
+    void onProcessForkComplete(bool isChild);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
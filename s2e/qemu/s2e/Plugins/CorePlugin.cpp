@@ -54,7 +54,9 @@ extern struct CPUX86State *env;
 #include <s2e/s2e_qemu.h>
 #include <s2e/s2e_config.h>
 #include <s2e/S2ESJLJ.h>
+#include <s2e/S2EStatsTracker.h>
 
+#include <algorithm>
 
 using namespace std;
 
@@ -90,11 +92,99 @@ void CorePlugin::initializeTimers()
     qemu_mod_timer(m_Timer, qemu_get_clock_ms(rt_clock) + 1000);
 }
 
+CorePlugin::~CorePlugin()
+{
+    if (!m_translationFilters.empty()) {
+        printTranslationFilterStats(s2e()->getMessagesStream());
+    }
+
+    foreach2(it, m_translationFilters.begin(), m_translationFilters.end()) {
+        delete *it;
+    }
+}
+
 void CorePlugin::initialize()
 {
 
 }
 
+/******************************/
+/* Translation filters        */
+
+TranslationFilter::TranslationFilter(Plugin *owner)
+{
+    m_owner = owner;
+    m_pid = 0;
+    m_anyPid = true;
+    m_instructionClasses = INSN_ALL;
+    m_matchedBlocks = 0;
+    m_skippedBlocks = 0;
+    m_instrumentationCalls = 0;
+}
+
+void TranslationFilter::addRange(uint64_t start, uint64_t end)
+{
+    assert(start < end);
+    m_ranges.push_back(AddressRange(start, end));
+}
+
+bool TranslationFilter::containsAddress(uint64_t pc) const
+{
+    if (m_ranges.empty()) {
+        return true;
+    }
+
+    foreach2(it, m_ranges.begin(), m_ranges.end()) {
+        if (pc >= (*it).first && pc < (*it).second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TranslationFilter::matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc)
+{
+    if (!m_anyPid && state->getPid() != m_pid) {
+        return false;
+    }
+
+    return containsAddress(pc);
+}
+
+void CorePlugin::registerTranslationFilter(TranslationFilter *filter)
+{
+    assert(filter);
+    m_translationFilters.push_back(filter);
+}
+
+void CorePlugin::selectTranslationFilters(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc)
+{
+    m_activeFilters.clear();
+
+    foreach2(it, m_translationFilters.begin(), m_translationFilters.end()) {
+        TranslationFilter *f = *it;
+        if (f->matchesBlock(state, tb, pc)) {
+            ++f->m_matchedBlocks;
+            m_activeFilters.push_back(f);
+        } else {
+            ++f->m_skippedBlocks;
+        }
+    }
+}
+
+void CorePlugin::printTranslationFilterStats(llvm::raw_ostream &os) const
+{
+    os << "Instrumentation calls generated: " << m_instrumentationCalls << '\n';
+
+    foreach2(it, m_translationFilters.begin(), m_translationFilters.end()) {
+        const TranslationFilter *f = *it;
+        os << "  " << f->getOwner()->getPluginInfo()->name <<
+              ": matched blocks=" << f->getMatchedBlocks() <<
+              " skipped blocks=" << f->getSkippedBlocks() <<
+              " instrumentation calls=" << f->getInstrumentationCalls() << '\n';
+    }
+}
+
 /******************************/
 /* Functions called from QEMU */
 
@@ -112,6 +202,21 @@ void s2e_tcg_execution_handler(void* signal, uint64_t pc)
     }
 }
 
+void s2e_tcg_indexed_execution_handler(uint64_t tb, uint64_t index, uint64_t pc)
+{
+    TranslationBlock *t = (TranslationBlock*) tb;
+    assert(index < t->s2e_tb->executionSignals.size());
+    s2e_tcg_execution_handler(t->s2e_tb->executionSignals[index], pc);
+}
+
+int s2e_get_execution_signal_index(TranslationBlock *tb, void *signal)
+{
+    const std::vector<void*> &signals = tb->s2e_tb->executionSignals;
+    std::vector<void*>::const_iterator it =
+            std::find(signals.begin(), signals.end(), signal);
+    return it == signals.end() ? -1 : (int) (it - signals.begin());
+}
+
 /*[fwl] 在s2e_qemu.h中声明
  *   发送onCustomInstruction信号，检测到s2e custom op时发送
  */
@@ -145,8 +250,10 @@ void s2e_tcg_emit_custom_instruction(S2E*, uint64_t arg)
 /* Next pc, when != -1, indicates with which value to update the program counter
    before calling the annotation. This is useful when instrumenting instructions
    that do not explicitely update the program counter by themselves. */
-static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc, uint64_t nextpc=-1)
+static void s2e_tcg_instrument_code(S2E* s2e, ExecutionSignal* signal, uint64_t pc, uint64_t nextpc=-1)
 {
+    s2e->getCorePlugin()->recordInstrumentationCall();
+
     TCGv_ptr t0 = tcg_temp_new_ptr();
     TCGv_i64 t1 = tcg_temp_new_i64();
 
@@ -180,6 +287,24 @@ static void s2e_tcg_instrument_code(S2E*, ExecutionSignal* signal, uint64_t pc,
     tcg_temp_free_ptr(t0);
 }
 
+/**
+ * Emits the translation signal of every filter that matched the current
+ * block. A filter that connected something to the execution signal
+ * causes an instrumentation call to be generated, which is accounted for here.
+ */
+#define EMIT_FILTERED_SIGNAL(s2e, sig, signal, ...) \
+    do { \
+        const std::vector<TranslationFilter*> &_filters = \
+            (s2e)->getCorePlugin()->getActiveTranslationFilters(); \
+        foreach2(_it, _filters.begin(), _filters.end()) { \
+            unsigned _size = (signal)->size(); \
+            (*_it)->sig.emit(signal, __VA_ARGS__); \
+            if ((signal)->size() != _size) { \
+                (*_it)->recordInstrumentationCall(); \
+            } \
+        } \
+    } while (0)
+
 /*[fwl] 在s2e_qemu.h中声明
  *   发送onTranslateBlockStart信号，被cpu_gen_code()在翻译进程开始时调用
  */
@@ -194,8 +319,12 @@ void s2e_on_translate_block_start(
                                     tb->s2e_tb->executionSignals.back());
     assert(signal->empty());
 
+    ++klee::stats::translatedBlocks;
+
     try {
+        s2e->getCorePlugin()->selectTranslationFilters(state, tb, pc);
         s2e->getCorePlugin()->onTranslateBlockStart.emit(signal, state, tb, pc);
+        EMIT_FILTERED_SIGNAL(s2e, onTranslateBlockStart, signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
             tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
@@ -225,6 +354,8 @@ void s2e_on_translate_block_end(
         s2e->getCorePlugin()->onTranslateBlockEnd.emit(
                 signal, state, tb, insPc,
                 staticTarget, targetPc);
+        EMIT_FILTERED_SIGNAL(s2e, onTranslateBlockEnd, signal, state, tb, insPc,
+                             staticTarget, targetPc);
     } catch(s2e::CpuExitException&) {
         s2e_longjmp(env->jmp_env, 1);
     }
@@ -251,6 +382,7 @@ void s2e_on_translate_instruction_start(
 
     try {
         s2e->getCorePlugin()->onTranslateInstructionStart.emit(signal, state, tb, pc);
+        EMIT_FILTERED_SIGNAL(s2e, onTranslateInstructionStart, signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
             tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
@@ -277,6 +409,7 @@ void s2e_on_translate_jump_start(
     try {
         s2e->getCorePlugin()->onTranslateJumpStart.emit(signal, state, tb,
                                                         pc, jump_type);
+        EMIT_FILTERED_SIGNAL(s2e, onTranslateJumpStart, signal, state, tb, pc, jump_type);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc);
             tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
@@ -305,6 +438,7 @@ void s2e_on_translate_instruction_end(
 
     try {
         s2e->getCorePlugin()->onTranslateInstructionEnd.emit(signal, state, tb, pc);
+        EMIT_FILTERED_SIGNAL(s2e, onTranslateInstructionEnd, signal, state, tb, pc);
         if(!signal->empty()) {
             s2e_tcg_instrument_code(s2e, signal, pc, nextpc);
             tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
@@ -333,6 +467,23 @@ void s2e_on_translate_register_access(
         g_s2e->getCorePlugin()->onTranslateRegisterAccessEnd.emit(signal,
                   g_s2e_state, tb, pc, readMask, writeMask, (bool)isMemoryAccess);
 
+        unsigned insnClass = isMemoryAccess ? TranslationFilter::INSN_MEMORY :
+                                              TranslationFilter::INSN_NO_MEMORY;
+
+        const std::vector<TranslationFilter*> &filters =
+                g_s2e->getCorePlugin()->getActiveTranslationFilters();
+        foreach2(it, filters.begin(), filters.end()) {
+            if (!((*it)->getInstructionClasses() & insnClass)) {
+                continue;
+            }
+            unsigned size = signal->size();
+            (*it)->onTranslateRegisterAccessEnd.emit(signal,
+                  g_s2e_state, tb, pc, readMask, writeMask, (bool)isMemoryAccess);
+            if (signal->size() != size) {
+                (*it)->recordInstrumentationCall();
+            }
+        }
+
         if(!signal->empty()) {
             s2e_tcg_instrument_code(g_s2e, signal, pc);
             tb->s2e_tb->executionSignals.push_back(new ExecutionSignal);
@@ -76,6 +76,112 @@ typedef sigc::signal<void, S2EExecutionState*, uint64_t /* pc */> ExecutionSigna
 typedef bool (*SYMB_PORT_CHECK)(uint16_t port, void *opaque);
 typedef bool (*SYMB_MMIO_CHECK)(uint64_t physaddress, uint64_t size, void *opaque);
 
+/**
+ *  Translation-time instrumentation filter.
+ *
+ *  Plugins that only care about part of the guest code register a filter
+ *  with CorePlugin and connect to the signals of the filter instead of the
+ *  global onTranslate* signals. The filter is evaluated once at the start
+ *  of each translation block. Its per-instruction signals are emitted
+ *  only for blocks that match, and only for the instruction classes the
+ *  filter subscribed to, so that instrumentation calls are generated only
+ *  for code some plugin actually watches.
+ *
+ *  Subclasses may override matchesBlock() to add their own criteria
+ *  (e.g., ModuleTranslationFilter restricts the filter to a set of modules).
+ */
+class TranslationFilter
+{
+public:
+    enum InstructionClass {
+        INSN_MEMORY = 1,        /* Instructions that access memory */
+        INSN_NO_MEMORY = 2,     /* Instructions that do not access memory */
+        INSN_ALL = INSN_MEMORY | INSN_NO_MEMORY
+    };
+
+private:
+    typedef std::pair<uint64_t, uint64_t> AddressRange;
+    typedef std::vector<AddressRange> AddressRanges;
+
+    Plugin *m_owner;
+    AddressRanges m_ranges;
+    uint64_t m_pid;
+    bool m_anyPid;
+    unsigned m_instructionClasses;
+
+    /* Statistics */
+    uint64_t m_matchedBlocks;
+    uint64_t m_skippedBlocks;
+    uint64_t m_instrumentationCalls;
+
+    friend class CorePlugin;
+
+public:
+    TranslationFilter(Plugin *owner);
+    virtual ~TranslationFilter() {}
+
+    Plugin *getOwner() const { return m_owner; }
+
+    /** Restrict the filter to [start, end). Without ranges, all addresses match. */
+    void addRange(uint64_t start, uint64_t end);
+    void clearRanges() { m_ranges.clear(); }
+
+    /** Restrict the filter to the given address space (page directory) */
+    void setPid(uint64_t pid) { m_pid = pid; m_anyPid = false; }
+    void clearPid() { m_anyPid = true; }
+
+    /** Mask of InstructionClass values for onTranslateRegisterAccessEnd */
+    void setInstructionClasses(unsigned classes) { m_instructionClasses = classes; }
+    unsigned getInstructionClasses() const { return m_instructionClasses; }
+
+    bool containsAddress(uint64_t pc) const;
+
+    virtual bool matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc);
+
+    uint64_t getMatchedBlocks() const { return m_matchedBlocks; }
+    uint64_t getSkippedBlocks() const { return m_skippedBlocks; }
+    uint64_t getInstrumentationCalls() const { return m_instrumentationCalls; }
+    void recordInstrumentationCall() { ++m_instrumentationCalls; }
+
+    /** Same as the corresponding CorePlugin signals, restricted to the filter */
+    sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* block PC */>
+            onTranslateBlockStart;
+
+    sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* ending instruction pc */,
+            bool /* static target is valid */,
+            uint64_t /* static target pc */>
+            onTranslateBlockEnd;
+
+    sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* instruction PC */>
+            onTranslateInstructionStart, onTranslateInstructionEnd;
+
+    sigc::signal<void, ExecutionSignal*,
+            S2EExecutionState*,
+            TranslationBlock*,
+            uint64_t /* instruction PC */,
+            int /* jump_type */>
+            onTranslateJumpStart;
+
+    sigc::signal<void,
+                 ExecutionSignal*,
+                 S2EExecutionState* /* current state */,
+                 TranslationBlock*,
+                 uint64_t /* program counter of the instruction */,
+                 uint64_t /* registers read by the instruction */,
+                 uint64_t /* registers written by the instruction */,
+                 bool /* instruction accesses memory */>
+          onTranslateRegisterAccessEnd;
+};
+
 /*[fwl] CorePlugin类，核心信号类
  *   必定会加载的Plugin。
  *   其中包含一系列signals，用于在检测到指令时发出signal。
@@ -91,6 +197,15 @@ private:
     void *m_isPortSymbolicOpaque;
     void *m_isMmioSymbolicOpaque;
 
+    typedef std::vector<TranslationFilter*> TranslationFilters;
+    TranslationFilters m_translationFilters;
+
+    /* Filters that matched the block being translated */
+    TranslationFilters m_activeFilters;
+
+    /* Number of instrumentation calls generated in translated code */
+    uint64_t m_instrumentationCalls;
+
 public:
     CorePlugin(S2E* s2e): Plugin(s2e) {
         m_Timer = NULL;
@@ -98,11 +213,39 @@ public:
         m_isMmioSymbolicCb = NULL;
         m_isPortSymbolicOpaque = NULL;
         m_isMmioSymbolicOpaque = NULL;
+        m_instrumentationCalls = 0;
     }
 
+    virtual ~CorePlugin();
+
     void initialize();
     void initializeTimers();
 
+    /**
+     *  Registers a translation filter. CorePlugin takes ownership of it.
+     *  The translation block cache must be flushed for the filter to
+     *  apply to already translated code.
+     */
+    void registerTranslationFilter(TranslationFilter *filter);
+
+    /** Evaluates all filters for the block that is about to be translated */
+    void selectTranslationFilters(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc);
+
+    const std::vector<TranslationFilter*> &getActiveTranslationFilters() const {
+        return m_activeFilters;
+    }
+
+    /** Accounts for an instrumentation call that is about to be generated */
+    void recordInstrumentationCall() {
+        ++m_instrumentationCalls;
+    }
+
+    uint64_t getInstrumentationCalls() const {
+        return m_instrumentationCalls;
+    }
+
+    void printTranslationFilterStats(llvm::raw_ostream &os) const;
+
 	/*[fwl] 
 	 *   设置port检测回调函数
 	 */
@@ -276,11 +419,25 @@ public:
                  const std::vector<klee::ref<klee::Expr> >& /* newConditions */>
             onStateFork;
 
+    /** Signal emitted before the state forks on a symbolic branch whose
+        sides are both feasible, or before it concretizes a symbolic value
+        when the condition is not boolean. Clearing the flag makes the
+        state follow one side instead of forking. */
+    sigc::signal<void, S2EExecutionState*,
+                 const klee::ref<klee::Expr>& /* condition */,
+                 bool* /* allow forking */>
+            onStateForkDecide;
+
     sigc::signal<void,
                  S2EExecutionState*, /* currentState */
                  S2EExecutionState*> /* nextState */
             onStateSwitch;
 
+    /** Signal emitted before the searcher selects the next state,
+        outside of the cpu loop. Plugins may add and remove states. */
+    sigc::signal<void, S2EExecutionState* /* currentState */>
+            onStateSelect;
+
     /**
      * Triggered when S2E wants to generate a test case
      */
@@ -0,0 +1,238 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "CoverageBitmap.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/TimeValue.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(CoverageBitmap, "Coverage of translation blocks shared by all S2E processes",
+                  "CoverageBitmap", "ModuleExecutionDetector");
+
+void CoverageBitmap::initialize()
+{
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    bool ok;
+    unsigned bits = s2e()->getConfig()->getInt(getConfigKey() + ".bitmapBits", 24, &ok);
+    if (bits < 6 || bits > 36) {
+        s2e()->getWarningsStream() << "CoverageBitmap: bitmapBits must be between 6 and 36\n";
+        exit(-1);
+    }
+
+    m_trackEdges = s2e()->getConfig()->getBool(getConfigKey() + ".trackEdges", true);
+    m_newEdges = 0;
+
+    //Must be mapped before S2E forks the other processes
+    m_bitmap = new S2ESharedBitmap(bits);
+
+    std::string load = s2e()->getConfig()->getString(getConfigKey() + ".load", "", &ok);
+    if (ok && !load.empty()) {
+        loadBitmap(load);
+    }
+
+    m_detector->onModuleTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &CoverageBitmap::onModuleTranslateBlockStart));
+
+    s2e()->getCorePlugin()->onProcessForkComplete.connect(
+            sigc::mem_fun(*this, &CoverageBitmap::onProcessForkComplete));
+}
+
+void CoverageBitmap::onProcessForkComplete(bool isChild)
+{
+    //The parent reports the blocks it covered before the fork
+    if (isChild) {
+        m_coveredBlocks.clear();
+        m_newEdges = 0;
+    }
+}
+
+CoverageBitmap::~CoverageBitmap()
+{
+    save();
+    delete m_bitmap;
+}
+
+/** FNV-1a over the module name and the addresses */
+uint64_t CoverageBitmap::hash(const std::string &module, uint64_t from, uint64_t to)
+{
+    uint64_t h = 14695981039346656037ULL;
+    foreach2(it, module.begin(), module.end()) {
+        h = (h ^ (uint8_t) *it) * 1099511628211ULL;
+    }
+
+    uint64_t values[2] = {from, to};
+    const uint8_t *bytes = (const uint8_t*) values;
+    for (unsigned i = 0; i < sizeof(values); ++i) {
+        h = (h ^ bytes[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+bool CoverageBitmap::isCovered(const std::string &module, uint64_t relativePc) const
+{
+    return m_bitmap->test(hash(module, relativePc, relativePc));
+}
+
+/** Directions use target addresses that no edge between blocks can have */
+bool CoverageBitmap::testAndSetBranch(const std::string &module, uint64_t relativePc,
+                                      uint64_t discriminator, bool taken)
+{
+    uint64_t direction = (discriminator << 1) | (taken ? 0 : 1);
+    return m_bitmap->testAndSet(hash(module, relativePc, ~direction));
+}
+
+void CoverageBitmap::loadBitmap(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        s2e()->getWarningsStream() << "CoverageBitmap: could not open " << path << "\n";
+        exit(-1);
+    }
+
+    uint64_t count = m_bitmap->size() / 64 + 1;
+    std::vector<uint64_t> words(count + 1);
+    uint64_t read = fread(&words[0], sizeof(uint64_t), count + 1, fp);
+    fclose(fp);
+
+    //The hashes only match if the bitmap has the same size
+    if (!m_bitmap->merge(&words[0], read)) {
+        s2e()->getWarningsStream() << "CoverageBitmap: " << path
+                << " was saved with a different bitmapBits\n";
+        exit(-1);
+    }
+
+    s2e()->getMessagesStream() << "CoverageBitmap: loaded " << m_bitmap->count()
+            << " bits from " << path << "\n";
+}
+
+void CoverageBitmap::onModuleTranslateBlockStart(
+        ExecutionSignal *signal,
+        S2EExecutionState* state,
+        const ModuleDescriptor &module,
+        TranslationBlock *tb,
+        uint64_t pc)
+{
+    signal->connect(sigc::bind(
+            sigc::mem_fun(*this, &CoverageBitmap::onExecuteBlockStart),
+            module.Name, module.ToRelative(pc), module.ToNativeBase(pc)));
+}
+
+void CoverageBitmap::onExecuteBlockStart(S2EExecutionState* state, uint64_t pc,
+                                         std::string module, uint64_t relativePc,
+                                         uint64_t nativePc)
+{
+    DECLARE_PLUGINSTATE(CoverageBitmapState, state);
+
+    if (m_trackEdges && plgState->m_previousPc) {
+        if (!m_bitmap->testAndSet(hash(module, plgState->m_previousPc, relativePc))) {
+            ++m_newEdges;
+        }
+    }
+    plgState->m_previousPc = relativePc;
+
+    if (m_bitmap->testAndSet(hash(module, relativePc, relativePc))) {
+        return;
+    }
+
+    CoveredBlock block;
+    block.module = module;
+    block.start = nativePc;
+    block.end = nativePc + state->getTb()->size - 1;
+    block.timeStamp = llvm::sys::TimeValue::now().usec();
+    m_coveredBlocks.push_back(block);
+
+    onNewBlock.emit(state, module, relativePc);
+}
+
+void CoverageBitmap::save()
+{
+    llvm::raw_ostream *blocks = s2e()->openOutputFile("coverage-blocks.txt");
+    foreach2(it, m_coveredBlocks.begin(), m_coveredBlocks.end()) {
+        *blocks << (*it).module << " " << hexval((*it).start) << " "
+                << hexval((*it).end) << " " << (*it).timeStamp << "\n";
+    }
+    delete blocks;
+
+    saveBitmap();
+
+    s2e()->getMessagesStream() << "CoverageBitmap: " << m_coveredBlocks.size()
+            << " blocks first covered by this process, " << m_newEdges << " new edges, "
+            << m_bitmap->count() << " bits set in total\n";
+}
+
+void CoverageBitmap::saveBitmap()
+{
+    std::string path = s2e()->getOutputFilename("coverage-bitmap.bin");
+    FILE *fp = fopen(path.c_str(), "wb");
+    if (fp) {
+        fwrite(m_bitmap->data(), sizeof(uint64_t), m_bitmap->size() / 64 + 1, fp);
+        fclose(fp);
+    }
+}
+
+CoverageBitmapState::CoverageBitmapState()
+{
+    m_previousPc = 0;
+}
+
+CoverageBitmapState::~CoverageBitmapState()
+{
+
+}
+
+CoverageBitmapState* CoverageBitmapState::clone() const
+{
+    return new CoverageBitmapState(*this);
+}
+
+PluginState *CoverageBitmapState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new CoverageBitmapState();
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,148 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_COVERAGEBITMAP_H
+#define S2E_PLUGINS_COVERAGEBITMAP_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/Synchronization.h>
+
+#include <string>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Coverage of translation blocks and edges between them, shared by
+ *  all S2E processes.
+ *
+ *  Blocks and edges are hashed from the module name and module-relative
+ *  addresses into a bitmap in shared memory, so that a block covered by
+ *  one process is known as covered by all the others, including after
+ *  load balancing. The bitmap and the blocks each process was the first
+ *  to cover are written to the output directory at exit, the latter in
+ *  a format the coverage tool reads with -blocks. A bitmap saved by a
+ *  previous run can be loaded at startup to continue its campaign.
+ */
+class CoverageBitmap : public Plugin
+{
+    S2E_PLUGIN
+public:
+    CoverageBitmap(S2E* s2e): Plugin(s2e) {}
+    virtual ~CoverageBitmap();
+
+    void initialize();
+
+    /** Whether any process executed the block at the module-relative pc */
+    bool isCovered(const std::string &module, uint64_t relativePc) const;
+
+    /** Marks one direction of the branch at the module-relative pc as
+        covered by all processes. The discriminator tells apart the
+        branches of a single instruction. Returns whether it already was. */
+    bool testAndSetBranch(const std::string &module, uint64_t relativePc,
+                          uint64_t discriminator, bool taken);
+
+    /** Writes the bitmap to coverage-bitmap.bin in the output directory */
+    void saveBitmap();
+
+    S2ESharedBitmap *getBitmap() const {
+        return m_bitmap;
+    }
+
+    /** Emitted when a block is executed for the first time by any process */
+    sigc::signal<void, S2EExecutionState*,
+            const std::string & /* module name */,
+            uint64_t /* module-relative pc */>
+            onNewBlock;
+
+private:
+    struct CoveredBlock {
+        std::string module;
+        uint64_t start;
+        uint64_t end;
+        uint64_t timeStamp;
+    };
+
+    ModuleExecutionDetector *m_detector;
+    S2ESharedBitmap *m_bitmap;
+    bool m_trackEdges;
+
+    std::vector<CoveredBlock> m_coveredBlocks;
+    uint64_t m_newEdges;
+
+    static uint64_t hash(const std::string &module, uint64_t from, uint64_t to);
+
+    void loadBitmap(const std::string &path);
+
+    void onModuleTranslateBlockStart(
+            ExecutionSignal *signal,
+            S2EExecutionState* state,
+            const ModuleDescriptor &module,
+            TranslationBlock *tb,
+            uint64_t pc);
+
+    void onExecuteBlockStart(S2EExecutionState* state, uint64_t pc,
+                             std::string module, uint64_t relativePc,
+                             uint64_t nativePc);
+
+    void onProcessForkComplete(bool isChild);
+
+    void save();
+};
+
+class CoverageBitmapState : public PluginState
+{
+private:
+    /* Module-relative pc of the previous block, 0 if unknown */
+    uint64_t m_previousPc;
+
+public:
+    CoverageBitmapState();
+    virtual ~CoverageBitmapState();
+    virtual CoverageBitmapState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class CoverageBitmap;
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -60,8 +60,6 @@ S2E_DEFINE_PLUGIN(InstructionCounter, "Instruction counter plugin", "Instruction
 
 void InstructionCounter::initialize()
 {
-    m_tb = NULL;
-
     m_executionTracer = static_cast<ExecutionTracer*>(s2e()->getPlugin("ExecutionTracer"));
     assert(m_executionTracer);
 
@@ -75,14 +73,24 @@ void InstructionCounter::initialize()
 
 
 /*[xyj]
- *连接onModuleTranslateBlockStart信号,信号触发onTranslateBlockStart()函数
+ *注册只匹配被跟踪模块的翻译过滤器,只有这些tb块中的指令才会被插桩
  */
 /////////////////////////////////////////////////////////////////////////////////////
 void InstructionCounter::startCounter()
 {
-    m_executionDetector->onModuleTranslateBlockStart.connect(
+    //Only the blocks of tracked modules get instrumented, the filter
+    //is evaluated once per translation block by CorePlugin.
+    ModuleTranslationFilter *filter = new ModuleTranslationFilter(this, m_executionDetector);
+
+    filter->onTranslateBlockStart.connect(
             sigc::mem_fun(*this, &InstructionCounter::onTranslateBlockStart)
             );
+
+    filter->onTranslateInstructionStart.connect(
+            sigc::mem_fun(*this, &InstructionCounter::onTranslateInstructionStart)
+            );
+
+    s2e()->getCorePlugin()->registerTranslationFilter(filter);
 }
 
 
@@ -91,27 +99,12 @@ void InstructionCounter::startCounter()
 /**
  *  Instrument only the blocks where we want to count the instructions.
  */
-/*[xyj]
- *连接coreplugin的onTranslateInstructionStart信号,信号触发onTranlateInstructionStart()函数
- *之后调用onTraceTb()函数
- */
 void InstructionCounter::onTranslateBlockStart(
         ExecutionSignal *signal,
         S2EExecutionState* state,
-        const ModuleDescriptor &module,
         TranslationBlock *tb,
         uint64_t pc)
 {
-    if (m_tb) {
-        m_tbConnection.disconnect();
-    }
-    m_tb = tb;
-
-    CorePlugin *plg = s2e()->getCorePlugin();
-    m_tbConnection = plg->onTranslateInstructionStart.connect(
-            sigc::mem_fun(*this, &InstructionCounter::onTranslateInstructionStart)
-    );
-
     //This function will flush the number of executed instructions
     signal->connect(
         sigc::mem_fun(*this, &InstructionCounter::onTraceTb)
@@ -119,7 +112,7 @@ void InstructionCounter::onTranslateBlockStart(
 }
 
 /*[xyj]
- *如果在那个tb块内,则调用onTraceInstruction()函数
+ *在被跟踪模块的tb块内,连接onTraceInstruction()函数
  */
 void InstructionCounter::onTranslateInstructionStart(
         ExecutionSignal *signal,
@@ -127,13 +120,6 @@ void InstructionCounter::onTranslateInstructionStart(
         TranslationBlock *tb,
         uint64_t pc)
 {
-    if (tb != m_tb) {
-        //We've been suddenly interrupted by some other module
-        m_tb = NULL;
-        m_tbConnection.disconnect();
-        return;
-    }
-
     //Connect a function that will increment the number of executed
     //instructions.
     signal->connect(
@@ -142,22 +128,6 @@ void InstructionCounter::onTranslateInstructionStart(
 
 }
 
-void InstructionCounter::onModuleTranslateBlockEnd(
-        ExecutionSignal *signal,
-        S2EExecutionState* state,
-        const ModuleDescriptor &module,
-        TranslationBlock *tb,
-        uint64_t endPc,
-        bool staticTarget,
-        uint64_t targetPc)
-{
-    //TRACE("%"PRIx64" StaticTarget=%d TargetPc=%"PRIx64"\n", endPc, staticTarget, targetPc);
-
-    //Done translating the blocks, no need to instrument anymore.
-    m_tb = NULL;
-    m_tbConnection.disconnect();
-}
-
 /////////////////////////////////////////////////////////////////////////////////////
 /*[xyj]
  *将trace_icount相关信息写入log文件
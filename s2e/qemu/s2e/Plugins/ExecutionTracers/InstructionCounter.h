@@ -58,9 +58,6 @@ private:
     ModuleExecutionDetector *m_executionDetector;
     ExecutionTracer *m_executionTracer;
 
-    TranslationBlock *m_tb;
-    sigc::connection m_tbConnection;
-
 public:
     InstructionCounter(S2E* s2e): Plugin(s2e) {}
 
@@ -73,7 +70,6 @@ private:
     void onTranslateBlockStart(
             ExecutionSignal *signal,
             S2EExecutionState* state,
-            const ModuleDescriptor &module,
             TranslationBlock *tb,
             uint64_t pc);
 
@@ -83,15 +79,6 @@ private:
             TranslationBlock *tb,
             uint64_t pc);
 
-    void onModuleTranslateBlockEnd(
-            ExecutionSignal *signal,
-            S2EExecutionState* state,
-            const ModuleDescriptor &module,
-            TranslationBlock *tb,
-            uint64_t endPc,
-            bool staticTarget,
-            uint64_t targetPc);
-
     void onTraceTb(S2EExecutionState* state, uint64_t pc);
     void onTraceInstruction(S2EExecutionState* state, uint64_t pc);
 };
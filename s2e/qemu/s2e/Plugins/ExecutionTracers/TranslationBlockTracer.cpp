@@ -71,6 +71,9 @@ void TranslationBlockTracer::initialize()
     //The default behavior is ON, because otherwise it may produce confising results.
     m_flushTbOnChange = s2e()->getConfig()->getBool(getConfigKey() + ".flushTbCache", true);
 
+    m_filter = new ModuleTranslationFilter(this, m_detector);
+    s2e()->getCorePlugin()->registerTranslationFilter(m_filter);
+
     if (manualTrigger) {
         s2e()->getCorePlugin()->onCustomInstruction.connect(
                 sigc::mem_fun(*this, &TranslationBlockTracer::onCustomInstruction));
@@ -80,7 +83,7 @@ void TranslationBlockTracer::initialize()
 }
 /*【xyj】
  *enable tracing；
- *连接ModuleExecutionDetector插件的onModuleTranslateBlockStart(End)两个信号
+ *连接模块翻译过滤器的onTranslateBlockStart(End)两个信号
  */
 void TranslationBlockTracer::enableTracing()
 {
@@ -88,17 +91,17 @@ void TranslationBlockTracer::enableTracing()
         tb_flush(env);
     }
 
-    m_tbStartConnection = m_detector->onModuleTranslateBlockStart.connect(
-            sigc::mem_fun(*this, &TranslationBlockTracer::onModuleTranslateBlockStart)
+    m_tbStartConnection = m_filter->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &TranslationBlockTracer::onTranslateBlockStart)
     );
 
-    m_tbEndConnection = m_detector->onModuleTranslateBlockEnd.connect(
-            sigc::mem_fun(*this, &TranslationBlockTracer::onModuleTranslateBlockEnd)
+    m_tbEndConnection = m_filter->onTranslateBlockEnd.connect(
+            sigc::mem_fun(*this, &TranslationBlockTracer::onTranslateBlockEnd)
     );
 }
 /*【xyj】
  *disable tracing；
- *disconnect ModuleExecutionDetector插件的onModuleTranslateBlockStart(End)两个信号
+ *disconnect 模块翻译过滤器的onTranslateBlockStart(End)两个信号
  */
 void TranslationBlockTracer::disableTracing()
 {
@@ -111,10 +114,9 @@ void TranslationBlockTracer::disableTracing()
 }
 
 //【xyj】函数内部触发onExecuteBlockStart函数
-void TranslationBlockTracer::onModuleTranslateBlockStart(
+void TranslationBlockTracer::onTranslateBlockStart(
         ExecutionSignal *signal,
         S2EExecutionState* state,
-        const ModuleDescriptor &module,
         TranslationBlock *tb,
         uint64_t pc)
 {
@@ -123,10 +125,9 @@ void TranslationBlockTracer::onModuleTranslateBlockStart(
     );
 }
 //【xyj】函数内部触发onExecuteBlockEnd函数
-void TranslationBlockTracer::onModuleTranslateBlockEnd(
+void TranslationBlockTracer::onTranslateBlockEnd(
         ExecutionSignal *signal,
         S2EExecutionState* state,
-        const ModuleDescriptor &module,
         TranslationBlock *tb,
         uint64_t endPc,
         bool staticTarget,
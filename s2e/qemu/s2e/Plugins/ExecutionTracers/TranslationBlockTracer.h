@@ -67,27 +67,14 @@ private:
     ExecutionTracer *m_tracer;
     ModuleExecutionDetector *m_detector;
 
+    //Matches the blocks of the tracked modules
+    ModuleTranslationFilter *m_filter;
+
     sigc::connection m_tbStartConnection;
     sigc::connection m_tbEndConnection;
 
     bool m_flushTbOnChange;
 
-    void onModuleTranslateBlockStart(
-            ExecutionSignal *signal,
-            S2EExecutionState* state,
-            const ModuleDescriptor &module,
-            TranslationBlock *tb,
-            uint64_t pc);
-
-    void onModuleTranslateBlockEnd(
-            ExecutionSignal *signal,
-            S2EExecutionState* state,
-            const ModuleDescriptor &module,
-            TranslationBlock *tb,
-            uint64_t endPc,
-            bool staticTarget,
-            uint64_t targetPc);
-
     void onTranslateBlockStart(
             ExecutionSignal *signal,
             S2EExecutionState* state,
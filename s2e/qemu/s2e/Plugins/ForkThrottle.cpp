@@ -0,0 +1,265 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "ForkThrottle.h"
+#include "CoverageBitmap.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(ForkThrottle, "Stops forking at instructions whose forks do not lead to new code",
+                  "ForkThrottle");
+
+void ForkThrottle::initialize()
+{
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    m_maxUnproductiveForks = s2e()->getConfig()->getInt(getConfigKey() + ".maxUnproductiveForks", 32);
+    m_retryInterval = s2e()->getConfig()->getInt(getConfigKey() + ".retryInterval", 64);
+
+    m_suppressedForks = 0;
+
+    //Index 0 is used for code outside of any known module
+    m_modules.push_back("");
+    m_moduleIndices[""] = 0;
+
+    s2e()->getCorePlugin()->onStateForkDecide.connect(
+            sigc::mem_fun(*this, &ForkThrottle::onStateForkDecide));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &ForkThrottle::onStateFork));
+
+    //Prefer the coverage shared by all processes, otherwise
+    //consider newly translated blocks as new code
+    CoverageBitmap *coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
+    if (coverage) {
+        coverage->onNewBlock.connect(
+                sigc::mem_fun(*this, &ForkThrottle::onNewCoveredBlock));
+    } else {
+        s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+                sigc::mem_fun(*this, &ForkThrottle::onTranslateBlockStart));
+    }
+}
+
+ForkThrottle::~ForkThrottle()
+{
+    writeReport();
+}
+
+uint64_t ForkThrottle::getSiteKey(S2EExecutionState *state)
+{
+    uint64_t pc = state->getPc();
+    uint32_t module = 0;
+
+    const ModuleDescriptor *md = m_detector ? m_detector->getModule(state, pc, false) : NULL;
+    if (md) {
+        std::map<std::string, uint32_t>::iterator it = m_moduleIndices.find(md->Name);
+        if (it == m_moduleIndices.end()) {
+            module = m_modules.size();
+            m_modules.push_back(md->Name);
+            m_moduleIndices[md->Name] = module;
+        } else {
+            module = (*it).second;
+        }
+        pc = md->ToRelative(pc);
+    }
+
+    return ((uint64_t) module << 48) | (pc & ((1ULL << 48) - 1));
+}
+
+ForkThrottle::ForkSite &ForkThrottle::getSite(uint64_t key)
+{
+    ForkSites::iterator it = m_sites.find(key);
+    if (it != m_sites.end()) {
+        return (*it).second;
+    }
+
+    ForkSite &site = m_sites[key];
+    site.forks = 0;
+    site.newBlocks = 0;
+    site.unproductiveForks = 0;
+    site.throttledAttempts = 0;
+    site.suppressedForks = 0;
+    return site;
+}
+
+void ForkThrottle::printSite(llvm::raw_ostream &os, uint64_t key) const
+{
+    os << m_modules[key >> 48] << "," << hexval(key & ((1ULL << 48) - 1));
+}
+
+void ForkThrottle::onStateForkDecide(S2EExecutionState *state,
+                                     const klee::ref<klee::Expr> &condition, bool *allow)
+{
+    if (!*allow) {
+        return;
+    }
+
+    //Sites that never forked are not in the table
+    ForkSites::iterator it = m_sites.find(getSiteKey(state));
+    if (it == m_sites.end() || !isThrottled((*it).second)) {
+        return;
+    }
+
+    ForkSite &site = (*it).second;
+
+    ++site.throttledAttempts;
+    if (m_retryInterval && site.throttledAttempts % m_retryInterval == 0) {
+        return;
+    }
+
+    //The executor now adds the constraint of one side of
+    //the branch instead of forking, if both sides are feasible
+    ++site.suppressedForks;
+    ++m_suppressedForks;
+    *allow = false;
+}
+
+void ForkThrottle::onStateFork(S2EExecutionState *state,
+                               const std::vector<S2EExecutionState*> &newStates,
+                               const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    uint64_t key = getSiteKey(state);
+    ForkSite &site = getSite(key);
+
+    ++site.forks;
+    ++site.unproductiveForks;
+
+    if (site.unproductiveForks == m_maxUnproductiveForks) {
+        llvm::raw_ostream &os = s2e()->getDebugStream();
+        os << "ForkThrottle: throttling forks at ";
+        printSite(os, key);
+        os << '\n';
+    }
+
+    foreach2(it, newStates.begin(), newStates.end()) {
+        DECLARE_PLUGINSTATE(ForkThrottleState, *it);
+        plgState->m_site = key;
+        plgState->m_hasSite = true;
+    }
+}
+
+/** Credits the site of the last fork of the state */
+void ForkThrottle::onNewBlock(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(ForkThrottleState, state);
+    if (!plgState->m_hasSite) {
+        return;
+    }
+
+    ForkSites::iterator it = m_sites.find(plgState->m_site);
+    assert(it != m_sites.end());
+    ForkSite &site = (*it).second;
+
+    if (isThrottled(site)) {
+        llvm::raw_ostream &os = s2e()->getDebugStream();
+        os << "ForkThrottle: resuming forks at ";
+        printSite(os, plgState->m_site);
+        os << '\n';
+    }
+
+    ++site.newBlocks;
+    site.unproductiveForks = 0;
+    site.throttledAttempts = 0;
+}
+
+void ForkThrottle::onNewCoveredBlock(S2EExecutionState *state,
+                                     const std::string &module, uint64_t relativePc)
+{
+    onNewBlock(state);
+}
+
+void ForkThrottle::onTranslateBlockStart(ExecutionSignal *signal,
+                                         S2EExecutionState *state,
+                                         TranslationBlock *tb,
+                                         uint64_t pc)
+{
+    onNewBlock(state);
+}
+
+void ForkThrottle::writeReport()
+{
+    llvm::raw_ostream *os = s2e()->openOutputFile("forks.csv");
+    if (!os) {
+        return;
+    }
+
+    unsigned throttled = 0;
+    *os << "module,pc,forks,newBlocks,suppressedForks,throttled\n";
+    foreach2(it, m_sites.begin(), m_sites.end()) {
+        const ForkSite &site = (*it).second;
+        throttled += isThrottled(site);
+        printSite(*os, (*it).first);
+        *os << "," << site.forks << "," << site.newBlocks << ","
+            << site.suppressedForks << "," << isThrottled(site) << "\n";
+    }
+    delete os;
+
+    s2e()->getMessagesStream() << "ForkThrottle: " << m_sites.size() << " fork sites, "
+            << throttled << " throttled, " << m_suppressedForks << " forks suppressed\n";
+}
+
+ForkThrottleState::ForkThrottleState()
+{
+    m_site = 0;
+    m_hasSite = false;
+}
+
+ForkThrottleState::~ForkThrottleState()
+{
+
+}
+
+ForkThrottleState* ForkThrottleState::clone() const
+{
+    return new ForkThrottleState(*this);
+}
+
+PluginState *ForkThrottleState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new ForkThrottleState();
+}
+
+} // namespace plugins
+} // namespace s2e
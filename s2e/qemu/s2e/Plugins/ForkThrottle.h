@@ -0,0 +1,145 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_FORKTHROTTLE_H
+#define S2E_PLUGINS_FORKTHROTTLE_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <map>
+#include <string>
+#include <tr1/unordered_map>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Stops forking at instructions whose forks no longer lead to new code.
+ *
+ *  Each fork site, i.e., module and module-relative pc, counts its forks
+ *  and the new blocks found by the states forked there. A site that forked
+ *  maxUnproductiveForks times since it last led to a new block is
+ *  throttled: states follow one side of the branch instead of forking,
+ *  except for one attempt every retryInterval, which gives the site a
+ *  chance to become productive again. Per-site counters are written to
+ *  forks.csv at exit.
+ *
+ *  New blocks come from CoverageBitmap if it is enabled, otherwise from
+ *  block translations.
+ */
+class ForkThrottle : public Plugin
+{
+    S2E_PLUGIN
+public:
+    ForkThrottle(S2E* s2e): Plugin(s2e) {}
+    virtual ~ForkThrottle();
+
+    void initialize();
+
+private:
+    struct ForkSite {
+        uint32_t forks;
+        uint32_t newBlocks;
+        uint32_t unproductiveForks;
+        uint32_t throttledAttempts;
+        uint32_t suppressedForks;
+    };
+
+    /** Module index in the upper 16 bits, module-relative pc below */
+    typedef std::tr1::unordered_map<uint64_t, ForkSite> ForkSites;
+
+    ModuleExecutionDetector *m_detector;
+
+    unsigned m_maxUnproductiveForks;
+    unsigned m_retryInterval;
+
+    ForkSites m_sites;
+    std::vector<std::string> m_modules;
+    std::map<std::string, uint32_t> m_moduleIndices;
+
+    uint64_t m_suppressedForks;
+
+    uint64_t getSiteKey(S2EExecutionState *state);
+    ForkSite &getSite(uint64_t key);
+    void printSite(llvm::raw_ostream &os, uint64_t key) const;
+    bool isThrottled(const ForkSite &site) const {
+        return site.unproductiveForks >= m_maxUnproductiveForks;
+    }
+
+    void onStateForkDecide(S2EExecutionState *state,
+                           const klee::ref<klee::Expr> &condition, bool *allow);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onNewBlock(S2EExecutionState *state);
+
+    void onNewCoveredBlock(S2EExecutionState *state,
+                           const std::string &module, uint64_t relativePc);
+
+    void onTranslateBlockStart(ExecutionSignal *signal,
+                               S2EExecutionState *state,
+                               TranslationBlock *tb,
+                               uint64_t pc);
+
+    void writeReport();
+};
+
+class ForkThrottleState : public PluginState
+{
+private:
+    /* Site of the last fork on the path of the state */
+    uint64_t m_site;
+    bool m_hasSite;
+
+public:
+    ForkThrottleState();
+    virtual ~ForkThrottleState();
+    virtual ForkThrottleState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class ForkThrottle;
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -178,7 +178,8 @@ void FunctionMonitor::slotTraceRet(S2EExecutionState *state, int f)
 
 FunctionMonitorState::FunctionMonitorState()
 {
-
+    m_callDescriptors = new SharedCallDescriptors();
+    m_returnDescriptors = new ReturnDescriptors();
 }
 
 FunctionMonitorState::~FunctionMonitorState()
@@ -186,11 +187,12 @@ FunctionMonitorState::~FunctionMonitorState()
 
 }
 //【xyj】FunctionMonitorState的克隆函数，返回克隆后新对象的指针
+//调用/返回描述符在fork后的状态之间共享，只有在修改时才复制
 FunctionMonitorState* FunctionMonitorState::clone() const
 {
     FunctionMonitorState *ret = new FunctionMonitorState(*this);
     m_plugin->s2e()->getDebugStream() << "Forking FunctionMonitorState ret=" << hexval(ret) << '\n';
-    assert(ret->m_returnDescriptors.size() == m_returnDescriptors.size());
+    assert(ret->m_returnDescriptors->size == m_returnDescriptors->size);
     return ret;
 }
 
@@ -200,14 +202,86 @@ PluginState *FunctionMonitorState::factory(Plugin *p, S2EExecutionState *s)
     ret->m_plugin = static_cast<FunctionMonitor*>(p);
     return ret;
 }
+
+FunctionMonitorState::CallDescriptorsMap &FunctionMonitorState::getWritableCallDescriptors()
+{
+    if (m_callDescriptors->refCount > 1) {
+        m_callDescriptors = new SharedCallDescriptors(*m_callDescriptors.get());
+    }
+    return m_callDescriptors->descriptors;
+}
+
+void FunctionMonitorState::flushNewCallDescriptors()
+{
+    if (!m_newCallDescriptors.empty()) {
+        getWritableCallDescriptors().insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
+        m_newCallDescriptors.clear();
+    }
+}
+
+void FunctionMonitorState::addReturnDescriptor(uint64_t esp, const ReturnDescriptor &descriptor)
+{
+    if (m_returnDescriptors->refCount > 1) {
+        m_returnDescriptors = new ReturnDescriptors(*m_returnDescriptors.get());
+    }
+
+    klee::ref<ReturnNode> &bucket = m_returnDescriptors->buckets[ReturnDescriptors::getBucket(esp)];
+    bucket = new ReturnNode(esp, descriptor, bucket);
+    ++m_returnDescriptors->size;
+}
+
+/**
+ *  Removes the most recently registered return descriptor for (esp, cr3)
+ *  and returns it, or returns a null reference if there is none.
+ */
+klee::ref<FunctionMonitorState::ReturnNode>
+FunctionMonitorState::takeReturnDescriptor(uint64_t esp, uint64_t cr3)
+{
+    unsigned b = ReturnDescriptors::getBucket(esp);
+
+    klee::ref<ReturnNode> found;
+    for (ReturnNode *n = m_returnDescriptors->buckets[b].get(); n; n = n->next.get()) {
+        if (n->esp == esp && n->descriptor.cr3 == cr3) {
+            found = n;
+            break;
+        }
+    }
+
+    if (found.isNull()) {
+        return found;
+    }
+
+    if (m_returnDescriptors->refCount > 1) {
+        m_returnDescriptors = new ReturnDescriptors(*m_returnDescriptors.get());
+    }
+
+    //Copy the nodes that precede the removed one, the rest of the list is shared
+    std::vector<ReturnNode*> prefix;
+    for (ReturnNode *n = m_returnDescriptors->buckets[b].get(); n != found.get(); n = n->next.get()) {
+        prefix.push_back(n);
+    }
+
+    klee::ref<ReturnNode> tail = found->next;
+    for (unsigned i = prefix.size(); i > 0; --i) {
+        tail = new ReturnNode(prefix[i - 1]->esp, prefix[i - 1]->descriptor, tail);
+    }
+
+    m_returnDescriptors->buckets[b] = tail;
+    --m_returnDescriptors->size;
+    return found;
+}
+
 /*【xyj】
  *传入参数是需要监视的函数地址和进程的pid；返回一个CallSignal信号
  */
 FunctionMonitor::CallSignal* FunctionMonitorState::getCallSignal(
         uint64_t eip, uint64_t cr3)
 {
+    //The caller may connect to the returned signal, so the table must not be shared
+    CallDescriptorsMap &callDescriptors = getWritableCallDescriptors();
+
     std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
-            range = m_callDescriptors.equal_range(eip);
+            range = callDescriptors.equal_range(eip);
     //【xyj】在已存在的call信号中查找是否存在和申请注册函数的pid一致的信号，存在则返回
     for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
         if(it->second.cr3 == cr3)
@@ -231,16 +305,16 @@ void FunctionMonitorState::slotCall(S2EExecutionState *state, uint64_t pc)
     target_ulong cr3 = state->getPid();
     target_ulong eip = state->getPc();
 
-    if (!m_newCallDescriptors.empty()) {
-        m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-        m_newCallDescriptors.clear();
-    }
+    flushNewCallDescriptors();
 
     /* Issue signals attached to all calls (eip==-1 means catch-all) */
     //【xyj】追踪进程的所有的函数调用
-    if (!m_callDescriptors.empty()) {
+    if (!m_callDescriptors->descriptors.empty()) {
+        //Keep the table alive (and shared) while handlers run
+        klee::ref<SharedCallDescriptors> calls = m_callDescriptors;
+
         std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
-                range = m_callDescriptors.equal_range((uint64_t)-1);
+                range = calls->descriptors.equal_range((uint64_t)-1);
         for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
             CallDescriptor cd = (*it).second;
             if (m_plugin->m_monitor) {
@@ -250,19 +324,18 @@ void FunctionMonitorState::slotCall(S2EExecutionState *state, uint64_t pc)
                 cd.signal.emit(state, this);
             }
         }
-        if (!m_newCallDescriptors.empty()) {
-            m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-            m_newCallDescriptors.clear();
-        }
+        flushNewCallDescriptors();
     }
 
     /* Issue signals attached to specific calls */
     //追踪进程的特定函数调用
-    if (!m_callDescriptors.empty()) {
+    if (!m_callDescriptors->descriptors.empty()) {
+        klee::ref<SharedCallDescriptors> calls = m_callDescriptors;
+
         std::pair<CallDescriptorsMap::iterator, CallDescriptorsMap::iterator>
                 range;
 
-        range = m_callDescriptors.equal_range(eip);
+        range = calls->descriptors.equal_range(eip);
         for(CallDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
             CallDescriptor cd = (*it).second;
             if (m_plugin->m_monitor) {
@@ -272,10 +345,7 @@ void FunctionMonitorState::slotCall(S2EExecutionState *state, uint64_t pc)
                 cd.signal.emit(state, this);
             }
         }
-        if (!m_newCallDescriptors.empty()) {
-            m_callDescriptors.insert(m_newCallDescriptors.begin(), m_newCallDescriptors.end());
-            m_newCallDescriptors.clear();
-        }
+        flushNewCallDescriptors();
     }
 }
 
@@ -306,7 +376,7 @@ void FunctionMonitorState::registerReturnSignal(S2EExecutionState *state, Functi
         pid = m_plugin->m_monitor->getPid(state, state->getPc());
     }
     ReturnDescriptor descriptor = {pid, sig };
-    m_returnDescriptors.insert(std::make_pair(esp, descriptor));
+    addReturnDescriptor(esp, descriptor);
 }
 
 /**
@@ -335,33 +405,25 @@ void FunctionMonitorState::slotRet(S2EExecutionState *state, uint64_t pc, bool e
         return;
     }
 
-    if (m_returnDescriptors.empty()) {
+    if (m_returnDescriptors->size == 0) {
         return;
     }
 
     //m_plugin->s2e()->getDebugStream() << "ESP AT RETURN 0x" << std::hex << esp <<
     //        " plgstate=0x" << this << " EmitSignal=" << emitSignal <<  std::endl;
 
-    bool finished = true;
-    do {
-        finished = true;
-        std::pair<ReturnDescriptorsMap::iterator, ReturnDescriptorsMap::iterator>
-                range = m_returnDescriptors.equal_range(esp);
-        for(ReturnDescriptorsMap::iterator it = range.first; it != range.second; ++it) {
-            if (m_plugin->m_monitor) {
-                cr3 = m_plugin->m_monitor->getPid(state, pc);
-            }
+    if (m_plugin->m_monitor) {
+        cr3 = m_plugin->m_monitor->getPid(state, pc);
+    }
 
-            if(it->second.cr3 == cr3) {
-                if (emitSignal) {
-                    it->second.signal.emit(state);
-                }
-                m_returnDescriptors.erase(it);
-                finished = false;
-                break;
-            }
+    //The descriptor is removed before its signal is emitted, so that
+    //the handler may safely register new return signals.
+    klee::ref<ReturnNode> node;
+    while (!(node = takeReturnDescriptor(esp, cr3)).isNull()) {
+        if (emitSignal) {
+            node->descriptor.signal.emit(state);
         }
-    } while(!finished);
+    }
 }
 
 void FunctionMonitorState::disconnect(const ModuleDescriptor &desc, CallDescriptorsMap &descMap)
@@ -385,7 +447,7 @@ void FunctionMonitorState::disconnect(const ModuleDescriptor &desc, CallDescript
 void FunctionMonitorState::disconnect(const ModuleDescriptor &desc)
 {
 
-    disconnect(desc, m_callDescriptors);
+    disconnect(desc, getWritableCallDescriptors());
     disconnect(desc, m_newCallDescriptors);
 
     //XXX: we assume there are no more return descriptors active when the module is unloaded
@@ -42,6 +42,8 @@
 #include <s2e/S2EExecutionState.h>
 #include <s2e/Plugins/OSMonitor.h>
 
+#include <klee/util/Ref.h>
+
 #include <tr1/unordered_map>
 
 namespace s2e {
@@ -110,12 +112,58 @@ class FunctionMonitorState : public PluginState
     };
     //【xyj】整个函数调用的管理和组织使用CallDescriptorsMap来描述，这个结构是<pc,CallDescriptor>对
     typedef std::tr1::unordered_multimap<uint64_t, CallDescriptor> CallDescriptorsMap;
-    //【xyj】整个函数返回的管理和组织使用ReturnDescriptorsMap来描述，这个结构是<pc,ReturnDescriptor>对
-    typedef std::tr1::unordered_multimap<uint64_t, ReturnDescriptor> ReturnDescriptorsMap;
 
-    CallDescriptorsMap m_callDescriptors;
+    /**
+     *  Call descriptors are shared between forked states and
+     *  copied only when a state registers or removes a call signal.
+     */
+    struct SharedCallDescriptors {
+        unsigned refCount;
+        CallDescriptorsMap descriptors;
+
+        SharedCallDescriptors() : refCount(0) {}
+        SharedCallDescriptors(const SharedCallDescriptors &o) :
+            refCount(0), descriptors(o.descriptors) {}
+    };
+
+    /**
+     *  Pending return descriptors, indexed by the stack pointer at the time
+     *  of the call. Each bucket is an immutable list whose nodes are shared
+     *  between forked states, so forking only takes a reference to the table.
+     *  Removing a descriptor copies the nodes that precede it in its bucket.
+     */
+    struct ReturnNode {
+        unsigned refCount;
+        uint64_t esp;
+        ReturnDescriptor descriptor;
+        klee::ref<ReturnNode> next;
+
+        ReturnNode(uint64_t _esp, const ReturnDescriptor &desc, const klee::ref<ReturnNode> &_next) :
+            refCount(0), esp(_esp), descriptor(desc), next(_next) {}
+    };
+
+    struct ReturnDescriptors {
+        static const unsigned BUCKET_COUNT = 64;
+
+        unsigned refCount;
+        unsigned size;
+        klee::ref<ReturnNode> buckets[BUCKET_COUNT];
+
+        ReturnDescriptors() : refCount(0), size(0) {}
+        ReturnDescriptors(const ReturnDescriptors &o) : refCount(0), size(o.size) {
+            for (unsigned i = 0; i < BUCKET_COUNT; ++i) {
+                buckets[i] = o.buckets[i];
+            }
+        }
+
+        static unsigned getBucket(uint64_t esp) {
+            return ((esp >> 2) ^ (esp >> 12)) & (BUCKET_COUNT - 1);
+        }
+    };
+
+    klee::ref<SharedCallDescriptors> m_callDescriptors;
     CallDescriptorsMap m_newCallDescriptors;
-    ReturnDescriptorsMap m_returnDescriptors;
+    klee::ref<ReturnDescriptors> m_returnDescriptors;
 
     FunctionMonitor *m_plugin;
 
@@ -123,6 +171,12 @@ class FunctionMonitorState : public PluginState
        any function, and cr3 = 0 means any cr3 */
     FunctionMonitor::CallSignal* getCallSignal(uint64_t eip, uint64_t cr3 = 0);
 
+    CallDescriptorsMap &getWritableCallDescriptors();
+    void flushNewCallDescriptors();
+
+    void addReturnDescriptor(uint64_t esp, const ReturnDescriptor &descriptor);
+    klee::ref<ReturnNode> takeReturnDescriptor(uint64_t esp, uint64_t cr3);
+
     void slotCall(S2EExecutionState *state, uint64_t pc);
     void slotRet(S2EExecutionState *state, uint64_t pc, bool emitSignal);
 
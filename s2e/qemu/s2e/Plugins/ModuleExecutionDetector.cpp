@@ -536,48 +536,184 @@ void ModuleExecutionDetector::dumpMemory(S2EExecutionState *state,
 /*****************************************************************************/
 /*****************************************************************************/
 
-ModuleTransitionState::ModuleTransitionState()
+bool ModuleTranslationFilter::matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc)
 {
-    m_PreviousModule = NULL;
-    m_CachedModule = NULL;
+    if (!TranslationFilter::matchesBlock(state, tb, pc)) {
+        return false;
+    }
+
+    const ModuleDescriptor *md = m_detector->getModule(state, pc);
+    if (!md) {
+        return false;
+    }
+
+    if (m_moduleIds.empty()) {
+        return true;
+    }
+
+    const std::string *id = m_detector->getModuleId(*md);
+    return id && m_moduleIds.count(*id);
 }
 
-ModuleTransitionState::~ModuleTransitionState()
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
+
+unsigned ModuleMap::lowerBound(uint64_t pid, uint64_t address) const
 {
-    foreach2(it, m_Descriptors.begin(), m_Descriptors.end()) {
-        delete *it;
+    unsigned lo = 0, hi = m_Entries.size();
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        const ModuleDescriptor &md = m_Entries[mid]->desc;
+        if (md.Pid < pid || (md.Pid == pid && md.LoadBase < address)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+const ModuleDescriptor *ModuleMap::lookup(uint64_t pid, uint64_t pc, bool *pageClean) const
+{
+    uint64_t pageStart = pc & TARGET_PAGE_MASK;
+    uint64_t pageEnd = pageStart + TARGET_PAGE_SIZE;
+
+    /* The candidate is the last module starting at or before pc */
+    unsigned next = lowerBound(pid, pc + 1);
+    const ModuleDescriptor *prev = NULL;
+    if (next > 0 && m_Entries[next - 1]->desc.Pid == pid) {
+        prev = &m_Entries[next - 1]->desc;
+    }
+
+    const ModuleDescriptor *ret = NULL;
+    if (prev && prev->Contains(pc)) {
+        ret = prev;
+    }
+
+    if (pageClean) {
+        bool clean = true;
+
+        /* Modules that share the page of pc with the result (or with the hole) */
+        if (prev && prev != ret && prev->LoadBase + prev->Size > pageStart) {
+            clean = false;
+        }
+        if (ret && (ret->LoadBase > pageStart || ret->LoadBase + ret->Size < pageEnd)) {
+            clean = false;
+        }
+        if (next < m_Entries.size()) {
+            const ModuleDescriptor &after = m_Entries[next]->desc;
+            if (after.Pid == pid && after.LoadBase < pageEnd) {
+                clean = false;
+            }
+        }
+
+        *pageClean = clean;
     }
 
-    foreach2(it, m_NotTrackedDescriptors.begin(), m_NotTrackedDescriptors.end()) {
-        delete *it;
+    return ret;
+}
+
+bool ModuleMap::overlaps(const ModuleDescriptor &desc) const
+{
+    unsigned next = lowerBound(desc.Pid, desc.LoadBase + desc.Size);
+    if (next == 0) {
+        return false;
     }
+
+    const ModuleDescriptor &md = m_Entries[next - 1]->desc;
+    return md.Pid == desc.Pid && md.LoadBase + md.Size > desc.LoadBase;
 }
 
-ModuleTransitionState* ModuleTransitionState::clone() const
+bool ModuleMap::contains(const ModuleDescriptor *desc) const
 {
-    ModuleTransitionState *ret = new ModuleTransitionState();
+    unsigned idx = lowerBound(desc->Pid, desc->LoadBase);
+    return idx < m_Entries.size() && &m_Entries[idx]->desc == desc;
+}
+
+ModuleMap *ModuleMap::insert(const ModuleDescriptor &desc) const
+{
+    if (overlaps(desc)) {
+        return NULL;
+    }
 
-    foreach2(it, m_Descriptors.begin(), m_Descriptors.end()) {
-        ret->m_Descriptors.insert(new ModuleDescriptor(**it));
+    unsigned idx = lowerBound(desc.Pid, desc.LoadBase);
+
+    ModuleMap *ret = new ModuleMap();
+    ret->m_Entries.reserve(m_Entries.size() + 1);
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin(), m_Entries.begin() + idx);
+    ret->m_Entries.push_back(new Entry(desc));
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin() + idx, m_Entries.end());
+    return ret;
+}
+
+ModuleMap *ModuleMap::remove(const ModuleDescriptor &desc) const
+{
+    /* Same semantics as the ModuleByLoadBase comparator: remove the module that overlaps desc */
+    unsigned next = lowerBound(desc.Pid, desc.LoadBase + desc.Size);
+    if (next == 0) {
+        return NULL;
     }
 
-    foreach2(it, m_NotTrackedDescriptors.begin(), m_NotTrackedDescriptors.end()) {
-        assert(*it != m_CachedModule && *it != m_PreviousModule);
-        ret->m_NotTrackedDescriptors.insert(new ModuleDescriptor(**it));
+    unsigned idx = next - 1;
+    const ModuleDescriptor &md = m_Entries[idx]->desc;
+    if (md.Pid != desc.Pid || md.LoadBase + md.Size <= desc.LoadBase) {
+        return NULL;
     }
 
-    if (m_CachedModule) {
-        DescriptorSet::iterator it = ret->m_Descriptors.find(m_CachedModule);
-        assert(it != ret->m_Descriptors.end());
-        ret->m_CachedModule = *it;
+    ModuleMap *ret = new ModuleMap();
+    ret->m_Entries.reserve(m_Entries.size() - 1);
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin(), m_Entries.begin() + idx);
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin() + idx + 1, m_Entries.end());
+    return ret;
+}
+
+ModuleMap *ModuleMap::removePid(uint64_t pid) const
+{
+    unsigned first = lowerBound(pid, 0);
+    unsigned last = first;
+    while (last < m_Entries.size() && m_Entries[last]->desc.Pid == pid) {
+        ++last;
     }
 
-    if (m_PreviousModule) {
-        DescriptorSet::iterator it = ret->m_Descriptors.find(m_PreviousModule);
-        assert(it != ret->m_Descriptors.end());
-        ret->m_PreviousModule = *it;
+    if (first == last) {
+        return NULL;
     }
 
+    ModuleMap *ret = new ModuleMap();
+    ret->m_Entries.reserve(m_Entries.size() - (last - first));
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin(), m_Entries.begin() + first);
+    ret->m_Entries.insert(ret->m_Entries.end(), m_Entries.begin() + last, m_Entries.end());
+    return ret;
+}
+
+/*****************************************************************************/
+/*****************************************************************************/
+/*****************************************************************************/
+
+ModuleTransitionState::ModuleTransitionState()
+{
+    m_PreviousModule = NULL;
+    m_Descriptors = new ModuleMap();
+    m_NotTrackedDescriptors = new ModuleMap();
+    flushPageCache();
+}
+
+ModuleTransitionState::~ModuleTransitionState()
+{
+
+}
+
+ModuleTransitionState* ModuleTransitionState::clone() const
+{
+    ModuleTransitionState *ret = new ModuleTransitionState();
+
+    /* The tables are immutable, forked states share them until the next module load */
+    ret->m_Descriptors = m_Descriptors;
+    ret->m_NotTrackedDescriptors = m_NotTrackedDescriptors;
+    ret->m_PreviousModule = m_PreviousModule;
+    assert(!m_PreviousModule || m_Descriptors->contains(m_PreviousModule));
+
     return ret;
 }
 
@@ -590,54 +726,52 @@ PluginState* ModuleTransitionState::factory(Plugin *p, S2EExecutionState *state)
     return s;
 }
 
+void ModuleTransitionState::flushPageCache()
+{
+    for (unsigned i = 0; i < PAGE_CACHE_SIZE; ++i) {
+        m_PageCache[i].pid = (uint64_t) -1;
+        m_PageCache[i].page = (uint64_t) -1;
+        m_PageCache[i].module = NULL;
+    }
+}
+
 const ModuleDescriptor *ModuleTransitionState::getDescriptor(uint64_t pid, uint64_t pc, bool tracked) const
 {
-    if (m_CachedModule) {
-        const ModuleDescriptor &md = *m_CachedModule;
-        uint64_t prevModStart = md.LoadBase;
-        uint64_t prevModSize = md.Size;
-        uint64_t prevModPid = md.Pid;
-        if (pid == prevModPid && pc >= prevModStart && pc < prevModStart + prevModSize) {
-            //We stayed in the same module
-            return m_CachedModule;
+    uint64_t page = pc & TARGET_PAGE_MASK;
+    PageCacheEntry &ce = m_PageCache[(pc >> TARGET_PAGE_BITS) & (PAGE_CACHE_SIZE - 1)];
+
+    const ModuleDescriptor *ret;
+    if (ce.page == page && ce.pid == pid) {
+        ret = ce.module;
+    } else {
+        bool pageClean;
+        ret = m_Descriptors->lookup(pid, pc, &pageClean);
+        if (pageClean) {
+            ce.pid = pid;
+            ce.page = page;
+            ce.module = ret;
         }
     }
 
-    ModuleDescriptor d;
-    d.Pid = pid;
-    d.LoadBase = pc;
-    d.Size = 1;
-    DescriptorSet::iterator it = m_Descriptors.find(&d);
-    if (it != m_Descriptors.end()) {
-        m_CachedModule = *it;
-        return *it;
-    }
-
-    m_CachedModule = NULL;
-
-    if (!tracked) {
-        it = m_NotTrackedDescriptors.find(&d);
-        if (it != m_NotTrackedDescriptors.end()) {
-            //XXX: implement proper caching
-            assert(*it != m_CachedModule && *it != m_PreviousModule);
-            return *it;
-        }
+    if (ret || tracked) {
+        return ret;
     }
 
-    return NULL;
+    return m_NotTrackedDescriptors->lookup(pid, pc);
 }
 
 bool ModuleTransitionState::loadDescriptor(const ModuleDescriptor &desc, bool track)
 {
+    klee::ref<ModuleMap> &table = track ? m_Descriptors : m_NotTrackedDescriptors;
+
+    ModuleMap *newTable = table->insert(desc);
+    if (!newTable) {
+        return false;
+    }
+
+    table = newTable;
     if (track) {
-        m_Descriptors.insert(new ModuleDescriptor(desc));
-    }else {
-        if (m_NotTrackedDescriptors.find(&desc) == m_NotTrackedDescriptors.end()) {
-            m_NotTrackedDescriptors.insert(new ModuleDescriptor(desc));
-        }
-        else {
-            return false;
-        }
+        flushPageCache();
     }
     return true;
 }
@@ -649,88 +783,42 @@ void ModuleTransitionState::unloadDescriptor(const ModuleDescriptor &desc)
     d.Pid = desc.Pid;
     d.Size = desc.Size;
 
-    DescriptorSet::iterator it = m_Descriptors.find(&d);
-    if (it != m_Descriptors.end()) {
-        if (m_CachedModule == *it) {
-            m_CachedModule = NULL;
-        }
-
-        if (m_PreviousModule == *it) {
+    ModuleMap *newTable = m_Descriptors->remove(d);
+    if (newTable) {
+        if (m_PreviousModule && !newTable->contains(m_PreviousModule)) {
             m_PreviousModule = NULL;
         }
-
-        const ModuleDescriptor *md = *it;
-        size_t s = m_Descriptors.erase(*it);
-        assert(s == 1);
-        delete md;
+        m_Descriptors = newTable;
+        flushPageCache();
     }
 
-    it = m_NotTrackedDescriptors.find(&d);
-    if (it != m_NotTrackedDescriptors.end()) {
-        assert(*it != m_CachedModule && *it != m_PreviousModule);
-        const ModuleDescriptor *md = *it;
-        size_t s = m_NotTrackedDescriptors.erase(*it);
-        assert(s == 1);
-        delete md;
+    newTable = m_NotTrackedDescriptors->remove(d);
+    if (newTable) {
+        m_NotTrackedDescriptors = newTable;
     }
 }
 
 void ModuleTransitionState::unloadDescriptorsWithPid(uint64_t pid)
 {
-    DescriptorSet::iterator it, it1;
-
-    for (it = m_Descriptors.begin(); it != m_Descriptors.end(); ) {
-        if ((*it)->Pid != pid) {
-            ++it;
-        }else {
-            it1 = it;
-            ++it1;
-
-            if (m_CachedModule == *it) {
-                m_CachedModule = NULL;
-            }
-
-            if (m_PreviousModule == *it) {
-                m_PreviousModule = NULL;
-            }
-
-            const ModuleDescriptor *md = *it;
-            m_Descriptors.erase(*it);
-            delete md;
-
-            it = it1;
+    ModuleMap *newTable = m_Descriptors->removePid(pid);
+    if (newTable) {
+        if (m_PreviousModule && m_PreviousModule->Pid == pid) {
+            m_PreviousModule = NULL;
         }
+        m_Descriptors = newTable;
+        flushPageCache();
     }
 
-    //XXX: avoid copy/paste
-    for (it = m_NotTrackedDescriptors.begin(); it != m_NotTrackedDescriptors.end(); ) {
-        if ((*it)->Pid != pid) {
-            ++it;
-        }else {
-            it1 = it;
-            ++it1;
-
-            if (m_CachedModule == *it) {
-                m_CachedModule = NULL;
-            }
-
-            if (m_PreviousModule == *it) {
-                m_PreviousModule = NULL;
-            }
-
-            const ModuleDescriptor *md = *it;
-            m_NotTrackedDescriptors.erase(*it);
-            delete md;
-
-            it = it1;
-        }
+    newTable = m_NotTrackedDescriptors->removePid(pid);
+    if (newTable) {
+        m_NotTrackedDescriptors = newTable;
     }
 }
 
 bool ModuleTransitionState::exists(const ModuleDescriptor *desc, bool tracked) const
 {
     bool ret;
-    ret = m_Descriptors.find(desc) != m_Descriptors.end();
+    ret = m_Descriptors->overlaps(*desc);
     if (ret) {
         return ret;
     }
@@ -739,5 +827,5 @@ bool ModuleTransitionState::exists(const ModuleDescriptor *desc, bool tracked) c
         return false;
     }
 
-    return m_NotTrackedDescriptors.find(desc) != m_NotTrackedDescriptors.end();
+    return m_NotTrackedDescriptors->overlaps(*desc);
 }
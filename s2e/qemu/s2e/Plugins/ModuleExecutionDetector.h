@@ -44,7 +44,10 @@
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/Plugins/OSMonitor.h>
 
+#include <klee/util/Ref.h>
+
 #include <inttypes.h>
+#include <vector>
 #include "OSMonitor.h"
 
 namespace s2e {
@@ -212,17 +215,112 @@ public:
 };
 
 
+/**
+ *  Translation filter that matches blocks belonging to tracked modules,
+ *  optionally restricted to a set of configured module ids.
+ */
+class ModuleTranslationFilter : public TranslationFilter
+{
+private:
+    ModuleExecutionDetector *m_detector;
+    std::set<std::string> m_moduleIds;
+
+public:
+    ModuleTranslationFilter(Plugin *owner, ModuleExecutionDetector *detector):
+        TranslationFilter(owner), m_detector(detector) {}
+
+    void addModuleId(const std::string &id) {
+        m_moduleIds.insert(id);
+    }
+
+    virtual bool matchesBlock(S2EExecutionState *state, TranslationBlock *tb, uint64_t pc);
+};
+
+/**
+ *  Immutable address-indexed table of module descriptors.
+ *  Entries are kept sorted by (Pid, LoadBase) so that lookups are a binary
+ *  search. Tables are reference-counted and shared between forked states:
+ *  loading or unloading a module builds a new table, all other operations
+ *  are read-only. Descriptors themselves are shared between successive
+ *  tables, so pointers handed out to plugins stay valid as long as
+ *  the module is loaded in the state.
+ */
+class ModuleMap
+{
+public:
+    struct Entry {
+        unsigned refCount;
+        ModuleDescriptor desc;
+
+        Entry(const ModuleDescriptor &d) : refCount(0), desc(d) {}
+    };
+
+    typedef klee::ref<Entry> EntryRef;
+    typedef std::vector<EntryRef> Entries;
+
+    unsigned refCount;
+
+private:
+    Entries m_Entries;
+
+    /* Index of the first entry that does not come before (pid, address) */
+    unsigned lowerBound(uint64_t pid, uint64_t address) const;
+
+public:
+    ModuleMap() : refCount(0) {}
+
+    /**
+     *  Returns the module that contains pc in the address space of pid.
+     *  If pageClean is not NULL, it is set to true when the page of pc
+     *  does not overlap with any other module, i.e., the result is valid
+     *  for every address of that page.
+     */
+    const ModuleDescriptor *lookup(uint64_t pid, uint64_t pc, bool *pageClean = NULL) const;
+
+    /* Returns true if some loaded module overlaps with desc */
+    bool overlaps(const ModuleDescriptor &desc) const;
+
+    /* Copy-on-write updates, return NULL if nothing changed */
+    ModuleMap *insert(const ModuleDescriptor &desc) const;
+    ModuleMap *remove(const ModuleDescriptor &desc) const;
+    ModuleMap *removePid(uint64_t pid) const;
+
+    bool contains(const ModuleDescriptor *desc) const;
+
+    const Entries &getEntries() const {
+        return m_Entries;
+    }
+
+    bool empty() const {
+        return m_Entries.empty();
+    }
+};
+
 class ModuleTransitionState:public PluginState
 {
 private:
-    typedef std::set<const ModuleDescriptor*, ModuleDescriptor::ModuleByLoadBase> DescriptorSet;
+    /**
+     *  Direct-mapped per-state cache of page -> descriptor translations.
+     *  Only pages entirely covered by a single module (or by none)
+     *  are cached, so a hit never needs to look at the table.
+     */
+    struct PageCacheEntry {
+        uint64_t pid;
+        uint64_t page;
+        const ModuleDescriptor *module;
+    };
+
+    static const unsigned PAGE_CACHE_BITS = 8;
+    static const unsigned PAGE_CACHE_SIZE = 1 << PAGE_CACHE_BITS;
 
     const ModuleDescriptor *m_PreviousModule;
-    mutable const ModuleDescriptor *m_CachedModule;
 
-    DescriptorSet m_Descriptors;
-    DescriptorSet m_NotTrackedDescriptors;
+    klee::ref<ModuleMap> m_Descriptors;
+    klee::ref<ModuleMap> m_NotTrackedDescriptors;
+
+    mutable PageCacheEntry m_PageCache[PAGE_CACHE_SIZE];
 
+    void flushPageCache();
     const ModuleDescriptor *getDescriptor(uint64_t pid, uint64_t pc, bool tracked=true) const;
     bool loadDescriptor(const ModuleDescriptor &desc, bool track);
     void unloadDescriptor(const ModuleDescriptor &desc);
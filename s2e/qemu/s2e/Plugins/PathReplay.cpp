@@ -0,0 +1,972 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "PathReplay.h"
+#include <s2e/Plugins/CoverageBitmap.h>
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+
+#include <llvm/Support/TimeValue.h>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(PathReplay, "Replaces idle states by their fork decisions and replays them later",
+                  "PathReplay");
+
+void PathReplay::initialize()
+{
+    m_executor = s2e()->getExecutor();
+
+    m_maxResidentStates = s2e()->getConfig()->getInt(getConfigKey() + ".maxResidentStates", 1000);
+    m_minResidentStates = s2e()->getConfig()->getInt(getConfigKey() + ".minResidentStates",
+                                                     m_maxResidentStates / 2);
+    m_checkpointInterval = s2e()->getConfig()->getInt(getConfigKey() + ".checkpointInterval", 64);
+    m_divergenceMargin = s2e()->getConfig()->getInt(getConfigKey() + ".divergenceMargin", 1000);
+    m_journalInterval = s2e()->getConfig()->getInt(getConfigKey() + ".journalInterval", 60);
+    std::string resumeFile = s2e()->getConfig()->getString(getConfigKey() + ".resume", "");
+
+    if (m_minResidentStates > m_maxResidentStates) {
+        s2e()->getWarningsStream() << "PathReplay: minResidentStates must not exceed maxResidentStates\n";
+        exit(-1);
+    }
+
+    m_evictedStates = 0;
+    m_materializedStates = 0;
+    m_replayedForks = 0;
+    m_divergences = 0;
+    m_checkpointCount = 0;
+
+    m_coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
+    m_journal = NULL;
+    m_lastJournalTime = llvm::sys::TimeValue::now().toEpochTime();
+    m_journalEpoch = 0;
+    //The initial state has path 0
+    m_nextPathId = 1;
+
+    m_root = NULL;
+    m_rootRequested = false;
+    m_rootScheduled = false;
+    m_rootFailed = false;
+    m_exportedPaths = 0;
+    m_importedPaths = 0;
+
+    if (!resumeFile.empty()) {
+        loadJournal(resumeFile);
+        if (!m_rootPaths.empty()) {
+            scheduleRootCheckpoint();
+        }
+    }
+
+    if (m_journalInterval) {
+        openJournal();
+
+        s2e()->getCorePlugin()->onTimer.connect(
+                sigc::mem_fun(*this, &PathReplay::onTimer));
+
+        s2e()->getCorePlugin()->onProcessForkComplete.connect(
+                sigc::mem_fun(*this, &PathReplay::onProcessForkComplete));
+    }
+
+    s2e()->getCorePlugin()->onStateSelect.connect(
+            sigc::mem_fun(*this, &PathReplay::onStateSelect));
+
+    s2e()->getCorePlugin()->onStateSwitch.connect(
+            sigc::mem_fun(*this, &PathReplay::onStateSwitch));
+
+    s2e()->getCorePlugin()->onStateKill.connect(
+            sigc::mem_fun(*this, &PathReplay::onStateKill));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &PathReplay::onStateFork));
+}
+
+PathReplay::~PathReplay()
+{
+    if (m_journal) {
+        writeJournal();
+        delete m_journal;
+    }
+
+    //Checkpoints may outlive the plugin, they are released with the states
+    foreach2(it, m_frontier.begin(), m_frontier.end()) {
+        --(*it)->checkpoint->refCount;
+        delete *it;
+    }
+
+    foreach2(it, m_rootPaths.begin(), m_rootPaths.end()) {
+        delete *it;
+    }
+
+    if (m_root) {
+        --m_root->refCount;
+    }
+
+    s2e()->getMessagesStream() << "PathReplay: " << m_evictedStates << " states evicted, "
+            << m_materializedStates << " materialized, " << m_frontier.size() << " left, "
+            << m_replayedForks << " forks replayed, " << m_divergences << " divergences, "
+            << m_checkpointCount << " checkpoints, " << m_exportedPaths << " paths exported, "
+            << m_importedPaths << " imported\n";
+}
+
+static uint64_t getBlockCount(S2EExecutionState *state)
+{
+    return state->m_stats.m_statTranslationBlockConcrete +
+           state->m_stats.m_statTranslationBlockSymbolic;
+}
+
+void PathReplay::touch(S2EExecutionState *state)
+{
+    StateIndex::iterator it = m_residentIndex.find(state);
+    if (it != m_residentIndex.end()) {
+        m_residentStates.erase((*it).second);
+    }
+
+    m_residentStates.push_front(state);
+    m_residentIndex[state] = m_residentStates.begin();
+}
+
+bool PathReplay::canEvict(S2EExecutionState *state, S2EExecutionState *current)
+{
+    if (state == current || state->isZombie() || state->isYielded() ||
+        state->isSpeculative()) {
+        return false;
+    }
+
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    return plgState->m_checkpoint && !plgState->isReplaying();
+}
+
+void PathReplay::evictStates(S2EExecutionState *current)
+{
+    if (m_residentStates.size() <= m_maxResidentStates) {
+        return;
+    }
+
+    unsigned excess = m_residentStates.size() - m_maxResidentStates;
+    std::vector<S2EExecutionState*> victims;
+
+    foreach2(it, m_residentStates.rbegin(), m_residentStates.rend()) {
+        if (victims.size() == excess) {
+            break;
+        }
+        if (canEvict(*it, current)) {
+            victims.push_back(*it);
+        }
+    }
+
+    foreach2(it, victims.begin(), victims.end()) {
+        S2EExecutionState *state = *it;
+        DECLARE_PLUGINSTATE(PathReplayState, state);
+
+        FrontierEntry *entry = new FrontierEntry;
+        entry->pathId = plgState->m_pathId;
+        entry->checkpoint = plgState->m_checkpoint;
+        entry->decisions = plgState->m_decisions;
+        getInputs(state, entry->inputs);
+        ++entry->checkpoint->refCount;
+        m_frontier.push_back(entry);
+
+        s2e()->getDebugStream() << "PathReplay: evicting state " << state->getID()
+                << " (" << entry->decisions.size() << " forks from its checkpoint)\n";
+
+        ++m_evictedStates;
+        m_executor->killState(state);
+    }
+}
+
+void PathReplay::materializeStates()
+{
+    while (m_residentStates.size() < m_minResidentStates && !m_frontier.empty()) {
+        FrontierEntry *entry = m_frontier.front();
+        m_frontier.pop_front();
+
+        S2EExecutionState *state = m_executor->copyState(entry->checkpoint->state);
+        DECLARE_PLUGINSTATE(PathReplayState, state);
+        plgState->m_pathId = entry->pathId;
+        plgState->setCheckpoint(entry->checkpoint);
+        plgState->m_replay.swap(entry->decisions);
+        plgState->m_replayPosition = 0;
+        plgState->m_forkBlocks = getBlockCount(state);
+
+        //Concolic execution keeps the state on the side of the branch
+        //chosen by these values, the other successors get killed.
+        //Arrays created after the checkpoint get theirs at the end.
+        setInputs(state, entry->inputs);
+        if (plgState->isReplaying()) {
+            plgState->m_inputs.swap(entry->inputs);
+        }
+
+        --entry->checkpoint->refCount;
+        delete entry;
+
+        s2e()->getDebugStream() << "PathReplay: materializing state " << state->getID()
+                << " (" << plgState->m_replay.size() << " forks to replay)\n";
+
+        ++m_materializedStates;
+        m_executor->addState(state);
+        touch(state);
+    }
+}
+
+void PathReplay::checkpoint(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    if (plgState->m_checkpoint && plgState->m_decisions.size() < m_checkpointInterval) {
+        return;
+    }
+
+    if (state->isZombie() || state->isYielded() || state->isSpeculative() ||
+        plgState->isReplaying()) {
+        return;
+    }
+
+    Checkpoint *checkpoint = new Checkpoint;
+    checkpoint->state = m_executor->copyState(state);
+    getPath(state, checkpoint->prefix);
+    checkpoint->refCount = 0;
+    m_checkpoints.insert(checkpoint);
+    ++m_checkpointCount;
+
+    //The checkpoint itself does not replay from the previous one
+    DECLARE_PLUGINSTATE_N(PathReplayState, checkpointState, checkpoint->state);
+    checkpointState->setCheckpoint(NULL);
+    checkpointState->m_decisions.clear();
+
+    plgState->setCheckpoint(checkpoint);
+    plgState->m_decisions.clear();
+}
+
+void PathReplay::collectCheckpoints()
+{
+    std::set<Checkpoint*>::iterator it = m_checkpoints.begin();
+    while (it != m_checkpoints.end()) {
+        Checkpoint *checkpoint = *it;
+        if (checkpoint->refCount) {
+            ++it;
+            continue;
+        }
+
+        m_executor->discardState(checkpoint->state);
+        delete checkpoint;
+        m_checkpoints.erase(it++);
+    }
+}
+
+/**
+ *  A branch of the recorded path may have become concrete, in which case
+ *  the state never forks there. The replay ends when the state ran well
+ *  past the number of blocks after which it forked when it was recorded.
+ */
+void PathReplay::checkReplayProgress(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    if (!plgState->isReplaying()) {
+        return;
+    }
+
+    const ForkDecision &decision = plgState->m_replay[plgState->m_replayPosition];
+    if (decision.blocks == ForkDecision::UNKNOWN_BLOCKS) {
+        return;
+    }
+
+    uint64_t elapsed = getBlockCount(state) - plgState->m_forkBlocks;
+    if (elapsed <= (uint64_t) decision.blocks + decision.blocks / 4 + m_divergenceMargin) {
+        return;
+    }
+
+    ++m_divergences;
+    s2e()->getWarningsStream(state) << "PathReplay: state did not fork at "
+            << hexval(decision.pc) << " within " << elapsed << " blocks, ending its replay\n";
+    endReplay(state);
+}
+
+/** Binds the concolic values of the arrays created since the checkpoint.
+    The state then forks on its own. */
+void PathReplay::endReplay(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    plgState->m_replay.clear();
+    plgState->m_replayPosition = 0;
+    setInputs(state, plgState->m_inputs);
+    plgState->m_inputs.clear();
+}
+
+void PathReplay::onStateSelect(S2EExecutionState *state)
+{
+    if (m_rootScheduled && !m_root && !m_rootFailed) {
+        createRoot(state);
+    }
+
+    if (!state->isZombie()) {
+        touch(state);
+        checkReplayProgress(state);
+        checkpoint(state);
+    }
+
+    evictStates(state);
+    materializeStates();
+    collectCheckpoints();
+}
+
+void PathReplay::onStateSwitch(S2EExecutionState *current, S2EExecutionState *next)
+{
+    touch(next);
+}
+
+void PathReplay::onStateKill(S2EExecutionState *state)
+{
+    StateIndex::iterator it = m_residentIndex.find(state);
+    if (it != m_residentIndex.end()) {
+        m_residentStates.erase((*it).second);
+        m_residentIndex.erase(it);
+    }
+}
+
+void PathReplay::onStateFork(S2EExecutionState *state,
+                             const std::vector<S2EExecutionState*> &newStates,
+                             const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    foreach2(it, newStates.begin(), newStates.end()) {
+        if (*it != state) {
+            touch(*it);
+        }
+    }
+
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    uint64_t blocks = getBlockCount(state);
+    uint64_t elapsed = blocks - plgState->m_forkBlocks;
+
+    foreach2(it, newStates.begin(), newStates.end()) {
+        DECLARE_PLUGINSTATE_N(PathReplayState, newState, *it);
+        newState->m_forkBlocks = blocks;
+    }
+
+    if (plgState->isReplaying()) {
+        replayFork(state, newStates);
+        return;
+    }
+
+    ForkDecision decision;
+    decision.pc = state->getPc();
+    decision.count = newStates.size();
+    decision.blocks = std::min<uint64_t>(elapsed, ForkDecision::UNKNOWN_BLOCKS - 1);
+
+    for (unsigned i = 0; i < newStates.size(); ++i) {
+        DECLARE_PLUGINSTATE_N(PathReplayState, newState, newStates[i]);
+        decision.index = i;
+        newState->m_decisions.push_back(decision);
+        newState->m_pathId = m_nextPathId++;
+    }
+}
+
+/**
+ *  Keeps the successor on the recorded path and kills the others. The
+ *  kills are scheduled, so that the plugins connected after this one
+ *  still see the fork.
+ */
+void PathReplay::replayFork(S2EExecutionState *state,
+                            const std::vector<S2EExecutionState*> &newStates)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    ForkDecision decision = plgState->m_replay[plgState->m_replayPosition];
+
+    S2EExecutionState *survivor = NULL;
+    if (decision.pc == state->getPc() && decision.count == newStates.size()) {
+        ++m_replayedForks;
+        survivor = newStates[decision.index];
+
+        //The successors were copied from the state before the fork
+        DECLARE_PLUGINSTATE_N(PathReplayState, survivorState, survivor);
+        survivorState->m_decisions.push_back(decision);
+        if (++survivorState->m_replayPosition == survivorState->m_replay.size()) {
+            endReplay(survivor);
+        }
+    } else {
+        ++m_divergences;
+        s2e()->getWarningsStream(state) << "PathReplay: state diverged from its path at "
+                << hexval(state->getPc()) << ", expected a fork at " << hexval(decision.pc) << '\n';
+    }
+
+    foreach2(it, newStates.begin(), newStates.end()) {
+        if (*it != survivor) {
+            m_executor->scheduleStateKill(*it);
+        }
+    }
+}
+
+/** Forks from the start of the execution, including those left to replay */
+void PathReplay::getPath(S2EExecutionState *state, ForkDecisions &path)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    path.clear();
+    if (plgState->m_checkpoint) {
+        path = plgState->m_checkpoint->prefix;
+    }
+
+    const ForkDecisions &decisions = plgState->isReplaying() ?
+            plgState->m_replay : plgState->m_decisions;
+    path.insert(path.end(), decisions.begin(), decisions.end());
+}
+
+void PathReplay::getPath(const FrontierEntry *entry, ForkDecisions &path)
+{
+    path = entry->checkpoint->prefix;
+    path.insert(path.end(), entry->decisions.begin(), entry->decisions.end());
+}
+
+void PathReplay::getInputs(S2EExecutionState *state, Inputs &inputs)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    if (plgState->isReplaying()) {
+        inputs = plgState->m_inputs;
+        return;
+    }
+
+    inputs.clear();
+    foreach2(it, state->symbolics.begin(), state->symbolics.end()) {
+        klee::Assignment::bindings_ty::const_iterator bit =
+                state->concolics.bindings.find((*it).second);
+        if (bit != state->concolics.bindings.end()) {
+            inputs.push_back((*bit).second);
+        } else {
+            inputs.push_back(std::vector<unsigned char>());
+        }
+    }
+}
+
+/** Binds the values to the arrays the state already created */
+void PathReplay::setInputs(S2EExecutionState *state, const Inputs &inputs)
+{
+    for (unsigned i = 0; i < inputs.size() && i < state->symbolics.size(); ++i) {
+        const klee::Array *array = state->symbolics[i].second;
+        if (!inputs[i].empty() && inputs[i].size() == array->size) {
+            state->concolics.bindings[array] = inputs[i];
+        }
+    }
+}
+
+void PathReplay::openJournal()
+{
+    m_journal = s2e()->openOutputFile("frontier.journal");
+    m_journaledPaths.clear();
+    *m_journal << "# PathReplay frontier journal\n";
+}
+
+/**
+ *  Appends the paths that became pending since the last epoch and
+ *  retires those that were explored or killed. Only the changes are
+ *  written, but finding them walks all the pending paths. A run that stops
+ *  in the middle of an epoch leaves an incomplete epoch, which loadJournal
+ *  ignores.
+ */
+void PathReplay::writeJournal()
+{
+    std::tr1::unordered_set<uint64_t> pending;
+    ForkDecisions path;
+    Inputs inputs;
+
+    foreach2(it, m_residentStates.begin(), m_residentStates.end()) {
+        S2EExecutionState *state = *it;
+        if (state->isZombie()) {
+            continue;
+        }
+
+        DECLARE_PLUGINSTATE(PathReplayState, state);
+        pending.insert(plgState->m_pathId);
+        if (!m_journaledPaths.count(plgState->m_pathId)) {
+            getPath(state, path);
+            getInputs(state, inputs);
+            *m_journal << "+ ";
+            writePath(*m_journal, plgState->m_pathId, path, inputs);
+            *m_journal << "\n";
+        }
+    }
+
+    foreach2(it, m_frontier.begin(), m_frontier.end()) {
+        FrontierEntry *entry = *it;
+        pending.insert(entry->pathId);
+        if (!m_journaledPaths.count(entry->pathId)) {
+            getPath(entry, path);
+            *m_journal << "+ ";
+            writePath(*m_journal, entry->pathId, path, entry->inputs);
+            *m_journal << "\n";
+        }
+    }
+
+    foreach2(it, m_journaledPaths.begin(), m_journaledPaths.end()) {
+        if (!pending.count(*it)) {
+            *m_journal << "- " << *it << "\n";
+        }
+    }
+
+    m_journaledPaths.swap(pending);
+
+    m_lastJournalTime = llvm::sys::TimeValue::now().toEpochTime();
+    *m_journal << "# epoch " << ++m_journalEpoch << " " << m_lastJournalTime
+            << " " << m_journaledPaths.size() << "\n";
+    m_journal->flush();
+
+    if (m_coverage) {
+        m_coverage->saveBitmap();
+    }
+}
+
+/** <id> <fork count> <pc>:<index>:<count>[:<blocks>]... <array count> <hex values or ->... */
+void PathReplay::writePath(llvm::raw_ostream &os, uint64_t pathId,
+                           const ForkDecisions &path, const Inputs &inputs)
+{
+    static const char digits[] = "0123456789abcdef";
+
+    os << pathId << " " << path.size();
+    foreach2(it, path.begin(), path.end()) {
+        os << " " << hexval((*it).pc) << ":" << (unsigned) (*it).index
+           << ":" << (unsigned) (*it).count;
+        if ((*it).blocks != ForkDecision::UNKNOWN_BLOCKS) {
+            os << ":" << (*it).blocks;
+        }
+    }
+
+    os << " " << inputs.size();
+    foreach2(it, inputs.begin(), inputs.end()) {
+        if ((*it).empty()) {
+            os << " -";
+            continue;
+        }
+
+        std::string hex;
+        foreach2(bit, (*it).begin(), (*it).end()) {
+            hex += digits[*bit >> 4];
+            hex += digits[*bit & 0xf];
+        }
+        os << " " << hex;
+    }
+}
+
+/** Parses <pc>:<index>:<count>[:<blocks>] */
+static bool parseDecision(const std::string &token, PathReplay::ForkDecision &decision)
+{
+    const char *str = token.c_str();
+    char *end;
+
+    decision.pc = strtoull(str, &end, 16);
+    if (*end != ':') {
+        return false;
+    }
+
+    unsigned long index = strtoul(end + 1, &end, 10);
+    if (*end != ':') {
+        return false;
+    }
+
+    unsigned long count = strtoul(end + 1, &end, 10);
+    if ((*end && *end != ':') || index >= count || count > 255) {
+        return false;
+    }
+
+    decision.blocks = PathReplay::ForkDecision::UNKNOWN_BLOCKS;
+    if (*end == ':') {
+        unsigned long long blocks = strtoull(end + 1, &end, 10);
+        if (*end || blocks >= PathReplay::ForkDecision::UNKNOWN_BLOCKS) {
+            return false;
+        }
+        decision.blocks = blocks;
+    }
+
+    decision.index = index;
+    decision.count = count;
+    return true;
+}
+
+static bool parseInput(const std::string &hex, std::vector<unsigned char> &input)
+{
+    input.clear();
+    if (hex == "-") {
+        return true;
+    }
+
+    if (hex.size() % 2) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < hex.size(); i += 2) {
+        char *end;
+        std::string byte = hex.substr(i, 2);
+        unsigned long value = strtoul(byte.c_str(), &end, 16);
+        if (*end) {
+            return false;
+        }
+        input.push_back(value);
+    }
+    return true;
+}
+
+bool PathReplay::parsePath(std::istream &is, uint64_t &pathId,
+                           ForkDecisions &path, Inputs &inputs)
+{
+    unsigned count = 0;
+    bool ok = (is >> pathId) && (is >> count);
+
+    path.clear();
+    for (unsigned i = 0; ok && i < count; ++i) {
+        std::string token;
+        path.push_back(ForkDecision());
+        ok = (is >> token) && parseDecision(token, path.back());
+    }
+
+    inputs.clear();
+    ok = ok && (is >> count);
+    for (unsigned i = 0; ok && i < count; ++i) {
+        std::string token;
+        inputs.push_back(std::vector<unsigned char>());
+        ok = (is >> token) && parseInput(token, inputs.back());
+    }
+
+    return ok;
+}
+
+/** Parses "# epoch <number> <time> <pending paths>" */
+static bool parseEpoch(const std::string &line, uint64_t &pending)
+{
+    std::istringstream ss(line);
+    std::string hash, epoch, extra;
+    uint64_t number, time;
+
+    return (ss >> hash >> epoch >> number >> time >> pending) && !(ss >> extra) &&
+           hash == "#" && epoch == "epoch";
+}
+
+/**
+ *  Reconstructs the pending paths at the last complete epoch of the
+ *  journal. The records a crash leaves after it may be truncated in ways
+ *  that still parse, e.g., a shorter path id, so they are ignored.
+ */
+void PathReplay::loadJournal(const std::string &fileName)
+{
+    std::ifstream journal(fileName.c_str());
+    if (!journal) {
+        s2e()->getWarningsStream() << "PathReplay: could not open " << fileName << "\n";
+        exit(-1);
+    }
+
+    typedef std::vector<std::pair<uint64_t, FrontierEntry*> > Records;
+
+    std::map<uint64_t, FrontierEntry*> paths;
+    Records records;
+    unsigned malformed = 0, epochs = 0;
+    std::string line;
+
+    while (std::getline(journal, line)) {
+        //A last line without a newline was cut by the crash
+        if (journal.eof()) {
+            break;
+        }
+
+        std::istringstream ss(line);
+        std::string op;
+        uint64_t pathId;
+
+        if (!(ss >> op)) {
+            continue;
+        }
+
+        if (op == "#") {
+            uint64_t pending;
+            if (!parseEpoch(line, pending)) {
+                continue;
+            }
+
+            foreach2(it, records.begin(), records.end()) {
+                std::map<uint64_t, FrontierEntry*>::iterator pit = paths.find((*it).first);
+                if (pit != paths.end()) {
+                    delete (*pit).second;
+                    paths.erase(pit);
+                }
+                if ((*it).second) {
+                    paths[(*it).first] = (*it).second;
+                    if ((*it).first >= m_nextPathId) {
+                        m_nextPathId = (*it).first + 1;
+                    }
+                }
+            }
+            records.clear();
+            ++epochs;
+
+            if (paths.size() != pending) {
+                s2e()->getWarningsStream() << "PathReplay: epoch " << epochs << " of " << fileName
+                        << " lists " << pending << " pending paths, found " << paths.size() << "\n";
+            }
+            continue;
+        }
+
+        FrontierEntry *entry = NULL;
+        if (op == "+") {
+            entry = new FrontierEntry;
+            entry->checkpoint = NULL;
+            if (!parsePath(ss, pathId, entry->decisions, entry->inputs)) {
+                delete entry;
+                ++malformed;
+                continue;
+            }
+            entry->pathId = pathId;
+        } else if (op != "-" || !(ss >> pathId)) {
+            ++malformed;
+            continue;
+        }
+
+        records.push_back(std::make_pair(pathId, entry));
+    }
+
+    //Records of the incomplete epoch
+    unsigned discarded = records.size();
+    foreach2(it, records.begin(), records.end()) {
+        delete (*it).second;
+    }
+
+    foreach2(it, paths.begin(), paths.end()) {
+        m_rootPaths.push_back((*it).second);
+    }
+
+    s2e()->getMessagesStream() << "PathReplay: loaded " << paths.size()
+            << " pending paths from " << epochs << " epochs of " << fileName << " ("
+            << malformed << " malformed records skipped, " << discarded
+            << " records of an incomplete epoch ignored)\n";
+}
+
+bool PathReplay::exportPath(ForkDecisions &path, Inputs &inputs)
+{
+    if (m_frontier.empty()) {
+        return false;
+    }
+
+    FrontierEntry *entry = m_frontier.front();
+    m_frontier.pop_front();
+
+    getPath(entry, path);
+    inputs.swap(entry->inputs);
+
+    --entry->checkpoint->refCount;
+    delete entry;
+
+    ++m_exportedPaths;
+    return true;
+}
+
+void PathReplay::importPath(const ForkDecisions &path, const Inputs &inputs)
+{
+    FrontierEntry *entry = new FrontierEntry;
+    entry->pathId = m_nextPathId++;
+    entry->checkpoint = m_root;
+    entry->decisions = path;
+    entry->inputs = inputs;
+
+    if (m_root) {
+        ++m_root->refCount;
+        m_frontier.push_back(entry);
+    } else if (!m_rootFailed) {
+        m_rootPaths.push_back(entry);
+        scheduleRootCheckpoint();
+    } else {
+        s2e()->getWarningsStream() << "PathReplay: dropping imported path, "
+                << "there is no root checkpoint\n";
+        delete entry;
+        return;
+    }
+
+    ++m_importedPaths;
+}
+
+void PathReplay::scheduleRootCheckpoint()
+{
+    if (m_rootRequested) {
+        return;
+    }
+
+    m_rootRequested = true;
+    m_rootConnection = s2e()->getCorePlugin()->onTranslateBlockStart.connect(
+            sigc::mem_fun(*this, &PathReplay::onTranslateBlockStart));
+}
+
+/**
+ *  The paths start at the beginning of the execution. The initial state,
+ *  stopped before its first block, becomes their common checkpoint. This
+ *  only works if they were recorded from the same snapshot.
+ */
+void PathReplay::createRoot(S2EExecutionState *state)
+{
+    DECLARE_PLUGINSTATE(PathReplayState, state);
+    if (!state->isZombie() && !plgState->m_checkpoint && plgState->m_decisions.empty() &&
+        m_residentStates.size() <= 1) {
+        touch(state);
+        checkpoint(state);
+    }
+
+    Checkpoint *root = plgState->m_checkpoint;
+    if (!root || !root->prefix.empty()) {
+        s2e()->getWarningsStream(state) << "PathReplay: cannot create the root checkpoint, "
+                << "the execution already forked\n";
+        foreach2(it, m_rootPaths.begin(), m_rootPaths.end()) {
+            delete *it;
+        }
+        m_rootPaths.clear();
+        m_rootFailed = true;
+        return;
+    }
+
+    //Paths may still be imported later
+    m_root = root;
+    ++m_root->refCount;
+
+    if (m_rootPaths.empty()) {
+        return;
+    }
+
+    s2e()->getMessagesStream(state) << "PathReplay: replaying " << m_rootPaths.size()
+            << " paths from the start of the execution\n";
+
+    //The current state stands at the root and replays the first path
+    FrontierEntry *first = m_rootPaths.front();
+    plgState->m_pathId = first->pathId;
+    plgState->m_replay.swap(first->decisions);
+    plgState->m_replayPosition = 0;
+    plgState->m_forkBlocks = getBlockCount(state);
+    setInputs(state, first->inputs);
+    if (plgState->isReplaying()) {
+        plgState->m_inputs.swap(first->inputs);
+    }
+    delete first;
+
+    for (unsigned i = 1; i < m_rootPaths.size(); ++i) {
+        FrontierEntry *entry = m_rootPaths[i];
+        entry->checkpoint = root;
+        ++root->refCount;
+        m_frontier.push_back(entry);
+    }
+    m_rootPaths.clear();
+}
+
+void PathReplay::onTranslateBlockStart(ExecutionSignal *signal,
+                                       S2EExecutionState *state,
+                                       TranslationBlock *tb,
+                                       uint64_t pc)
+{
+    signal->connect(sigc::mem_fun(*this, &PathReplay::onRootPoint));
+}
+
+/** Leaves the cpu loop before the first block runs, so that the initial
+    state is copied before it can fork */
+void PathReplay::onRootPoint(S2EExecutionState *state, uint64_t pc)
+{
+    if (m_rootScheduled) {
+        return;
+    }
+
+    m_rootScheduled = true;
+    m_rootConnection.disconnect();
+    m_executor->scheduleStateSwitch();
+
+    state->writeCpuState(CPU_OFFSET(exception_index), EXCP_S2E, 8*sizeof(int));
+    throw CpuExitException();
+}
+
+void PathReplay::onTimer()
+{
+    uint64_t now = llvm::sys::TimeValue::now().toEpochTime();
+    if (now - m_lastJournalTime >= m_journalInterval) {
+        writeJournal();
+    }
+}
+
+/** The child has its own output directory and starts a new journal */
+void PathReplay::onProcessForkComplete(bool isChild)
+{
+    if (isChild) {
+        delete m_journal;
+        openJournal();
+    }
+}
+
+PathReplayState::PathReplayState()
+{
+    m_pathId = 0;
+    m_checkpoint = NULL;
+    m_forkBlocks = 0;
+    m_replayPosition = 0;
+}
+
+PathReplayState::~PathReplayState()
+{
+    setCheckpoint(NULL);
+}
+
+void PathReplayState::setCheckpoint(PathReplay::Checkpoint *checkpoint)
+{
+    if (checkpoint) {
+        ++checkpoint->refCount;
+    }
+    if (m_checkpoint) {
+        --m_checkpoint->refCount;
+    }
+    m_checkpoint = checkpoint;
+}
+
+PathReplayState* PathReplayState::clone() const
+{
+    PathReplayState *ret = new PathReplayState(*this);
+    if (ret->m_checkpoint) {
+        ++ret->m_checkpoint->refCount;
+    }
+    return ret;
+}
+
+PluginState *PathReplayState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new PathReplayState();
+}
+
+} // namespace plugins
+} // namespace s2e
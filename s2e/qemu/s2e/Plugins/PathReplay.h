@@ -0,0 +1,269 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_PATHREPLAY_H
+#define S2E_PLUGINS_PATHREPLAY_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+#include <s2e/S2EExecutor.h>
+
+#include <deque>
+#include <istream>
+#include <list>
+#include <set>
+#include <string>
+#include <tr1/unordered_map>
+#include <tr1/unordered_set>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+class CoverageBitmap;
+
+/**
+ *  Keeps at most maxResidentStates states in memory.
+ *
+ *  Every state records the forks it went through since its checkpoint,
+ *  a copy of one of its ancestors that is never scheduled. When there are
+ *  too many states, the least recently scheduled ones are replaced by
+ *  their fork decisions and concolic values. When fewer than
+ *  minResidentStates remain, these states are recreated by copying their
+ *  checkpoint and killing, at each fork, the successors that are not on
+ *  the recorded path. The current state gets a new checkpoint when it
+ *  forked checkpointInterval times since its last one, which bounds the
+ *  length of replays.
+ *
+ *  The paths of the pending states, from the start of the execution, are
+ *  periodically appended to a journal in the output directory. Another
+ *  run started from the same snapshot resumes the campaign by replaying
+ *  them from its initial state. Paths can also be exported to and
+ *  imported from other runs, e.g., on other hosts.
+ */
+class PathReplay : public Plugin
+{
+    S2E_PLUGIN
+public:
+    PathReplay(S2E* s2e): Plugin(s2e) {}
+    virtual ~PathReplay();
+
+    void initialize();
+
+    /** Index of the successor taken at a fork, out of count */
+    struct ForkDecision {
+        static const uint32_t UNKNOWN_BLOCKS = 0xffffffff;
+
+        uint64_t pc;
+        uint8_t index;
+        uint8_t count;
+        /* Translation blocks executed since the previous fork */
+        uint32_t blocks;
+    };
+
+    typedef std::vector<ForkDecision> ForkDecisions;
+
+    /** Concolic values of the symbolic arrays, in creation order.
+        Arrays without values are empty. */
+    typedef std::vector<std::vector<unsigned char> > Inputs;
+
+    struct Checkpoint {
+        S2EExecutionState *state;
+        /* Forks from the start of the execution to the checkpoint */
+        ForkDecisions prefix;
+        /* States and frontier entries that replay from this checkpoint */
+        unsigned refCount;
+    };
+
+    /** Writes a path in the format of the journal, without the newline */
+    static void writePath(llvm::raw_ostream &os, uint64_t pathId,
+                          const ForkDecisions &path, const Inputs &inputs);
+
+    /** Reads a path written by writePath. Returns false if it is malformed. */
+    static bool parsePath(std::istream &is, uint64_t &pathId,
+                          ForkDecisions &path, Inputs &inputs);
+
+    /** Removes the least recently evicted state and returns its path
+        from the start of the execution */
+    bool exportPath(ForkDecisions &path, Inputs &inputs);
+
+    /** Queues a path from the start of the execution for replay */
+    void importPath(const ForkDecisions &path, const Inputs &inputs);
+
+    /** Copies the initial state before its first block, so that
+        imported paths can be replayed from it */
+    void scheduleRootCheckpoint();
+
+    /** Number of evicted and imported states */
+    unsigned getFrontierSize() const {
+        return m_frontier.size() + m_rootPaths.size();
+    }
+
+private:
+    /** An evicted state */
+    struct FrontierEntry {
+        uint64_t pathId;
+        Checkpoint *checkpoint;
+        ForkDecisions decisions;
+        Inputs inputs;
+    };
+
+    /* Most recently scheduled states first */
+    typedef std::list<S2EExecutionState*> StateList;
+    typedef std::tr1::unordered_map<S2EExecutionState*, StateList::iterator> StateIndex;
+
+    S2EExecutor *m_executor;
+
+    unsigned m_maxResidentStates;
+    unsigned m_minResidentStates;
+    unsigned m_checkpointInterval;
+    unsigned m_divergenceMargin;
+
+    StateList m_residentStates;
+    StateIndex m_residentIndex;
+    std::deque<FrontierEntry*> m_frontier;
+    std::set<Checkpoint*> m_checkpoints;
+
+    CoverageBitmap *m_coverage;
+
+    llvm::raw_ostream *m_journal;
+    unsigned m_journalInterval;
+    uint64_t m_lastJournalTime;
+    uint64_t m_journalEpoch;
+    /* Paths that are pending according to the journal */
+    std::tr1::unordered_set<uint64_t> m_journaledPaths;
+    uint64_t m_nextPathId;
+
+    /* Copy of the initial state, from which imported paths replay */
+    Checkpoint *m_root;
+    /* Imported paths waiting for the root checkpoint */
+    std::vector<FrontierEntry*> m_rootPaths;
+    sigc::connection m_rootConnection;
+    bool m_rootRequested;
+    bool m_rootScheduled;
+    bool m_rootFailed;
+
+    uint64_t m_evictedStates;
+    uint64_t m_materializedStates;
+    uint64_t m_replayedForks;
+    uint64_t m_divergences;
+    uint64_t m_checkpointCount;
+    uint64_t m_exportedPaths;
+    uint64_t m_importedPaths;
+
+    void touch(S2EExecutionState *state);
+
+    bool canEvict(S2EExecutionState *state, S2EExecutionState *current);
+    void evictStates(S2EExecutionState *current);
+    void materializeStates();
+    void checkpoint(S2EExecutionState *state);
+    void checkReplayProgress(S2EExecutionState *state);
+    void endReplay(S2EExecutionState *state);
+    void collectCheckpoints();
+
+    void getPath(S2EExecutionState *state, ForkDecisions &path);
+    void getPath(const FrontierEntry *entry, ForkDecisions &path);
+    void getInputs(S2EExecutionState *state, Inputs &inputs);
+    void setInputs(S2EExecutionState *state, const Inputs &inputs);
+
+    void openJournal();
+    void writeJournal();
+    void loadJournal(const std::string &fileName);
+    void createRoot(S2EExecutionState *state);
+
+    void onTranslateBlockStart(ExecutionSignal *signal,
+                               S2EExecutionState *state,
+                               TranslationBlock *tb,
+                               uint64_t pc);
+
+    void onRootPoint(S2EExecutionState *state, uint64_t pc);
+
+    void onTimer();
+    void onProcessForkComplete(bool isChild);
+
+    void onStateSelect(S2EExecutionState *state);
+    void onStateSwitch(S2EExecutionState *current, S2EExecutionState *next);
+    void onStateKill(S2EExecutionState *state);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void replayFork(S2EExecutionState *state,
+                    const std::vector<S2EExecutionState*> &newStates);
+};
+
+class PathReplayState : public PluginState
+{
+private:
+    /* Identifies the path of the state in the journal */
+    uint64_t m_pathId;
+
+    PathReplay::Checkpoint *m_checkpoint;
+
+    /* Forks since the checkpoint */
+    PathReplay::ForkDecisions m_decisions;
+
+    /* Blocks executed when the state last forked or started replaying */
+    uint64_t m_forkBlocks;
+
+    /* Forks the state must follow before it forks on its own */
+    PathReplay::ForkDecisions m_replay;
+    unsigned m_replayPosition;
+
+    /* Concolic values to bind once the replay is over */
+    PathReplay::Inputs m_inputs;
+
+    void setCheckpoint(PathReplay::Checkpoint *checkpoint);
+
+    bool isReplaying() const {
+        return m_replayPosition < m_replay.size();
+    }
+
+public:
+    PathReplayState();
+    virtual ~PathReplayState();
+    virtual PathReplayState* clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class PathReplay;
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
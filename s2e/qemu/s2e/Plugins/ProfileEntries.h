@@ -0,0 +1,98 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_PROFILEENTRIES_H
+#define S2E_PLUGINS_PROFILEENTRIES_H
+
+#include <inttypes.h>
+
+/**
+ * On-disk format of the profiles written by the SamplingProfiler plugin.
+ * This header is shared with the profiler tool and must not depend on
+ * anything from QEMU or KLEE.
+ *
+ * Layout:
+ *   ProfileHeader
+ *   for each module (moduleCount times):
+ *      ProfileModuleHeader
+ *      char name[nameLength]             (not null-terminated)
+ *      ProfileBin bins[binCount]
+ */
+
+namespace s2e {
+namespace plugins {
+
+static const char PROFILE_MAGIC[4] = {'S', '2', 'E', 'P'};
+static const uint32_t PROFILE_VERSION = 1;
+
+struct ProfileHeader {
+    char magic[4];
+    uint32_t version;
+
+    //Sampling period in milliseconds
+    uint32_t interval;
+
+    //Size in bytes of the address range covered by one bin
+    uint32_t granularity;
+
+    uint32_t moduleCount;
+
+    uint64_t totalSamples;
+    uint64_t concreteSamples;
+    uint64_t symbolicSamples;
+}__attribute__((packed));
+
+struct ProfileModuleHeader {
+    uint32_t nameLength;
+    uint32_t binCount;
+
+    //Bins of known modules contain native addresses (i.e., relative
+    //to nativeBase). Samples that did not hit any known module are
+    //stored in a module with an empty name and absolute addresses.
+    uint64_t nativeBase;
+    uint64_t size;
+}__attribute__((packed));
+
+struct ProfileBin {
+    uint64_t pc;
+    uint32_t concreteCount;
+    uint32_t symbolicCount;
+}__attribute__((packed));
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+// XXX: qemu stuff should be included before anything from KLEE or LLVM !
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+#include <qemu-timer.h>
+}
+
+#include "SamplingProfiler.h"
+#include "ProfileEntries.h"
+
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/s2e_qemu.h>
+
+#include <string.h>
+#include <fstream>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(SamplingProfiler, "Samples the guest program counter at regular intervals",
+                  "SamplingProfiler");
+
+static void s2e_sampling_timer_cb(void *opaque)
+{
+    SamplingProfiler *p = static_cast<SamplingProfiler*>(opaque);
+    p->takeSample();
+    qemu_mod_timer(p->getTimer(), qemu_get_clock_ms(rt_clock) + p->getInterval());
+}
+
+void SamplingProfiler::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    //ModuleExecutionDetector is optional, without it all samples are
+    //attributed to absolute addresses.
+    m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+
+    m_fileName = cfg->getString(getConfigKey() + ".fileName", "profile.dat");
+
+    m_interval = cfg->getInt(getConfigKey() + ".interval", 10);
+    if (m_interval == 0) {
+        m_interval = 1;
+    }
+
+    unsigned granularity = cfg->getInt(getConfigKey() + ".granularity", 16);
+    if (granularity == 0 || (granularity & (granularity - 1))) {
+        s2e()->getWarningsStream() << "SamplingProfiler: granularity must be a power of two, using 16\n";
+        granularity = 16;
+    }
+    m_granularityMask = ~(uint64_t)(granularity - 1);
+
+    m_flushInterval = cfg->getInt(getConfigKey() + ".flushInterval", 10);
+
+    m_timer = NULL;
+    m_concreteSamples = 0;
+    m_symbolicSamples = 0;
+    m_secondsSinceFlush = 0;
+    m_dirty = false;
+
+    //QEMU clocks are not available yet when plugins get initialized.
+    //The sampling timer is armed on the first tick of the core timer.
+    s2e()->getCorePlugin()->onTimer.connect(
+            sigc::mem_fun(*this, &SamplingProfiler::onTimer));
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+    if (m_timer) {
+        qemu_del_timer(m_timer);
+        qemu_free_timer(m_timer);
+    }
+
+    if (m_dirty) {
+        writeProfile();
+    }
+}
+
+void SamplingProfiler::onTimer()
+{
+    if (!m_timer) {
+        s2e()->getDebugStream() << "SamplingProfiler: sampling every " << m_interval << " ms\n";
+        m_timer = qemu_new_timer_ms(rt_clock, s2e_sampling_timer_cb, this);
+        qemu_mod_timer(m_timer, qemu_get_clock_ms(rt_clock) + m_interval);
+        return;
+    }
+
+    if (m_flushInterval && ++m_secondsSinceFlush >= m_flushInterval) {
+        m_secondsSinceFlush = 0;
+        if (m_dirty) {
+            writeProfile();
+        }
+    }
+}
+
+void SamplingProfiler::takeSample()
+{
+    S2EExecutionState *state = g_s2e_state;
+    if (!state) {
+        return;
+    }
+
+    uint64_t pc = state->getPc();
+    ModuleProfile *profile;
+
+    const ModuleDescriptor *md = m_detector ? m_detector->getModule(state, pc, false) : NULL;
+    if (md) {
+        profile = &m_profiles[md->Name];
+        profile->nativeBase = md->NativeBase;
+        profile->size = md->Size;
+        pc = md->ToNativeBase(pc);
+    } else {
+        profile = &m_profiles[""];
+    }
+
+    Counts &counts = profile->bins[pc & m_granularityMask];
+    if (state->isRunningConcrete()) {
+        ++counts.concrete;
+        ++m_concreteSamples;
+    } else {
+        ++counts.symbolic;
+        ++m_symbolicSamples;
+    }
+
+    m_dirty = true;
+}
+
+void SamplingProfiler::writeProfile()
+{
+    std::string path = s2e()->getOutputFilename(m_fileName);
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out) {
+        s2e()->getWarningsStream() << "SamplingProfiler: could not open " << path << '\n';
+        return;
+    }
+
+    ProfileHeader hdr;
+    memcpy(hdr.magic, PROFILE_MAGIC, sizeof(hdr.magic));
+    hdr.version = PROFILE_VERSION;
+    hdr.interval = m_interval;
+    hdr.granularity = (uint32_t) (~m_granularityMask + 1);
+    hdr.moduleCount = m_profiles.size();
+    hdr.concreteSamples = m_concreteSamples;
+    hdr.symbolicSamples = m_symbolicSamples;
+    hdr.totalSamples = m_concreteSamples + m_symbolicSamples;
+    out.write((const char*) &hdr, sizeof(hdr));
+
+    std::vector<ProfileBin> bins;
+    foreach2(it, m_profiles.begin(), m_profiles.end()) {
+        const ModuleProfile &profile = (*it).second;
+
+        ProfileModuleHeader mhdr;
+        mhdr.nameLength = (*it).first.size();
+        mhdr.binCount = profile.bins.size();
+        mhdr.nativeBase = profile.nativeBase;
+        mhdr.size = profile.size;
+        out.write((const char*) &mhdr, sizeof(mhdr));
+        out.write((*it).first.data(), mhdr.nameLength);
+
+        bins.clear();
+        bins.reserve(profile.bins.size());
+        foreach2(bit, profile.bins.begin(), profile.bins.end()) {
+            ProfileBin bin;
+            bin.pc = (*bit).first;
+            bin.concreteCount = (*bit).second.concrete;
+            bin.symbolicCount = (*bit).second.symbolic;
+            bins.push_back(bin);
+        }
+
+        if (!bins.empty()) {
+            out.write((const char*) &bins[0], bins.size() * sizeof(ProfileBin));
+        }
+    }
+
+    m_dirty = false;
+}
+
+} // namespace plugins
+} // namespace s2e
@@ -0,0 +1,125 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_SAMPLINGPROFILER_H
+#define S2E_PLUGINS_SAMPLINGPROFILER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <tr1/unordered_map>
+#include <map>
+#include <string>
+
+struct QEMUTimer;
+
+namespace s2e {
+namespace plugins {
+
+/**
+ *  Statistical profiler for guest code.
+ *
+ *  A host timer periodically samples the program counter, the current
+ *  module and the execution mode (concrete/symbolic) of the running state.
+ *  The plugin does not instrument any translation block, so its overhead
+ *  only depends on the sampling frequency.
+ *
+ *  Samples are aggregated into per-module histograms and written to a
+ *  compact binary profile (see ProfileEntries.h) that can be analyzed
+ *  offline with the profiler tool.
+ */
+class SamplingProfiler : public Plugin
+{
+    S2E_PLUGIN
+public:
+    SamplingProfiler(S2E* s2e): Plugin(s2e) {}
+    virtual ~SamplingProfiler();
+
+    void initialize();
+
+    void takeSample();
+    void writeProfile();
+
+    QEMUTimer *getTimer() const {
+        return m_timer;
+    }
+
+    unsigned getInterval() const {
+        return m_interval;
+    }
+
+private:
+    struct Counts {
+        uint32_t concrete;
+        uint32_t symbolic;
+        Counts() : concrete(0), symbolic(0) {}
+    };
+
+    typedef std::tr1::unordered_map<uint64_t, Counts> Histogram;
+
+    struct ModuleProfile {
+        uint64_t nativeBase;
+        uint64_t size;
+        Histogram bins;
+        ModuleProfile() : nativeBase(0), size(0) {}
+    };
+
+    //Samples outside of any known module go to the entry with an empty name
+    typedef std::map<std::string, ModuleProfile> Profiles;
+
+    ModuleExecutionDetector *m_detector;
+    QEMUTimer *m_timer;
+
+    Profiles m_profiles;
+    uint64_t m_concreteSamples;
+    uint64_t m_symbolicSamples;
+
+    std::string m_fileName;
+    unsigned m_interval;
+    uint64_t m_granularityMask;
+    unsigned m_flushInterval;
+    unsigned m_secondsSinceFlush;
+    bool m_dirty;
+
+    void onTimer();
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
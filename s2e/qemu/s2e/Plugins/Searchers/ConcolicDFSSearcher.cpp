@@ -74,17 +74,16 @@ void ConcolicDFSSearcher::initialize()
 }
 
 
-klee::ExecutionState& ConcolicDFSSearcher::selectState()
+ConcolicDFSSearcher::Priority ConcolicDFSSearcher::getPriority(klee::ExecutionState *state)
 {
-    klee::ExecutionState *state;
-    if (!m_normalStates.empty()) {
-        state = *m_normalStates.begin();
-    } else {
-        assert(!m_speculativeStates.empty());
-        state = *m_speculativeStates.begin();
-    }
+    S2EExecutionState *s2estate = static_cast<S2EExecutionState*>(state);
+    return Priority(state->isSpeculative(), s2estate->getID());
+}
 
-    return *state;
+klee::ExecutionState& ConcolicDFSSearcher::selectState()
+{
+    assert(!m_states.empty());
+    return *m_states.top();
 }
 
 
@@ -95,44 +94,24 @@ void ConcolicDFSSearcher::update(klee::ExecutionState *current,
     if (current && addedStates.empty() && removedStates.empty()) {
         S2EExecutionState *s2estate = dynamic_cast<S2EExecutionState*>(current);
         if (!s2estate->isZombie()) {
-            if (current->isSpeculative()) {
-                m_normalStates.erase(current);
-                m_speculativeStates.insert(current);
-            } else  {
-                m_speculativeStates.erase(current);
-                m_normalStates.insert(current);
-            }
+            m_states.push(current, getPriority(current));
         }
     }
 
     foreach2(it, removedStates.begin(), removedStates.end()) {
-        S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
-        //s2e()->getDebugStream() << "update remove id=" << es->getID() << '\n';
-        if (es->isSpeculative()) {
-            size_t count = m_speculativeStates.erase(es);
-            assert(count > 0);
-            assert(m_normalStates.find(es) == m_normalStates.end());
-        } else {
-            size_t count = m_normalStates.erase(es);
-            assert(count > 0);
-            assert(m_speculativeStates.find(es) == m_speculativeStates.end());
-        }
+        bool erased = m_states.erase(*it);
+        assert(erased);
+        (void) erased;
     }
 
     foreach2(it, addedStates.begin(), addedStates.end()) {
-        S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*it);
-        //s2e()->getDebugStream() << "update add id=" << es->getID() << '\n';
-        if (es->isSpeculative()) {
-            m_speculativeStates.insert(es);
-        } else {
-            m_normalStates.insert(es);
-        }
+        m_states.push(*it, getPriority(*it));
     }
 }
 
 bool ConcolicDFSSearcher::empty()
 {
-    return m_normalStates.empty() && m_speculativeStates.empty();
+    return m_states.empty();
 }
 
 
@@ -43,6 +43,7 @@
 #include <s2e/S2EExecutionState.h>
 
 #include <klee/Searcher.h>
+#include <klee/Internal/ADT/IndexedHeap.h>
 
 #include <set>
 
@@ -54,16 +55,11 @@ class ConcolicDFSSearcher : public Plugin, public klee::Searcher
 {
     S2E_PLUGIN
 
-    struct SortById {
-        bool operator ()(const klee::ExecutionState *_s1, const klee::ExecutionState *_s2) const {
-            const S2EExecutionState *s1 = static_cast<const S2EExecutionState*>(_s1);
-            const S2EExecutionState *s2 = static_cast<const S2EExecutionState*>(_s2);
+    //Non-speculative states come first, then the oldest state
+    typedef std::pair<bool, uint64_t> Priority;
+    typedef klee::IndexedHeap<klee::ExecutionState*, Priority> States;
 
-            return s1->getID() < s2->getID();
-        }
-    };
-
-    typedef std::set<klee::ExecutionState*, SortById> States;
+    static Priority getPriority(klee::ExecutionState *state);
 
 public:
     ConcolicDFSSearcher(S2E* s2e): Plugin(s2e) {}
@@ -80,8 +76,7 @@ public:
 
 private:
 
-    States m_normalStates;
-    States m_speculativeStates;
+    States m_states;
 };
 
 
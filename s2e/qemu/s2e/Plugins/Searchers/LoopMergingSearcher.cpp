@@ -0,0 +1,389 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+extern "C" {
+#include "config.h"
+#include "qemu-common.h"
+}
+
+#include "LoopMergingSearcher.h"
+#include <s2e/S2E.h>
+#include <s2e/ConfigFile.h>
+#include <s2e/Utils.h>
+#include <s2e/S2EExecutor.h>
+
+#include <klee/SolverStats.h>
+#include <llvm/Support/TimeValue.h>
+
+#include <algorithm>
+
+namespace s2e {
+namespace plugins {
+
+S2E_DEFINE_PLUGIN(LoopMergingSearcher, "Merges states that reach the same loop head",
+                  "LoopMergingSearcher");
+
+//Absolute wall-clock time in milliseconds
+static uint64_t currentTimeMs()
+{
+    llvm::sys::TimeValue now = llvm::sys::TimeValue::now();
+    return (uint64_t) now.seconds() * 1000 + now.msec();
+}
+
+void LoopMergingSearcher::initialize()
+{
+    ConfigFile *cfg = s2e()->getConfig();
+
+    //Maximum number of states held at one loop head
+    m_maxStates = cfg->getInt(getConfigKey() + ".maxStates", 8);
+
+    //Milliseconds to wait for other states after the first one arrives
+    m_window = cfg->getInt(getConfigKey() + ".window", 1000);
+
+    //States whose memory differs in more objects are not merged
+    m_maxMutatedObjects = cfg->getInt(getConfigKey() + ".maxMutatedObjects", 16);
+
+    m_searcherInited = false;
+    m_parentSearcher = NULL;
+    m_pending = NULL;
+
+    m_heldCount = m_mergedCount = m_rejectedCount = 0;
+    m_lastQueryTime = m_lastQueries = 0;
+    m_mergedQueryTime = m_mergedQueries = 0;
+    m_otherQueryTime = m_otherQueries = 0;
+
+    s2e()->getCorePlugin()->onTranslateBlockEnd.connect(
+            sigc::mem_fun(*this, &LoopMergingSearcher::onTranslateBlockEnd));
+
+    s2e()->getCorePlugin()->onStateFork.connect(
+            sigc::mem_fun(*this, &LoopMergingSearcher::onStateFork));
+
+    s2e()->getCorePlugin()->onStateSwitch.connect(
+            sigc::mem_fun(*this, &LoopMergingSearcher::onStateSwitch));
+}
+
+LoopMergingSearcher::~LoopMergingSearcher()
+{
+    //Account for the state that ran last
+    onStateSwitch(NULL, NULL);
+
+    s2e()->getMessagesStream()
+            << "LoopMergingSearcher: " << m_loopHeads.size() << " loop heads, "
+            << m_heldCount << " states held, "
+            << m_mergedCount << " merged, "
+            << m_rejectedCount << " not merged because of large memory differences\n"
+            << "LoopMergingSearcher: solver time in merged states "
+            << m_mergedQueryTime / 1000000.0 << "s (" << m_mergedQueries << " queries), "
+            << "in other states "
+            << m_otherQueryTime / 1000000.0 << "s (" << m_otherQueries << " queries)\n";
+}
+
+void LoopMergingSearcher::initializeSearcher()
+{
+    if (m_searcherInited) {
+        return;
+    }
+
+    m_parentSearcher = s2e()->getExecutor()->getSearcher();
+    assert(m_parentSearcher);
+    s2e()->getExecutor()->setSearcher(this);
+    m_searcherInited = true;
+}
+
+/**
+ *  A jump to an address that is not after the jump itself closes a loop.
+ *  QEMU updates the program counter before the end of block is signaled,
+ *  so the handler only runs when the backward jump is taken and the state
+ *  is about to execute the loop head.
+ */
+void LoopMergingSearcher::onTranslateBlockEnd(
+    ExecutionSignal *signal,
+    S2EExecutionState* state,
+    TranslationBlock *tb,
+    uint64_t endPc,
+    bool staticTarget,
+    uint64_t targetPc)
+{
+    initializeSearcher();
+
+    if (!staticTarget || targetPc > endPc) {
+        return;
+    }
+
+    m_loopHeads.insert(targetPc);
+    signal->connect(sigc::mem_fun(*this, &LoopMergingSearcher::onBackEdge));
+}
+
+void LoopMergingSearcher::onBackEdge(S2EExecutionState* state, uint64_t pc)
+{
+    DECLARE_PLUGINSTATE(LoopMergingSearcherState, state);
+
+    //Only states that forked since the last iteration have
+    //siblings to merge with
+    if (!plgState->m_forked) {
+        return;
+    }
+
+    if (s2e()->getExecutor()->getStatesCount() <= 1) {
+        return;
+    }
+
+    target_ulong esp;
+    if (!state->readCpuRegisterConcrete(CPU_OFFSET(regs[R_ESP]), &esp, sizeof(esp))) {
+        return;
+    }
+
+    plgState->m_forked = false;
+
+    //The state may have forked siblings that did not reach the searcher yet.
+    //It is removed from the parent searcher in selectState, after updateStates.
+    assert(!m_pending);
+    m_pending = state;
+    m_pendingPoint = MergePoint(state->getPc(), esp);
+
+    state->yield(true);
+    s2e()->getExecutor()->scheduleStateSwitch();
+
+    state->writeCpuState(CPU_OFFSET(exception_index), EXCP_S2E, 8*sizeof(int));
+    throw CpuExitException();
+}
+
+void LoopMergingSearcher::onStateFork(S2EExecutionState *state,
+                                      const std::vector<S2EExecutionState*> &newStates,
+                                      const std::vector<klee::ref<klee::Expr> > &newConditions)
+{
+    foreach2(it, newStates.begin(), newStates.end()) {
+        DECLARE_PLUGINSTATE(LoopMergingSearcherState, *it);
+        plgState->m_forked = true;
+    }
+}
+
+void LoopMergingSearcher::onStateSwitch(S2EExecutionState *currentState,
+                                        S2EExecutionState *nextState)
+{
+    uint64_t queryTime = klee::stats::queryTime;
+    uint64_t queries = klee::stats::queries;
+
+    bool merged = false;
+    if (currentState) {
+        DECLARE_PLUGINSTATE(LoopMergingSearcherState, currentState);
+        merged = plgState->m_merged;
+    }
+
+    if (merged) {
+        m_mergedQueryTime += queryTime - m_lastQueryTime;
+        m_mergedQueries += queries - m_lastQueries;
+    } else {
+        m_otherQueryTime += queryTime - m_lastQueryTime;
+        m_otherQueries += queries - m_lastQueries;
+    }
+
+    m_lastQueryTime = queryTime;
+    m_lastQueries = queries;
+}
+
+void LoopMergingSearcher::holdPendingState()
+{
+    if (!m_pending) {
+        return;
+    }
+
+    m_parentSearcher->removeState(m_pending);
+
+    Group &group = m_groups[m_pendingPoint];
+    if (group.states.empty()) {
+        group.deadline = currentTimeMs() + m_window;
+    }
+    group.states.push_back(m_pending);
+    m_held[m_pending] = m_pendingPoint;
+    ++m_heldCount;
+
+    m_pending = NULL;
+}
+
+void LoopMergingSearcher::release(S2EExecutionState *state)
+{
+    m_held.erase(state);
+    state->yield(false);
+    m_parentSearcher->addState(state);
+}
+
+/**
+ *  Merges every state of the group into the first one it can be merged
+ *  with. The states that remain go back to the parent searcher.
+ */
+void LoopMergingSearcher::mergeGroup(std::vector<S2EExecutionState*> &states)
+{
+    S2EExecutor *executor = s2e()->getExecutor();
+
+    while (!states.empty()) {
+        S2EExecutionState *base = states.front();
+        std::vector<S2EExecutionState*> rest;
+
+        foreach2(it, states.begin() + 1, states.end()) {
+            S2EExecutionState *other = *it;
+
+            int distance = base->getMergeDistance(*other);
+            if (distance < 0) {
+                rest.push_back(other);
+                continue;
+            }
+
+            if ((unsigned) distance > m_maxMutatedObjects) {
+                ++m_rejectedCount;
+                rest.push_back(other);
+                continue;
+            }
+
+            S2EExecutionState *merged = executor->mergeStates(base, other);
+            if (!merged) {
+                rest.push_back(other);
+                continue;
+            }
+
+            S2EExecutionState *killed = merged == base ? other : base;
+            m_held.erase(killed);
+            m_killed.insert(killed);
+            ++m_mergedCount;
+
+            base = merged;
+            DECLARE_PLUGINSTATE(LoopMergingSearcherState, base);
+            plgState->m_merged = true;
+        }
+
+        release(base);
+        states.swap(rest);
+    }
+}
+
+void LoopMergingSearcher::processGroups(bool force)
+{
+    uint64_t now = currentTimeMs();
+
+    Groups::iterator it = m_groups.begin();
+    while (it != m_groups.end()) {
+        Group &group = (*it).second;
+        if (force || group.states.size() >= m_maxStates || now >= group.deadline) {
+            mergeGroup(group.states);
+            m_groups.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+klee::ExecutionState& LoopMergingSearcher::selectState()
+{
+    holdPendingState();
+    processGroups(false);
+
+    //Do not wait for the window to expire if nothing else can run
+    if (m_parentSearcher->empty()) {
+        processGroups(true);
+    }
+
+    return m_parentSearcher->selectState();
+}
+
+void LoopMergingSearcher::update(klee::ExecutionState *current,
+                    const std::set<klee::ExecutionState*> &addedStates,
+                    const std::set<klee::ExecutionState*> &removedStates)
+{
+    std::set<klee::ExecutionState*> parentRemoved;
+
+    foreach2(it, removedStates.begin(), removedStates.end()) {
+        S2EExecutionState *es = static_cast<S2EExecutionState*>(*it);
+
+        if (m_killed.erase(es)) {
+            continue;
+        }
+
+        if (es == m_pending) {
+            m_pending = NULL;
+        }
+
+        HeldStates::iterator hit = m_held.find(es);
+        if (hit == m_held.end()) {
+            parentRemoved.insert(es);
+            continue;
+        }
+
+        Groups::iterator git = m_groups.find((*hit).second);
+        assert(git != m_groups.end());
+        std::vector<S2EExecutionState*> &states = (*git).second.states;
+        states.erase(std::find(states.begin(), states.end(), es));
+        if (states.empty()) {
+            m_groups.erase(git);
+        }
+        m_held.erase(hit);
+    }
+
+    //The parent searcher does not know about held or merged away states
+    if (current && (m_held.count(static_cast<S2EExecutionState*>(current)) ||
+                    (removedStates.count(current) && !parentRemoved.count(current)))) {
+        current = NULL;
+    }
+
+    m_parentSearcher->update(current, addedStates, parentRemoved);
+}
+
+bool LoopMergingSearcher::empty()
+{
+    return m_parentSearcher->empty() && m_groups.empty() && !m_pending;
+}
+
+LoopMergingSearcherState::LoopMergingSearcherState()
+{
+    m_forked = false;
+    m_merged = false;
+}
+
+LoopMergingSearcherState::~LoopMergingSearcherState()
+{
+}
+
+PluginState *LoopMergingSearcherState::clone() const
+{
+    return new LoopMergingSearcherState(*this);
+}
+
+PluginState *LoopMergingSearcherState::factory(Plugin *p, S2EExecutionState *s)
+{
+    return new LoopMergingSearcherState();
+}
+
+} // namespace plugins
+} // namespace s2e
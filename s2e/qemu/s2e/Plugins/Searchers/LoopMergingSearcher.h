@@ -0,0 +1,161 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_PLUGINS_LOOPMERGINGSEARCHER_H
+#define S2E_PLUGINS_LOOPMERGINGSEARCHER_H
+
+#include <s2e/Plugin.h>
+#include <s2e/Plugins/CorePlugin.h>
+#include <s2e/S2EExecutionState.h>
+
+#include <klee/Searcher.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+namespace s2e {
+namespace plugins {
+
+class LoopMergingSearcherState: public PluginState
+{
+private:
+    /** The state forked since it was last held at a loop head */
+    bool m_forked;
+
+    /** The state results from a merge */
+    bool m_merged;
+
+public:
+    LoopMergingSearcherState();
+    virtual ~LoopMergingSearcherState();
+    virtual PluginState *clone() const;
+    static PluginState *factory(Plugin *p, S2EExecutionState *s);
+
+    friend class LoopMergingSearcher;
+};
+
+/**
+ *  Holds states that reach the head of a guest loop for a bounded time,
+ *  and merges the ones that arrived at the same loop head with the same
+ *  stack pointer. Loop heads are the targets of backward jumps.
+ */
+class LoopMergingSearcher : public Plugin, public klee::Searcher
+{
+    S2E_PLUGIN
+public:
+    LoopMergingSearcher(S2E* s2e): Plugin(s2e) {}
+    virtual ~LoopMergingSearcher();
+    void initialize();
+
+    virtual klee::ExecutionState& selectState();
+    virtual void update(klee::ExecutionState *current,
+                        const std::set<klee::ExecutionState*> &addedStates,
+                        const std::set<klee::ExecutionState*> &removedStates);
+
+    virtual bool empty();
+
+private:
+    /** Loop head and stack pointer */
+    typedef std::pair<uint64_t, uint64_t> MergePoint;
+
+    struct Group {
+        uint64_t deadline;
+        std::vector<S2EExecutionState*> states;
+    };
+
+    typedef std::map<MergePoint, Group> Groups;
+    typedef std::map<S2EExecutionState*, MergePoint> HeldStates;
+
+    bool m_searcherInited;
+    klee::Searcher *m_parentSearcher;
+
+    unsigned m_maxStates;
+    unsigned m_window;
+    unsigned m_maxMutatedObjects;
+
+    Groups m_groups;
+    HeldStates m_held;
+
+    /** State that exited the cpu loop at a loop head */
+    S2EExecutionState *m_pending;
+    MergePoint m_pendingPoint;
+
+    /** Merged away states whose removal has not reached the searcher yet */
+    std::set<klee::ExecutionState*> m_killed;
+
+    std::set<uint64_t> m_loopHeads;
+
+    uint64_t m_heldCount;
+    uint64_t m_mergedCount;
+    uint64_t m_rejectedCount;
+
+    uint64_t m_lastQueryTime;
+    uint64_t m_lastQueries;
+    uint64_t m_mergedQueryTime;
+    uint64_t m_mergedQueries;
+    uint64_t m_otherQueryTime;
+    uint64_t m_otherQueries;
+
+    void initializeSearcher();
+
+    void onTranslateBlockEnd(
+        ExecutionSignal *signal,
+        S2EExecutionState* state,
+        TranslationBlock *tb,
+        uint64_t endPc,
+        bool staticTarget,
+        uint64_t targetPc);
+
+    void onBackEdge(S2EExecutionState* state, uint64_t pc);
+
+    void onStateFork(S2EExecutionState *state,
+                     const std::vector<S2EExecutionState*> &newStates,
+                     const std::vector<klee::ref<klee::Expr> > &newConditions);
+
+    void onStateSwitch(S2EExecutionState *currentState,
+                       S2EExecutionState *nextState);
+
+    void holdPendingState();
+    void processGroups(bool force);
+    void mergeGroup(std::vector<S2EExecutionState*> &states);
+    void release(S2EExecutionState *state);
+};
+
+} // namespace plugins
+} // namespace s2e
+
+#endif
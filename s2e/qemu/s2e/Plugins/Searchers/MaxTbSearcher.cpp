@@ -56,6 +56,11 @@ namespace plugins {
 
 using namespace llvm;
 
+//States whose metric is below this value run before the parent searcher's.
+//Blocks covered by other processes get this metric, so that they are not
+//preferred over the ones no process executed yet.
+static const uint64_t NOVEL_METRIC_THRESHOLD = 2;
+
 S2E_DEFINE_PLUGIN(MaxTbSearcher, "Prioritizes states that are about to execute unexplored translation blocks",
                   "MaxTbSearcher", "ModuleExecutionDetector");
 
@@ -63,12 +68,10 @@ void MaxTbSearcher::initialize()
 {
 
     m_moduleExecutionDetector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
+    m_coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
     m_searcherInited = false;
     m_parentSearcher = NULL;
 
-    m_sorter.p = this;
-    m_states = StateSet(m_sorter);
-
     //XXX: Take care of module load/unload
     m_moduleExecutionDetector->onModuleTranslateBlockEnd.connect(
             sigc::mem_fun(*this, &MaxTbSearcher::onModuleTranslateBlockEnd)
@@ -228,12 +231,11 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     uint64_t tbVa = curModule->ToRelative(state->getTb()->pc);
 
     if (!md) {
-        m_states.erase(state);
         m_coveredTbs[*curModule][tbVa]++;
         DECLARE_PLUGINSTATE(MaxTbSearcherState, state);
         plgState->m_metric = m_coveredTbs[*curModule][tbVa];
         plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
-        m_states.insert(state);
+        m_states.push(state, plgState->m_metric);
         return;
     }
 
@@ -250,8 +252,6 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     bool NextTbIsNew = NewTbIt == tbm.end();
     bool CurTbIsNew = CurTbIt == tbm.end();
 
-    m_states.erase(state);
-
     /**
      * Update the frequency of the current and next
      * translation blocks
@@ -273,7 +273,7 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
     }
 
     DECLARE_PLUGINSTATE(MaxTbSearcherState, state);
-    plgState->m_metric = tbm[newPc];
+    plgState->m_metric = getMetric(*md, tbm, newPc);
 
 #if 1
     s2e()->getDebugStream() << "Metric for " << hexval(newPc+md->NativeBase) << " = " << plgState->m_metric
@@ -282,14 +282,25 @@ void MaxTbSearcher::onTraceTb(S2EExecutionState* state, uint64_t pc)
 
     plgState->m_metric *= state->queryCost < 1 ? 1 : state->queryCost;
 
-    m_states.insert(state);
+    m_states.push(state, plgState->m_metric);
+}
+
+/**
+ *  Blocks that this process never executed are not novel
+ *  if another S2E process already covered them.
+ */
+uint64_t MaxTbSearcher::getMetric(const ModuleDescriptor &md, TbMap &tbm, uint64_t relativePc)
+{
+    uint64_t metric = tbm[relativePc];
+    if (!metric && m_coverage && m_coverage->isCovered(md.Name, relativePc)) {
+        metric = NOVEL_METRIC_THRESHOLD;
+    }
+    return metric;
 }
 
 klee::ExecutionState& MaxTbSearcher::selectState()
 {
     //If there are no prioritized states, revert to the parent searcher
-    StateSet::iterator it;
-
 #if 0
     uint64_t absNextPc = 0;
     while((it = m_states.begin()) != m_states.end()) {
@@ -308,13 +319,8 @@ klee::ExecutionState& MaxTbSearcher::selectState()
     }while(absNextPc);
 #endif
 
-    if (m_states.size() > 0) {
-        S2EExecutionState *es = dynamic_cast<S2EExecutionState*>(*m_states.begin());
-        DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
-        if (plgState->m_metric < 2) {
-            return *es;
-        }
-
+    if (!m_states.empty() && m_states.topPriority() < NOVEL_METRIC_THRESHOLD) {
+        return *m_states.top();
     }
 
     return m_parentSearcher->selectState();
@@ -340,13 +346,13 @@ bool MaxTbSearcher::updatePc(S2EExecutionState *es)
     DECLARE_PLUGINSTATE(MaxTbSearcherState, es);
 
     //If not covered, add the forked state to the wait list
-    plgState->m_metric = m_coveredTbs[*md][md->ToRelative(absNextPc)];
+    plgState->m_metric = getMetric(*md, m_coveredTbs[*md], md->ToRelative(absNextPc));
 #if 1
     s2e()->getDebugStream() << "MaxTBSearcher updatePc Metric for " << hexval(md->ToNativeBase(absNextPc)) << " = " << plgState->m_metric
             << '\n';
 #endif
 
-    m_states.insert(es);
+    m_states.push(es, plgState->m_metric);
     return true;
 }
 
@@ -40,9 +40,11 @@
 #include <s2e/Plugin.h>
 #include <s2e/Plugins/CorePlugin.h>
 #include <s2e/Plugins/ModuleExecutionDetector.h>
+#include <s2e/Plugins/CoverageBitmap.h>
 #include <s2e/S2EExecutionState.h>
 
 #include <klee/Searcher.h>
+#include <klee/Internal/ADT/IndexedHeap.h>
 
 #include <vector>
 
@@ -73,25 +75,10 @@ class MaxTbSearcher : public Plugin, public klee::Searcher
 {
     S2E_PLUGIN
 public:
-    struct MaxTbSorter{
-        Plugin *p;
-
-        MaxTbSorter() {
-            p = NULL;
-        }
-
-        bool operator()(const S2EExecutionState *s1, const S2EExecutionState *s2) const{
-            const MaxTbSearcherState *p1 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s1), &MaxTbSearcherState::factory));
-            const MaxTbSearcherState *p2 = static_cast<MaxTbSearcherState*>(p->getPluginState(const_cast<S2EExecutionState*>(s2), &MaxTbSearcherState::factory));
-
-            if (p1->m_metric == p2->m_metric) {
-                return p1 < p2;
-            }
-            return p1->m_metric < p2->m_metric;
-        }
-    };
-
-    typedef std::set<S2EExecutionState*, MaxTbSorter> StateSet;
+    //States ordered by increasing metric. The heap tracks the position
+    //of every state, so that updating the metric on each executed
+    //translation block does not require a remove/insert pair.
+    typedef klee::IndexedHeap<S2EExecutionState*, uint64_t> StateHeap;
 
     //Maps a translation block address to the number of times it was executed
     typedef std::map<uint64_t, uint64_t> TbMap;
@@ -110,19 +97,20 @@ public:
 private:
 
     ModuleExecutionDetector *m_moduleExecutionDetector;
+    CoverageBitmap *m_coverage;
     bool m_searcherInited;
 
     klee::Searcher *m_parentSearcher;
     TbsByModule m_coveredTbs;
 
-    MaxTbSorter m_sorter;
-    StateSet m_states;
+    StateHeap m_states;
 
 
     void addTb(S2EExecutionState *s, uint64_t absTargetPc);
     bool isExplored(S2EExecutionState *s, uint64_t absTargetPc);
     uint64_t computeTargetPc(S2EExecutionState *s);
     bool updatePc(S2EExecutionState *es);
+    uint64_t getMetric(const ModuleDescriptor &md, TbMap &tbm, uint64_t relativePc);
 
     void onModuleTranslateBlockEnd(
         ExecutionSignal *signal,
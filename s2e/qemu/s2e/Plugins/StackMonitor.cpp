@@ -45,6 +45,8 @@ extern "C" {
 #include <s2e/Utils.h>
 #include <s2e/s2e_qemu.h>
 
+#include <klee/util/Ref.h>
+
 #include <iostream>
 
 namespace s2e {
@@ -107,9 +109,22 @@ public:
         friend llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackFrame &frame);
     };
 
-    //The frames are sorted by decreasing stack pointer
-    typedef std::vector<StackFrame> StackFrames;
+    /**
+     *  Frames form an immutable linked list from the most recent frame
+     *  to the oldest one. Lists are shared between forked states, so that
+     *  cloning a stack only takes a reference to its top frame.
+     *  A frame is copied before being modified if it is shared.
+     */
+    struct FrameNode {
+        unsigned refCount;
+        StackFrame frame;
+        klee::ref<FrameNode> parent;
+
+        FrameNode(const StackFrame &f, const klee::ref<FrameNode> &p) :
+            refCount(0), frame(f), parent(p) {}
+    };
 
+    typedef klee::ref<FrameNode> FrameRef;
 
     class Stack {
         uint64_t m_stackBase;
@@ -118,7 +133,27 @@ public:
         //XXX: remove it?
         uint64_t m_lastStackPointer;
 
-        StackFrames m_frames;
+        //The frames are sorted by increasing stack pointer from the top
+        FrameRef m_top;
+        unsigned m_depth;
+
+        void pushFrame(const StackFrame &frame) {
+            m_top = new FrameNode(frame, m_top);
+            ++m_depth;
+        }
+
+        void popFrame() {
+            m_top = m_top->parent;
+            --m_depth;
+        }
+
+        /** Returns a top frame that can be modified in place */
+        StackFrame &getWritableTop() {
+            if (m_top->refCount > 1) {
+                m_top = new FrameNode(m_top->frame, m_top->parent);
+            }
+            return m_top->frame;
+        }
 
     public:
         Stack(S2EExecutionState *state,
@@ -129,6 +164,7 @@ public:
             m_stackBase = base;
             m_stackSize = size;
             m_lastStackPointer = state->getSp();
+            m_depth = 0;
 
             const ModuleDescriptor *module = plgState->m_detector->getModule(state, pc);
             assert(module && "BUG: StackMonitor should only track configured modules");
@@ -141,7 +177,7 @@ public:
             sf.size = 4; //XXX: Fix constant
             sf.pc = pc;
 
-            m_frames.push_back(sf);
+            pushFrame(sf);
         }
 
         uint64_t getStackBase() const {
@@ -152,9 +188,13 @@ public:
             return m_stackSize;
         }
 
+        unsigned getDepth() const {
+            return m_depth;
+        }
+
         /** Used for call instructions */
         void newFrame(S2EExecutionState *state, unsigned currentModuleId, uint64_t pc, uint64_t stackPointer) {
-            const StackFrame &last = m_frames.back();
+            const StackFrame &last = m_top->frame;
             assert(stackPointer < last.top + last.size);
 
             StackFrame frame;
@@ -162,40 +202,38 @@ public:
             frame.moduleId = currentModuleId;
             frame.top = stackPointer;
             frame.size = 4;
-            m_frames.push_back(frame);
+            pushFrame(frame);
 
             m_lastStackPointer = stackPointer;
         }
 
         void update(S2EExecutionState *state, unsigned currentModuleId, uint64_t stackPointer) {
-            assert(!m_frames.empty());
+            assert(!m_top.isNull());
             assert(stackPointer >= m_stackBase && stackPointer < (m_stackBase + m_stackSize));
-            StackFrame &last = m_frames.back();
 
             //The current stack pointer is above the bottom of the stack
             //We need to unwind the frames
             do {
-                if (last.top >= stackPointer) {
+                if (m_top->frame.top >= stackPointer) {
+                    StackFrame &last = getWritableTop();
                     last.size = last.top - stackPointer + 4;
                 } else {
-                    m_frames.pop_back();
+                    popFrame();
                 }
 
-                if (m_frames.empty()) {
+                if (m_top.isNull()) {
                     break;
                 }
-
-                last = m_frames.back();
-            } while (stackPointer > last.top);
+            } while (stackPointer > m_top->frame.top);
 
             // The stack may become empty when the last frame is popped,
             // e.g., when the top-level function returns.
         }
 
         /** Check whether there is a frame that belongs to the module. */
-        bool hasModule(unsigned moduleId) {
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                if ((*it).moduleId == moduleId) {
+        bool hasModule(unsigned moduleId) const {
+            for (const FrameNode *n = m_top.get(); n; n = n->parent.get()) {
+                if (n->frame.moduleId == moduleId) {
                     return true;
                 }
             }
@@ -203,21 +241,27 @@ public:
         }
 
         bool removeAllFrames(unsigned moduleId) {
-            StackFrames::iterator it = m_frames.begin();
+            if (!hasModule(moduleId)) {
+                return empty();
+            }
 
-            unsigned i=0;
-            while (i < m_frames.size()) {
-                if (m_frames[i].moduleId == moduleId) {
-                    m_frames.erase(it + i);
-                } else {
-                    ++i;
+            std::vector<StackFrame> kept;
+            for (const FrameNode *n = m_top.get(); n; n = n->parent.get()) {
+                if (n->frame.moduleId != moduleId) {
+                    kept.push_back(n->frame);
                 }
             }
-            return m_frames.empty();
+
+            m_top = FrameRef();
+            m_depth = 0;
+            for (unsigned i = kept.size(); i > 0; --i) {
+                pushFrame(kept[i - 1]);
+            }
+            return empty();
         }
 
         bool empty() const {
-            return m_frames.empty();
+            return m_top.isNull();
         }
 
         bool getFrame(uint64_t sp, bool &frameValid, StackFrame &frameInfo) const {
@@ -228,9 +272,8 @@ public:
             frameValid = false;
 
             //Look for the right frame
-            //XXX: Use binary search?
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                const StackFrame &frame= *it;
+            for (const FrameNode *n = m_top.get(); n; n = n->parent.get()) {
+                const StackFrame &frame = n->frame;
                 if (sp > frame.top || (sp < frame.top - frame.size)) {
                     continue;
                 }
@@ -244,8 +287,12 @@ public:
         }
 
         void getCallStack(CallStack &cs) const {
-            foreach2(it, m_frames.begin(), m_frames.end()) {
-                cs.push_back((*it).pc);
+            unsigned start = cs.size();
+            cs.resize(start + m_depth);
+
+            unsigned i = m_depth;
+            for (const FrameNode *n = m_top.get(); n; n = n->parent.get()) {
+                cs[start + --i] = n->frame.pc;
             }
         }
 
@@ -295,8 +342,15 @@ llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackMonitorState::St
 llvm::raw_ostream& operator<<(llvm::raw_ostream &os, const StackMonitorState::Stack &stack)
 {
     os << "Stack " << hexval(stack.m_stackBase) << " size=" << hexval(stack.m_stackSize) << "\n";
-    foreach2(it, stack.m_frames.begin(), stack.m_frames.end()) {
-        os << *it << "\n";
+
+    //Print the frames from the oldest to the most recent one
+    std::vector<const StackMonitorState::StackFrame*> frames;
+    for (const StackMonitorState::FrameNode *n = stack.m_top.get(); n; n = n->parent.get()) {
+        frames.push_back(&n->frame);
+    }
+
+    for (unsigned i = frames.size(); i > 0; --i) {
+        os << *frames[i - 1] << "\n";
     }
 
     return os;
@@ -46,6 +46,7 @@ extern "C" {
 #include <s2e/s2e_qemu.h>
 
 #include "StateManager.h"
+#include "CoverageBitmap.h"
 #include <klee/Searcher.h>
 
 #ifdef CONFIG_WIN32
@@ -68,7 +69,6 @@ void sm_callback(S2EExecutionState *s, bool killingState)
         return;
     }
 
-    sm->m_shared.acquire();
     sm->checkInvariants();
 
     //Process the queued commands for the current process
@@ -82,24 +82,18 @@ void sm_callback(S2EExecutionState *s, bool killingState)
         //there is nothing else to do, kill the process
         if (sm->m_succeeded.size() == 0) {
             g_s2e->getDebugStream() << "No more succeeded states" << '\n';
-            sm->m_shared.release();
             return;
         }
 
-        sm->m_shared.release();
-
         sm->suspendCurrentProcess();
 
         //Only a kill all can resume us, so we must process commands now
-        sm->m_shared.acquire();
         sm->processCommands();
-        sm->m_shared.release();
         return;
     }
 
     //Check for timeout conditions
     sm->killOnTimeOut();
-    sm->m_shared.release();
 }
 
 //XXX: Assumes we are called from the callback
@@ -108,27 +102,23 @@ void StateManager::suspendCurrentProcess()
     s2e()->getDebugStream() << "Suspending process" << '\n';
     unsigned currentProcessId = s2e()->getCurrentProcessId();
 
-    StateManagerShared *shared = m_shared.acquire();
-    shared->suspendedProcesses[currentProcessId] = true;
-    m_shared.release();
+    StateManagerShared *shared = m_shared.get();
+    AtomicFunctions::write(&shared->suspendedProcesses[currentProcessId], 1);
 
     while(true) {
-        shared = m_shared.tryAcquire();
-        if (shared) {
-            //Somebody woke us up
-            if (!shared->suspendedProcesses[currentProcessId]) {
-                m_shared.release();
-                return;
-            }
+        //Somebody woke us up
+        if (!AtomicFunctions::read(&shared->suspendedProcesses[currentProcessId])) {
+            return;
+        }
 
-            //There are no more active processes in the system,
-            if (getSuspendedProcessCount() == s2e()->getCurrentProcessCount()) {
-                resumeAllProcesses();
-                killAllButOneSuccessful();
-                m_shared.release();
-                return;
-            }
-            m_shared.release();
+        //There are no more active processes in the system.
+        //Only one of the suspended processes may resume the others.
+        if (getSuspendedProcessCount() == s2e()->getCurrentProcessCount() &&
+            AtomicFunctions::compareAndSwap(&shared->suspendAll, 0, 1)) {
+            resumeAllProcesses();
+            AtomicFunctions::write(&shared->suspendAll, 0);
+            killAllButOneSuccessful();
+            return;
         }
         #ifdef CONFIG_WIN32
         Sleep(1000);
@@ -145,7 +135,7 @@ void StateManager::resumeAllProcesses()
 
     unsigned maxProcessCount = s2e()->getMaxProcesses();
     for (unsigned i=0; i<maxProcessCount; ++i) {
-        shared->suspendedProcesses[i] = false;
+        AtomicFunctions::write(&shared->suspendedProcesses[i], 0);
     }
 }
 
@@ -158,7 +148,7 @@ unsigned StateManager::getSuspendedProcessCount()
     //so use max processes instead of the current count
     unsigned maxProcessCount = s2e()->getMaxProcesses();
     for (unsigned i=0; i<maxProcessCount; ++i) {
-        if (shared->suspendedProcesses[i]) {
+        if (AtomicFunctions::read(&shared->suspendedProcesses[i])) {
             ++count;
         }
     }
@@ -166,22 +156,14 @@ unsigned StateManager::getSuspendedProcessCount()
 }
 
 
-void StateManager::checkInvariants(bool grabLock)
+void StateManager::checkInvariants()
 {
-    if (grabLock) {
-        m_shared.acquire();
-    }
-
-    uint64_t *successCount = m_shared.get()->successCount;
-    if (successCount[s2e()->getCurrentProcessId()] != m_succeeded.size()) {
-        unsigned procId = s2e()->getCurrentProcessId();
-        s2e()->getWarningsStream() << "successCount[" << procId << "]=" << successCount[procId] << '\n';
+    unsigned procId = s2e()->getCurrentProcessId();
+    uint64_t successCount = AtomicFunctions::read(&m_shared.get()->successCount[procId]);
+    if (successCount != m_succeeded.size()) {
+        s2e()->getWarningsStream() << "successCount[" << procId << "]=" << successCount << '\n';
         s2e()->getWarningsStream() << "m_succeeded.size()=" << m_succeeded.size() << '\n';
-        assert(successCount[procId] == m_succeeded.size());
-    }
-
-    if (grabLock) {
-        m_shared.release();
+        assert(successCount == m_succeeded.size());
     }
 }
 
@@ -206,26 +188,25 @@ bool StateManager::processCommands()
 {
     StateManagerShared *s = m_shared.get();
 
-
-    StateManagerShared::Command cmd = s->commands[s2e()->getCurrentProcessId()].read();
+    //Take the command, so that one posted concurrently is not lost
+    StateManagerShared::Command empty = {StateManagerShared::EMPTY, 0, 0, 0};
+    StateManagerShared::Command cmd = s->commands[s2e()->getCurrentProcessId()].exchange(empty);
 
     if (cmd.command == StateManagerShared::KILL) {
-        cmd.command = StateManagerShared::EMPTY;
-        s->commands[s2e()->getCurrentProcessId()].write(cmd);
         s2e()->getDebugStream() << "StateManager: received kill command" << '\n';
         if (cmd.nodeId == s2e()->getCurrentProcessId()) {
-            //Keep one successful
-            assert(s->keepOneStateOnNode == cmd.nodeId);
+            //Keep one successful. The slot may already have been released
+            //if this instance also claimed itself in killAllButOneSuccessful.
+            AtomicFunctions::compareAndSwap(&s->keepOneStateOnNode, cmd.nodeId, (uint64_t)-1);
             //It may happen that wake up kills all states locally. Skip this case here.
-            s->keepOneStateOnNode = (unsigned)-1;
             if (m_succeeded.size() > 0) {
-                killAllButOneSuccessfulLocal(true);
+                killAllButOneSuccessfulLocal();
             }
         }else {
             //Kill everything
             StateSet toKeep;
             resumeSucceeded();
-            killAllExcept(toKeep, true);
+            killAllExcept(toKeep);
         }
     }
 
@@ -266,7 +247,7 @@ void StateManager::resumeSucceeded()
     }
     m_succeeded.clear();
 
-    successCount[s2e()->getCurrentProcessId()] = 0;
+    AtomicFunctions::write(&successCount[s2e()->getCurrentProcessId()], 0);
 }
 
 bool StateManager::resumeSucceededState(S2EExecutionState *s)
@@ -275,7 +256,7 @@ bool StateManager::resumeSucceededState(S2EExecutionState *s)
         uint64_t *successCount = m_shared.get()->successCount;
 
         checkInvariants();
-        --successCount[s2e()->getCurrentProcessId()];
+        AtomicFunctions::sub(&successCount[s2e()->getCurrentProcessId()], 1);
 
         m_succeeded.erase(s);
         m_executor->resumeState(s);
@@ -286,17 +267,12 @@ bool StateManager::resumeSucceededState(S2EExecutionState *s)
 
 StateManager::~StateManager()
 {
-    StateManagerShared *shared = m_shared.acquire();
-    uint64_t *successCount = shared->successCount;
+    StateManagerShared *shared = m_shared.get();
 
     checkInvariants();
     unsigned procId = s2e()->getCurrentProcessId();
-    successCount[procId] -= m_succeeded.size();
-    if (shared->keepOneStateOnNode == procId) {
-        shared->keepOneStateOnNode = (unsigned)-1;
-    }
-
-    m_shared.release();
+    AtomicFunctions::sub(&shared->successCount[procId], m_succeeded.size());
+    AtomicFunctions::compareAndSwap(&shared->keepOneStateOnNode, procId, (uint64_t)-1);
 }
 
 void StateManager::initialize()
@@ -304,14 +280,24 @@ void StateManager::initialize()
     ConfigFile *cfg = s2e()->getConfig();
 
     m_timeout = cfg->getInt(getConfigKey() + ".timeout");
+    m_remoteSuccessCount = 0;
     resetTimeout();
 
     m_detector = static_cast<ModuleExecutionDetector*>(s2e()->getPlugin("ModuleExecutionDetector"));
 
-    m_detector->onModuleTranslateBlockStart.connect(
-            sigc::mem_fun(*this,
-                    &StateManager::onNewBlockCovered)
-            );
+    //Prefer the coverage shared by all processes when it is available
+    CoverageBitmap *coverage = static_cast<CoverageBitmap*>(s2e()->getPlugin("CoverageBitmap"));
+    if (coverage) {
+        coverage->onNewBlock.connect(
+                sigc::mem_fun(*this,
+                        &StateManager::onNewBlockExecuted)
+                );
+    } else {
+        m_detector->onModuleTranslateBlockStart.connect(
+                sigc::mem_fun(*this,
+                        &StateManager::onNewBlockCovered)
+                );
+    }
 
     s2e()->getCorePlugin()->onProcessFork.connect(
             sigc::mem_fun(*this,
@@ -338,7 +324,7 @@ void StateManager::onTimer()
 void StateManager::onProcessFork(bool preFork, bool isChild, unsigned parentProcId)
 {
     if (preFork) {
-        checkInvariants(true);
+        checkInvariants();
         return;
     }
 
@@ -348,20 +334,19 @@ void StateManager::onProcessFork(bool preFork, bool isChild, unsigned parentProc
         s2e()->getDebugStream() << "StateManager forked curProc=" << procId <<
                 " parentProcId=" << parentProcId << '\n';
 
-        StateManagerShared *s = m_shared.acquire();
-        s->successCount[procId] = m_succeeded.size();
+        StateManagerShared *s = m_shared.get();
+        AtomicFunctions::write(&s->successCount[procId], m_succeeded.size());
         StateManagerShared::Command cmd = {0,0,0,0};
         s->commands[procId].write(cmd);
-        s->suspendedProcesses[procId] = false;
-        m_shared.release();
+        AtomicFunctions::write(&s->suspendedProcesses[procId], 0);
     }
 
-    checkInvariants(true);
+    checkInvariants();
 }
 
 //Reset the timeout every time a new block of the module is translated.
 //XXX: this is an approximation. The cache could be flushed in between.
-//XXX: don't reset the timeout if this block has been covered somewhere else.
+//Blocks covered by other processes are only filtered out with CoverageBitmap.
 void StateManager::onNewBlockCovered(
         ExecutionSignal *signal,
         S2EExecutionState* state,
@@ -373,6 +358,16 @@ void StateManager::onNewBlockCovered(
     resetTimeout();
 }
 
+//Called when no process executed the block before
+void StateManager::onNewBlockExecuted(
+        S2EExecutionState* state,
+        const std::string &module,
+        uint64_t relativePc)
+{
+    s2e()->getDebugStream() << "New block " << module << ":" << hexval(relativePc) << " covered" << '\n';
+    resetTimeout();
+}
+
 bool StateManager::killOnTimeOut()
 {
     if (!timeoutReached()) {
@@ -395,7 +390,7 @@ bool StateManager::killOnTimeOut()
 }
 
 
-bool StateManager::killAllExcept(StateSet &toKeep, bool ungrab)
+bool StateManager::killAllExcept(StateSet &toKeep)
 {
     llvm::raw_ostream &os = s2e()->getDebugStream();
     os << "StateManager: killAllExcept ";
@@ -426,16 +421,13 @@ bool StateManager::killAllExcept(StateSet &toKeep, bool ungrab)
     //In case we need to kill the current state, do it last, because it will throw and exception
     //and return to the state scheduler.
     if (killCurrent) {
-        if (ungrab) {
-            m_shared.release();
-        }
         s2e()->getExecutor()->terminateStateEarly(*g_s2e_state, "StateManager: killing state");
     }
 
     return true;
 }
 
-void StateManager::killAllButOneSuccessfulLocal(bool ungrabLock)
+void StateManager::killAllButOneSuccessfulLocal()
 {
     s2e()->getDebugStream() << "StateManager: killAllButOneSuccessfulLocal" << '\n';
     checkInvariants();
@@ -446,7 +438,7 @@ void StateManager::killAllButOneSuccessfulLocal(bool ungrabLock)
     StateSet toKeep;
     toKeep.insert(one);
 
-    killAllExcept(toKeep, ungrabLock);
+    killAllExcept(toKeep);
 }
 
 bool StateManager::killAllButOneSuccessful()
@@ -458,13 +450,13 @@ bool StateManager::killAllButOneSuccessful()
     unsigned maxProcesses = s2e()->getMaxProcesses();
 
     //Determine the instance that has at least one successful state
-    unsigned hasSuccessfulIndex = shared->keepOneStateOnNode;
+    unsigned hasSuccessfulIndex = AtomicFunctions::read(&shared->keepOneStateOnNode);
     if ((hasSuccessfulIndex == (unsigned)-1) || (m_succeeded.size() == 0)) {
         for (hasSuccessfulIndex=0; hasSuccessfulIndex < maxProcesses; ++hasSuccessfulIndex) {
             if (s2e()->getProcessIndexForId(hasSuccessfulIndex) == (unsigned)-1) {
                 continue;
             }
-            if (successCount[hasSuccessfulIndex] > 0) {
+            if (AtomicFunctions::read(&successCount[hasSuccessfulIndex]) > 0) {
                 break;
             }
         }
@@ -477,30 +469,45 @@ bool StateManager::killAllButOneSuccessful()
         return false;
     }
 
+    //All concurrent kills will have to chose the same node
+    //to avoid killing everything by accident. The first one wins,
+    //including when it picked itself, and the others follow it.
+    if (!AtomicFunctions::compareAndSwap(&shared->keepOneStateOnNode, (uint64_t)-1, hasSuccessfulIndex)) {
+        uint64_t chosen = AtomicFunctions::read(&shared->keepOneStateOnNode);
+        if (chosen != (uint64_t)-1) {
+            hasSuccessfulIndex = chosen;
+        }
+    }
+
     s2e()->getDebugStream() << "StateManager: Killing all but one successful on node "
             << s2e()->getProcessIndexForId(hasSuccessfulIndex) << '\n';
 
+    onKillAll.emit();
+
     //Kill all states everywhere except one successful on the instance that we found
     if (hasSuccessfulIndex == s2e()->getCurrentProcessId()) {
         //We chose one state on our local instance
-        assert(successCount[hasSuccessfulIndex] == m_succeeded.size());
+        assert(AtomicFunctions::read(&successCount[hasSuccessfulIndex]) == m_succeeded.size());
 
         //Ask other instances to kill all their states
         sendKillToAllInstances(false, 0);
 
         //Kill all local states
-        killAllButOneSuccessfulLocal(true);
-    }else {
-        //All concurrent kills will have to chose the same node
-        //to avoid killing everything by accident
-        shared->keepOneStateOnNode = hasSuccessfulIndex;
+        if (m_succeeded.size() > 0) {
+            killAllButOneSuccessfulLocal();
+        }
 
+        //Release the slot. Kill commands from instances that followed
+        //our claim only try to release it again.
+        AtomicFunctions::compareAndSwap(&shared->keepOneStateOnNode,
+                                        hasSuccessfulIndex, (uint64_t)-1);
+    }else {
         //We chose a state on a different instance
         sendKillToAllInstances(true, hasSuccessfulIndex);
 
         //Kill everything locally
         StateSet toKeep;
-        killAllExcept(toKeep, true);
+        killAllExcept(toKeep);
     }
 
     return true;
@@ -525,13 +532,33 @@ bool StateManager::succeedState(S2EExecutionState *s)
 
     bool ret =  s2e()->getExecutor()->suspendState(s);
 
-    StateManagerShared *shared = m_shared.acquire();
-    shared->successCount[s2e()->getCurrentProcessId()] = m_succeeded.size();
-    m_shared.release();
+    StateManagerShared *shared = m_shared.get();
+    AtomicFunctions::write(&shared->successCount[s2e()->getCurrentProcessId()], m_succeeded.size());
 
     return ret;
 }
 
+uint64_t StateManager::getSuccessfulStateCount()
+{
+    StateManagerShared *s = m_shared.get();
+    uint64_t count = 0;
+    for (unsigned i=0; i<s2e()->getMaxProcesses(); ++i) {
+        count += AtomicFunctions::read(&s->successCount[i]);
+    }
+    return count;
+}
+
+void StateManager::queueKillAll()
+{
+    StateManagerShared *s = m_shared.get();
+
+    //No process has this id, so that none of them keeps a state
+    StateManagerShared::Command cmd = {StateManagerShared::KILL, (uint8_t)-1, 0, 0};
+    for (unsigned i=0; i<s2e()->getMaxProcesses(); ++i) {
+        s->commands[i].write(cmd);
+    }
+}
+
 bool StateManager::empty()
 {
     assert(s2e()->getExecutor()->getSearcher());
@@ -561,14 +588,9 @@ void StateManager::onCustomInstruction(S2EExecutionState* state, uint64_t opcode
 
         //Count the number of successful states across all nodes
         case GET_SUCCESSFUL_STATE_COUNT: {
-            StateManagerShared *s = m_shared.acquire();
-            uint32_t count=0;
-            for (unsigned i=0;i<s2e()->getMaxProcesses(); ++i) {
-                count += s->successCount[i];
-            }
-            m_shared.release();
-
+            uint32_t count = getSuccessfulStateCount() + m_remoteSuccessCount;
             state->writeCpuRegisterConcrete(CPU_OFFSET(regs[R_EAX]), &count, sizeof(uint32_t));
+            break;
         }
 
         default:
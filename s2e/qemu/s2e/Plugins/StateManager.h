@@ -63,30 +63,38 @@ struct StateManagerShared {
         uint32_t padding2;
     };
 
+    //All the fields are accessed with atomic operations,
+    //there is no lock.
+
+    //Set by the suspended process that resumes all the others
     uint64_t suspendAll;
     uint64_t timeOfLastNewBlock;
 
     //How many states succeeded in each instance.
     //Access using the current state id modulo max number of processes.
+    //Only the owner of a slot writes to it.
     uint64_t successCount[S2E_MAX_PROCESSES];
+
+    //Mailbox of each instance. Any instance may post a command,
+    //the owner takes it by exchanging it with an empty one.
     AtomicObject<Command>  commands[S2E_MAX_PROCESSES];
-    bool suspendedProcesses[S2E_MAX_PROCESSES];
+    uint64_t suspendedProcesses[S2E_MAX_PROCESSES];
 
     //If killing is in progress, indicate which node
     //will keep a successful state. Used to handle concurrent killAlls.
     //-1 if no kill is in progress
-    unsigned keepOneStateOnNode;
+    uint64_t keepOneStateOnNode;
 
     StateManagerShared() {
         suspendAll = 0;
         timeOfLastNewBlock = 0;
         Command cmd = {0,0,0,0};
-        keepOneStateOnNode = (unsigned)-1;
+        keepOneStateOnNode = (uint64_t)-1;
 
         for (unsigned i=0; i<S2E_MAX_PROCESSES; ++i) {
             successCount[i] = 0;
             commands[i].write(cmd);
-            suspendedProcesses[i] = false;
+            suspendedProcesses[i] = 0;
         }
     }
 };
@@ -115,11 +123,14 @@ private:
     unsigned m_timeout;
     uint64_t m_currentTime;
 
+    //Successful states on other hosts
+    uint64_t m_remoteSuccessCount;
+
     ModuleExecutionDetector *m_detector;
 
     static StateManager *s_stateManager;
 
-    S2ESynchronizedObject<StateManagerShared> m_shared;
+    S2ESharedObject<StateManagerShared> m_shared;
 
     void onNewBlockCovered(
             ExecutionSignal *signal,
@@ -128,13 +139,18 @@ private:
             TranslationBlock *tb,
             uint64_t pc);
 
+    void onNewBlockExecuted(
+            S2EExecutionState* state,
+            const std::string &module,
+            uint64_t relativePc);
+
     void onProcessFork(bool preFork, bool isChild, unsigned parentProcId);
     void onTimer();
 
     bool processCommands();
 
 
-    bool killAllExcept(StateSet &states, bool ungrab);
+    bool killAllExcept(StateSet &states);
     void resumeSucceeded();
 
     bool timeoutReached() const;
@@ -145,13 +161,13 @@ private:
     bool resumeSucceededState(S2EExecutionState *s);
 
     bool killAllButOneSuccessful();
-    void killAllButOneSuccessfulLocal(bool ungrabLock);
+    void killAllButOneSuccessfulLocal();
 
 
     void onCustomInstruction(S2EExecutionState* state,
         uint64_t opcode);
 
-    void checkInvariants(bool grabLock=false);
+    void checkInvariants();
 
     void suspendCurrentProcess();
     void resumeAllProcesses();
@@ -160,6 +176,21 @@ private:
 public:
     bool succeedState(S2EExecutionState *s);
 
+    //Number of successful states in all processes of this host
+    uint64_t getSuccessfulStateCount();
+
+    //Successful states on other hosts are reported to the guest as well
+    void setRemoteSuccessfulStateCount(uint64_t count) {
+        m_remoteSuccessCount = count;
+    }
+
+    //Asks every process of this host to kill all its states,
+    //e.g., because another host kept a successful one
+    void queueKillAll();
+
+    //Emitted when all states but one successful are about to be killed
+    sigc::signal<void> onKillAll;
+
     //Checks whether the search has no more states
     bool empty();
 
@@ -53,6 +53,7 @@ extern CPUX86State *env;
 #include <s2e/Utils.h>
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/S2EStatsTracker.h>
 
 #include <s2e/s2e_qemu.h>
 #include <llvm/Support/FileSystem.h>
@@ -219,13 +220,13 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     m_maxProcesses = s2e_max_processes;
     m_currentProcessIndex = 0;
     m_currentProcessId = 0;
-    S2EShared *shared = m_sync.acquire();
+    //No other instance exists yet
+    S2EShared *shared = m_sync.get();
     shared->currentProcessCount = 1;
     shared->lastStateId = 0;
     shared->lastFileId = 1;
     shared->processIds[m_currentProcessId] = m_currentProcessIndex;
     shared->processPids[m_currentProcessId] = getpid();
-    m_sync.release();
 
     /* Open output directory. Do it at the very begining so that
        other init* functions can use it. */
@@ -259,6 +260,9 @@ S2E::S2E(int argc, char** argv, TCGLLVMContext *tcgLLVMContext,
     /* Initialize KLEE command line options */
     initKleeOptions();
 
+    /* Host time accounting depends on the command line options */
+    S2EStatsTracker::initializePhases();
+
     /* Initialize S2EExecutor */
     initExecutor();
 
@@ -289,14 +293,15 @@ S2E::~S2E()
         delete p;
 
     //Tell other instances we are dead so they can fork more
-    S2EShared *shared = m_sync.acquire();
+    S2EShared *shared = m_sync.get();
 
+    shared->processLock.writeLock();
     assert(shared->processIds[m_currentProcessId] == m_currentProcessIndex);
     shared->processIds[m_currentProcessId] = (unsigned) -1;
     shared->processPids[m_currentProcessId] = (unsigned) -1;
-    --shared->currentProcessCount;
+    shared->processLock.writeUnlock();
 
-    m_sync.release();
+    AtomicFunctions::sub(&shared->currentProcessCount, 1);
 
     delete m_pluginsFactory;
     writeBitCodeToFile();
@@ -524,6 +529,7 @@ void S2E::initPlugins()
     assert(m_corePlugin);
 
     m_activePluginsList.push_back(m_corePlugin);
+    S2EStatsTracker::registerPluginPhase(m_corePlugin, m_corePlugin->getPluginInfo()->name);
     m_activePluginsMap.insert(
             make_pair(m_corePlugin->getPluginInfo()->name, m_corePlugin));
     if(!m_corePlugin->getPluginInfo()->functionName.empty())
@@ -558,6 +564,7 @@ void S2E::initPlugins()
             assert(plugin);
 
             m_activePluginsList.push_back(plugin);
+            S2EStatsTracker::registerPluginPhase(plugin, plugin->getPluginInfo()->name);
             m_activePluginsMap.insert(
                     make_pair(plugin->getPluginInfo()->name, plugin));
             if(!plugin->getPluginInfo()->functionName.empty())
@@ -636,34 +643,32 @@ int S2E::fork()
     return -1;
 #else
 
-    S2EShared *shared = m_sync.acquire();
-    if (shared->currentProcessCount == m_maxProcesses) {
-        m_sync.release();
-        return -1;
-    }
+    S2EShared *shared = m_sync.get();
 
-    unsigned newProcessIndex = shared->lastFileId;
-    ++shared->lastFileId;
-    ++shared->currentProcessCount;
+    //Reserve a process without exceeding the maximum
+    uint64_t count;
+    do {
+        count = AtomicFunctions::read(&shared->currentProcessCount);
+        if (count >= m_maxProcesses) {
+            return -1;
+        }
+    } while (!AtomicFunctions::compareAndSwap(&shared->currentProcessCount, count, count + 1));
 
-    m_sync.release();
+    unsigned newProcessIndex = AtomicFunctions::fetchAdd(&shared->lastFileId, 1);
 
     pid_t pid = ::fork();
     if (pid < 0) {
         //Fork failed
 
-        shared = m_sync.acquire();
         //Do not decrement lastFileId, as other fork may have
         //succeeded while we were handling the failure.
-
-        --shared->currentProcessCount;
-        m_sync.release();
+        AtomicFunctions::sub(&shared->currentProcessCount, 1);
         return -1;
     }
 
     if (pid == 0) {
         //Allocate a free slot in the instance map
-        shared = m_sync.acquire();
+        shared->processLock.writeLock();
         unsigned i=0;
         for (i=0; i<m_maxProcesses; ++i) {
             if (shared->processIds[i] == (unsigned)-1) {
@@ -674,7 +679,7 @@ int S2E::fork()
             }
         }
         assert (i < m_maxProcesses);
-        m_sync.release();
+        shared->processLock.writeUnlock();
 
         m_currentProcessIndex = newProcessIndex;
         //We are the child process, setup the log files again
@@ -714,60 +719,81 @@ int S2E::fork()
 
 unsigned S2E::fetchAndIncrementStateId()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->lastStateId;
-    ++shared->lastStateId;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::fetchAdd(&m_sync.get()->lastStateId, 1);
 }
+
 unsigned S2E::fetchNextStateId()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->lastStateId;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::read(&m_sync.get()->lastStateId);
+}
+
+void S2E::setNextStateId(unsigned id)
+{
+    AtomicFunctions::write(&m_sync.get()->lastStateId, id);
 }
 
 unsigned S2E::getCurrentProcessCount()
 {
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->currentProcessCount;
-    m_sync.release();
-    return ret;
+    return AtomicFunctions::read(&m_sync.get()->currentProcessCount);
 }
 
 unsigned S2E::getProcessIndexForId(unsigned id)
 {
     assert(id < m_maxProcesses);
-    S2EShared *shared = m_sync.acquire();
-    unsigned ret = shared->processIds[id];
-    m_sync.release();
+    const S2EShared *shared = m_sync.get();
+    unsigned ret;
+    uint64_t sequence;
+    do {
+        sequence = shared->processLock.readBegin();
+        ret = shared->processIds[id];
+    } while (shared->processLock.readRetry(sequence));
     return ret;
 }
 
 bool S2E::checkDeadProcesses()
 {
-    S2EShared *shared = m_sync.acquire();
+    S2EShared *shared = m_sync.get();
+
+    //Probe the processes without blocking the other instances
+    unsigned pids[S2E_MAX_PROCESSES];
+    uint64_t sequence;
+    do {
+        sequence = shared->processLock.readBegin();
+        for (unsigned i=0; i<m_maxProcesses; ++i) {
+            pids[i] = shared->processPids[i];
+        }
+    } while (shared->processLock.readRetry(sequence));
+
     bool ret = false;
     for (unsigned i=0; i<m_maxProcesses; ++i) {
-        if (shared->processPids[i] == (unsigned)-1) {
+        if (pids[i] == (unsigned)-1) {
             continue;
         }
 
         //Check if pid is alive
         char buffer[64];
-        snprintf(buffer, sizeof(buffer), "kill -0 %d", shared->processPids[i]);
-        int ret = system(buffer);
-        if (ret != 0) {
-            //Process is dead, we have to decrement everyting
+        snprintf(buffer, sizeof(buffer), "kill -0 %d", pids[i]);
+        if (system(buffer) == 0) {
+            continue;
+        }
+
+        //Process is dead, we have to decrement everyting,
+        //unless another instance already did it.
+        bool cleared = false;
+        shared->processLock.writeLock();
+        if (shared->processPids[i] == pids[i]) {
             shared->processIds[i] = (unsigned) -1;
             shared->processPids[i] = (unsigned) -1;
-            --shared->currentProcessCount;
+            cleared = true;
+        }
+        shared->processLock.writeUnlock();
+
+        if (cleared) {
+            AtomicFunctions::sub(&shared->currentProcessCount, 1);
             ret = true;
         }
     }
 
-    m_sync.release();
     return ret;
 }
 
@@ -74,14 +74,19 @@ class Database;
  *   用于同步S2E的多个实例。
  */
 
-//Structure used for synchronization among multiple instances of S2E
+//Structure used for synchronization among multiple instances of S2E.
+//The counters are only accessed with AtomicFunctions.
 struct S2EShared {
-    unsigned currentProcessCount;
-    unsigned lastFileId;
+    uint64_t currentProcessCount;
+    uint64_t lastFileId;
     //We must have unique state ids across all processes
     //otherwise offline tools will be extremely confused when
     //aggregating different execution trace files.
-    unsigned lastStateId;
+    uint64_t lastStateId;
+
+    //Protects processIds and processPids, which only change
+    //when an instance starts or terminates
+    S2ESeqLock processLock;
 
 	/*[fwl] 成员变量processIds、processPids数组
 	 *   记录当前运行实例索引的数组，内容为-1（没有实例化）或者为实例的索引，大小为S2E_MAX_PROCESSES=48。
@@ -109,7 +114,7 @@ struct S2EShared {
 class S2E
 {
 protected:
-    S2ESynchronizedObject<S2EShared> m_sync;
+    S2ESharedObject<S2EShared> m_sync;
     ConfigFile* m_configFile;
     PluginsFactory* m_pluginsFactory;
 
@@ -248,6 +253,10 @@ public:
 
     unsigned fetchAndIncrementStateId();
     unsigned fetchNextStateId();
+
+    /** Makes the processes allocate state ids from the given one on,
+        e.g., from a range reserved for this host */
+    void setNextStateId(unsigned id);
     unsigned getMaxProcesses() const {
         return m_maxProcesses;
     }
@@ -53,6 +53,7 @@ void vm_start(void);
 #include "llvm/Support/CommandLine.h"
 #include "S2EDeviceState.h"
 #include "S2EExecutionState.h"
+#include "S2EStatsTracker.h"
 
 namespace {
     //Force writes to disk to be persistent (and disable copy on write)
@@ -209,6 +210,7 @@ int s2edev_dbg=0;
 
 void S2EDeviceState::saveDeviceState()
 {
+    S2EPhaseTimer phaseTimer(S2E_PHASE_DEVICE_SNAPSHOT);
     s_currentDeviceState = this;
 
     qemu_make_readable(m_memFile);
@@ -231,6 +233,7 @@ void S2EDeviceState::restoreDeviceState()
     assert(m_stateSize);
     assert(m_state);
 
+    S2EPhaseTimer phaseTimer(S2E_PHASE_DEVICE_SNAPSHOT);
     s_currentDeviceState = this;
 
     qemu_make_readable(m_memFile);
@@ -64,6 +64,7 @@ extern struct CPUX86State *env;
 
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
 
 //XXX: The idea is to avoid function calls
 //#define small_memcpy(dest, source, count) asm volatile ("cld; rep movsb"::"S"(source), "D"(dest), "c" (count):"flags", "memory")
@@ -98,7 +99,7 @@ S2EExecutionState::S2EExecutionState(klee::KFunction *kf) :
         m_active(true), m_zombie(false), m_yielded(false), m_runningConcrete(true),
         m_cpuRegistersObject(NULL), m_cpuSystemObject(NULL),
         m_qemuIcount(0), m_lastS2ETb(NULL),
-        m_lastMergeICount((uint64_t)-1),
+        m_lastMergeICount((uint64_t)-1), m_timeSlice(0),
         m_needFinalizeTBExec(false), m_nextSymbVarId(0), m_runningExceptionEmulationCode(false)
 {
     m_deviceState = new S2EDeviceState();
@@ -472,10 +473,8 @@ uint64_t S2EExecutionState::getPc() const
 
 uint64_t S2EExecutionState::getFlags()
 {
-    /* restore flags in standard format */
-    WR_cpu(env, cc_src, cpu_cc_compute_all(env, CC_OP));
-    WR_cpu(env, cc_op, CC_OP_EFLAGS);
-    return cpu_get_eflags(env);
+    /* compute the flags without discarding lazy condition codes */
+    return env->mflags | cpu_cc_compute_all(env, CC_OP) | (env->df & DF_MASK) | 0x2;
 }
 
 void S2EExecutionState::setPc(uint64_t pc)
@@ -754,6 +753,36 @@ ref<Expr> S2EExecutionState::readMemory8(uint64_t address,
     return op.second->read8(hostAddress & ~S2E_RAM_OBJECT_MASK);
 }
 
+bool S2EExecutionState::isMemoryConcrete(uint64_t address, uint64_t size,
+                                         AddressType addressType) const
+{
+    while (size > 0) {
+        uint64_t pageOffset = address & ~S2E_RAM_OBJECT_MASK;
+        uint64_t chunk = std::min(size, (uint64_t) S2E_RAM_OBJECT_SIZE - pageOffset);
+
+        uint64_t hostAddress = getHostAddress(address, addressType);
+        if(hostAddress == (uint64_t) -1)
+            return false;
+
+        ObjectPair op = m_memcache.get(hostAddress & S2E_RAM_OBJECT_MASK);
+        if (!op.first) {
+            op = addressSpace.findObject(hostAddress & S2E_RAM_OBJECT_MASK);
+            m_memcache.put(hostAddress & S2E_RAM_OBJECT_MASK, op);
+        }
+
+        assert(op.first && op.first->isUserSpecified
+               && op.first->size == S2E_RAM_OBJECT_SIZE);
+
+        if (!op.second->isConcrete(pageOffset, chunk * 8))
+            return false;
+
+        address += chunk;
+        size -= chunk;
+    }
+
+    return true;
+}
+
 bool S2EExecutionState::readMemoryConcrete8(uint64_t address,
                                             uint8_t *result,
                                             AddressType addressType,
@@ -1317,22 +1346,52 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         }
     }
 
-    std::set< ref<Expr> > aConstraints(constraints.begin(), constraints.end());
-    std::set< ref<Expr> > bConstraints(b.constraints.begin(),
-                                       b.constraints.end());
-    std::set< ref<Expr> > commonConstraints, aSuffix, bSuffix;
-    std::set_intersection(aConstraints.begin(), aConstraints.end(),
-                          bConstraints.begin(), bConstraints.end(),
-                          std::inserter(commonConstraints, commonConstraints.begin()));
-    std::set_difference(aConstraints.begin(), aConstraints.end(),
-                        commonConstraints.begin(), commonConstraints.end(),
-                        std::inserter(aSuffix, aSuffix.end()));
-    std::set_difference(bConstraints.begin(), bConstraints.end(),
-                        commonConstraints.begin(), commonConstraints.end(),
-                        std::inserter(bSuffix, bSuffix.end()));
+    /* Check CPUX86State */
+    {
+        uint8_t* cpuStateA = m_cpuSystemObject->getConcreteStore() - CPU_OFFSET(eip);
+        uint8_t* cpuStateB = b.m_cpuSystemObject->getConcreteStore() - CPU_OFFSET(eip);
+        if(memcmp(cpuStateA + CPU_OFFSET(eip), cpuStateB + CPU_OFFSET(eip),
+                  CPU_OFFSET(current_tb) - CPU_OFFSET(eip))) {
+            if(DebugLogStateMerge)
+                s << "merge failed: different concrete cpu state" << '\n';
+            return false;
+        }
+    }
+
+    std::set<const MemoryObject*> mutated;
+    if(!getMutatedObjects(b, mutated, DebugLogStateMerge ? &s : NULL)) {
+        return false;
+    }
+
+    /* States forked from a common ancestor share the constraints that
+       were added before the fork, in the same order. Compare that prefix
+       pairwise, which only looks at the expression hashes in most cases,
+       and only build sets for the remaining suffixes. */
+    std::vector< ref<Expr> > commonConstraints;
+    std::set< ref<Expr> > aSuffix, bSuffix;
+    {
+        ConstraintManager::constraint_iterator ai = constraints.begin();
+        ConstraintManager::constraint_iterator ae = constraints.end();
+        ConstraintManager::constraint_iterator bi = b.constraints.begin();
+        ConstraintManager::constraint_iterator be = b.constraints.end();
+        for(; ai != ae && bi != be && *ai == *bi; ++ai, ++bi)
+            commonConstraints.push_back(*ai);
+
+        std::set< ref<Expr> > aRest(ai, ae), bRest(bi, be);
+        std::set_intersection(aRest.begin(), aRest.end(),
+                              bRest.begin(), bRest.end(),
+                              std::back_inserter(commonConstraints));
+        std::set_difference(aRest.begin(), aRest.end(),
+                            bRest.begin(), bRest.end(),
+                            std::inserter(aSuffix, aSuffix.end()));
+        std::set_difference(bRest.begin(), bRest.end(),
+                            aRest.begin(), aRest.end(),
+                            std::inserter(bSuffix, bSuffix.end()));
+    }
+
     if(DebugLogStateMerge) {
         s << "\tconstraint prefix: [";
-        for(std::set< ref<Expr> >::iterator it = commonConstraints.begin(),
+        for(std::vector< ref<Expr> >::iterator it = commonConstraints.begin(),
                         ie = commonConstraints.end(); it != ie; ++it)
             s << *it << ", ";
         s << "]\n";
@@ -1348,71 +1407,6 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         s << "]" << '\n';
     }
 
-    /* Check CPUX86State */
-    {
-        uint8_t* cpuStateA = m_cpuSystemObject->getConcreteStore() - CPU_OFFSET(eip);
-        uint8_t* cpuStateB = b.m_cpuSystemObject->getConcreteStore() - CPU_OFFSET(eip);
-        if(memcmp(cpuStateA + CPU_OFFSET(eip), cpuStateB + CPU_OFFSET(eip),
-                  CPU_OFFSET(current_tb) - CPU_OFFSET(eip))) {
-            if(DebugLogStateMerge)
-                s << "merge failed: different concrete cpu state" << '\n';
-            return false;
-        }
-    }
-
-    // We cannot merge if addresses would resolve differently in the
-    // states. This means:
-    //
-    // 1. Any objects created since the branch in either object must
-    // have been free'd.
-    //
-    // 2. We cannot have free'd any pre-existing object in one state
-    // and not the other
-
-    //if(DebugLogStateMerge) {
-    //    s << "\tchecking object states\n";
-    //    s << "A: " << addressSpace.objects << "\n";
-    //    s << "B: " << b.addressSpace.objects << "\n";
-    //}
-
-    std::set<const MemoryObject*> mutated;
-    MemoryMap::iterator ai = addressSpace.objects.begin();
-    MemoryMap::iterator bi = b.addressSpace.objects.begin();
-    MemoryMap::iterator ae = addressSpace.objects.end();
-    MemoryMap::iterator be = b.addressSpace.objects.end();
-    for(; ai!=ae && bi!=be; ++ai, ++bi) {
-        if (ai->first != bi->first) {
-            if (DebugLogStateMerge) {
-                if (ai->first < bi->first) {
-                    s << "\t\tB misses binding for: " << ai->first->id << "\n";
-                } else {
-                    s << "\t\tA misses binding for: " << bi->first->id << "\n";
-                }
-            }
-            if(DebugLogStateMerge)
-                s << "merge failed: different callstacks" << '\n';
-            return false;
-        }
-        if(ai->second != bi->second && !ai->first->isValueIgnored &&
-                    ai->first != m_cpuSystemState && ai->first != m_dirtyMask) {
-            const MemoryObject *mo = ai->first;
-            if(DebugLogStateMerge)
-                s << "\t\tmutated: " << mo->id << " (" << mo->name << ")\n";
-            if(mo->isSharedConcrete) {
-                if(DebugLogStateMerge)
-                    s << "merge failed: different shared-concrete objects "
-                      << '\n';
-                return false;
-            }
-            mutated.insert(mo);
-        }
-    }
-    if(ai!=ae || bi!=be) {
-        if(DebugLogStateMerge)
-            s << "merge failed: different address maps" << '\n';
-        return false;
-    }
-
     // Create state predicates
     ref<Expr> inA = ConstantExpr::alloc(1, Expr::Bool);
     ref<Expr> inB = ConstantExpr::alloc(1, Expr::Bool);
@@ -1478,7 +1472,7 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
         s << "\t\tcreated " << selectCountMem << " select expressions in memory\n";
 
     constraints = ConstraintManager();
-    for(std::set< ref<Expr> >::iterator it = commonConstraints.begin(),
+    for(std::vector< ref<Expr> >::iterator it = commonConstraints.begin(),
                 ie = commonConstraints.end(); it != ie; ++it)
         constraints.addConstraint(*it);
 
@@ -1517,6 +1511,77 @@ bool S2EExecutionState::merge(const ExecutionState &_b)
     return true;
 }
 
+// We cannot merge if addresses would resolve differently in the
+// states. This means:
+//
+// 1. Any objects created since the branch in either object must
+// have been free'd.
+//
+// 2. We cannot have free'd any pre-existing object in one state
+// and not the other
+bool S2EExecutionState::getMutatedObjects(const S2EExecutionState &b,
+                                          std::set<const MemoryObject*> &mutated,
+                                          llvm::raw_ostream *s) const
+{
+    MemoryMap::iterator ai = addressSpace.objects.begin();
+    MemoryMap::iterator bi = b.addressSpace.objects.begin();
+    MemoryMap::iterator ae = addressSpace.objects.end();
+    MemoryMap::iterator be = b.addressSpace.objects.end();
+    for(; ai!=ae && bi!=be; ++ai, ++bi) {
+        if (ai->first != bi->first) {
+            if (s) {
+                if (ai->first < bi->first) {
+                    *s << "\t\tB misses binding for: " << ai->first->id << "\n";
+                } else {
+                    *s << "\t\tA misses binding for: " << bi->first->id << "\n";
+                }
+                *s << "merge failed: different callstacks" << '\n';
+            }
+            return false;
+        }
+        if(ai->second != bi->second && !ai->first->isValueIgnored &&
+                    ai->first != m_cpuSystemState && ai->first != m_dirtyMask) {
+            const MemoryObject *mo = ai->first;
+            if(s)
+                *s << "\t\tmutated: " << mo->id << " (" << mo->name << ")\n";
+            if(mo->isSharedConcrete) {
+                if(s)
+                    *s << "merge failed: different shared-concrete objects "
+                       << '\n';
+                return false;
+            }
+            mutated.insert(mo);
+        }
+    }
+    if(ai!=ae || bi!=be) {
+        if(s)
+            *s << "merge failed: different address maps" << '\n';
+        return false;
+    }
+    return true;
+}
+
+int S2EExecutionState::getMergeDistance(const S2EExecutionState &b) const
+{
+    if(pc != b.pc || symbolics != b.symbolics || stack.size() != b.stack.size())
+        return -1;
+
+    //The concrete store of the active state is stale until it is switched
+    //out, its registers live in the CPU state itself
+    const uint8_t* cpuStateA = m_active ? (const uint8_t*) m_cpuSystemState->address :
+                                          m_cpuSystemObject->getConcreteStore();
+    const uint8_t* cpuStateB = b.m_active ? (const uint8_t*) m_cpuSystemState->address :
+                                            b.m_cpuSystemObject->getConcreteStore();
+    if(memcmp(cpuStateA, cpuStateB, CPU_OFFSET(current_tb) - CPU_OFFSET(eip)))
+        return -1;
+
+    std::set<const MemoryObject*> mutated;
+    if(!getMutatedObjects(b, mutated, NULL))
+        return -1;
+
+    return mutated.size();
+}
+
 CPUX86State *S2EExecutionState::getConcreteCpuState() const
 {
     return (CPUX86State *) (m_cpuSystemState->address - CPU_OFFSET(eip));
@@ -155,6 +155,10 @@ protected:
 
     uint64_t m_lastMergeICount;
 
+    /* Milliseconds the state runs before the searcher is asked for
+       another one, 0 until the state is first scheduled */
+    uint64_t m_timeSlice;
+
     bool m_needFinalizeTBExec;
 
     unsigned m_nextSymbVarId;
@@ -356,6 +360,11 @@ public:
     klee::ref<klee::Expr> readMemory8(uint64_t address,
                               AddressType addressType = VirtualAddress) const;
 
+    /** Returns true if the given memory is mapped and does not contain
+        symbolic values. Never concretizes. */
+    bool isMemoryConcrete(uint64_t address, uint64_t size,
+                          AddressType addressType = VirtualAddress) const;
+
     bool readMemoryConcrete8(uint64_t address,
                              uint8_t *result = NULL,
                              AddressType addressType = VirtualAddress,
@@ -420,11 +429,23 @@ public:
     /** Attempt to merge two states */
     bool merge(const ExecutionState &b);
 
+    /** Number of memory objects that would get select expressions if b
+        was merged into this state, or -1 if the states cannot be merged.
+        The registers of the active state are read from the CPU. */
+    int getMergeDistance(const S2EExecutionState &b) const;
+
     void updateTlbEntry(CPUX86State* env,
                               int mmu_idx, uint64_t virtAddr, uint64_t hostAddr);
     void flushTlbCache();
 
     void flushTlbCachePage(klee::ObjectState *objectState, int mmu_idx, int index);
+
+private:
+    /** Collects the objects that differ between the address spaces of this
+        state and b. Returns false if the address spaces cannot be merged. */
+    bool getMutatedObjects(const S2EExecutionState &b,
+                           std::set<const klee::MemoryObject*> &mutated,
+                           llvm::raw_ostream *log) const;
 };
 
 //Some convenience macros
@@ -77,6 +77,10 @@ uint64_t helper_set_cc_op_eflags(void);
 #include <s2e/S2EDeviceState.h>
 #include <s2e/SelectRemovalPass.h>
 #include <s2e/S2EStatsTracker.h>
+#include <s2e/BitcodeCache.h>
+#include <s2e/BackgroundTranslator.h>
+#include <s2e/SuperblockBuilder.h>
+#include <s2e/TbOptimizer.h>
 
 //XXX: Remove this from executor
 #include <s2e/Plugins/ModuleExecutionDetector.h>
@@ -208,6 +212,78 @@ namespace {
     UseFastHelpers("use-fast-helpers",
                    cl::desc("Replaces LLVM bitcode with fast symbolic-aware equivalent native helpers"),  cl::init(false));
 
+    cl::opt<std::string>
+    BitcodeCacheDir("bitcode-cache",
+            cl::desc("Directory where the optimized LLVM code of translation blocks is cached across runs"),
+            cl::init(""));
+
+    cl::opt<unsigned>
+    BitcodeCacheSize("bitcode-cache-size",
+            cl::desc("Maximum size of the bitcode cache in MB"),
+            cl::init(1024));
+
+    cl::opt<bool>
+    SplitTranslationBlocks("split-translation-blocks",
+            cl::desc("Execute natively the instructions of a symbolic translation block that precede the first access to symbolic data"),
+            cl::init(false));
+
+    cl::opt<bool>
+    BackgroundTranslation("background-llvm-translation",
+            cl::desc("Optimize the LLVM code of upcoming symbolic translation blocks on a separate thread"),
+            cl::init(false));
+
+    cl::opt<unsigned>
+    BackgroundTranslationQueue("background-llvm-translation-queue",
+            cl::desc("Maximum number of translation blocks waiting for background optimization"),
+            cl::init(32));
+
+    cl::opt<unsigned>
+    SuperblockThreshold("superblock-threshold",
+            cl::desc("Merge a translation block with its hottest successors after that many executions in KLEE (0 to disable)"),
+            cl::init(0));
+
+    cl::opt<unsigned>
+    SuperblockMaxLength("superblock-max-length",
+            cl::desc("Maximum number of translation blocks in a superblock"),
+            cl::init(8));
+
+    cl::opt<std::string>
+    TbPasses("tb-passes",
+            cl::desc("Comma-separated passes run once on each translation block instead of KLEE's generic "
+                     "optimizations (e.g., instcombine,cpu-dse,gvn,sink,select-to-branch,simplifycfg,adce)"),
+            cl::init(""));
+
+    cl::opt<bool>
+    LazyFlags("lazy-flags",
+            cl::desc("Keep symbolic condition codes in lazy form when leaving the CPU loop "
+                     "(experimental: EFLAGS consumers outside the CPU loop expect CC_OP_EFLAGS)"),
+            cl::init(false));
+
+    cl::opt<bool>
+    InterruptFastPath("interrupt-fast-path",
+            cl::desc("Deliver interrupts natively when the state they use is concrete, even if other registers are symbolic"),
+            cl::init(true));
+
+    cl::opt<unsigned>
+    StateSwitchQuantum("state-switch-quantum",
+            cl::desc("Milliseconds a state runs before the searcher selects the next one"),
+            cl::init(100));
+
+    cl::opt<unsigned>
+    MaxStateSwitchQuantum("max-state-switch-quantum",
+            cl::desc("Upper bound in milliseconds of the quantum of states that keep translating new blocks"),
+            cl::init(1600));
+
+    cl::opt<bool>
+    AdaptiveQuantum("adaptive-quantum",
+            cl::desc("Extend the quantum of states that translate new blocks, and keep it well above the state switch cost"),
+            cl::init(true));
+
+    cl::opt<bool>
+    S2ETlbProbes("s2e-tlb-probes",
+            cl::desc("Serve concrete memory accesses of symbolic code directly from the S2E TLB"),
+            cl::init(true));
+
 }
 
 //The logs may be flooded with messages when switching execution mode.
@@ -238,6 +314,8 @@ extern "C" {
     int g_s2e_fork_on_symbolic_address = 0;
     int g_s2e_concretize_io_addresses = 1;
     int g_s2e_concretize_io_writes = 1;
+    int g_s2e_split_translation_blocks = 0;
+    int g_s2e_translating_llvm = 0;
 }
 
 
@@ -522,7 +600,7 @@ void S2EExecutor::handleForkAndConcretize(Executor* executor,
 
     g_s2e->getDebugStream(s2eState) << "forkAndConcretize(" << expr << ")" << '\n';
 
-    if (state->forkDisabled) {
+    if (state->forkDisabled || !s2eExecutor->isForkAllowed(*state, expr)) {
         //Simply pick one possible value and continue
         ref<klee::ConstantExpr> value;
         bool success = s2eExecutor->getSolver()->getValue(
@@ -658,7 +736,11 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
         : Executor(opts, ie, tcgLLVMContext->getExecutionEngine()),
           m_s2e(s2e), m_tcgLLVMContext(tcgLLVMContext),
           m_executeAlwaysKlee(false), m_forkProcTerminateCurrentState(false),
-          m_inLoadBalancing(false), yieldedState(NULL)
+          m_inLoadBalancing(false), m_sliceTranslatedBlocks(0), m_switchCost(0),
+          m_stateSwitchRequested(false),
+          yieldedState(NULL), m_bitcodeCache(NULL),
+          m_backgroundTranslator(NULL), m_superblockBuilder(NULL),
+          m_tbOptimizer(NULL)
 {
     delete externalDispatcher;
     externalDispatcher = new S2EExternalDispatcher(
@@ -882,6 +964,10 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
             replaceExternalFunctionsWithSpecialHandlers();
         }
 
+        if (S2ETlbProbes) {
+            installS2ETlbProbes();
+        }
+
         m_tcgLLVMContext->initializeHelpers();
     }
 
@@ -895,6 +981,36 @@ S2EExecutor::S2EExecutor(S2E* s2e, TCGLLVMContext *tcgLLVMContext,
     g_s2e_fork_on_symbolic_address = ForkOnSymbolicAddress;
     g_s2e_concretize_io_addresses = ConcretizeIoAddress;
     g_s2e_concretize_io_writes = ConcretizeIoWrites;
+    g_s2e_split_translation_blocks = SplitTranslationBlocks && !execute_llvm;
+
+    if (BackgroundTranslation && !execute_llvm) {
+        char* filename =  qemu_find_file(QEMU_FILE_TYPE_LIB, "op_helper.bc");
+        assert(filename);
+        m_backgroundTranslator = new BackgroundTranslator(m_tcgLLVMContext->getModule(),
+                                                          filename, BackgroundTranslationQueue);
+        g_free(filename);
+    }
+
+    if (SuperblockThreshold && SuperblockMaxLength > 1 && !execute_llvm) {
+        m_superblockBuilder = new SuperblockBuilder(m_tcgLLVMContext->getModule());
+    }
+
+    if (!TbPasses.empty() && !execute_llvm) {
+        m_tbOptimizer = new TbOptimizer(m_tcgLLVMContext->getModule(), TbPasses);
+        if (m_tbOptimizer->empty()) {
+            delete m_tbOptimizer;
+            m_tbOptimizer = NULL;
+        }
+    }
+
+    //Functions are only stored once KLEE optimized them,
+    //which never happens when everything runs in the JIT.
+    if (!BitcodeCacheDir.empty() && !execute_llvm) {
+        m_bitcodeCache = new BitcodeCache(m_tcgLLVMContext->getModule(), BitcodeCacheDir,
+                                          (uint64_t) BitcodeCacheSize << 20,
+                                          m_tbOptimizer ? TbPasses : std::string("klee"));
+        m_tcgLLVMContext->setFunctionCache(m_bitcodeCache);
+    }
 }
 
 void S2EExecutor::initializeStatistics()
@@ -917,6 +1033,29 @@ S2EExecutor::~S2EExecutor()
 {
     if(statsTracker)
         statsTracker->done();
+
+    writeNativeHelperProfile();
+
+    if (m_backgroundTranslator) {
+        m_backgroundTranslator->printStats(m_s2e->getMessagesStream());
+        delete m_backgroundTranslator;
+    }
+
+    if (m_superblockBuilder) {
+        m_superblockBuilder->printStats(m_s2e->getMessagesStream());
+        delete m_superblockBuilder;
+    }
+
+    if (m_tbOptimizer) {
+        m_tbOptimizer->printStats(m_s2e->getMessagesStream());
+        delete m_tbOptimizer;
+    }
+
+    if (m_bitcodeCache) {
+        m_bitcodeCache->printStats(m_s2e->getMessagesStream());
+        m_tcgLLVMContext->setFunctionCache(NULL);
+        delete m_bitcodeCache;
+    }
 }
 
 S2EExecutionState* S2EExecutor::createInitialState()
@@ -952,6 +1091,10 @@ S2EExecutionState* S2EExecutor::createInitialState()
                       /* isSharedConcrete = */ true,
                       /* isValueIgnored = */ true);
 
+    //Translation block functions request goto_tb through this global
+    predefinedSymbols.insert(std::make_pair(TCG_LLVM_GOTO_TB_NAME,
+                                            (void*) &tcg_llvm_runtime.goto_tb));
+
     addExternalObject(*state, (void*) tb_function_args,
                       sizeof(tb_function_args), false,
                       /* isUserSpecified = */ true,
@@ -1008,6 +1151,11 @@ void S2EExecutor::initializeExecution(S2EExecutionState* state,
 
     m_executeAlwaysKlee = executeAlwaysKlee;
 
+    /* QEMU registers its helpers during machine initialization */
+    if (UseFastHelpers && !execute_llvm) {
+        installNativeHelpers();
+    }
+
     initializeGlobals(*state);
     bindModuleConstants();
 
@@ -1267,28 +1415,82 @@ void S2EExecutor::doLoadBalancing()
     vm_start();
 }
 
+/**
+ *  With -adaptive-quantum, a state that translated new blocks during its
+ *  quantum keeps running for twice as long, up to -max-state-switch-quantum,
+ *  without asking the searcher (see keepCurrentState). Other states get the
+ *  base quantum, raised so that switching costs at most about 5% of the time.
+ */
+uint64_t S2EExecutor::getTimeSlice(S2EExecutionState *state, bool productive)
+{
+    if (!AdaptiveQuantum) {
+        return StateSwitchQuantum;
+    }
+
+    uint64_t minSlice = std::max<uint64_t>(StateSwitchQuantum, m_switchCost * 20 / 1000);
+    uint64_t maxSlice = std::max<uint64_t>(MaxStateSwitchQuantum, minSlice);
+
+    if (!productive || !state->m_timeSlice) {
+        return minSlice;
+    }
+
+    return std::min(state->m_timeSlice * 2, maxSlice);
+}
+
+/**
+ *  Whether the current state keeps running without going through the
+ *  searcher while it finds new code. Anything else that needs the searcher
+ *  (new or removed states, a yielded state, or an explicit request through
+ *  scheduleStateSwitch) takes precedence over the adaptive quantum.
+ */
+bool S2EExecutor::keepCurrentState(S2EExecutionState *state, bool productive,
+                                   uint64_t previousSlice) const
+{
+    return AdaptiveQuantum && productive &&
+           state->m_timeSlice > previousSlice &&
+           !m_stateSwitchRequested &&
+           s2e_is_runnable(state) && !yieldedState &&
+           addedStates.empty() && removedStates.empty();
+}
+
 void S2EExecutor::stateSwitchTimerCallback(void *opaque)
 {
     S2EExecutor *c = (S2EExecutor*)opaque;
 
     if (g_s2e_state) {
         c->doLoadBalancing();
-        S2EExecutionState *nextState = c->selectNextState(g_s2e_state);
-        if (nextState) {
-            g_s2e_state = nextState;
-        } else {
-            //Do not reschedule the timer anymore
-            return;
+
+        S2EExecutionState *state = g_s2e_state;
+        bool productive = stats::translatedBlocks > c->m_sliceTranslatedBlocks;
+        uint64_t previousSlice = state->m_timeSlice;
+        state->m_timeSlice = c->getTimeSlice(state, productive);
+
+        if (!c->keepCurrentState(state, productive, previousSlice)) {
+            S2EExecutionState *nextState = c->selectNextState(state);
+            if (nextState) {
+                g_s2e_state = nextState;
+            } else {
+                //Do not reschedule the timer anymore
+                return;
+            }
+
+            if (!g_s2e_state->m_timeSlice) {
+                g_s2e_state->m_timeSlice = c->getTimeSlice(g_s2e_state, false);
+            }
         }
     }
 
-    qemu_mod_timer(c->m_stateSwitchTimer, qemu_get_clock_ms(rt_clock) + 100);
+    c->m_sliceTranslatedBlocks = stats::translatedBlocks;
+    c->m_stateSwitchRequested = false;
+
+    uint64_t slice = g_s2e_state ? g_s2e_state->m_timeSlice : StateSwitchQuantum;
+    qemu_mod_timer(c->m_stateSwitchTimer, qemu_get_clock_ms(rt_clock) + slice);
 }
 
 void S2EExecutor::initializeStateSwitchTimer()
 {
     m_stateSwitchTimer = qemu_new_timer_ms(rt_clock, &stateSwitchTimerCallback, this);
-    qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock) + 100);
+    qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock) + StateSwitchQuantum);
 }
 
 void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
@@ -1299,6 +1501,10 @@ void S2EExecutor::doStateSwitch(S2EExecutionState* oldState,
     assert(!newState || !newState->m_active);
     assert(!newState || !newState->m_runningConcrete);
 
+    S2EPhaseTimer phaseTimer(S2E_PHASE_STATE_SWITCH);
+    TimerStatIncrementer switchTimer(stats::stateSwitchTime);
+    ++stats::stateSwitches;
+
     //Some state save/restore logic in QEMU flushes the cache.
     //This can have bad effects in case of saving/restoring states
     //that were in the middle of a memory operation. Therefore,
@@ -1458,6 +1664,10 @@ void S2EExecutor::restoreYieldedState(void) {
 S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
 {
     assert(state->m_active);
+    g_s2e->getCorePlugin()->onStateSelect.emit(state);
+    if (!m_scheduledKills.empty()) {
+        killScheduledStates(state, false);
+    }
     updateStates(state);
 
     ExecutionState *nstate = selectNonSpeculativeState(state);
@@ -1484,7 +1694,11 @@ S2EExecutionState* S2EExecutor::selectNextState(S2EExecutionState *state)
     if(newState != state) {
         g_s2e->getCorePlugin()->onStateSwitch.emit(state, newState);
         vm_stop(RUN_STATE_SAVE_VM);
+
+        uint64_t switchTime = stats::stateSwitchTime;
         doStateSwitch(state, newState);
+        m_switchCost = (7 * m_switchCost + (stats::stateSwitchTime - switchTime)) / 8;
+
         vm_start();
     }
 
@@ -1514,7 +1728,23 @@ void S2EExecutor::prepareFunctionExecution(S2EExecutionState *state,
     } else {
 
         unsigned cIndex = kmodule->constants.size();
-        kf = kmodule->updateModuleWithFunction(function);
+
+        bool optimized = m_bitcodeCache && m_bitcodeCache->isCached(function);
+        if (m_backgroundTranslator) {
+            optimized |= m_backgroundTranslator->isOptimized(function);
+            //KLEE owns the function from now on
+            m_backgroundTranslator->forget(function);
+        }
+
+        if (m_tbOptimizer && !optimized) {
+            m_tbOptimizer->optimize(function);
+            optimized = true;
+        }
+
+        kf = kmodule->updateModuleWithFunction(function, !optimized);
+        if (m_bitcodeCache) {
+            m_bitcodeCache->store(function);
+        }
 
         for(unsigned i = 0; i < kf->numInstructions; ++i)
             bindInstructionConstants(kf->instructions[i]);
@@ -1638,6 +1868,11 @@ inline void S2EExecutor::executeOneInstruction(S2EExecutionState *state)
 
     updateStates(state);
 
+    //Plugins may have doomed the successors of a fork in this instruction
+    if (!m_scheduledKills.empty()) {
+        killScheduledStates(state, true);
+    }
+
     // assume that symbex is 50 times slower
     //cpu_enable_ticks();
 
@@ -1734,6 +1969,154 @@ static void s2e_enable_signals(sigset_t *oldset)
 
 #endif
 
+/**
+ *  Returns the function to run in KLEE for tb. Once tb gets hot, it is
+ *  merged with the successors it most often chains to in KLEE. The
+ *  superblock is used only while the chain it was built from is intact.
+ */
+llvm::Function *S2EExecutor::getSuperblock(TranslationBlock *tb)
+{
+    S2ETranslationBlock *s2e_tb = tb->s2e_tb;
+
+    if (!s2e_tb->superblock) {
+        //Members of other superblocks do not become heads, so that
+        //superblocks never reference each other in a cycle.
+        if (++s2e_tb->executionCount != SuperblockThreshold ||
+            s2e_tb->superblockUses || !buildSuperblock(tb)) {
+            return tb->llvm_function;
+        }
+    }
+
+    const std::vector<SuperblockMember> &members = s2e_tb->superblockMembers;
+    for (unsigned i = 0; i + 1 < members.size(); ++i) {
+        if (members[i].tb->s2e_tb_next[members[i].exit] != members[i + 1].tb) {
+            m_superblockBuilder->skipped();
+            return tb->llvm_function;
+        }
+    }
+
+    m_superblockBuilder->executed();
+    return s2e_tb->superblock;
+}
+
+bool S2EExecutor::buildSuperblock(TranslationBlock *tb)
+{
+    std::vector<SuperblockMember> members;
+    std::vector<llvm::Function*> functions;
+    std::vector<uint64_t> blocks;
+    std::vector<unsigned> exits;
+
+    TranslationBlock *current = tb;
+    while (true) {
+        SuperblockMember member = { current, current->s2e_tb, 0 };
+        members.push_back(member);
+        functions.push_back(current->llvm_function);
+        blocks.push_back((uint64_t) (uintptr_t) current);
+
+        if (members.size() >= SuperblockMaxLength) {
+            break;
+        }
+
+        //Follow the exit taken by most of the executions
+        S2ETranslationBlock *s2e_tb = current->s2e_tb;
+        unsigned hotExit = s2e_tb->exitCount[1] > s2e_tb->exitCount[0];
+        if (!s2e_tb->exitCount[hotExit] || 2 * s2e_tb->exitCount[hotExit] < s2e_tb->executionCount) {
+            break;
+        }
+
+        TranslationBlock *next = current->s2e_tb_next[hotExit];
+        if (!next || !next->llvm_function || next->s2e_tb->superblock) {
+            break;
+        }
+
+        bool loop = false;
+        foreach2(it, members.begin(), members.end()) {
+            loop |= (*it).tb == next;
+        }
+        if (loop) {
+            break;
+        }
+
+        members.back().exit = hotExit;
+        exits.push_back(hotExit);
+        current = next;
+    }
+
+    if (members.size() < 2) {
+        return false;
+    }
+
+    std::stringstream name;
+    name << "superblock-" << std::hex << tb->pc;
+
+    llvm::Function *superblock = m_superblockBuilder->build(functions, blocks, exits,
+                                                             name.str());
+    if (!superblock) {
+        return false;
+    }
+
+    //Keep the code and the execution signals of the members alive
+    for (unsigned i = 1; i < members.size(); ++i) {
+        members[i].s2e_tb->refCount += 1;
+        members[i].s2e_tb->superblockUses += 1;
+    }
+
+    tb->s2e_tb->superblock = superblock;
+    tb->s2e_tb->superblockMembers = members;
+    return true;
+}
+
+bool S2EExecutor::mayRunInKlee(S2EExecutionState *state, TranslationBlock *tb) const
+{
+    uint64_t smask = state->getSymbolicRegistersMask();
+    return m_executeAlwaysKlee || (smask & tb->reg_rmask) ||
+           (smask & tb->reg_wmask) || (tb->helper_accesses_mem & 4);
+}
+
+/**
+ *  Generating LLVM code later on would run the guest translation again,
+ *  which fires the onTranslate* signals a second time and may fault on
+ *  the code fetch. Blocks that may run in KLEE get their code right after
+ *  the translation, from the same TCG ops.
+ */
+bool S2EExecutor::shouldGenerateLLVM(S2EExecutionState *state, TranslationBlock *tb) const
+{
+    return m_backgroundTranslator && m_backgroundTranslator->canSubmit() &&
+           mayRunInKlee(state, tb);
+}
+
+/**
+ *  Hands over the LLVM code of the chained successors of tb that will
+ *  likely run in KLEE too to the background translator, which optimizes
+ *  it while tb executes. Successors without LLVM code are skipped.
+ */
+void S2EExecutor::speculateSuccessors(S2EExecutionState *state, TranslationBlock *tb)
+{
+    for (unsigned n = 0; n < 2; ++n) {
+        TranslationBlock *next = tb->s2e_tb_next[n];
+        if (!next || next == tb || !next->llvm_function) {
+            continue;
+        }
+
+        llvm::Function *function = next->llvm_function;
+        if (kmodule->functionMap.count(function) ||
+            m_backgroundTranslator->isOptimized(function) ||
+            (m_bitcodeCache && m_bitcodeCache->isCached(function))) {
+            continue;
+        }
+
+        if (!mayRunInKlee(state, next)) {
+            continue;
+        }
+
+        if (!m_backgroundTranslator->canSubmit()) {
+            return;
+        }
+
+        m_backgroundTranslator->submit(function);
+    }
+}
+
 uintptr_t S2EExecutor::executeTranslationBlockKlee(
         S2EExecutionState* state,
         TranslationBlock* tb)
@@ -1759,6 +2142,10 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
         /* Make sure to init tb_next value */
         tcg_llvm_runtime.goto_tb = 0xff;
 
+        if (m_backgroundTranslator) {
+            m_backgroundTranslator->poll();
+        }
+
         /* Generate LLVM code if necessary */
         if(!tb->llvm_function) {
             cpu_gen_llvm(env, tb);
@@ -1771,11 +2158,21 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
             state->m_lastS2ETb->refCount += 1;
         }
 
+        llvm::Function *function = tb->llvm_function;
+        if (m_superblockBuilder) {
+            function = getSuperblock(tb);
+        }
+
         /* Prepare function execution */
+        tb_function_args[TCG_LLVM_TB_ARG] = tb;
         prepareFunctionExecution(state,
-                tb->llvm_function, std::vector<ref<Expr> >(1,
+                function, std::vector<ref<Expr> >(1,
                     Expr::createPointer((uint64_t) tb_function_args)));
 
+        if (m_backgroundTranslator) {
+            speculateSuccessors(state, tb);
+        }
+
         /* Information for GETPC() macro */
         //g_s2e_exec_ret_addr = tb->tc_ptr;
 
@@ -1800,13 +2197,19 @@ uintptr_t S2EExecutor::executeTranslationBlockKlee(
                 sigprocmask(SIG_BLOCK, &set, &oldset);
 #endif
 
+                //Superblocks can be left from any of their members,
+                //each of them stores itself in s2e_current_tb.
+                TranslationBlock* exit_tb = tb;
+                if (function != tb->llvm_function) {
+                    exit_tb = env->s2e_current_tb;
+                }
+
                 TranslationBlock* next_tb =
-                        tb->s2e_tb_next[tcg_llvm_runtime.goto_tb];
+                        exit_tb->s2e_tb_next[tcg_llvm_runtime.goto_tb];
 
                 if(next_tb) {
-#ifndef NDEBUG
-                    TranslationBlock* old_tb = tb;
-#endif
+                    TranslationBlock* old_tb = exit_tb;
+                    old_tb->s2e_tb->exitCount[tcg_llvm_runtime.goto_tb] += 1;
 
                     assert(state->stack.size() == 2);
                     state->popFrame();
@@ -1869,6 +2272,7 @@ uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
 
     if(s2e_setjmp(env->jmp_env)) {
         memcpy(env->jmp_env, s2e_cpuExitJmpBuf, sizeof(env->jmp_env));
+        env->s2e_split_insn = 0;
         throw CpuExitException();
     } else {
 
@@ -1880,9 +2284,33 @@ uintptr_t S2EExecutor::executeTranslationBlockConcrete(S2EExecutionState *state,
     }
 
     memcpy(env->jmp_env, s2e_cpuExitJmpBuf, sizeof(env->jmp_env));
+    env->s2e_split_insn = 0;
     return ret;
 }
 
+/**
+ *  Returns how many instructions at the beginning of tb can run natively
+ *  given the mask of symbolic registers, 0 if the block cannot be split.
+ */
+static unsigned getConcretePrefix(TranslationBlock *tb, uint64_t smask)
+{
+    unsigned prefix = tb->s2e_first_access[S2E_TB_ACCESS_SYMBOLIC_MEM];
+
+    for (unsigned i = 0; i < S2E_TB_ACCESS_SYMBOLIC_MEM && smask; ++i, smask >>= 1) {
+        if ((smask & 1) && tb->s2e_first_access[i] < prefix) {
+            prefix = tb->s2e_first_access[i];
+        }
+    }
+
+    //Code that executes after the last instruction (e.g., block end
+    //instrumentation) may also be what touches symbolic data.
+    if (prefix >= tb->icount) {
+        return 0;
+    }
+
+    return prefix;
+}
+
 static inline void s2e_tb_reset_jump(TranslationBlock *tb, unsigned int n)
 {
     TranslationBlock *tb1, *tb_next, **ptb;
@@ -1984,6 +2412,18 @@ uintptr_t S2EExecutor::executeTranslationBlock(
                     /* TB reads symbolic variables */
                     executeKlee = true;
 
+                    /* Run natively up to the first instruction that needs KLEE,
+                       the rest of the block will be translated separately */
+                    if (g_s2e_split_translation_blocks) {
+                        unsigned prefix = getConcretePrefix(tb, smask);
+                        if (prefix > 0) {
+                            env->s2e_split_insn = prefix;
+                            state->m_stats.m_statInstructionCountSplit += prefix;
+                            ++state->m_stats.m_statTranslationBlockSplit;
+                            executeKlee = false;
+                        }
+                    }
+
                 } else {
                     s2e_tb_reset_jump_smask(tb, 0, smask);
                     s2e_tb_reset_jump_smask(tb, 1, smask);
@@ -2018,6 +2458,7 @@ uintptr_t S2EExecutor::executeTranslationBlock(
         }
 
         TimerStatIncrementer t(stats::symbolicModeTime);
+        S2EPhaseTimer phaseTimer(S2E_PHASE_INTERPRETER);
 
         return executeTranslationBlockKlee(state, tb);
 
@@ -2030,6 +2471,7 @@ uintptr_t S2EExecutor::executeTranslationBlock(
             TimerStatIncrementer t(stats::concreteModeTime);
         }
 
+        S2EPhaseTimer phaseTimer(S2E_PHASE_CONCRETE);
         return executeTranslationBlockConcrete(state, tb);
     }
 }
@@ -2113,6 +2555,37 @@ void S2EExecutor::deleteState(klee::ExecutionState *state)
     m_deletedStates.push_back(static_cast<S2EExecutionState*>(state));
 }
 
+/** Saves the machine state of the active state into a fresh copy of it */
+void S2EExecutor::saveStateCopy(S2EExecutionState *copy)
+{
+    //XXX: How do we make this stuff atomic? Disable all signals?
+    //vm_stop(RUN_STATE_SAVE_VM);
+    copy->getDeviceState()->saveDeviceState();
+    //vm_start();
+
+    //copy->m_qemuIcount = qemu_icount;
+    *copy->m_timersState = timers_state;
+
+    /* Save CPU state */
+    const MemoryObject* cpuMo = copy->m_cpuSystemState;
+    uint8_t *cpuStore = copy->m_cpuSystemObject->getConcreteStore();
+    memcpy(cpuStore, (uint8_t*) cpuMo->address, cpuMo->size);
+    copy->m_active = false;
+
+    /* Save all other objects */
+    foreach(MemoryObject* mo, m_saveOnContextSwitch) {
+        if(mo == cpuMo)
+            continue;
+
+        const ObjectState *os = copy->addressSpace.findObject(mo);
+        ObjectState *wos = copy->addressSpace.getWriteable(mo, os);
+        uint8_t *store = wos->getConcreteStore();
+
+        assert(store);
+        memcpy(store, (uint8_t*) mo->address, mo->size);
+    }
+}
+
 void S2EExecutor::doStateFork(S2EExecutionState *originalState,
                  const vector<S2EExecutionState*>& newStates,
                  const vector<ref<Expr> >& newConditions)
@@ -2136,33 +2609,7 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
 
         if(newState != originalState) {
             newState->m_needFinalizeTBExec = true;
-
-            //XXX: How do we make this stuff atomic? Disable all signals?
-            //vm_stop(RUN_STATE_SAVE_VM);
-            newState->getDeviceState()->saveDeviceState();
-            //vm_start();
-
-            //newState->m_qemuIcount = qemu_icount;
-            *newState->m_timersState = timers_state;
-
-            /* Save CPU state */
-            const MemoryObject* cpuMo = newState->m_cpuSystemState;
-            uint8_t *cpuStore = newState->m_cpuSystemObject->getConcreteStore();
-            memcpy(cpuStore, (uint8_t*) cpuMo->address, cpuMo->size);
-            newState->m_active = false;
-
-            /* Save all other objects */
-            foreach(MemoryObject* mo, m_saveOnContextSwitch) {
-                if(mo == cpuMo)
-                    continue;
-
-                const ObjectState *os = newState->addressSpace.findObject(mo);
-                ObjectState *wos = newState->addressSpace.getWriteable(mo, os);
-                uint8_t *store = wos->getConcreteStore();
-
-                assert(store);
-                memcpy(store, (uint8_t*) mo->address, mo->size);
-            }
+            saveStateCopy(newState);
         }
     }
 
@@ -2178,6 +2625,15 @@ void S2EExecutor::doStateFork(S2EExecutionState *originalState,
 
 }
 
+bool S2EExecutor::isForkAllowed(ExecutionState &current, ref<Expr> condition)
+{
+    assert(dynamic_cast<S2EExecutionState*>(&current));
+    bool allow = true;
+    m_s2e->getCorePlugin()->onStateForkDecide.emit(
+            static_cast<S2EExecutionState*>(&current), condition, &allow);
+    return allow;
+}
+
 S2EExecutor::StatePair S2EExecutor::fork(ExecutionState &current,
                             ref<Expr> condition, bool isInternal)
 {
@@ -2256,7 +2712,9 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     else if(other.m_active)
         doStateSwitch(&other, NULL);
 
+    ++stats::stateMergeAttempts;
     if(base.merge(other)) {
+        ++stats::statesMerged;
         m_s2e->getMessagesStream(&base)
                 << "Merged with state " << other.getID() << '\n';
         return true;
@@ -2267,6 +2725,112 @@ bool S2EExecutor::merge(klee::ExecutionState &_base, klee::ExecutionState &_othe
     }
 }
 
+S2EExecutionState *S2EExecutor::mergeStates(S2EExecutionState *a, S2EExecutionState *b)
+{
+    //The merged state disappears, which must not happen to the current one
+    if(b == g_s2e_state) {
+        std::swap(a, b);
+    }
+
+    if(!merge(*a, *b)) {
+        return NULL;
+    }
+
+    terminateState(*b);
+    return a;
+}
+
+/**
+ *  States can only be cloned while they are active. An inactive state
+ *  is switched to for the time of the copy, which must therefore happen
+ *  outside of the cpu loop, e.g., while a state is being selected.
+ */
+S2EExecutionState *S2EExecutor::copyState(S2EExecutionState *state)
+{
+    S2EExecutionState *current = g_s2e_state;
+    assert(current && current->m_active);
+
+    if(state != current) {
+        vm_stop(RUN_STATE_SAVE_VM);
+        doStateSwitch(current, state);
+    } else if(state->m_runningConcrete) {
+        switchToSymbolic(state);
+    }
+
+    //States that are not scheduled have an inactive node, which cannot be split
+    bool scheduled = state->ptreeNode->active;
+    if(!scheduled) {
+        processTree->activate(state->ptreeNode);
+    }
+
+    S2EExecutionState *copy = static_cast<S2EExecutionState*>(state->clone());
+    std::pair<PTree::Node*, PTree::Node*> res =
+            processTree->split(state->ptreeNode, state, copy);
+    state->ptreeNode = res.first;
+    copy->ptreeNode = res.second;
+
+    saveStateCopy(copy);
+
+    processTree->deactivate(copy->ptreeNode);
+    if(!scheduled) {
+        processTree->deactivate(state->ptreeNode);
+    }
+
+    if(state != current) {
+        doStateSwitch(state, current);
+        vm_start();
+    }
+
+    return copy;
+}
+
+void S2EExecutor::addState(S2EExecutionState *state)
+{
+    assert(!state->m_active);
+    processTree->activate(state->ptreeNode);
+    addedStates.insert(state);
+}
+
+void S2EExecutor::discardState(S2EExecutionState *state)
+{
+    assert(!state->m_active && !states.count(state));
+    deleteState(state);
+}
+
+void S2EExecutor::killState(S2EExecutionState *state)
+{
+    terminateState(*state);
+}
+
+void S2EExecutor::scheduleStateKill(S2EExecutionState *state)
+{
+    m_scheduledKills.insert(state);
+}
+
+/**
+ *  Kills the states passed to scheduleStateKill. The current state is
+ *  killed last, if killCurrent is set, which exits the cpu loop.
+ */
+void S2EExecutor::killScheduledStates(S2EExecutionState *current, bool killCurrent)
+{
+    std::vector<S2EExecutionState*> doomed(m_scheduledKills.begin(), m_scheduledKills.end());
+    bool currentDoomed = false;
+
+    foreach2(it, doomed.begin(), doomed.end()) {
+        if (*it == current) {
+            currentDoomed = true;
+        } else if (m_scheduledKills.count(*it)) {
+            //Not killed by the onStateKill handlers of a previous one
+            terminateState(**it);
+        }
+    }
+
+    if (currentDoomed && killCurrent) {
+        cpu_enable_ticks();
+        terminateState(*current);
+    }
+}
+
 void S2EExecutor::terminateStateEarly(klee::ExecutionState &state, const llvm::Twine &message)
 {
     S2EExecutionState  *s2estate = static_cast<S2EExecutionState*>(&state);
@@ -2338,8 +2902,15 @@ void S2EExecutor::yieldState(ExecutionState &s)
     throw CpuExitException();
 }
 
+void S2EExecutor::scheduleStateSwitch()
+{
+    m_stateSwitchRequested = true;
+    qemu_mod_timer(m_stateSwitchTimer, qemu_get_clock_ms(rt_clock));
+}
+
 void S2EExecutor::terminateStateAtFork(S2EExecutionState &state)
 {
+    m_scheduledKills.erase(&state);
     Executor::terminateState(state);
 }
 
@@ -2353,6 +2924,18 @@ inline void S2EExecutor::setCCOpEflags(S2EExecutionState *state)
         bool ok = state->readCpuRegisterConcrete(CPU_OFFSET(cc_op),
                                                  &cc_op, sizeof(cc_op));
         if(!ok || cc_op != CC_OP_EFLAGS) {
+            // Translated code and the helpers evaluate cc_op, cc_src and
+            // cc_dst of the state themselves, only flags actually read
+            // by the guest will be computed. Code outside the CPU loop
+            // (cpu_get_eflags, devices, interrupt delivery) still expects
+            // CC_OP_EFLAGS, hence this is opt-in. Concrete condition codes
+            // are always materialized.
+            if (LazyFlags && (state->getSymbolicRegistersMask() & (0xf<<1))) {
+                ++stats::flagsDeferred;
+                return;
+            }
+
+            ++stats::flagsMaterialized;
             try {
                 if(state->m_runningConcrete)
                     switchToSymbolic(state);
@@ -2376,16 +2959,134 @@ inline void S2EExecutor::setCCOpEflags(S2EExecutionState *state)
     }
 }
 
+/** Reads a segment descriptor, returns false if it is out of the table or symbolic */
+static bool readSegmentDescriptor(S2EExecutionState *state, uint32_t selector,
+                                  uint32_t *e1, uint32_t *e2)
+{
+    SegmentCache *dt = (selector & 0x4) ? &env->ldt : &env->gdt;
+    uint32_t index = selector & ~7;
+    if (index + 7 > dt->limit) {
+        return false;
+    }
+
+    return state->readMemoryConcrete(dt->base + index, e1, sizeof(*e1)) &&
+           state->readMemoryConcrete(dt->base + index + 4, e2, sizeof(*e2));
+}
+
+/**
+ *  Checks whether an interrupt can be delivered natively even though some
+ *  registers are symbolic. Delivery reads the IDT, pushes the return frame
+ *  and EFLAGS on the stack and loads segments, which are always concrete.
+ *  Of the symbolic register file it only uses ESP and the condition codes.
+ *  Task gates save all registers in the TSS and are left to KLEE. When the
+ *  privilege level changes, the frame goes to the stack named by the TSS,
+ *  which must be concrete too.
+ */
+bool S2EExecutor::canDeliverInterruptConcretely(S2EExecutionState *state, int intno)
+{
+    if (state->m_cpuRegistersObject->isAllConcrete()) {
+        return true;
+    }
+
+    if (!InterruptFastPath) {
+        return false;
+    }
+
+    uint64_t registers = (0xf << 1) | (1 << (R_ESP + 5));
+    if (state->getSymbolicRegistersMask() & registers) {
+        return false;
+    }
+
+    target_ulong esp = 0;
+    bool ok = state->readCpuRegisterConcrete(CPU_OFFSET(regs[R_ESP]), &esp, sizeof(esp));
+    assert(ok);
+
+    target_ulong ssBase = env->segs[R_SS].base;
+
+    /* Largest frame: SS, ESP, EFLAGS, CS, EIP and the error code */
+    unsigned slots = 6;
+    unsigned slotSize = 4;
+
+    if (!(env->cr[0] & CR0_PE_MASK)) {
+        if (!state->isMemoryConcrete(env->idt.base + intno * 4, 4)) {
+            return false;
+        }
+    } else {
+        bool longMode = env->hflags & HF_LMA_MASK;
+        unsigned entrySize = longMode ? 16 : 8;
+        target_ulong gate = env->idt.base + intno * entrySize;
+
+        uint32_t e1, e2;
+        if (!state->isMemoryConcrete(gate, entrySize) ||
+            !state->readMemoryConcrete(gate, &e1, sizeof(e1)) ||
+            !state->readMemoryConcrete(gate + 4, &e2, sizeof(e2))) {
+            return false;
+        }
+
+        if (((e2 >> DESC_TYPE_SHIFT) & 0x1f) == 5) {
+            return false;
+        }
+
+        /* Find out whether delivery switches to a stack taken from the TSS */
+        uint32_t cs1, cs2;
+        if (!readSegmentDescriptor(state, e1 >> 16, &cs1, &cs2)) {
+            return false;
+        }
+
+        unsigned cpl = env->hflags & HF_CPL_MASK;
+        unsigned dpl = (cs2 >> DESC_DPL_SHIFT) & 3;
+        bool innerPrivilege = !(cs2 & DESC_C_MASK) && dpl < cpl;
+
+        if (longMode) {
+            unsigned ist = e2 & 7;
+            slotSize = 8;
+            if (innerPrivilege || ist != 0) {
+                unsigned index = 8 * (ist != 0 ? ist + 3 : dpl) + 4;
+                uint64_t rsp = 0;
+                if (index + 7 > env->tr.limit ||
+                    !state->readMemoryConcrete(env->tr.base + index, &rsp, sizeof(rsp))) {
+                    return false;
+                }
+                esp = rsp;
+                ssBase = 0;
+            }
+            esp &= ~0xfULL;
+        } else if (innerPrivilege) {
+            unsigned shift = (env->tr.flags >> DESC_TYPE_SHIFT) & 8 ? 1 : 0;
+            unsigned index = (dpl * 4 + 2) << shift;
+            uint32_t newEsp = 0, ss = 0, ss1, ss2;
+            if (index + (4 << shift) - 1 > env->tr.limit ||
+                !state->readMemoryConcrete(env->tr.base + index, &newEsp, 2 << shift) ||
+                !state->readMemoryConcrete(env->tr.base + index + (2 << shift), &ss, 2) ||
+                !readSegmentDescriptor(state, ss, &ss1, &ss2)) {
+                return false;
+            }
+            esp = newEsp;
+            ssBase = (ss1 >> 16) | ((ss2 & 0xff) << 16) | (ss2 & 0xff000000);
+
+            /* Leaving vm86 mode also pushes ES, DS, FS and GS */
+            if (env->mflags & VM_MASK) {
+                slots += 4;
+            }
+        }
+    }
+
+    unsigned frameSize = slots * slotSize;
+    return state->isMemoryConcrete(ssBase + esp - frameSize, frameSize);
+}
+
 inline void S2EExecutor::doInterrupt(S2EExecutionState *state, int intno,
                                      int is_int, int error_code,
                                      uint64_t next_eip, int is_hw)
 {
-    if(state->m_cpuRegistersObject->isAllConcrete() && !m_executeAlwaysKlee) {
+    if(!m_executeAlwaysKlee && canDeliverInterruptConcretely(state, intno)) {
+        ++stats::interruptsConcrete;
         if(!state->m_runningConcrete)
             switchToConcrete(state);
         //TimerStatIncrementer t(stats::concreteModeTime);
         s2e_do_interrupt_all(intno, is_int, error_code, next_eip, is_hw);
     } else {
+        ++stats::interruptsSymbolic;
         if(state->m_runningConcrete)
             switchToSymbolic(state);
         std::vector<klee::ref<klee::Expr> > args(5);
@@ -2448,14 +3149,44 @@ bool S2EExecutor::resumeState(S2EExecutionState *state, bool onlyAddToPtree)
 }
 
 
+void S2EExecutor::removeTbFunction(llvm::Function *function)
+{
+    S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
+    s2eDispatcher->removeFunction(function);
+
+    //Speculatively translated blocks may never have run in KLEE
+    if (kmodule->functionMap.count(function)) {
+        kmodule->removeFunction(function);
+    } else {
+        function->eraseFromParent();
+    }
+}
+
 void S2EExecutor::unrefS2ETb(S2ETranslationBlock* s2e_tb)
 {
     if(s2e_tb && 0 == --s2e_tb->refCount) {
         if(s2e_tb->llvm_function && !KeepLLVMFunctions) {
-            S2EExternalDispatcher *s2eDispatcher = static_cast<S2EExternalDispatcher*>(externalDispatcher);
-            s2eDispatcher->removeFunction(s2e_tb->llvm_function);
-            kmodule->removeFunction(s2e_tb->llvm_function);
+            if (m_bitcodeCache) {
+                m_bitcodeCache->forget(s2e_tb->llvm_function);
+            }
+            if (m_backgroundTranslator) {
+                m_backgroundTranslator->forget(s2e_tb->llvm_function);
+            }
+            removeTbFunction(s2e_tb->llvm_function);
+        }
+
+        if (s2e_tb->superblock) {
+            if (!KeepLLVMFunctions) {
+                removeTbFunction(s2e_tb->superblock);
+            }
+
+            for (unsigned i = 1; i < s2e_tb->superblockMembers.size(); ++i) {
+                S2ETranslationBlock *member = s2e_tb->superblockMembers[i].s2e_tb;
+                member->superblockUses -= 1;
+                unrefS2ETb(member);
+            }
         }
+
         foreach(void* s, s2e_tb->executionSignals) {
             delete static_cast<ExecutionSignal*>(s);
         }
@@ -2638,6 +3369,11 @@ void s2e_tb_alloc(S2E*, TranslationBlock *tb)
     tb->s2e_tb = new S2ETranslationBlock;
     tb->s2e_tb->llvm_function = NULL;
     tb->s2e_tb->refCount = 1;
+    tb->s2e_tb->executionCount = 0;
+    tb->s2e_tb->exitCount[0] = 0;
+    tb->s2e_tb->exitCount[1] = 0;
+    tb->s2e_tb->superblock = NULL;
+    tb->s2e_tb->superblockUses = 0;
 
     /* Push one copy of a signal to use it as a cache */
     tb->s2e_tb->executionSignals.push_back(new s2e::ExecutionSignal);
@@ -2651,6 +3387,11 @@ void s2e_set_tb_function(S2E*, TranslationBlock *tb)
     tb->s2e_tb->llvm_function = tb->llvm_function;
 }
 
+int s2e_should_gen_llvm(S2E *s2e, S2EExecutionState *state, TranslationBlock *tb)
+{
+    return s2e->getExecutor()->shouldGenerateLLVM(state, tb);
+}
+
 void s2e_tb_free(S2E* s2e, TranslationBlock *tb)
 {
     s2e->getExecutor()->unrefS2ETb(tb->s2e_tb);
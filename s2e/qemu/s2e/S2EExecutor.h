@@ -53,6 +53,10 @@ namespace s2e {
 
 class S2E;
 class S2EExecutionState;
+class BitcodeCache;
+class BackgroundTranslator;
+class SuperblockBuilder;
+class TbOptimizer;
 struct S2ETranslationBlock;
 
 class CpuExitException
@@ -112,9 +116,52 @@ protected:
 
     struct QEMUTimer *m_stateSwitchTimer;
 
+    /** Blocks translated when the current quantum started */
+    uint64_t m_sliceTranslatedBlocks;
+
+    /** Moving average of the state switch time, in microseconds */
+    uint64_t m_switchCost;
+
+    /** Set by scheduleStateSwitch, forces the searcher to be queried */
+    bool m_stateSwitchRequested;
+
+    /** States passed to scheduleStateKill that are still alive */
+    std::set<S2EExecutionState*> m_scheduledKills;
+
     /** Holds the yielded state, if any */
     S2EExecutionState* yieldedState;
 
+    /** Persistent cache of the LLVM code of translation blocks */
+    BitcodeCache *m_bitcodeCache;
+
+    /** Optimizes the code of upcoming symbolic translation blocks */
+    BackgroundTranslator *m_backgroundTranslator;
+
+    /** Merges hot chains of symbolic translation blocks */
+    SuperblockBuilder *m_superblockBuilder;
+
+    /** Optimization pipeline for the LLVM code of translation blocks */
+    TbOptimizer *m_tbOptimizer;
+
+    /** Softmmu helpers the S2E TLB probes fall back to, by [isWrite][log2(size)] */
+    llvm::Function *m_s2eTlbProbeHelpers[2][4];
+
+public:
+    /** Invocation profile of a helper intercepted by the native helper library */
+    struct NativeHelper {
+        uint64_t rmask;
+        bool native;
+        uint64_t nativeCalls;
+        uint64_t interpretedCalls;
+    };
+
+protected:
+    typedef std::map<llvm::Function*, NativeHelper> NativeHelpers;
+    NativeHelpers m_nativeHelpers;
+
+    bool helperNeedsInterpreter(llvm::Function *f);
+    void writeNativeHelperProfile();
+
     /** Moves yielded state back into list of schedulable states */
     void restoreYieldedState(void);
 
@@ -171,6 +218,7 @@ public:
 
 
     void setCCOpEflags(S2EExecutionState *state);
+    bool canDeliverInterruptConcretely(S2EExecutionState *state, int intno);
     void doInterrupt(S2EExecutionState *state, int intno, int is_int,
                      int error_code, uint64_t next_eip, int is_hw);
 
@@ -188,18 +236,30 @@ public:
         searcher = s;
     }
 
+    /** Asks plugins whether the state may fork at the current instruction */
+    bool isForkAllowed(klee::ExecutionState &current, klee::ref<klee::Expr> condition);
+
     /** Called on fork, used to trace forks */
     StatePair fork(klee::ExecutionState &current,
                    klee::ref<klee::Expr> condition, bool isInternal);
 
     bool merge(klee::ExecutionState &base, klee::ExecutionState &other);
 
+    /** Merges two states that are not in the searcher and kills the one
+        that was merged into the other. Returns the surviving state, which
+        is the current one if either was, or NULL if merging failed. */
+    S2EExecutionState *mergeStates(S2EExecutionState *a, S2EExecutionState *b);
+
     void setForceConcretizations(bool b) {
         m_forceConcretizations = true;
     }
 
     void unrefS2ETb(S2ETranslationBlock* s2e_tb);
 
+    /** Whether the LLVM code of a block that was just translated should
+        be generated right away for the background translator */
+    bool shouldGenerateLLVM(S2EExecutionState *state, TranslationBlock *tb) const;
+
     void queueStateForMerge(S2EExecutionState *state);
 
     void initializeStatistics();
@@ -215,6 +275,31 @@ public:
 
     /** Yields the specified state and raises an exception to exit the cpu loop */
     virtual void yieldState(klee::ExecutionState &state);
+
+    /** Selects the next state as soon as the cpu loop exits,
+        instead of waiting for the state switch timer. This also
+        overrides the adaptive quantum of the current state. */
+    void scheduleStateSwitch();
+
+    /** Copies the state without scheduling the copy. Must be called
+        outside of the cpu loop if the state is not the current one. */
+    S2EExecutionState *copyState(S2EExecutionState *state);
+
+    /** Schedules a state returned by copyState */
+    void addState(S2EExecutionState *state);
+
+    /** Frees a state returned by copyState that was never scheduled */
+    void discardState(S2EExecutionState *state);
+
+    /** Kills the state without generating a test case. Exits the
+        cpu loop if the state is the current one. */
+    void killState(S2EExecutionState *state);
+
+    /** Kills the state like killState once the current instruction is
+        over, or at the next state switch if it is not running. Used by
+        plugins that must not interrupt the signal they handle, e.g.,
+        onStateFork. */
+    void scheduleStateKill(S2EExecutionState *state);
     const S2EExecutionState* getYieldedState() {
         return yieldedState;
     }
@@ -250,6 +335,14 @@ protected:
                            llvm::Function* function,
                            const std::vector<klee::ref<klee::Expr> >& args);
     void executeOneInstruction(S2EExecutionState *state);
+    void killScheduledStates(S2EExecutionState *current, bool killCurrent);
+
+    bool mayRunInKlee(S2EExecutionState *state, TranslationBlock *tb) const;
+    void speculateSuccessors(S2EExecutionState *state, TranslationBlock *tb);
+
+    llvm::Function *getSuperblock(TranslationBlock *tb);
+    bool buildSuperblock(TranslationBlock *tb);
+    void removeTbFunction(llvm::Function *function);
 
     uintptr_t executeTranslationBlockKlee(S2EExecutionState *state,
                                           TranslationBlock *tb);
@@ -262,6 +355,8 @@ protected:
     void doStateSwitch(S2EExecutionState* oldState,
                        S2EExecutionState* newState);
 
+    void saveStateCopy(S2EExecutionState *copy);
+
     void doStateFork(S2EExecutionState *originalState,
                      const std::vector<S2EExecutionState*>& newStates,
                      const std::vector<klee::ref<klee::Expr> >& conditions);
@@ -304,6 +399,9 @@ protected:
     void setupTimersHandler();
     void initializeStateSwitchTimer();
     static void stateSwitchTimerCallback(void *opaque);
+    uint64_t getTimeSlice(S2EExecutionState *state, bool productive);
+    bool keepCurrentState(S2EExecutionState *state, bool productive,
+                          uint64_t previousSlice) const;
 
     /** The following are special handlers for MMU functions **/
     static void handle_ldb_mmu(klee::Executor* executor,
@@ -363,7 +461,21 @@ protected:
                         std::vector< klee::ref<klee::Expr> > &args,
                         bool isWrite, unsigned data_size, bool signExtend, bool zeroExtend);
 
+    /** Probes the S2E TLB for loads/stores of generated code */
+    static void handle_s2e_tlb_probe(klee::Executor* executor,
+                        klee::ExecutionState* state,
+                        klee::KInstruction* target,
+                        std::vector< klee::ref<klee::Expr> > &args);
+
+    /** Runs a QEMU helper natively if its inputs are concrete */
+    static void handleNativeHelper(klee::Executor* executor,
+                        klee::ExecutionState* state,
+                        klee::KInstruction* target,
+                        std::vector< klee::ref<klee::Expr> > &args);
+
     void replaceExternalFunctionsWithSpecialHandlers();
+    void installS2ETlbProbes();
+    void installNativeHelpers();
     void disableConcreteLLVMHelpers();
 
     struct HandlerInfo {
@@ -374,6 +486,16 @@ protected:
     static HandlerInfo s_handlerInfo[];
 };
 
+/** A translation block merged in a superblock */
+struct SuperblockMember
+{
+    TranslationBlock *tb;
+    S2ETranslationBlock *s2e_tb;
+
+    /** The goto_tb exit that leads to the next member */
+    unsigned exit;
+};
+
 struct S2ETranslationBlock
 {
     /** Reference counter. S2ETranslationBlock should not be freed
@@ -390,6 +512,19 @@ struct S2ETranslationBlock
         when this translation block will be flushed.
         XXX: how could we avoid using void* here ? */
     std::vector<void*> executionSignals;
+
+    /** Number of executions in KLEE before a superblock was built,
+        and how many of them continued through each goto_tb exit */
+    unsigned executionCount;
+    unsigned exitCount[2];
+
+    /** This block merged with its hottest successors. The superblock
+        holds a reference to all the members after the first one. */
+    llvm::Function* superblock;
+    std::vector<SuperblockMember> superblockMembers;
+
+    /** Number of superblocks this block is a member of */
+    unsigned superblockUses;
 };
 
 } // namespace s2e
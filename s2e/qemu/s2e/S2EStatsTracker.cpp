@@ -38,14 +38,17 @@
 
 #include <s2e/S2EExecutor.h>
 #include <s2e/S2EExecutionState.h>
+#include <s2e/Signals/Signals.h>
 
 #include <klee/CoreStats.h>
 #include <klee/SolverStats.h>
 #include <klee/Internal/System/Time.h>
 
 #include <llvm/Support/Process.h>
+#include <llvm/Support/CommandLine.h>
 
 #include <sstream>
+#include <tr1/unordered_map>
 
 #include <stdio.h>
 #include <inttypes.h>
@@ -67,19 +70,47 @@ namespace stats {
     Statistic translationBlocks("TranslationBlocks", "TBs");
     Statistic translationBlocksConcrete("TranslationBlocksConcrete", "TBsConcrete");
     Statistic translationBlocksKlee("TranslationBlocksKlee", "TBsKlee");
+    Statistic translationBlocksSplit("TranslationBlocksSplit", "TBsSplit");
+    Statistic translatedBlocks("TranslatedBlocks", "TBsTrans");
 
     Statistic cpuInstructions("CpuInstructions", "CpuI");
     Statistic cpuInstructionsConcrete("CpuInstructionsConcrete", "CpuIConcrete");
     Statistic cpuInstructionsKlee("CpuInstructionsKlee", "CpuIKlee");
+    Statistic cpuInstructionsSplit("CpuInstructionsSplit", "CpuISplit");
 
     Statistic concreteModeTime("ConcreteModeTime", "ConcModeTime");
     Statistic symbolicModeTime("SymbolicModeTime", "SymbModeTime");
+
+    Statistic flagsMaterialized("FlagsMaterialized", "FlagsMat");
+    Statistic flagsDeferred("FlagsDeferred", "FlagsDef");
+
+    Statistic interruptsConcrete("InterruptsConcrete", "IntConc");
+    Statistic interruptsSymbolic("InterruptsSymbolic", "IntSymb");
+
+    Statistic stateMergeAttempts("StateMergeAttempts", "MrgAtt");
+    Statistic statesMerged("StatesMerged", "Mrg");
+
+    Statistic stateSwitches("StateSwitches", "Switches");
+    Statistic stateSwitchTime("StateSwitchTime", "SwitchTime");
 } // namespace stats
 } // namespace klee
 
 using namespace klee;
 using namespace llvm;
 
+namespace {
+    cl::opt<bool>
+    ProfilePhases("s2e-profile-phases",
+            cl::desc("Account host time per execution phase into phases.csv"),
+            cl::init(true));
+
+    cl::opt<bool>
+    ProfilePlugins("s2e-profile-plugins",
+            cl::desc("Also charge the time of each signal callback to the plugin that owns it "
+                     "(reads the time stamp counter around every slot)"),
+            cl::init(false));
+}
+
 
 namespace s2e {
 
@@ -138,7 +169,120 @@ uint64_t S2EStatsTracker::getProcessMemoryUsage()
 #endif
 }
 
+/******************************************/
+/* Phase accounting */
+
+unsigned S2EStatsTracker::s_phaseIds[S2E_PHASE_MAX];
+
+typedef std::tr1::unordered_map<const void*, unsigned> PluginPhases;
+static PluginPhases s_pluginPhases;
+
+//Called once per slot, the functor caches the result
+static unsigned s2e_emit_phase(const void *object)
+{
+    PluginPhases::const_iterator it = s_pluginPhases.find(object);
+    if (it != s_pluginPhases.end()) {
+        return (*it).second;
+    }
+    return S2EStatsTracker::getPhaseId(S2E_PHASE_PLUGINS);
+}
+
+static unsigned s2e_emit_enter(unsigned phase)
+{
+    return PhaseProfiler::enter(phase);
+}
+
+static void s2e_emit_leave(unsigned previous)
+{
+    PhaseProfiler::leave(previous);
+}
+
+void S2EStatsTracker::initializePhases()
+{
+    static const char *names[S2E_PHASE_MAX] = {
+        "Translation", "Concrete", "Interpreter",
+        "StateSwitch", "DeviceSnapshot", "Plugins"
+    };
+
+    for (unsigned i = 0; i < S2E_PHASE_MAX; ++i) {
+        s_phaseIds[i] = PhaseProfiler::registerPhase(names[i]);
+    }
+
+    PhaseProfiler::setEnabled(ProfilePhases);
+
+    //Phases change at most a few times per translation block, which is
+    //cheap enough to leave on. Timing each slot is not: per-instruction
+    //signals would read the counter twice per callback, so plugin time
+    //stays in the enclosing phase unless asked for.
+    if (ProfilePhases && ProfilePlugins) {
+        sigc::g_emit_phase = s2e_emit_phase;
+        sigc::g_emit_enter = s2e_emit_enter;
+        sigc::g_emit_leave = s2e_emit_leave;
+    }
+}
+
+void S2EStatsTracker::registerPluginPhase(const void *plugin, const std::string &name)
+{
+    s_pluginPhases[plugin] = PhaseProfiler::registerPhase("Plugin:" + name);
+}
+
+extern "C" {
+
+unsigned s2e_phase_enter(enum S2EPhase phase)
+{
+    return PhaseProfiler::enter(S2EStatsTracker::getPhaseId(phase));
+}
+
+void s2e_phase_leave(unsigned previous)
+{
+    PhaseProfiler::leave(previous);
+}
+
+unsigned s2e_phase_current(void)
+{
+    return PhaseProfiler::getCurrent();
+}
+
+}
+
+S2EStatsTracker::~S2EStatsTracker()
+{
+    if (m_phasesFile) {
+        delete m_phasesFile;
+    }
+}
+
+void S2EStatsTracker::writePhasesLine()
+{
+    if (!m_phasesFile) {
+        return;
+    }
+
+    unsigned count = PhaseProfiler::getPhaseCount();
+    if (count != m_phaseColumns) {
+        *m_phasesFile << "WallTime";
+        for (unsigned i = 0; i < count; ++i) {
+            *m_phasesFile << "," << PhaseProfiler::getPhaseName(i);
+        }
+        *m_phasesFile << "\n";
+        m_phaseColumns = count;
+    }
+
+    double cps = PhaseProfiler::getCyclesPerSecond();
+
+    *m_phasesFile << elapsed();
+    for (unsigned i = 0; i < count; ++i) {
+        *m_phasesFile << "," << (cps ? PhaseProfiler::getCycles(i) / cps : 0.0);
+    }
+    *m_phasesFile << "\n";
+    m_phasesFile->flush();
+}
+
 void S2EStatsTracker::writeStatsHeader() {
+  if (PhaseProfiler::isEnabled())
+    m_phasesFile = executor.interpreterHandler->openOutputFile("phases.csv");
+
+
   *statsFile //<< "('Instructions',"
              //<< "'FullBranches',"
              //<< "'PartialBranches',"
@@ -165,6 +309,18 @@ void S2EStatsTracker::writeStatsHeader() {
              << "'ForkTime',"
              << "'ResolveTime',"
              << "'MemoryUsage',"
+             << "'TranslationBlocksSplit',"
+             << "'CpuInstructionsSplit',"
+             << "'FastPathInstructions',"
+             << "'FlagsMaterialized',"
+             << "'FlagsDeferred',"
+             << "'InterruptsConcrete',"
+             << "'InterruptsSymbolic',"
+             << "'StateMergeAttempts',"
+             << "'StatesMerged',"
+             << "'TranslatedBlocks',"
+             << "'StateSwitches',"
+             << "'StateSwitchTime',"
              << ")\n";
   statsFile->flush();
 }
@@ -196,16 +352,34 @@ void S2EStatsTracker::writeStatsLine() {
              << "," << stats::forkTime / 1000000.
              << "," << stats::resolveTime / 1000000.
              << "," << getProcessMemoryUsage() //sys::Process::GetTotalMemoryUsage()
+             << "," << stats::translationBlocksSplit
+             << "," << stats::cpuInstructionsSplit
+             << "," << stats::fastPathInstructions
+             << "," << stats::flagsMaterialized
+             << "," << stats::flagsDeferred
+             << "," << stats::interruptsConcrete
+             << "," << stats::interruptsSymbolic
+             << "," << stats::stateMergeAttempts
+             << "," << stats::statesMerged
+             << "," << stats::translatedBlocks
+             << "," << stats::stateSwitches
+             << "," << stats::stateSwitchTime / 1000000.
              << ")\n";
   statsFile->flush();
+
+  writePhasesLine();
 }
 
 S2EStateStats::S2EStateStats():
     m_statTranslationBlockConcrete(0),
     m_statTranslationBlockSymbolic(0),
     m_statInstructionCountSymbolic(0),
+    m_statTranslationBlockSplit(0),
+    m_statInstructionCountSplit(0),
     m_laststatTranslationBlockConcrete(0),
     m_laststatTranslationBlockSymbolic(0),
+    m_laststatTranslationBlockSplit(0),
+    m_laststatInstructionCountSplit(0),
     m_laststatInstructionCount(0),
     m_laststatInstructionCountConcrete(0),
     m_laststatInstructionCountSymbolic(0)
@@ -226,6 +400,13 @@ void S2EStateStats::updateStats(S2EExecutionState* state)
 
     stats::translationBlocks += tbcdiff + sbcdiff;
 
+    //Prefixes of symbolic blocks are counted as concrete blocks too
+    stats::translationBlocksSplit += m_statTranslationBlockSplit - m_laststatTranslationBlockSplit;
+    m_laststatTranslationBlockSplit = m_statTranslationBlockSplit;
+
+    stats::cpuInstructionsSplit += m_statInstructionCountSplit - m_laststatInstructionCountSplit;
+    m_laststatInstructionCountSplit = m_statInstructionCountSplit;
+
     //Updating instruction counts
 
     //KLEE icount
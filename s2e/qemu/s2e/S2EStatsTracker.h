@@ -39,19 +39,39 @@
 
 #include <klee/Statistic.h>
 #include <klee/StatsTracker.h>
+#include <klee/Internal/Support/PhaseProfiler.h>
+
+#include <s2e/s2e_qemu.h>
+
+#include <string>
 
 namespace klee {
 namespace stats {
     extern klee::Statistic translationBlocks;
     extern klee::Statistic translationBlocksConcrete;
     extern klee::Statistic translationBlocksKlee;
+    extern klee::Statistic translationBlocksSplit;
+    extern klee::Statistic translatedBlocks;
 
     extern klee::Statistic cpuInstructions;
     extern klee::Statistic cpuInstructionsConcrete;
     extern klee::Statistic cpuInstructionsKlee;
+    extern klee::Statistic cpuInstructionsSplit;
 
     extern klee::Statistic concreteModeTime;
     extern klee::Statistic symbolicModeTime;
+
+    extern klee::Statistic flagsMaterialized;
+    extern klee::Statistic flagsDeferred;
+
+    extern klee::Statistic interruptsConcrete;
+    extern klee::Statistic interruptsSymbolic;
+
+    extern klee::Statistic stateMergeAttempts;
+    extern klee::Statistic statesMerged;
+
+    extern klee::Statistic stateSwitches;
+    extern klee::Statistic stateSwitchTime;
 } // namespace stats
 } // namespace klee
 
@@ -62,12 +82,42 @@ class S2EStatsTracker: public klee::StatsTracker
 public:
     S2EStatsTracker(klee::Executor &_executor, std::string _objectFilename,
                     bool _updateMinDistToUncovered)
-        : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered) {}
+        : StatsTracker(_executor, _objectFilename, _updateMinDistToUncovered),
+          m_phasesFile(NULL), m_phaseColumns(0) {}
+
+    virtual ~S2EStatsTracker();
 
     static uint64_t getProcessMemoryUsage();
+
+    /** Register the S2E phases and, with -s2e-profile-plugins, the signal
+        hooks that charge the time spent in plugin callbacks to each plugin */
+    static void initializePhases();
+    static void registerPluginPhase(const void *plugin, const std::string &name);
+
+    static unsigned getPhaseId(S2EPhase phase) {
+        return s_phaseIds[phase];
+    }
+
 protected:
     void writeStatsHeader();
     void writeStatsLine();
+
+private:
+    static unsigned s_phaseIds[S2E_PHASE_MAX];
+
+    //Per-phase host time, written next to run.stats
+    llvm::raw_ostream *m_phasesFile;
+    unsigned m_phaseColumns;
+
+    void writePhasesLine();
+};
+
+/** Charges the lifetime of the object to one of the S2E phases */
+class S2EPhaseTimer: public klee::PhaseTimer
+{
+public:
+    S2EPhaseTimer(S2EPhase phase)
+        : klee::PhaseTimer(S2EStatsTracker::getPhaseId(phase)) {}
 };
 
 class S2EExecutionState;
@@ -80,9 +130,15 @@ public:
     uint64_t m_statTranslationBlockSymbolic;
     uint64_t m_statInstructionCountSymbolic;
 
+    //Symbolic blocks whose first instructions ran natively
+    uint64_t m_statTranslationBlockSplit;
+    uint64_t m_statInstructionCountSplit;
+
     //Counter values at the last check
     uint64_t m_laststatTranslationBlockConcrete;
     uint64_t m_laststatTranslationBlockSymbolic;
+    uint64_t m_laststatTranslationBlockSplit;
+    uint64_t m_laststatInstructionCountSplit;
     uint64_t m_laststatInstructionCount;
     uint64_t m_laststatInstructionCountConcrete;
     uint64_t m_laststatInstructionCountSymbolic;
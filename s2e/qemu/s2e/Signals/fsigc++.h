@@ -75,6 +75,28 @@ public:
 };
 
 
+/**
+ * Hooks invoked around each slot when set, used to account the time spent
+ * in the callbacks of each object. phase() maps the object a slot is bound
+ * to a phase, it is called once per slot. enter() returns a token for leave().
+ */
+typedef unsigned (*emit_phase_t)(const void *object);
+typedef unsigned (*emit_enter_t)(unsigned phase);
+typedef void (*emit_leave_t)(unsigned token);
+
+extern emit_phase_t g_emit_phase;
+extern emit_enter_t g_emit_enter;
+extern emit_leave_t g_emit_leave;
+
+/** Calls the leave hook even if the slot throws */
+class emit_guard
+{
+    unsigned m_token;
+public:
+    emit_guard(unsigned phase) : m_token(g_emit_enter(phase)) {}
+    ~emit_guard() { g_emit_leave(m_token); }
+};
+
 class mysignal_base
 {
 public:
@@ -92,11 +114,23 @@ class functor_base
 {
 protected:
     unsigned m_refcount;
+    unsigned m_phase;
 public:
-    functor_base():m_refcount(0){}
+    functor_base():m_refcount(0), m_phase((unsigned)-1){}
     void incref() { ++m_refcount; }
     unsigned decref() { assert(this->m_refcount > 0); return --m_refcount; }
     virtual ~functor_base() {assert(m_refcount == 0);}
+
+    /** Object the functor is bound to, NULL for stateless functors */
+    virtual const void *object() const { return NULL; }
+
+    /** Phase charged for the time spent in the functor */
+    unsigned phase() {
+        if (m_phase == (unsigned)-1) {
+            m_phase = g_emit_phase(object());
+        }
+        return m_phase;
+    }
     virtual RET operator()() {assert(false);};
     virtual RET operator()(P1 p1) {assert(false);};
     virtual RET operator()(P1 p1, P2 p2) {assert(false);};
@@ -169,6 +203,8 @@ public:
         FASSERT(this->m_refcount > 0);
         return (*m_obj.*m_func)();
     };
+
+    virtual const void *object() const { return m_obj; }
 };
 
 template <class T, typename RET>
@@ -374,6 +410,8 @@ public:
     functor0_1(functor_t *fb, A1 _a1) : m_fb(fb), a1(_a1) {
         fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor0_1() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -409,6 +447,8 @@ public:
     functor0_2(functor_t *fb, A1 a1_, A2 a2_) : m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor0_2() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -443,6 +483,8 @@ public:
     functor1_1(functor_t *fb, A1 a1_):m_fb(fb), a1(a1_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor1_1() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -476,6 +518,8 @@ public:
     functor1_2(functor_t *fb, A1 a1_, A2 a2_):m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor1_2() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -510,6 +554,8 @@ public:
     functor1_3(functor_t *fb, A1 a1_, A2 a2_, A3 a3_):m_fb(fb), a1(a1_), a2(a2_), a3(a3_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor1_3() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -544,6 +590,8 @@ public:
     functor1_4(functor_t *fb, A1 a1_, A2 a2_, A3 a3_, A4 a4_):m_fb(fb), a1(a1_), a2(a2_), a3(a3_), a4(a4_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor1_4() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -580,6 +628,8 @@ public:
     functor2_1(functor_t *fb, A1 a1_):m_fb(fb), a1(a1_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor2_1() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -613,6 +663,8 @@ public:
     functor2_2(functor_t *fb, A1 a1_, A2 a2_):m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor2_2() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -649,6 +701,8 @@ public:
     functor3_1(functor_t *fb, A1 a1_):m_fb(fb), a1(a1_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor3_1() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -682,6 +736,8 @@ public:
     functor3_2(functor_t *fb, A1 a1_, A2 a2_):m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor3_2() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -717,6 +773,8 @@ public:
     functor4_1(functor_t *fb, A1 a1_):m_fb(fb), a1(a1_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor4_1() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -750,6 +808,8 @@ public:
     functor4_2(functor_t *fb, A1 a1_, A2 a2_):m_fb(fb), a1(a1_), a2(a2_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor4_2() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -783,6 +843,8 @@ public:
     functor4_3(functor_t *fb, A1 a1_, A2 a2_, A3 a3_):m_fb(fb), a1(a1_), a2(a2_), a3(a3_) {
         m_fb->incref();
     }
+    virtual const void *object() const { return m_fb->object(); }
+
     virtual ~functor4_3() {
         if (!m_fb->decref()) {
             delete m_fb;
@@ -55,6 +55,8 @@ public:
         FASSERT(this->m_refcount > 0);
         return (*m_obj.*m_func)(CALL_PARAMS);
     };
+
+    virtual const void *object() const { return m_obj; }
 };
 
 template <class T, typename RET, TYPENAMES>
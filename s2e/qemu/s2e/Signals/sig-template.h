@@ -109,7 +109,21 @@ bool empty() const{
     return m_activeSignals == 0;
 }
 
+unsigned size() const{
+    return m_activeSignals;
+}
+
 void emit(OPERATOR_PARAM_DECL) {
+    if (g_emit_enter) {
+        for (unsigned i=0; i<m_size; ++i) {
+            if (m_funcs[i]) {
+                emit_guard guard(m_funcs[i]->phase());
+                m_funcs[i]->operator ()(CALL_PARAMS);
+            }
+        }
+        return;
+    }
+
     for (unsigned i=0; i<m_size; ++i) {
         if (m_funcs[i]) {
             m_funcs[i]->operator ()(CALL_PARAMS);
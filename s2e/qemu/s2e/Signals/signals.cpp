@@ -2,6 +2,10 @@
 
 namespace fsigc {
 
+emit_phase_t g_emit_phase = NULL;
+emit_enter_t g_emit_enter = NULL;
+emit_leave_t g_emit_leave = NULL;
+
 connection::connection(mysignal_base *sig, void *func, unsigned index) {
     m_functor = func;
     m_sig = sig;
@@ -0,0 +1,161 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#include "SuperblockBuilder.h"
+#include "Utils.h"
+
+#include <tcg-llvm.h>
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/GlobalVariable.h>
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+#include <llvm/LLVMContext.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Analysis/Verifier.h>
+#include <llvm/Support/IRBuilder.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+using namespace llvm;
+
+namespace s2e {
+
+SuperblockBuilder::SuperblockBuilder(Module *module)
+    : m_module(module), m_built(0), m_failed(0), m_executions(0), m_skipped(0)
+{
+    //Declared by tcg-llvm when it initializes its helpers
+    m_gotoTb = m_module->getNamedGlobal(TCG_LLVM_GOTO_TB_NAME);
+    assert(m_gotoTb);
+}
+
+Function *SuperblockBuilder::build(const std::vector<Function*> &members,
+                                   const std::vector<uint64_t> &blocks,
+                                   const std::vector<unsigned> &exits,
+                                   const std::string &name)
+{
+    assert(members.size() >= 2 && exits.size() + 1 == members.size());
+    assert(blocks.size() == members.size());
+
+    LLVMContext &context = m_module->getContext();
+    IntegerType *int8 = Type::getInt8Ty(context);
+    Constant *noGoto = ConstantInt::get(int8, 0xff);
+
+    Function *superblock = Function::Create(members[0]->getFunctionType(),
+                                            Function::PrivateLinkage, name, m_module);
+    Value *arg = superblock->arg_begin();
+
+    IRBuilder<> builder(BasicBlock::Create(context, "entry", superblock));
+
+    //Members report goto_tb requests here instead of to the executor
+    Value *exitSlot = builder.CreateAlloca(int8, 0, "goto_tb");
+    Value *tbArg = builder.CreateConstGEP1_32(arg, TCG_LLVM_TB_ARG);
+
+    std::vector<CallInst*> calls;
+    SmallPtrSet<Instruction*, 16> forwards;
+
+    BasicBlock *memberBlock = BasicBlock::Create(context, "member", superblock);
+    builder.CreateBr(memberBlock);
+
+    for (unsigned i = 0; i < members.size(); ++i) {
+        builder.SetInsertPoint(memberBlock);
+        builder.CreateStore(noGoto, exitSlot);
+        builder.CreateStore(ConstantInt::get(Type::getInt64Ty(context), blocks[i]),
+                            tbArg);
+        CallInst *call = builder.CreateCall(members[i], arg);
+        calls.push_back(call);
+
+        Value *taken = builder.CreateLoad(exitSlot);
+
+        BasicBlock *leaveBlock = BasicBlock::Create(context, "leave", superblock);
+        BasicBlock *forwardBlock = BasicBlock::Create(context, "forward", superblock);
+        BasicBlock *returnBlock = BasicBlock::Create(context, "return", superblock);
+
+        if (i + 1 < members.size()) {
+            memberBlock = BasicBlock::Create(context, "member", superblock);
+            builder.CreateCondBr(builder.CreateICmpEQ(taken, ConstantInt::get(int8, exits[i])),
+                                 memberBlock, leaveBlock);
+        } else {
+            builder.CreateBr(leaveBlock);
+        }
+
+        builder.SetInsertPoint(leaveBlock);
+        builder.CreateCondBr(builder.CreateICmpNE(taken, noGoto), forwardBlock, returnBlock);
+
+        //The executor takes over as soon as it sees the request
+        builder.SetInsertPoint(forwardBlock);
+        forwards.insert(builder.CreateStore(taken, m_gotoTb));
+        builder.CreateBr(returnBlock);
+
+        builder.SetInsertPoint(returnBlock);
+        builder.CreateRet(call);
+    }
+
+    foreach2(it, calls.begin(), calls.end()) {
+        InlineFunctionInfo info;
+        if (!InlineFunction(*it, info)) {
+            superblock->eraseFromParent();
+            ++m_failed;
+            return NULL;
+        }
+    }
+
+    for (Function::iterator bb = superblock->begin(); bb != superblock->end(); ++bb) {
+        for (BasicBlock::iterator it = bb->begin(); it != bb->end(); ++it) {
+            StoreInst *store = dyn_cast<StoreInst>(it);
+            if (store && !forwards.count(store) &&
+                store->getPointerOperand() == m_gotoTb) {
+                store->setOperand(1, exitSlot);
+            }
+        }
+    }
+
+#ifndef NDEBUG
+    verifyFunction(*superblock);
+#endif
+
+    ++m_built;
+    return superblock;
+}
+
+void SuperblockBuilder::printStats(raw_ostream &os) const
+{
+    os << "Superblocks: " << m_built << " built, " << m_failed << " failed, "
+       << m_executions << " executions, " << m_skipped << " skipped" << '\n';
+}
+
+} // namespace s2e
@@ -0,0 +1,97 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_SUPERBLOCKBUILDER_H
+#define S2E_SUPERBLOCKBUILDER_H
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+#include <string>
+#include <inttypes.h>
+
+namespace llvm {
+    class Module;
+    class Function;
+    class GlobalVariable;
+}
+
+namespace s2e {
+
+/**
+ *  Merges the LLVM functions of a chain of translation blocks into a
+ *  single function, so that KLEE optimizes and interprets the chain as
+ *  a unit. Register values then flow between the blocks in SSA form
+ *  instead of being written back to and reloaded from the CPU state at
+ *  every block boundary.
+ *
+ *  Member i continues with member i+1 when it takes the goto_tb exit
+ *  exits[i]. Any other exit leaves the superblock the same way the
+ *  member would: the goto_tb request is forwarded to the executor,
+ *  which finds the exiting block in env->s2e_current_tb. Each member is
+ *  passed its translation block, blocks[i], in its argument array.
+ */
+class SuperblockBuilder
+{
+public:
+    SuperblockBuilder(llvm::Module *module);
+
+    llvm::Function *build(const std::vector<llvm::Function*> &members,
+                          const std::vector<uint64_t> &blocks,
+                          const std::vector<unsigned> &exits,
+                          const std::string &name);
+
+    /** Called when the executor enters a superblock */
+    void executed() { ++m_executions; }
+
+    /** Called when a superblock could not be used because its chain changed */
+    void skipped() { ++m_skipped; }
+
+    void printStats(llvm::raw_ostream &os) const;
+
+private:
+    llvm::Module *m_module;
+    llvm::GlobalVariable *m_gotoTb;
+
+    uint64_t m_built;
+    uint64_t m_failed;
+    uint64_t m_executions;
+    uint64_t m_skipped;
+};
+
+} // namespace s2e
+
+#endif // S2E_SUPERBLOCKBUILDER_H
@@ -110,7 +110,20 @@ void AtomicFunctions::sub(uint64_t *address, uint64_t value)
 
 void AtomicFunctions::write(uint64_t *address, uint64_t value)
 {
-    *address = value;
+    //Make previous writes visible before this one
+    __sync_synchronize();
+    *(volatile uint64_t*)address = value;
+    __sync_synchronize();
+}
+
+void *S2ESharedMemory::allocate(uint64_t size)
+{
+    return new uint8_t[size]();
+}
+
+void S2ESharedMemory::free(void *buffer, uint64_t size)
+{
+    delete [] (uint8_t*)buffer;
 }
 
 #else
@@ -230,9 +243,145 @@ void AtomicFunctions::sub(uint64_t *address, uint64_t value)
 
 void AtomicFunctions::write(uint64_t *address, uint64_t value)
 {
-    *address = value;
+    //Make previous writes visible before this one
+    __sync_synchronize();
+    *(volatile uint64_t*)address = value;
+    __sync_synchronize();
+}
+
+void *S2ESharedMemory::allocate(uint64_t size)
+{
+    //Anonymous shared mappings are zero-filled and survive fork
+    void *buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
+    if (buffer == MAP_FAILED) {
+        perror("Could not allocate shared memory ");
+        exit(-1);
+    }
+    return buffer;
+}
+
+void S2ESharedMemory::free(void *buffer, uint64_t size)
+{
+    munmap(buffer, size);
 }
 
 #endif
 
+uint64_t AtomicFunctions::fetchAdd(uint64_t *address, uint64_t value)
+{
+    return __sync_fetch_and_add(address, value);
+}
+
+bool AtomicFunctions::compareAndSwap(uint64_t *address, uint64_t expected, uint64_t value)
+{
+    return __sync_bool_compare_and_swap(address, expected, value);
+}
+
+uint64_t AtomicFunctions::exchange(uint64_t *address, uint64_t value)
+{
+    //__sync_lock_test_and_set is only an acquire barrier
+    uint64_t previous;
+    do {
+        previous = *(volatile uint64_t*)address;
+    } while (!__sync_bool_compare_and_swap(address, previous, value));
+    return previous;
+}
+
+void AtomicFunctions::barrier()
+{
+    __sync_synchronize();
+}
+
+void S2ESeqLock::writeLock()
+{
+    while (true) {
+        uint64_t sequence = *(volatile uint64_t*)&m_sequence;
+        if (!(sequence & 1) && AtomicFunctions::compareAndSwap(&m_sequence, sequence, sequence + 1)) {
+            break;
+        }
+    }
+}
+
+void S2ESeqLock::writeUnlock()
+{
+    assert(m_sequence & 1);
+    AtomicFunctions::add(&m_sequence, 1);
+}
+
+uint64_t S2ESeqLock::readBegin() const
+{
+    uint64_t sequence;
+    do {
+        sequence = *(volatile uint64_t*)&m_sequence;
+    } while (sequence & 1);
+    AtomicFunctions::barrier();
+    return sequence;
+}
+
+bool S2ESeqLock::readRetry(uint64_t sequence) const
+{
+    AtomicFunctions::barrier();
+    return *(volatile uint64_t*)&m_sequence != sequence;
+}
+
+S2ESharedBitmap::S2ESharedBitmap(unsigned log2Bits)
+{
+    m_bits = 1ULL << log2Bits;
+    m_words = (uint64_t*)S2ESharedMemory::allocate((m_bits / 64 + 1) * sizeof(uint64_t));
+}
+
+S2ESharedBitmap::~S2ESharedBitmap()
+{
+    S2ESharedMemory::free(m_words, (m_bits / 64 + 1) * sizeof(uint64_t));
+}
+
+uint64_t AtomicFunctions::fetchOr(uint64_t *address, uint64_t value)
+{
+    return __sync_fetch_and_or(address, value);
+}
+
+bool S2ESharedBitmap::testAndSet(uint64_t index)
+{
+    index &= m_bits - 1;
+    uint64_t mask = 1ULL << (index % 64);
+    return AtomicFunctions::fetchOr(&m_words[index / 64], mask) & mask;
+}
+
+bool S2ESharedBitmap::test(uint64_t index) const
+{
+    index &= m_bits - 1;
+    return AtomicFunctions::read(&m_words[index / 64]) & (1ULL << (index % 64));
+}
+
+uint64_t S2ESharedBitmap::count() const
+{
+    uint64_t result = 0;
+    for (uint64_t i = 0; i < m_bits / 64 + 1; ++i) {
+        result += __builtin_popcountll(m_words[i]);
+    }
+    return result;
+}
+
+bool S2ESharedBitmap::merge(const uint64_t *words, uint64_t count)
+{
+    if (count != m_bits / 64 + 1) {
+        return false;
+    }
+
+    for (uint64_t i = 0; i < count; ++i) {
+        if (words[i]) {
+            AtomicFunctions::fetchOr(&m_words[i], words[i]);
+        }
+    }
+    return true;
+}
+
+void S2ESharedBitmap::mergeWord(uint64_t index, uint64_t value)
+{
+    assert(index < wordCount());
+    if (value) {
+        AtomicFunctions::fetchOr(&m_words[index], value);
+    }
+}
+
 }
@@ -38,6 +38,7 @@
 #define S2E_SYNCHRONIZATION_H
 
 #include <inttypes.h>
+#include <new>
 #include <string>
 
 namespace s2e {
@@ -113,6 +114,129 @@ public:
     static void write(uint64_t *address, uint64_t value);
     static void add(uint64_t *address, uint64_t value);
     static void sub(uint64_t *address, uint64_t value);
+    static uint64_t fetchOr(uint64_t *address, uint64_t value);
+
+    /** Adds value and returns the previous content */
+    static uint64_t fetchAdd(uint64_t *address, uint64_t value);
+
+    /** Writes value if the address contains expected. Returns true on success. */
+    static bool compareAndSwap(uint64_t *address, uint64_t expected, uint64_t value);
+
+    /** Writes value and returns the previous content */
+    static uint64_t exchange(uint64_t *address, uint64_t value);
+
+    /** Full memory barrier */
+    static void barrier();
+};
+
+/**
+ *  Allocates memory that is shared by the current process
+ *  and all the S2E processes it forks afterwards.
+ *  The memory is zero-filled.
+ */
+class S2ESharedMemory {
+public:
+    static void *allocate(uint64_t size);
+    static void free(void *buffer, uint64_t size);
+};
+
+/**
+ *  Same as S2ESynchronizedObject, without the lock.
+ *  The members of T must be accessed with AtomicFunctions
+ *  or be protected by an S2ESeqLock that is part of T.
+ */
+template <class T>
+class S2ESharedObject {
+private:
+    T *m_object;
+
+    S2ESharedObject(const S2ESharedObject&);
+    void operator=(const S2ESharedObject&);
+
+public:
+    S2ESharedObject() {
+        m_object = new (S2ESharedMemory::allocate(sizeof(T))) T();
+    }
+
+    ~S2ESharedObject() {
+        m_object->~T();
+        S2ESharedMemory::free(m_object, sizeof(T));
+    }
+
+    T* get() const {
+        return m_object;
+    }
+};
+
+/**
+ *  Sequence lock for data in shared memory that is read
+ *  often and written rarely.
+ *
+ *  Writers serialize among themselves on the sequence number,
+ *  which is odd while a write is in progress. Readers never
+ *  block writers and never write to shared memory. They copy
+ *  the data they need and retry if the sequence number changed
+ *  in the meantime:
+ *
+ *  do {
+ *      seq = lock.readBegin();
+ *      ...copy the data...
+ *  } while (lock.readRetry(seq));
+ */
+class S2ESeqLock {
+private:
+    mutable uint64_t m_sequence;
+
+public:
+    S2ESeqLock() : m_sequence(0) {}
+
+    void writeLock();
+    void writeUnlock();
+
+    uint64_t readBegin() const;
+    bool readRetry(uint64_t sequence) const;
+};
+
+/**
+ *  A bitmap in shared memory that all S2E processes can update.
+ *  Bits are only ever set, using atomic operations, so accesses
+ *  need no lock. Indexes wrap around the size of the bitmap.
+ */
+class S2ESharedBitmap {
+private:
+    uint64_t *m_words;
+    uint64_t m_bits;
+
+public:
+    S2ESharedBitmap(unsigned log2Bits);
+    ~S2ESharedBitmap();
+
+    /** Sets the bit and returns its previous value */
+    bool testAndSet(uint64_t index);
+
+    bool test(uint64_t index) const;
+
+    /** Number of bits that are set */
+    uint64_t count() const;
+
+    /** Sets the bits that are set in the count words of a saved bitmap.
+        Returns false if the size does not match. */
+    bool merge(const uint64_t *words, uint64_t count);
+
+    /** Sets the bits that are set in value in the word at index */
+    void mergeWord(uint64_t index, uint64_t value);
+
+    uint64_t wordCount() const {
+        return m_bits / 64 + 1;
+    }
+
+    uint64_t size() const {
+        return m_bits;
+    }
+
+    const uint64_t *data() const {
+        return m_words;
+    }
 };
 
 template <class T>
@@ -131,6 +255,12 @@ public:
     void write(T &object) {
         AtomicFunctions::write(&m_value, *(uint64_t*)&object);
     }
+
+    /** Writes the object and returns the previous one */
+    T exchange(T &object) {
+        uint64_t value = AtomicFunctions::exchange(&m_value, *(uint64_t*)&object);
+        return *(T*)&value;
+    }
 };
 
 }
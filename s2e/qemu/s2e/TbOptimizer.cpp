@@ -0,0 +1,400 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#include "TbOptimizer.h"
+#include "Utils.h"
+
+#include <llvm/Module.h>
+#include <llvm/Function.h>
+#include <llvm/Instructions.h>
+#include <llvm/Constants.h>
+#include <llvm/Operator.h>
+#include <llvm/Pass.h>
+#include <llvm/PassManager.h>
+#include <llvm/Target/TargetData.h>
+#include <llvm/Transforms/Scalar.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/Support/Format.h>
+
+using namespace llvm;
+
+namespace s2e {
+
+namespace {
+
+/**
+ *  Splits a pointer into a base value and a constant byte offset.
+ *  CPU state accesses generated by tcg-llvm are of the form
+ *  inttoptr(add(env, offset)).
+ */
+Value *decomposePointer(Value *ptr, int64_t &offset)
+{
+    offset = 0;
+
+    while (true) {
+        ptr = ptr->stripPointerCasts();
+
+        if (Operator::getOpcode(ptr) == Instruction::IntToPtr) {
+            ptr = cast<Operator>(ptr)->getOperand(0);
+            continue;
+        }
+
+        if (Operator::getOpcode(ptr) == Instruction::Add) {
+            Operator *add = cast<Operator>(ptr);
+            if (ConstantInt *ci = dyn_cast<ConstantInt>(add->getOperand(1))) {
+                offset += ci->getSExtValue();
+                ptr = add->getOperand(0);
+                continue;
+            }
+        }
+
+        if (GEPOperator *gep = dyn_cast<GEPOperator>(ptr)) {
+            IntegerType *elTy = dyn_cast<IntegerType>(
+                    cast<PointerType>(gep->getPointerOperand()->getType())->getElementType());
+            if (gep->getNumIndices() == 1 && elTy && !(elTy->getBitWidth() % 8)) {
+                if (ConstantInt *ci = dyn_cast<ConstantInt>(gep->getOperand(1))) {
+                    offset += ci->getSExtValue() * (elTy->getBitWidth() / 8);
+                    ptr = gep->getPointerOperand();
+                    continue;
+                }
+            }
+        }
+
+        return ptr;
+    }
+}
+
+struct MemoryAccess {
+    Value *base;
+    int64_t offset;
+    uint64_t size;
+
+    MemoryAccess(Value *ptr, Type *type) {
+        base = decomposePointer(ptr, offset);
+        size = type->getPrimitiveSizeInBits() / 8;
+    }
+
+    bool mayOverlap(const MemoryAccess &other) const {
+        if (base != other.base) {
+            return true;
+        }
+        return offset < other.offset + (int64_t) other.size &&
+               other.offset < offset + (int64_t) size;
+    }
+
+    bool covers(const MemoryAccess &other) const {
+        return base == other.base && offset <= other.offset &&
+               other.offset + other.size <= offset + size;
+    }
+};
+
+/**
+ *  Removes stores to the CPU state that are overwritten later in the same
+ *  block without being read in between. Any call may read the CPU state
+ *  and ends the search. Unlike LLVM's DSE, this does not need alias
+ *  analysis to tell apart two registers accessed through inttoptr.
+ */
+struct CpuStateStoreElimination : public FunctionPass {
+    static char ID;
+    CpuStateStoreElimination() : FunctionPass(ID) {}
+
+    virtual const char *getPassName() const {
+        return "CPU state dead store elimination";
+    }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+        AU.setPreservesCFG();
+    }
+
+    virtual bool runOnFunction(Function &F) {
+        bool modified = false;
+
+        foreach2(bb, F.begin(), F.end()) {
+            std::vector<std::pair<StoreInst*, MemoryAccess> > pending;
+
+            foreach2(it, bb->begin(), bb->end()) {
+                Instruction *inst = &*it;
+
+                if (StoreInst *store = dyn_cast<StoreInst>(inst)) {
+                    if (store->isVolatile()) {
+                        continue;
+                    }
+
+                    MemoryAccess access(store->getPointerOperand(),
+                                        store->getValueOperand()->getType());
+                    if (!access.size) {
+                        continue;
+                    }
+
+                    for (unsigned i = 0; i < pending.size(); ) {
+                        if (access.covers(pending[i].second)) {
+                            pending[i].first->eraseFromParent();
+                            pending.erase(pending.begin() + i);
+                            modified = true;
+                        } else {
+                            ++i;
+                        }
+                    }
+
+                    pending.push_back(std::make_pair(store, access));
+                } else if (LoadInst *load = dyn_cast<LoadInst>(inst)) {
+                    MemoryAccess access(load->getPointerOperand(), load->getType());
+                    if (!access.size) {
+                        pending.clear();
+                        continue;
+                    }
+
+                    for (unsigned i = 0; i < pending.size(); ) {
+                        if (access.mayOverlap(pending[i].second)) {
+                            pending.erase(pending.begin() + i);
+                        } else {
+                            ++i;
+                        }
+                    }
+                } else if (inst->mayReadFromMemory()) {
+                    pending.clear();
+                }
+            }
+        }
+
+        return modified;
+    }
+};
+
+char CpuStateStoreElimination::ID = 0;
+
+/**
+ *  Converts selects into branches when one of the operands is computed
+ *  only for the select. That computation is moved into its branch, so
+ *  only the selected value is evaluated. Selects of already available
+ *  values are cheaper as ite expressions and are kept.
+ */
+struct SelectToBranch : public FunctionPass {
+    static char ID;
+    SelectToBranch() : FunctionPass(ID) {}
+
+    virtual const char *getPassName() const {
+        return "Profitable select to branch conversion";
+    }
+
+    static bool isMovable(Value *v, SelectInst *select) {
+        Instruction *inst = dyn_cast<Instruction>(v);
+        return inst && inst->getParent() == select->getParent() &&
+               inst->hasOneUse() && !isa<PHINode>(inst) &&
+               !inst->mayHaveSideEffects() && !inst->mayReadFromMemory();
+    }
+
+    static void moveInto(Value *v, BasicBlock *bb) {
+        cast<Instruction>(v)->moveBefore(bb->getTerminator());
+    }
+
+    virtual bool runOnFunction(Function &F) {
+        SmallVector<SelectInst*, 16> selects;
+        bool modified = false;
+
+        foreach2(bb, F.begin(), F.end()) {
+            foreach2(it, bb->begin(), bb->end()) {
+                SelectInst *select = dyn_cast<SelectInst>(&*it);
+                if (!select || select->getCondition()->getType()->isVectorTy()) {
+                    continue;
+                }
+
+                if (isMovable(select->getTrueValue(), select) ||
+                    isMovable(select->getFalseValue(), select)) {
+                    selects.push_back(select);
+                }
+            }
+        }
+
+        foreach2(it, selects.begin(), selects.end()) {
+            SelectInst *select = *it;
+            Value *trueV = select->getTrueValue();
+            Value *falseV = select->getFalseValue();
+
+            /* Moving may have made an operand unavailable to later selects */
+            bool moveTrue = isMovable(trueV, select);
+            bool moveFalse = isMovable(falseV, select) && falseV != trueV;
+            if (!moveTrue && !moveFalse) {
+                continue;
+            }
+
+            BasicBlock *entry = select->getParent();
+            BasicBlock *fallback = entry->splitBasicBlock(select);
+
+            BasicBlock *trueBb = BasicBlock::Create(F.getContext(), "", &F, fallback);
+            BranchInst::Create(fallback, trueBb);
+            BasicBlock *falseBb = BasicBlock::Create(F.getContext(), "", &F, fallback);
+            BranchInst::Create(fallback, falseBb);
+
+            entry->getTerminator()->eraseFromParent();
+            BranchInst::Create(trueBb, falseBb, select->getCondition(), entry);
+
+            if (moveTrue) {
+                moveInto(trueV, trueBb);
+            }
+            if (moveFalse) {
+                moveInto(falseV, falseBb);
+            }
+
+            PHINode *phi = PHINode::Create(select->getType(), 2, "", select);
+            phi->addIncoming(trueV, trueBb);
+            phi->addIncoming(falseV, falseBb);
+            select->replaceAllUsesWith(phi);
+            phi->takeName(select);
+            select->eraseFromParent();
+            modified = true;
+        }
+
+        return modified;
+    }
+};
+
+char SelectToBranch::ID = 0;
+
+} // anonymous namespace
+
+FunctionPass *TbOptimizer::createPass(const std::string &name)
+{
+    if (name == "cpu-dse") {
+        return new CpuStateStoreElimination();
+    } else if (name == "select-to-branch") {
+        return new SelectToBranch();
+    } else if (name == "sink") {
+        return createSinkingPass();
+    } else if (name == "instcombine") {
+        return createInstructionCombiningPass();
+    } else if (name == "gvn") {
+        return createGVNPass();
+    } else if (name == "dse") {
+        return createDeadStoreEliminationPass();
+    } else if (name == "adce") {
+        return createAggressiveDCEPass();
+    } else if (name == "simplifycfg") {
+        return createCFGSimplificationPass();
+    } else if (name == "reassociate") {
+        return createReassociatePass();
+    } else if (name == "mem2reg") {
+        return createPromoteMemoryToRegisterPass();
+    }
+
+    return NULL;
+}
+
+TbOptimizer::TbOptimizer(Module *module, const std::string &passes)
+    : m_module(module), m_functions(0)
+{
+    std::string::size_type start = 0;
+    while (start <= passes.size()) {
+        std::string::size_type end = passes.find(',', start);
+        if (end == std::string::npos) {
+            end = passes.size();
+        }
+
+        std::string name = passes.substr(start, end - start);
+        start = end + 1;
+
+        if (name.empty()) {
+            continue;
+        }
+
+        FunctionPass *pass = createPass(name);
+        if (!pass) {
+            errs() << "TbOptimizer: unknown pass " << name << '\n';
+            continue;
+        }
+
+        Stage stage;
+        stage.name = name;
+        stage.fpm = new FunctionPassManager(module);
+        stage.fpm->add(new TargetData(module));
+        stage.fpm->add(pass);
+        stage.fpm->doInitialization();
+        stage.instructionsBefore = 0;
+        stage.instructionsAfter = 0;
+        m_stages.push_back(stage);
+    }
+}
+
+TbOptimizer::~TbOptimizer()
+{
+    foreach2(it, m_stages.begin(), m_stages.end()) {
+        (*it).fpm->doFinalization();
+        delete (*it).fpm;
+    }
+}
+
+uint64_t TbOptimizer::countInstructions(Function *function)
+{
+    uint64_t count = 0;
+    foreach2(bb, function->begin(), function->end()) {
+        count += bb->size();
+    }
+    return count;
+}
+
+void TbOptimizer::optimize(Function *function)
+{
+    ++m_functions;
+
+    uint64_t count = countInstructions(function);
+    foreach2(it, m_stages.begin(), m_stages.end()) {
+        Stage &stage = *it;
+        stage.instructionsBefore += count;
+        stage.fpm->run(*function);
+        count = countInstructions(function);
+        stage.instructionsAfter += count;
+    }
+}
+
+void TbOptimizer::printStats(raw_ostream &os) const
+{
+    os << "TB optimizer: " << m_functions << " functions" << '\n';
+
+    foreach2(it, m_stages.begin(), m_stages.end()) {
+        const Stage &stage = *it;
+        int64_t removed = (int64_t) stage.instructionsBefore - (int64_t) stage.instructionsAfter;
+
+        os << "  " << stage.name << ": " << stage.instructionsBefore << " -> "
+           << stage.instructionsAfter << " instructions";
+        if (stage.instructionsBefore) {
+            os << " (" << format("%.1f", 100.0 * removed / stage.instructionsBefore)
+               << "% removed)";
+        }
+        os << '\n';
+    }
+}
+
+} // namespace s2e
@@ -0,0 +1,102 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2E_TBOPTIMIZER_H
+#define S2E_TBOPTIMIZER_H
+
+#include <llvm/Support/raw_ostream.h>
+
+#include <vector>
+#include <string>
+#include <inttypes.h>
+
+namespace llvm {
+    class Module;
+    class Function;
+    class FunctionPass;
+    class FunctionPassManager;
+}
+
+namespace s2e {
+
+/**
+ *  Optimization pipeline for the LLVM code of translation blocks.
+ *
+ *  KLEE's generic passes target whole programs. Translation blocks are
+ *  small straight-line functions dominated by accesses to the CPU state
+ *  and by flag computations whose results are often overwritten or only
+ *  needed on one side of a branch. Every instruction that survives is
+ *  interpreted and builds an expression each time the block runs
+ *  symbolically, so the pipeline is run once per block before KLEE
+ *  takes ownership of it.
+ *
+ *  Each pass runs in its own pass manager so that the number of
+ *  instructions it removes can be reported.
+ */
+class TbOptimizer
+{
+public:
+    /** passes is a comma-separated list of pass names */
+    TbOptimizer(llvm::Module *module, const std::string &passes);
+    ~TbOptimizer();
+
+    bool empty() const { return m_stages.empty(); }
+
+    void optimize(llvm::Function *function);
+
+    void printStats(llvm::raw_ostream &os) const;
+
+    /** Returns NULL if the name is unknown */
+    static llvm::FunctionPass *createPass(const std::string &name);
+
+    static uint64_t countInstructions(llvm::Function *function);
+
+private:
+    struct Stage {
+        std::string name;
+        llvm::FunctionPassManager *fpm;
+        uint64_t instructionsBefore;
+        uint64_t instructionsAfter;
+    };
+
+    llvm::Module *m_module;
+    std::vector<Stage> m_stages;
+    uint64_t m_functions;
+};
+
+} // namespace s2e
+
+#endif // S2E_TBOPTIMIZER_H
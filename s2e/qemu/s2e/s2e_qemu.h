@@ -91,6 +91,29 @@ void s2e_close_arg(void);
 
 
 void s2e_debug_print(const char *fmtstr, ...);
+
+/***************************************/
+/* Functions from S2EStatsTracker.cpp */
+
+/** Host-side phases accounted by the phase profiler */
+enum S2EPhase {
+    S2E_PHASE_TRANSLATION,
+    S2E_PHASE_CONCRETE,
+    S2E_PHASE_INTERPRETER,
+    S2E_PHASE_STATE_SWITCH,
+    S2E_PHASE_DEVICE_SNAPSHOT,
+    S2E_PHASE_PLUGINS,
+    S2E_PHASE_MAX
+};
+
+/** Charge host time to phase until s2e_phase_leave() is called
+    with the returned value */
+unsigned s2e_phase_enter(enum S2EPhase phase);
+void s2e_phase_leave(unsigned previous);
+
+/** Current phase, to be restored with s2e_phase_leave() after a
+    s2e_longjmp skipped the leave calls of the phases it unwound */
+unsigned s2e_phase_current(void);
 void print_stacktrace(void);
 
 void s2e_print_apic(struct CPUX86State *env);
@@ -100,6 +123,13 @@ void s2e_print_apic(struct CPUX86State *env);
 /* Functions from CorePlugin.cpp */
 
 void s2e_tcg_execution_handler(void* signal, uint64_t pc);
+
+/** Same as above, for code that refers to the signal by its index
+    in tb->s2e_tb->executionSignals */
+void s2e_tcg_indexed_execution_handler(uint64_t tb, uint64_t index, uint64_t pc);
+
+/** Index of the signal in tb->s2e_tb->executionSignals, -1 if not found */
+int s2e_get_execution_signal_index(struct TranslationBlock *tb, void *signal);
 void s2e_tcg_custom_instruction_handler(uint64_t arg);
 
 /** Called by the translator when a custom instruction is detected */
@@ -178,6 +208,13 @@ extern int g_s2e_concretize_io_addresses;
     symbolic I/O writes concrete */
 extern int g_s2e_concretize_io_writes;
 
+/** Global variable that determines whether translated blocks
+    can stop before any instruction (see s2e_split_insn) */
+extern int g_s2e_split_translation_blocks;
+
+/** Set while guest code is translated for LLVM only */
+extern int g_s2e_translating_llvm;
+
 
 /** Prevent anything from flushing the TLB cache */
 extern int g_s2e_disable_tlb_flush;
@@ -253,6 +290,11 @@ void s2e_tb_free(struct S2E* s2e, struct TranslationBlock *tb);
     in order to update tb->s2e_tb->llvm_function */
 void s2e_set_tb_function(struct S2E* s2e, struct TranslationBlock *tb);
 
+/** Called after the translation of a block to decide whether
+    its LLVM code must be generated from the current TCG ops */
+int s2e_should_gen_llvm(struct S2E *s2e, struct S2EExecutionState *state,
+                        struct TranslationBlock *tb);
+
 void s2e_flush_tlb_cache(void);
 void s2e_flush_tlb_cache_page(void *objectState, int mmu_idx, int index);
 
@@ -151,6 +151,8 @@ typedef struct DisasContext {
 
     int done_reg_access_end; /* 1 when onTranslateRegisterAccess was called */
 
+    int insn_index; /* position of the instruction in the TB */
+
 #endif
     //enum ETranslationBlockType tb_type;
 //[chy]------------------------------------
@@ -177,6 +179,8 @@ static inline void s2e_translate_compute_reg_mask_end(DisasContext *dc)
 
     tcg_calc_regmask_ex(&tcg_ctx, &rmask, &wmask, &accesses_mem, dc->ins_opc, dc->ins_arg);
 
+    s2e_tb_record_accesses(dc->tb, dc->insn_index, rmask | wmask, accesses_mem);
+
     //First five bits contain flag registers
     rmask >>= 5;
     wmask >>= 5;
@@ -7949,6 +7953,29 @@ void optimize_flags_init(void)
 }
 
 
+#ifdef CONFIG_S2E
+/* Leaves the TB before the current instruction if the executor asked to
+   run only the first instructions natively (see S2EExecutor). Only native
+   code is ever split, LLVM translations never contain split points. */
+static inline void s2e_gen_split_point(DisasContext *dc, target_ulong pc, int insn)
+{
+    int l1 = gen_new_label();
+
+    tcg_gen_ld_i32(cpu_tmp2_i32, cpu_env, offsetof(CPUX86State, s2e_split_insn));
+    tcg_gen_brcondi_i32(TCG_COND_NE, cpu_tmp2_i32, insn, l1);
+    /* Globals are in memory after the branch. Storing cc_op directly
+       keeps it out of tb->reg_wmask. */
+    if (dc->cc_op != CC_OP_DYNAMIC) {
+        tcg_gen_movi_i32(cpu_tmp2_i32, dc->cc_op);
+        tcg_gen_st_i32(cpu_tmp2_i32, cpu_env, offsetof(CPUX86State, cc_op));
+    }
+    tcg_gen_movi_tl(cpu_tmp0, pc - dc->cs_base);
+    tcg_gen_st_tl(cpu_tmp0, cpu_env, offsetof(CPUX86State, eip));
+    tcg_gen_exit_tb(0);
+    gen_set_label(l1);
+}
+#endif
+
 /* generate intermediate code in gen_opc_buf and gen_opparam_buf for
    basic block 'tb'. If search_pc is TRUE, also generate PC
    information for each intermediate instruction. */
@@ -8053,11 +8080,19 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
     tcg_gen_movi_i64(cpu_tmp1_i64, (uint64_t) tb);
     tcg_gen_st_i64(cpu_tmp1_i64, cpu_env, offsetof(CPUArchState, s2e_current_tb));
 
+    s2e_tb_reset_accesses(tb);
+
     s2e_on_translate_block_start(g_s2e, g_s2e_state, tb, pc_start);
 #endif
 //[chy]--------------------------------------------------
     gen_icount_start();
     for(;;) {
+#ifdef CONFIG_S2E
+        if (g_s2e_split_translation_blocks && !g_s2e_translating_llvm &&
+            num_insns > 0 && num_insns <= 0xff && !use_icount) {
+            s2e_gen_split_point(dc, pc_ptr, num_insns);
+        }
+#endif
         if (unlikely(!QTAILQ_EMPTY(&env->breakpoints))) {
             QTAILQ_FOREACH(bp, &env->breakpoints, entry) {
                 if (bp->pc == pc_ptr &&
@@ -8086,6 +8121,7 @@ static inline void gen_intermediate_code_internal(CPUX86State *env,
  */
 #ifdef CONFIG_S2E
         dc->insPc = pc_ptr;
+        dc->insn_index = num_insns;
         dc->done_instr_end = 0;
         dc->done_reg_access_end = 0;
 
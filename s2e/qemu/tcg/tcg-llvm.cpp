@@ -70,6 +70,10 @@ static void *qemu_st_helpers[5] = {
 
 }
 
+#ifdef CONFIG_S2E
+#include <s2e/s2e_qemu.h>
+#endif
+
 #include <llvm/DerivedTypes.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/JITMemoryManager.h>
@@ -88,7 +92,9 @@ static void *qemu_st_helpers[5] = {
 #include <llvm/Support/DynamicLibrary.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
 #include <iostream>
+#include <map>
 #include <sstream>
 
 //#undef NDEBUG
@@ -134,11 +140,23 @@ struct TCGLLVMContextPrivate {
     Function *m_helperForkAndConcretize;
     Function* m_qemu_ld_helpers[5];
     Function* m_qemu_st_helpers[5];
+
+    /* S2E TLB probes standing in for the helpers above (NULL if disabled) */
+    Function* m_qemu_ld_probes[5];
+    Function* m_qemu_st_probes[5];
+
+    /* Named stand-ins for tcg_llvm_runtime.goto_tb and for the execution
+       signals, which keep host addresses out of the generated code */
+    GlobalVariable *m_gotoTb;
+    Function *m_helperIndexedExecution;
 #endif
 
     /* Count of generated translation blocks */
     int m_tbCount;
 
+    /* Persistent cache of generated functions (optional) */
+    TCGLLVMFunctionCache *m_functionCache;
+
     /* XXX: The following members are "local" to generateCode method */
 
     /* TCGContext for current translation block */
@@ -147,6 +165,14 @@ struct TCGLLVMContextPrivate {
     /* Function for current translation block */
     Function *m_tbFunction;
 
+    /* Current translation block and the pointer to it that the executor
+       passes in the argument array (S2E) */
+    TranslationBlock *m_tb;
+    Value *m_tbPointer;
+
+    /* Whether the function embeds host addresses and cannot be cached */
+    bool m_addressDependent;
+
     /* Current temp m_values */
     Value* m_values[TCG_MAX_TEMPS];
 
@@ -242,6 +268,8 @@ public:
 #ifdef CONFIG_S2E
     void initializeHelpers();
 #endif
+    Function* getHelperFunction(const char *name, void *address,
+                                FunctionType *type);
 
     BasicBlock* getLabel(int idx);
     void delLabel(int idx);
@@ -254,6 +282,9 @@ public:
     void generateTraceCall(uintptr_t pc);
     int generateOperation(int opc, const TCGArg *args);
 
+    bool computeCacheKey(TranslationBlock *tb, uint64_t *key);
+    void declareCalledHelpers();
+    void generateFunction(TranslationBlock *tb, const std::string &fcnName);
     void generateCode(TCGContext *s, TranslationBlock *tb);
 };
 
@@ -334,7 +365,8 @@ public:
 
 TCGLLVMContextPrivate::TCGLLVMContextPrivate()
     : m_context(getGlobalContext()), m_builder(m_context), m_tbCount(0),
-      m_tcgContext(NULL), m_tbFunction(NULL)
+      m_functionCache(NULL), m_tcgContext(NULL), m_tbFunction(NULL),
+      m_tb(NULL), m_tbPointer(NULL), m_addressDependent(false)
 {
     std::memset(m_values, 0, sizeof(m_values));
     std::memset(m_memValuesPtr, 0, sizeof(m_memValuesPtr));
@@ -407,6 +439,33 @@ void TCGLLVMContextPrivate::initializeHelpers()
     m_qemu_st_helpers[3] = m_module->getFunction("__stq_mmu");
     m_qemu_st_helpers[4] = m_module->getFunction("__stq_mmu");
 
+    m_qemu_ld_probes[0] = m_module->getFunction("tcg_llvm_s2e_tlb_ldb");
+    m_qemu_ld_probes[1] = m_module->getFunction("tcg_llvm_s2e_tlb_ldw");
+    m_qemu_ld_probes[2] = m_module->getFunction("tcg_llvm_s2e_tlb_ldl");
+    m_qemu_ld_probes[3] = m_module->getFunction("tcg_llvm_s2e_tlb_ldq");
+    m_qemu_ld_probes[4] = m_module->getFunction("tcg_llvm_s2e_tlb_ldq");
+
+    m_qemu_st_probes[0] = m_module->getFunction("tcg_llvm_s2e_tlb_stb");
+    m_qemu_st_probes[1] = m_module->getFunction("tcg_llvm_s2e_tlb_stw");
+    m_qemu_st_probes[2] = m_module->getFunction("tcg_llvm_s2e_tlb_stl");
+    m_qemu_st_probes[3] = m_module->getFunction("tcg_llvm_s2e_tlb_stq");
+    m_qemu_st_probes[4] = m_module->getFunction("tcg_llvm_s2e_tlb_stq");
+
+    /* The global is resolved by name, both by the JIT and by KLEE */
+    m_gotoTb = m_module->getNamedGlobal(TCG_LLVM_GOTO_TB_NAME);
+    if(!m_gotoTb) {
+        m_gotoTb = new GlobalVariable(*m_module, intType(8), false,
+                GlobalValue::ExternalLinkage, NULL, TCG_LLVM_GOTO_TB_NAME);
+    }
+    m_executionEngine->addGlobalMapping(m_gotoTb, &tcg_llvm_runtime.goto_tb);
+    sys::DynamicLibrary::AddSymbol(TCG_LLVM_GOTO_TB_NAME, &tcg_llvm_runtime.goto_tb);
+
+    m_helperIndexedExecution = getHelperFunction(
+            "s2e_tcg_indexed_execution_handler",
+            (void*) s2e_tcg_indexed_execution_handler,
+            FunctionType::get(Type::getVoidTy(m_context),
+                              std::vector<Type*>(3, intType(64)), false));
+
     assert(m_helperTraceMemoryAccess);
     for(int i = 0; i < 5; ++i) {
         assert(m_qemu_ld_helpers[i]);
@@ -415,6 +474,23 @@ void TCGLLVMContextPrivate::initializeHelpers()
 }
 #endif
 
+/* Helpers are called by name, the name is mapped to their address */
+Function* TCGLLVMContextPrivate::getHelperFunction(const char *name,
+                                                   void *address,
+                                                   FunctionType *type)
+{
+    std::string funcName = std::string("helper_") + name;
+    Function* helperFunc = m_module->getFunction(funcName);
+    if(!helperFunc) {
+        helperFunc = Function::Create(type, Function::PrivateLinkage,
+                                      funcName, m_module);
+        m_executionEngine->addGlobalMapping(helperFunc, address);
+        /* XXX: Why do we need this ? */
+        sys::DynamicLibrary::AddSymbol(funcName, address);
+    }
+    return helperFunc;
+}
+
 Value* TCGLLVMContextPrivate::getPtrForValue(int idx)
 {
     TCGContext *s = m_tcgContext;
@@ -678,11 +754,17 @@ inline Value* TCGLLVMContextPrivate::generateQemuMemOp(bool ld,
     return m_builder.CreateCall(funcAddr, ArrayRef<Value*>(argValues));
 #if defined (CONFIG_S2E)
     } else {
+        /* When the executor provides them, call the S2E TLB probes instead
+           of the softmmu helpers. A probe serves concrete addresses that hit
+           the S2E TLB directly from the ObjectState and only falls back to
+           the helper (with its tracing and concretization) otherwise. */
         if(ld) {
-            return m_builder.CreateCall2(m_qemu_ld_helpers[bits>>4], addr,
+            Function *f = m_qemu_ld_probes[bits>>4];
+            return m_builder.CreateCall2(f ? f : m_qemu_ld_helpers[bits>>4], addr,
                         ConstantInt::get(intType(8*sizeof(int)), mem_index));
         } else {
-            m_builder.CreateCall3(m_qemu_st_helpers[bits>>4], addr, value,
+            Function *f = m_qemu_st_probes[bits>>4];
+            m_builder.CreateCall3(f ? f : m_qemu_st_helpers[bits>>4], addr, value,
                         ConstantInt::get(intType(8*sizeof(int)), mem_index));
             return NULL;
         }
@@ -779,20 +861,41 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
                                                              (void*) helperAddrC);
                 assert(helperName);
 
-                std::string funcName = std::string("helper_") + helperName;
-                Function* helperFunc = m_module->getFunction(funcName);
-                if(!helperFunc) {
-                    helperFunc = Function::Create(
-                            FunctionType::get(retType, argTypes, false),
-                            Function::PrivateLinkage, funcName, m_module);
-                    m_executionEngine->addGlobalMapping(helperFunc,
-                                                        (void*) helperAddrC);
-                    /* XXX: Why do we need this ? */
-                    sys::DynamicLibrary::AddSymbol(funcName, (void*) helperAddrC);
+                result = NULL;
+#ifdef CONFIG_S2E
+                if (helperAddrC == (tcg_target_ulong) s2e_tcg_execution_handler) {
+                    /* Refer to the signal by its index in the block */
+                    int index = -1;
+                    if (isa<ConstantInt>(argValues[0])) {
+                        index = s2e_get_execution_signal_index(m_tb,
+                                    (void*) toInteger(argValues[0]));
+                    }
+
+                    if (index >= 0) {
+                        result = m_builder.CreateCall3(m_helperIndexedExecution,
+                                    m_tbPointer, ConstantInt::get(intType(64), index),
+                                    argValues[1]);
+                    } else {
+                        m_addressDependent = true;
+                    }
                 }
+#endif
 
-                result = m_builder.CreateCall(helperFunc,
-                                              ArrayRef<Value*>(argValues));
+                if (!result) {
+                    FunctionType *helperType =
+                            FunctionType::get(retType, argTypes, false);
+                    Value *helperFunc = getHelperFunction(helperName,
+                                            (void*) helperAddrC, helperType);
+
+                    /* The helper may have been declared from the temp types */
+                    if (cast<Function>(helperFunc)->getFunctionType() != helperType) {
+                        helperFunc = m_builder.CreateBitCast(helperFunc,
+                                            PointerType::getUnqual(helperType));
+                    }
+
+                    result = m_builder.CreateCall(helperFunc,
+                                                  ArrayRef<Value*>(argValues));
+                }
             } else { //if (!execute_llvm)
                 //Generate this in LLVM mode
                 Type* helperFunctionPtrTy = PointerType::get(
@@ -888,6 +991,13 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
 
 #if TCG_TARGET_REG_BITS == 64
     case INDEX_op_movi_i64:
+#ifdef CONFIG_S2E
+        /* The block refers to itself through the pointer in its arguments */
+        if (!execute_llvm && args[1] == (TCGArg) (uintptr_t) m_tb) {
+            setValue(args[0], m_tbPointer);
+            break;
+        }
+#endif
         setValue(args[0], ConstantInt::get(intType(64), args[1]));
         break;
 
@@ -1168,6 +1278,16 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
 #endif
 
     case INDEX_op_exit_tb:
+#ifdef CONFIG_S2E
+        /* tb + jump slot */
+        if (!execute_llvm && args[0] &&
+                (args[0] & ~(TCGArg) 3) == (TCGArg) (uintptr_t) m_tb) {
+            m_builder.CreateRet(m_builder.CreateAdd(m_tbPointer,
+                    ConstantInt::get(wordType(), args[0] & 3)));
+            break;
+        }
+        m_addressDependent |= args[0] != 0;
+#endif
         m_builder.CreateRet(ConstantInt::get(wordType(), args[0]));
         break;
 
@@ -1175,9 +1295,7 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
 #ifdef CONFIG_S2E
         if (!execute_llvm) {
             m_builder.CreateStore(ConstantInt::get(intType(8), args[0]),
-                    m_builder.CreateIntToPtr(ConstantInt::get(wordType(),
-                        (uint64_t) &tcg_llvm_runtime.goto_tb),
-                    intPtrType(8)));
+                                  m_gotoTb);
         }
 #endif
         /* XXX: tb linking is disabled */
@@ -1227,28 +1345,218 @@ int TCGLLVMContextPrivate::generateOperation(int opc, const TCGArg *args)
     return nb_args;
 }
 
+/* Bumped whenever a change of the translation affects cached functions */
+static const uint64_t TCG_LLVM_CACHE_VERSION = 2;
+
+static int getOpArgCount(int opc, const TCGArg *args)
+{
+    const TCGOpDef &def = tcg_op_defs[opc];
+    if (opc == INDEX_op_nopn) {
+        return args[0];
+    } else if (opc == INDEX_op_call) {
+        return (args[0] >> 16) + (args[0] & 0xffff) + def.nb_cargs + 1;
+    }
+    return def.nb_args;
+}
+
+/* The generated code is a function of the guest code of the block, of its
+   translation context and of its instrumentation, which are all hashed
+   along with the TCG code they produced. Host addresses in the TCG code
+   (the block itself, its execution signals and the helpers) are hashed as
+   the symbols that the generated code uses in their place, so that keys
+   remain valid across runs. Returns false if the guest code is not
+   available. */
+bool TCGLLVMContextPrivate::computeCacheKey(TranslationBlock *tb, uint64_t *key)
+{
+    std::vector<uint8_t> code;
+    if (!m_functionCache->readCode(tb, code)) {
+        return false;
+    }
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+#define HASH_BYTES(ptr, size) do { \
+        const uint8_t *__p = (const uint8_t*) (ptr); \
+        for (size_t __i = 0; __i < (size); ++__i) { \
+            hash = (hash ^ __p[__i]) * 0x100000001b3ULL; \
+        } \
+    } while (0)
+
+#define HASH_VALUE(v) do { \
+        uint64_t __v = (v); \
+        HASH_BYTES(&__v, sizeof(__v)); \
+    } while (0)
+
+    uint64_t context[6] = { TCG_LLVM_CACHE_VERSION,
+                            (uint64_t) tb->pc, (uint64_t) tb->cs_base,
+                            (uint64_t) tb->flags, (uint64_t) tb->cflags,
+                            (uint64_t) tb->size };
+    HASH_BYTES(context, sizeof(context));
+    if (!code.empty()) {
+        HASH_BYTES(&code[0], code.size());
+    }
+#ifdef CONFIG_S2E
+    HASH_VALUE(m_qemu_ld_probes[0] != NULL);
+#endif
+    HASH_BYTES(gen_opc_buf, (gen_opc_ptr - gen_opc_buf) * sizeof(*gen_opc_buf));
+
+    uint64_t tbAddress = (uint64_t) (uintptr_t) tb;
+    const TCGArg *args = gen_opparam_buf;
+    for (const uint16_t *opc = gen_opc_buf; *opc != INDEX_op_end; ++opc) {
+        int nb_args = getOpArgCount(*opc, args);
+
+        for (int i = 0; i < nb_args; ++i) {
+            uint64_t value = (uint64_t) args[i];
+            uint64_t symbol = 0;
+            const char *helperName = NULL;
+
+#ifdef CONFIG_S2E
+            if (*opc == INDEX_op_exit_tb && value && (value & ~3ULL) == tbAddress) {
+                symbol = 0x7462000000000000ULL | (value & 3);
+            } else if (*opc == INDEX_op_movi_i64 && i == 1) {
+                int signal = s2e_get_execution_signal_index(tb, (void*) value);
+                if (value == tbAddress) {
+                    symbol = 0x7462000000000000ULL | 4;
+                } else if (signal >= 0) {
+                    symbol = 0x7367000000000000ULL | signal;
+                } else {
+                    helperName = tcg_helper_get_name(m_tcgContext, (void*) value);
+                }
+            }
+#endif
+
+            if (symbol) {
+                HASH_VALUE(symbol);
+            } else if (helperName) {
+                HASH_VALUE(0x6870000000000000ULL);
+                HASH_BYTES(helperName, strlen(helperName));
+            } else {
+                HASH_VALUE(value);
+            }
+        }
+        args += nb_args;
+    }
+
+#undef HASH_VALUE
+#undef HASH_BYTES
+
+    *key = hash;
+    return true;
+}
+
+/* Cached functions refer to the helpers by name. Declaring the helpers
+   called by the block lets them be mapped even if no other block called
+   these helpers in this run yet. */
+void TCGLLVMContextPrivate::declareCalledHelpers()
+{
+    std::map<TCGArg, TCGArg> constants;
+
+    const TCGArg *args = gen_opparam_buf;
+    for (const uint16_t *opc = gen_opc_buf; *opc != INDEX_op_end; ++opc) {
+        int nb_args = getOpArgCount(*opc, args);
+
+        if (*opc == INDEX_op_movi_i32
+#if TCG_TARGET_REG_BITS == 64
+                || *opc == INDEX_op_movi_i64
+#endif
+                ) {
+            constants[args[0]] = args[1];
+        } else if (*opc == INDEX_op_call) {
+            int nb_oargs = args[0] >> 16;
+            int nb_iargs = args[0] & 0xffff;
+
+            std::map<TCGArg, TCGArg>::iterator it =
+                    constants.find(args[nb_oargs + nb_iargs]);
+            const char *helperName = it == constants.end() ? NULL :
+                    tcg_helper_get_name(m_tcgContext, (void*) (*it).second);
+
+            if (helperName) {
+                std::vector<Type*> argTypes;
+                for (int i = 0; i < nb_iargs - 1; ++i) {
+                    TCGArg arg = args[nb_oargs + i + 1];
+                    if (arg != TCG_CALL_DUMMY_ARG) {
+                        argTypes.push_back(tcgType(m_tcgContext->temps[arg].type));
+                    }
+                }
+
+                Type* retType = nb_oargs == 0 ?
+                    Type::getVoidTy(m_context) : wordType(getValueBits(args[1]));
+
+                getHelperFunction(helperName, (void*) (*it).second,
+                                  FunctionType::get(retType, argTypes, false));
+            }
+        }
+        args += nb_args;
+    }
+}
+
 void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 {
     /* Create new function for current translation block */
-    /* TODO: compute the checksum of the tb to see if we can reuse some code */
     std::ostringstream fName;
     fName << "tcg-llvm-tb-" << (m_tbCount++) << "-" << std::hex << tb->pc;
 
-    /*
-    if(m_tbFunction)
-        m_tbFunction->eraseFromParent();
-    */
+    m_tcgContext = s;
+    m_tb = tb;
+    m_tbFunction = NULL;
+
+    uint64_t cacheKey = 0;
+    bool cacheable = m_functionCache && computeCacheKey(tb, &cacheKey);
+    if (cacheable) {
+        declareCalledHelpers();
+        m_tbFunction = m_functionCache->load(cacheKey, fName.str().c_str());
+    }
 
+    if (!m_tbFunction) {
+        generateFunction(tb, fName.str());
+        if (cacheable && !m_addressDependent) {
+            m_functionCache->generated(cacheKey, m_tbFunction);
+        }
+    }
+
+    tb->llvm_function = m_tbFunction;
+
+    if(execute_llvm || qemu_loglevel_mask(CPU_LOG_LLVM_ASM)) {
+        tb->llvm_tc_ptr = (uint8_t*)
+                m_executionEngine->getPointerToFunction(m_tbFunction);
+        tb->llvm_tc_end = tb->llvm_tc_ptr +
+                m_jitMemoryManager->getLastFunctionSize();
+    } else {
+        tb->llvm_tc_ptr = 0;
+        tb->llvm_tc_end = 0;
+    }
+
+    if(qemu_loglevel_mask(CPU_LOG_LLVM_IR)) {
+        std::string fcnString;
+        llvm::raw_string_ostream s(fcnString);
+        s << *m_tbFunction;
+        qemu_log("OUT (LLVM IR):\n");
+        qemu_log("%s", s.str().c_str());
+        qemu_log("\n");
+        qemu_log_flush();
+    }
+}
+
+void TCGLLVMContextPrivate::generateFunction(TranslationBlock *tb,
+                                             const std::string &fcnName)
+{
     FunctionType *tbFunctionType = FunctionType::get(
             wordType(),
             std::vector<Type*>(1, intPtrType(64)), false);
     m_tbFunction = Function::Create(tbFunctionType,
-            Function::PrivateLinkage, fName.str(), m_module);
+            Function::PrivateLinkage, fcnName, m_module);
     BasicBlock *basicBlock = BasicBlock::Create(m_context,
             "entry", m_tbFunction);
     m_builder.SetInsertPoint(basicBlock);
 
-    m_tcgContext = s;
+    m_addressDependent = false;
+    m_tbPointer = NULL;
+#ifdef CONFIG_S2E
+    if (!execute_llvm) {
+        m_tbPointer = m_builder.CreateLoad(m_builder.CreateConstGEP1_32(
+                m_tbFunction->arg_begin(), TCG_LLVM_TB_ARG), "tb");
+    }
+#endif
 
     /* Prepare globals and temps information */
     initGlobalsAndLocalTemps();
@@ -1306,28 +1614,6 @@ void TCGLLVMContextPrivate::generateCode(TCGContext *s, TranslationBlock *tb)
 
     //KLEE will optimize the function later
     //m_functionPassManager->run(*m_tbFunction);
-
-    tb->llvm_function = m_tbFunction;
-
-    if(execute_llvm || qemu_loglevel_mask(CPU_LOG_LLVM_ASM)) {
-        tb->llvm_tc_ptr = (uint8_t*)
-                m_executionEngine->getPointerToFunction(m_tbFunction);
-        tb->llvm_tc_end = tb->llvm_tc_ptr +
-                m_jitMemoryManager->getLastFunctionSize();
-    } else {
-        tb->llvm_tc_ptr = 0;
-        tb->llvm_tc_end = 0;
-    }
-
-    if(qemu_loglevel_mask(CPU_LOG_LLVM_IR)) {
-        std::string fcnString;
-        llvm::raw_string_ostream s(fcnString);
-        s << *m_tbFunction;
-        qemu_log("OUT (LLVM IR):\n");
-        qemu_log("%s", s.str().c_str());
-        qemu_log("\n");
-        qemu_log_flush();
-    }
 }
 
 /***********************************/
@@ -1384,6 +1670,11 @@ void TCGLLVMContext::generateCode(TCGContext *s, TranslationBlock *tb)
     m_private->generateCode(s, tb);
 }
 
+void TCGLLVMContext::setFunctionCache(TCGLLVMFunctionCache *cache)
+{
+    m_private->m_functionCache = cache;
+}
+
 /*****************************/
 /* Functions for QEMU c code */
 
@@ -96,6 +96,8 @@ int tcg_llvm_search_last_pc(struct TranslationBlock *tb, uintptr_t searched_pc);
 
 #ifdef __cplusplus
 
+#include <vector>
+
 /***********************************/
 /* External interface for C++ code */
 
@@ -108,6 +110,35 @@ namespace llvm {
     class FunctionPassManager;
 }
 
+/** Name of the global through which S2E translation block functions
+    request a goto_tb. It is mapped to tcg_llvm_runtime.goto_tb. */
+#define TCG_LLVM_GOTO_TB_NAME "tcg_llvm_goto_tb"
+
+/** Slot of the argument array of S2E translation block functions
+    that holds the TranslationBlock the function is executed for */
+#define TCG_LLVM_TB_ARG 1
+
+/** Persistent storage of translation block functions. Keys identify the
+    guest code and the instrumentation a function was generated from.
+    Cached functions refer to the helpers, the runtime globals, the block
+    and its signals symbolically, so that they can be reused by runs where
+    these live at other addresses. */
+class TCGLLVMFunctionCache
+{
+public:
+    virtual ~TCGLLVMFunctionCache() {}
+
+    /** Copies the guest code of tb, returns false if it cannot be read */
+    virtual bool readCode(TranslationBlock *tb, std::vector<uint8_t> &code) = 0;
+
+    /** Returns a function equivalent to the one that would be generated
+        for the given key, named fcnName, or NULL on a miss */
+    virtual llvm::Function* load(uint64_t key, const char *fcnName) = 0;
+
+    /** Called for each function that had to be generated */
+    virtual void generated(uint64_t key, llvm::Function *function) = 0;
+};
+
 class TCGLLVMContextPrivate;
 class TCGLLVMContext
 {
@@ -135,6 +166,9 @@ public:
 
     void generateCode(struct TCGContext *s,
                       struct TranslationBlock *tb);
+
+    /** The cache is not owned by the context, NULL disables it */
+    void setFunctionCache(TCGLLVMFunctionCache *cache);
 };
 
 #endif
@@ -82,11 +82,19 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
+#ifdef CONFIG_S2E
+    unsigned prev_phase;
+#endif
 
 #ifdef CONFIG_PROFILER
     s->tb_count1++; /* includes aborted translations because of
                        exceptions */
     ti = profile_getclock();
+#endif
+#ifdef CONFIG_S2E
+    prev_phase = s2e_phase_enter(S2E_PHASE_TRANSLATION);
+    /* An aborted LLVM translation may have left it set */
+    g_s2e_translating_llvm = 0;
 #endif
     tcg_func_start(s);
 
@@ -121,6 +129,20 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
 #if defined(CONFIG_LLVM)
     if(generate_llvm)
         tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
+#if defined(CONFIG_S2E)
+    else if(s2e_should_gen_llvm(g_s2e, g_s2e_state, tb)) {
+        /* Same ops as cpu_gen_llvm, without translating the guest code again,
+           unless the native ops contain split points */
+        if (g_s2e_split_translation_blocks) {
+            tcg_func_start(s);
+            g_s2e_translating_llvm = 1;
+            gen_intermediate_code_pc(env, tb);
+            g_s2e_translating_llvm = 0;
+        }
+        tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
+        s2e_set_tb_function(g_s2e, tb);
+    }
+#endif
 #endif
 
 
@@ -148,6 +170,9 @@ int cpu_gen_code(CPUArchState *env, TranslationBlock *tb, int *gen_code_size_ptr
         qemu_log_flush();
     }
 #endif
+#endif
+#ifdef CONFIG_S2E
+    s2e_phase_leave(prev_phase);
 #endif
     return 0;
 }
@@ -233,12 +258,17 @@ int cpu_restore_state(TranslationBlock *tb,
 int cpu_gen_llvm(CPUArchState *env, TranslationBlock *tb)
 {
     TCGContext *s = &tcg_ctx;
+    unsigned prev_phase;
     assert(tb->llvm_function == NULL);
 
+    prev_phase = s2e_phase_enter(S2E_PHASE_TRANSLATION);
     tcg_func_start(s);
+    g_s2e_translating_llvm = 1;
     gen_intermediate_code_pc(env, tb);
+    g_s2e_translating_llvm = 0;
     tcg_llvm_gen_code(tcg_llvm_ctx, s, tb);
     s2e_set_tb_function(g_s2e, tb);
+    s2e_phase_leave(prev_phase);
 
     if(qemu_loglevel_mask(CPU_LOG_LLVM_ASM) && tb->llvm_tc_ptr) {
         ptrdiff_t size = tb->llvm_tc_end - tb->llvm_tc_ptr;
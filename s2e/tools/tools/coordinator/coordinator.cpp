@@ -0,0 +1,385 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#define __STDC_FORMAT_MACROS 1
+
+#include "llvm/Support/CommandLine.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "coordinator.h"
+
+using namespace llvm;
+using namespace s2etools;
+
+
+namespace {
+
+cl::opt<unsigned>
+    Port("port", cl::desc("TCP port to listen on"), cl::init(7557));
+
+cl::opt<unsigned>
+    StateIdBlock("state-id-block", cl::desc("Number of state ids reserved for each host"),
+                 cl::init(1 << 20));
+
+}
+
+namespace s2etools
+{
+
+Coordinator::Coordinator(unsigned stateIdBlock)
+{
+    m_listenSocket = -1;
+    m_stateIdBlock = stateIdBlock;
+    m_pushedPaths = 0;
+    m_pulledPaths = 0;
+    m_version = 0;
+    m_killEpoch = 0;
+}
+
+Coordinator::~Coordinator()
+{
+    for (Connections::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+        close((*it).first);
+    }
+
+    if (m_listenSocket >= 0) {
+        close(m_listenSocket);
+    }
+}
+
+bool Coordinator::listen(unsigned port)
+{
+    m_listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (m_listenSocket < 0) {
+        perror("socket");
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+
+    if (bind(m_listenSocket, (struct sockaddr*) &address, sizeof(address)) < 0 ||
+        ::listen(m_listenSocket, 16) < 0) {
+        perror("bind");
+        return false;
+    }
+
+    std::cout << "Listening on port " << port << std::endl;
+    return true;
+}
+
+void Coordinator::run()
+{
+    while (true) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(m_listenSocket, &fds);
+        int maxFd = m_listenSocket;
+
+        for (Connections::iterator it = m_connections.begin(); it != m_connections.end(); ++it) {
+            FD_SET((*it).first, &fds);
+            maxFd = std::max(maxFd, (*it).first);
+        }
+
+        if (select(maxFd + 1, &fds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            return;
+        }
+
+        if (FD_ISSET(m_listenSocket, &fds)) {
+            acceptConnection();
+        }
+
+        Connections::iterator it = m_connections.begin();
+        while (it != m_connections.end()) {
+            int fd = (*it).first;
+            if (!FD_ISSET(fd, &fds) || receive(fd, (*it).second)) {
+                ++it;
+                continue;
+            }
+
+            if ((*it).second.nodeId >= 0) {
+                std::cout << "Node " << (*it).second.nodeId << " disconnected" << std::endl;
+            }
+            close(fd);
+            m_connections.erase(it++);
+        }
+    }
+}
+
+void Coordinator::acceptConnection()
+{
+    int fd = accept(m_listenSocket, NULL, NULL);
+    if (fd < 0) {
+        perror("accept");
+        return;
+    }
+
+    Connection connection;
+    connection.nodeId = -1;
+    m_connections[fd] = connection;
+}
+
+/** Handles the complete requests. Returns false if the connection is closed. */
+bool Coordinator::receive(int fd, Connection &connection)
+{
+    char buffer[4096];
+    ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+        return received < 0 && errno == EINTR;
+    }
+
+    connection.buffer.append(buffer, received);
+
+    size_t end;
+    while ((end = connection.buffer.find('\n')) != std::string::npos) {
+        std::string line = connection.buffer.substr(0, end);
+        connection.buffer.erase(0, end + 1);
+
+        if (!sendLine(fd, handle(connection, line))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Coordinator::sendLine(int fd, const std::string &line)
+{
+    std::string data = line + "\n";
+    size_t sent = 0;
+
+    while (sent < data.size()) {
+        ssize_t ret = send(fd, data.data() + sent, data.size() - sent, 0);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return false;
+        }
+        sent += ret;
+    }
+    return true;
+}
+
+std::string Coordinator::handle(Connection &connection, const std::string &line)
+{
+    std::istringstream is(line);
+    std::string op;
+    is >> op;
+
+    if (op == "HELLO") {
+        return hello(connection, is);
+    }
+
+    if (connection.nodeId < 0) {
+        return "ERROR the node must send HELLO first";
+    }
+
+    if (op == "SYNC") {
+        return sync(connection, is);
+    } else if (op == "PUSH") {
+        return push(line);
+    } else if (op == "PULL") {
+        return pull();
+    } else if (op == "KILL") {
+        return kill(connection);
+    }
+
+    return "ERROR unknown request " + op;
+}
+
+/** Processes forked on a host reuse the node id of their parent */
+std::string Coordinator::hello(Connection &connection, std::istream &is)
+{
+    std::string node;
+    uint64_t words;
+
+    if (!(is >> node >> words)) {
+        return "ERROR malformed HELLO";
+    }
+
+    //All hosts must hash coverage into bitmaps of the same size
+    if (words) {
+        if (m_bitmap.empty()) {
+            m_bitmap.resize(words, 0);
+            m_changedAt.resize(words, 0);
+        } else if (m_bitmap.size() != words) {
+            return "ERROR the coverage bitmap has a different size on other hosts";
+        }
+    }
+
+    unsigned nodeId;
+    if (node == "-") {
+        nodeId = m_successCounts.size();
+        m_successCounts.push_back(0);
+        std::cout << "Node " << nodeId << " joined" << std::endl;
+    } else {
+        nodeId = strtoul(node.c_str(), NULL, 10);
+        if (nodeId >= m_successCounts.size()) {
+            return "ERROR unknown node " + node;
+        }
+    }
+
+    connection.nodeId = nodeId;
+
+    std::stringstream reply;
+    reply << "WELCOME " << nodeId << " " << (uint64_t) nodeId * m_stateIdBlock
+          << " " << m_killEpoch;
+    return reply.str();
+}
+
+std::string Coordinator::sync(Connection &connection, std::istream &is)
+{
+    uint64_t since, successCount;
+    if (!(is >> since >> successCount)) {
+        return "ERROR malformed SYNC";
+    }
+
+    m_successCounts[connection.nodeId] = successCount;
+
+    //The coordinator was restarted since the last synchronization
+    if (since > m_version) {
+        since = 0;
+    }
+
+    bool changed = false;
+    std::string token;
+    while (is >> token) {
+        char *end;
+        uint64_t index = strtoull(token.c_str(), &end, 10);
+        if (*end != ':' || index >= m_bitmap.size()) {
+            continue;
+        }
+
+        uint64_t word = m_bitmap[index] | strtoull(end + 1, NULL, 16);
+        if (word != m_bitmap[index]) {
+            m_bitmap[index] = word;
+            m_changedAt[index] = m_version + 1;
+            changed = true;
+        }
+    }
+
+    if (changed) {
+        ++m_version;
+    }
+
+    uint64_t remoteSuccessCount = 0;
+    for (unsigned i = 0; i < m_successCounts.size(); ++i) {
+        if (i != (unsigned) connection.nodeId) {
+            remoteSuccessCount += m_successCounts[i];
+        }
+    }
+
+    std::stringstream reply;
+    reply << "SYNC " << m_version << " " << remoteSuccessCount << " " << m_killEpoch;
+    for (uint64_t i = 0; i < m_bitmap.size(); ++i) {
+        if (m_changedAt[i] > since) {
+            reply << " " << std::dec << i << ":" << std::hex << m_bitmap[i];
+        }
+    }
+    return reply.str();
+}
+
+std::string Coordinator::push(const std::string &line)
+{
+    size_t start = line.find("PUSH") + 4;
+    m_paths.push_back(line.substr(start));
+    ++m_pushedPaths;
+    return "OK";
+}
+
+std::string Coordinator::pull()
+{
+    if (m_paths.empty()) {
+        return "NONE";
+    }
+
+    std::string reply = "PATH" + m_paths.front();
+    m_paths.pop_front();
+    ++m_pulledPaths;
+    return reply;
+}
+
+std::string Coordinator::kill(Connection &connection)
+{
+    ++m_killEpoch;
+    std::cout << "Node " << connection.nodeId << " kept a successful state, "
+              << "asking the other nodes to kill their states" << std::endl;
+
+    std::stringstream reply;
+    reply << "OK " << m_killEpoch;
+    return reply.str();
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " coordinator for S2E processes on several hosts");
+
+    //Nodes that go away must not kill the coordinator
+    signal(SIGPIPE, SIG_IGN);
+
+    Coordinator coordinator(StateIdBlock);
+    if (!coordinator.listen(Port)) {
+        return 1;
+    }
+
+    coordinator.run();
+    return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#ifndef S2ETOOLS_COORDINATOR_H
+#define S2ETOOLS_COORDINATOR_H
+
+#include <deque>
+#include <istream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <inttypes.h>
+
+namespace s2etools
+{
+
+/**
+ *  Serves the CoordinatorClient plugins of the S2E processes of several
+ *  hosts. Every request is one line and gets a one line reply:
+ *
+ *  HELLO <node id or -> <bitmap words>   WELCOME <node id> <first state id> <kill epoch>
+ *  SYNC <version> <successful states> <index>:<word>...
+ *                                        SYNC <version> <remote successful states> <kill epoch> <index>:<word>...
+ *  PUSH <path>                           OK
+ *  PULL                                  PATH <path> or NONE
+ *  KILL                                  OK <kill epoch>
+ *
+ *  Paths are kept as sent, the coordinator does not interpret them.
+ */
+class Coordinator
+{
+public:
+    Coordinator(unsigned stateIdBlock);
+    ~Coordinator();
+
+    bool listen(unsigned port);
+    void run();
+
+private:
+    struct Connection {
+        std::string buffer;
+        int nodeId;
+    };
+
+    typedef std::map<int, Connection> Connections;
+
+    int m_listenSocket;
+    Connections m_connections;
+
+    unsigned m_stateIdBlock;
+
+    /* Successful states reported by each node */
+    std::vector<uint64_t> m_successCounts;
+
+    std::deque<std::string> m_paths;
+    uint64_t m_pushedPaths;
+    uint64_t m_pulledPaths;
+
+    std::vector<uint64_t> m_bitmap;
+    /* Version at which each word of the bitmap last changed */
+    std::vector<uint64_t> m_changedAt;
+    uint64_t m_version;
+
+    uint64_t m_killEpoch;
+
+    void acceptConnection();
+    bool receive(int fd, Connection &connection);
+    bool sendLine(int fd, const std::string &line);
+
+    std::string handle(Connection &connection, const std::string &line);
+    std::string hello(Connection &connection, std::istream &is);
+    std::string sync(Connection &connection, std::istream &is);
+    std::string push(const std::string &line);
+    std::string pull();
+    std::string kill(Connection &connection);
+};
+
+}
+
+#endif
@@ -78,6 +78,9 @@ ModDir("moddir", cl::desc("Directory containing binary modules, the basic block
 cl::opt<bool>
     Compact("compact", cl::desc("Do not display non-covered blocks"), cl::init(false));
 
+cl::list<std::string>
+    BlockLists("blocks", cl::desc("Block list written by the CoverageBitmap plugin (coverage-blocks.txt)"));
+
 
 //cl::opt<std::string>
 //    CovType("covtype", cl::desc("Coverage type"), cl::init("basicblock"));
@@ -405,23 +408,22 @@ Coverage::~Coverage()
     }
 }
 
-BasicBlockCoverage *Coverage::loadCoverage(const ModuleInstance *mi)
+BasicBlockCoverage *Coverage::loadCoverage(const std::string &moduleName)
 {
     BasicBlockCoverage *bbcov = NULL;
-    assert(mi);
 
-    BbCoverageMap::iterator it = m_bbCov.find(mi->Name);
+    BbCoverageMap::iterator it = m_bbCov.find(moduleName);
     if (it == m_bbCov.end()) {
         //Look for the file containing the bbs.
         std::string path;
-        if (m_library->findLibrary(mi->Name, path)) {
+        if (m_library->findLibrary(moduleName, path)) {
             llvm::sys::Path modPath(path);
             modPath.eraseComponent();
-            BasicBlockCoverage *bb = new BasicBlockCoverage(modPath.str(), mi->Name);
-            m_bbCov[mi->Name] = bb;
+            BasicBlockCoverage *bb = new BasicBlockCoverage(modPath.str(), moduleName);
+            m_bbCov[moduleName] = bb;
             bbcov = bb;
         } else {
-            m_notFoundModuleImages.insert(mi->Name);
+            m_notFoundModuleImages.insert(moduleName);
         }
     }else {
         bbcov = (*it).second;
@@ -430,6 +432,33 @@ BasicBlockCoverage *Coverage::loadCoverage(const ModuleInstance *mi)
     return bbcov;
 }
 
+//Each line contains the module name, the native start and end
+//addresses of a translation block and the time it was covered.
+void Coverage::loadBlockList(const std::string &path)
+{
+    FILE *fp = fopen(path.c_str(), "r");
+    if (!fp) {
+        std::cerr << "Could not open file " << path << std::endl;
+        return;
+    }
+
+    char buffer[512];
+    while (fgets(buffer, sizeof(buffer), fp)) {
+        char name[512];
+        uint64_t start, end, timeStamp;
+        if (sscanf(buffer, "%511s 0x%"PRIx64" 0x%"PRIx64" %"PRIu64, name, &start, &end, &timeStamp) != 4) {
+            continue;
+        }
+
+        BasicBlockCoverage *bbcov = loadCoverage(name);
+        if (bbcov) {
+            bbcov->addTranslationBlock(timeStamp, start, end);
+        }
+    }
+
+    fclose(fp);
+}
+
 void Coverage::onItem(unsigned traceIndex,
             const s2e::plugins::ExecutionTraceItemHeader &hdr,
             void *item)
@@ -454,7 +483,7 @@ void Coverage::onItem(unsigned traceIndex,
         return;
     }
 
-    BasicBlockCoverage *bbcov = loadCoverage(mi);
+    BasicBlockCoverage *bbcov = loadCoverage(mi->Name);
     if (!bbcov) {
         return;
     }
@@ -541,6 +570,11 @@ void CoverageTool::flatTrace()
     Coverage cov(&m_binaries, &mc, &pb);
 
     pb.processTree();
+
+    for (unsigned i = 0; i < BlockLists.size(); ++i) {
+        cov.loadBlockList(BlockLists[i]);
+    }
+
     cov.printErrors();
 
     cov.outputCoverage(LogDir);
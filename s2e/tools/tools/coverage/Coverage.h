@@ -173,7 +173,7 @@ private:
     /* BB lists that were not found. */
     std::set<std::string> m_notFoundBbList;
 
-    BasicBlockCoverage *loadCoverage(const ModuleInstance *mi);
+    BasicBlockCoverage *loadCoverage(const std::string &moduleName);
 
     void onItem(unsigned traceIndex,
                 const s2e::plugins::ExecutionTraceItemHeader &hdr,
@@ -183,6 +183,8 @@ public:
     Coverage(Library *lib, ModuleCache *cache, LogEvents *events);
     virtual ~Coverage();
 
+    void loadBlockList(const std::string &path);
+
     void outputCoverage(const std::string &Path) const;
 
     uint64_t getPathCount() const {
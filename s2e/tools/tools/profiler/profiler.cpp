@@ -0,0 +1,199 @@
+/*
+ * S2E Selective Symbolic Execution Framework
+ *
+ * Copyright (c) 2010, Dependable Systems Laboratory, EPFL
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *     * Neither the name of the Dependable Systems Laboratory, EPFL nor the
+ *       names of its contributors may be used to endorse or promote products
+ *       derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE DEPENDABLE SYSTEMS LABORATORY, EPFL BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * Currently maintained by:
+ *    Vitaly Chipounov <vitaly.chipounov@epfl.ch>
+ *    Volodymyr Kuznetsov <vova.kuznetsov@epfl.ch>
+ *
+ * All contributors are listed in S2E-AUTHORS file.
+ *
+ */
+
+#define __STDC_FORMAT_MACROS 1
+
+#include "llvm/Support/CommandLine.h"
+
+#include <lib/BinaryReaders/Library.h>
+
+#include <s2e/Plugins/ProfileEntries.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace s2etools;
+using namespace s2e::plugins;
+
+namespace {
+
+cl::opt<std::string>
+    ProfileFile("profile", cl::desc("Profile generated by the SamplingProfiler plugin"), cl::init("profile.dat"));
+
+cl::list<std::string>
+    ModPath("modpath", cl::desc("Path to modules"));
+
+cl::opt<unsigned>
+    TopCount("top", cl::desc("Number of hot spots to display per module"), cl::init(20));
+
+struct ModuleSamples {
+    std::string name;
+    uint64_t nativeBase;
+    uint64_t size;
+    uint64_t concrete;
+    uint64_t symbolic;
+    std::vector<ProfileBin> bins;
+
+    uint64_t total() const {
+        return concrete + symbolic;
+    }
+};
+
+bool byTotalSamples(const ProfileBin &b1, const ProfileBin &b2)
+{
+    return (uint64_t) b1.concreteCount + b1.symbolicCount >
+           (uint64_t) b2.concreteCount + b2.symbolicCount;
+}
+
+bool byModuleSamples(const ModuleSamples &m1, const ModuleSamples &m2)
+{
+    return m1.total() > m2.total();
+}
+
+double percent(uint64_t part, uint64_t total)
+{
+    return total ? (part * 100.0) / total : 0.0;
+}
+
+bool readProfile(std::istream &is, ProfileHeader &hdr, std::vector<ModuleSamples> &modules)
+{
+    if (!is.read((char*) &hdr, sizeof(hdr))) {
+        return false;
+    }
+
+    if (memcmp(hdr.magic, PROFILE_MAGIC, sizeof(hdr.magic)) || hdr.version != PROFILE_VERSION) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < hdr.moduleCount; ++i) {
+        ProfileModuleHeader mhdr;
+        if (!is.read((char*) &mhdr, sizeof(mhdr))) {
+            return false;
+        }
+
+        ModuleSamples m;
+        m.name.resize(mhdr.nameLength);
+        if (mhdr.nameLength && !is.read(&m.name[0], mhdr.nameLength)) {
+            return false;
+        }
+
+        m.nativeBase = mhdr.nativeBase;
+        m.size = mhdr.size;
+        m.concrete = m.symbolic = 0;
+        m.bins.resize(mhdr.binCount);
+        if (mhdr.binCount && !is.read((char*) &m.bins[0], mhdr.binCount * sizeof(ProfileBin))) {
+            return false;
+        }
+
+        for (unsigned j = 0; j < m.bins.size(); ++j) {
+            m.concrete += m.bins[j].concreteCount;
+            m.symbolic += m.bins[j].symbolicCount;
+        }
+
+        modules.push_back(m);
+    }
+
+    return true;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    cl::ParseCommandLineOptions(argc, (char**) argv, " profiler");
+
+    std::ifstream is(ProfileFile.c_str(), std::ios::in | std::ios::binary);
+    if (!is) {
+        std::cerr << "Could not open " << ProfileFile << std::endl;
+        return -1;
+    }
+
+    ProfileHeader hdr;
+    std::vector<ModuleSamples> modules;
+    if (!readProfile(is, hdr, modules)) {
+        std::cerr << ProfileFile << " is not a valid profile" << std::endl;
+        return -1;
+    }
+
+    Library library;
+    library.setPaths(ModPath);
+
+    std::cout << std::dec << hdr.totalSamples << " samples every " << hdr.interval << " ms, "
+              << std::fixed << std::setprecision(2)
+              << percent(hdr.concreteSamples, hdr.totalSamples) << "% concrete, "
+              << percent(hdr.symbolicSamples, hdr.totalSamples) << "% symbolic" << std::endl;
+
+    std::sort(modules.begin(), modules.end(), byModuleSamples);
+
+    for (unsigned i = 0; i < modules.size(); ++i) {
+        ModuleSamples &m = modules[i];
+        const std::string name = m.name.empty() ? "<unknown>" : m.name;
+
+        std::cout << std::endl
+                  << std::setw(6) << percent(m.total(), hdr.totalSamples) << "% "
+                  << name << " (" << m.total() << " samples, "
+                  << m.concrete << " concrete, " << m.symbolic << " symbolic)" << std::endl;
+
+        unsigned count = std::min<unsigned>(TopCount, m.bins.size());
+        std::partial_sort(m.bins.begin(), m.bins.begin() + count, m.bins.end(), byTotalSamples);
+
+        for (unsigned j = 0; j < count; ++j) {
+            const ProfileBin &bin = m.bins[j];
+            uint64_t total = (uint64_t) bin.concreteCount + bin.symbolicCount;
+
+            std::cout << "    " << std::setw(6) << percent(total, m.total()) << "% "
+                      << "0x" << std::hex << std::setw(8) << std::setfill('0') << bin.pc
+                      << std::dec << std::setfill(' ')
+                      << " c=" << bin.concreteCount << " s=" << bin.symbolicCount;
+
+            std::string info;
+            if (!m.name.empty() && library.print(m.name, m.nativeBase, m.nativeBase, bin.pc, info, true, true, true)) {
+                std::cout << " " << info;
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,15 @@
+
+-- File: config_bench.lua
+-- Used by runlab5_bench.sh; FAST_PATH selects the interpreter mode.
+s2e = {
+  kleeArgs = {
+    "--use-batching-search=true", "--batch-time=1.0",
+    "--concrete-fast-path=" .. (os.getenv("FAST_PATH") or "true")
+  }
+}
+plugins = {
+  -- Enable a plugin that handles S2E custom opcode
+  "BaseInstructions"
+}
+pluginsConfig = {
+}
@@ -0,0 +1,14 @@
+#!/bin/sh
+# Measures KLEE interpreter throughput on lab5: runs everything in KLEE for
+# BENCH_TIME seconds, with and without the concrete fast path, and prints
+# the number of guest instructions interpreted per second of symbolic time.
+QEMU=/home/xyj/researchs/build/qemu-release/i386-s2e-softmmu/qemu-system-i386
+BENCH_TIME=${BENCH_TIME:-120}
+
+for mode in false true; do
+    out=bench-fastpath-$mode
+    rm -rf $out
+    FAST_PATH=$mode timeout -s INT $BENCH_TIME $QEMU -hda lab5_result/bin/ucore.img -drive file=lab5_result/bin/swap.img,media=disk,cache=writeback -serial null -always-klee -s2e-config-file config_bench.lua -s2e-output-dir $out
+    tail -n 1 $out/run.stats | tr -d '()' | awk -F, -v mode=$mode \
+        '{ printf "fast-path=%s: %d KLEE insns, %d fast-path LLVM insns, %.0f insns/s\n", mode, $10, $23, $10 / ($12 > 0 ? $12 : 1) }'
+done